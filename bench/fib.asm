@@ -0,0 +1,31 @@
+; fib(18) by plain recursion, over and over. Measures JSR/RET and stack traffic.
+; FIB leaves fib(R0) in R1 and keeps R0. Each call saves R7, its argument and fib(n - 1) on a stack in R6.
+        .ORIG x3000
+START   LD R6, STACK
+        AND R0, R0, #0
+        ADD R0, R0, #9
+        ADD R0, R0, #9
+        JSR FIB
+        BRnzp START
+
+FIB     ADD R6, R6, #-3
+        STR R7, R6, #0
+        STR R0, R6, #1
+        ADD R1, R0, #-2
+        BRn SMALL
+        ADD R0, R0, #-1
+        JSR FIB
+        STR R1, R6, #2
+        ADD R0, R0, #-1
+        JSR FIB
+        LDR R2, R6, #2
+        ADD R1, R1, R2
+        BRnzp DONE
+SMALL   ADD R1, R0, #0
+DONE    LDR R0, R6, #1
+        LDR R7, R6, #0
+        ADD R6, R6, #3
+        RET
+
+STACK   .FILL xFD00
+        .END
@@ -0,0 +1,11 @@
+; The LOOP PROGRAM from src/lsc_vm.h, counting to 30000 instead of 10, over and over.
+; Almost all ADD then BR, so it mostly measures dispatch (and the ADD_BR superinstruction).
+        .ORIG x3000
+        LD R2, LIMIT
+START   AND R0, R0, #0
+LOOP    ADD R0, R0, #1
+        ADD R1, R0, R2
+        BRn LOOP
+        BRnzp START
+LIMIT   .FILL #-30000
+        .END
@@ -0,0 +1,17 @@
+; Copy 1024 words from x4000 to x5000, over and over, through two moving pointers.
+; Measures loads and stores to plain memory.
+        .ORIG x3000
+START   LD R1, SOURCE
+        LD R2, DEST
+        LD R3, COUNT
+COPY    LDR R0, R1, #0
+        STR R0, R2, #0
+        ADD R1, R1, #1
+        ADD R2, R2, #1
+        ADD R3, R3, #-1
+        BRp COPY
+        BRnzp START
+SOURCE  .FILL x4000
+DEST    .FILL x5000
+COUNT   .FILL #1024
+        .END
@@ -0,0 +1,7 @@
+; PUTS the same line over and over. Measures the output trap: scanning and copying the string.
+        .ORIG x3000
+START   LEA R0, LINE
+        PUTS
+        BRnzp START
+LINE    .STRINGZ "The quick brown fox jumps over the lazy dog, again and again.\n"
+        .END
@@ -0,0 +1,48 @@
+; Fill 256 words with pseudo-random numbers and insertion sort them, over and over.
+; Measures loads, stores and data-dependent branches.
+        .ORIG x3000
+START   LD R1, ARRAY
+        LD R2, COUNT
+        LD R3, SEED
+        LD R5, MASK
+FILL    ADD R4, R3, R3          ; x = x * 5 + 13
+        ADD R4, R4, R4
+        ADD R4, R4, R3
+        ADD R3, R4, #13
+        AND R4, R3, R5          ; Small enough that a difference never overflows
+        STR R4, R1, #0
+        ADD R1, R1, #1
+        ADD R2, R2, #-1
+        BRp FILL
+        ST R3, SEED             ; The next round sorts different numbers
+
+        LD R3, ARRAY
+        NOT R3, R3
+        ADD R3, R3, #1          ; R3 = -ARRAY
+        LD R1, ARRAY
+        ADD R1, R1, #1          ; R1 = address of the next word to insert
+        LD R2, COUNT
+        ADD R2, R2, #-1         ; R2 = words left to insert
+OUTER   LDR R0, R1, #0          ; R0 = key
+        NOT R5, R0
+        ADD R5, R5, #1          ; R5 = -key
+        ADD R4, R1, #-1         ; R4 = address of the word to compare with
+INNER   ADD R6, R4, R3
+        BRn PLACE               ; Past the start of the array
+        LDR R6, R4, #0
+        ADD R7, R6, R5
+        BRnz PLACE              ; Not bigger than the key
+        STR R6, R4, #1
+        ADD R4, R4, #-1
+        BRnzp INNER
+PLACE   STR R0, R4, #1
+        ADD R1, R1, #1
+        ADD R2, R2, #-1
+        BRp OUTER
+        BRnzp START
+
+ARRAY   .FILL x4000
+COUNT   .FILL #256
+SEED    .FILL #1
+MASK    .FILL x0FFF
+        .END
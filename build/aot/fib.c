@@ -0,0 +1,351 @@
+/*
+Translated from an LC-3 image by lsc_vm --aot, see lsc_aot.h. Build with the VM's sources, all but main.c:
+
+    gcc -O2 -I<lsc_vm>/src build/aot/fib.c <lsc_vm>/src/lsc_*.c -pthread
+*/
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lsc_block.h"
+#include "lsc_console.h"
+#include "lsc_vm.h"
+
+typedef struct {
+    uint16_t first;
+    uint32_t count;
+    const uint16_t *words;
+} LSC_AOT_SEGMENT;
+
+typedef struct {
+    uint16_t first;
+    uint32_t count;
+} LSC_AOT_RANGE;
+
+static uint16_t lsc_aot_original[LSC_MEMORY_MAX]; // Memory as translated
+static uint8_t lsc_aot_code[LSC_MEMORY_MAX]; // Words translated as instructions
+static uint8_t lsc_aot_code_page[LSC_PAGE_COUNT];
+static uint8_t lsc_aot_slow[LSC_MEMORY_MAX]; // Code or a device: stores there go through lsc_mem_write
+static uint8_t lsc_aot_touched[LSC_PAGE_COUNT]; // Pages stored to without lsc_mem_write, see lsc_aot_leave
+static int lsc_aot_stale; // Translated code was changed, the interpreter runs everything from now on
+static LSC_CONSOLE *lsc_aot_console;
+
+// Like the interpreter's own loading, a store with no page to go to stops the program
+static void lsc_aot_out_of_memory(void) {
+    lsc_console_restore(lsc_aot_console);
+    printf("out of memory\n");
+    exit(1);
+}
+
+#define LSC_AOT_LEAVE(next) do { pc = (next); goto lsc_aot_leave; } while (0)
+
+#define LSC_AOT_LOAD(address) lsc_aot_load(vm, (address))
+
+// A store to plain memory the VM may not own yet (see Memory in lsc_vm.h)
+#define LSC_AOT_POKE(address, value) do { \
+    uint16_t p_ = (address); \
+    if (!lsc_mem_poke(vm, p_, (value))) { \
+        lsc_aot_out_of_memory(); \
+    } \
+    lsc_aot_touched[p_ >> LSC_PAGE_SHIFT] = 1; \
+} while (0)
+
+#define LSC_AOT_STORE_CODE(address, value, next) do { \
+    lsc_mem_write(vm, (address), (value)); \
+    lsc_aot_stale = 1; \
+    LSC_AOT_LEAVE(next); \
+} while (0)
+
+#define LSC_AOT_STORE(address, value, next) do { \
+    uint16_t a_ = (address); \
+    if (lsc_aot_slow[a_]) { \
+        lsc_mem_write(vm, a_, (value)); \
+        if (lsc_aot_code[a_]) { \
+            lsc_aot_stale = 1; \
+            LSC_AOT_LEAVE(next); \
+        } \
+    } else { \
+        LSC_AOT_POKE(a_, (value)); \
+    } \
+} while (0)
+
+// Trap routines see the whole machine, like in the interpreter
+#define LSC_AOT_TRAP(address, vector) do { \
+    for (int i_ = 0; i_ < 8; ++i_) vm->reg[i_] = r[i_]; \
+    vm->reg[LSC_R_PC] = (uint16_t)((address) + 1); \
+    vm->reg[LSC_R_COND] = lsc_cond_flags(cc); \
+    if (lsc_trap(vm, (vector))) { \
+        vm->waiting = 1; \
+        LSC_AOT_LEAVE(address); \
+    } \
+    for (int i_ = 0; i_ < 8; ++i_) r[i_] = vm->reg[i_]; \
+    r[7] = (uint16_t)((address) + 1); \
+    cc = lsc_cond_value(vm->reg[LSC_R_COND]); \
+} while (0)
+
+// BLKIN copies straight into memory, maybe over code
+#define LSC_AOT_TRAP_BLKIN(address) do { \
+    memset(vm->page_dirty, 0, sizeof(vm->page_dirty)); \
+    LSC_AOT_TRAP((address), LSC_TRAP_BLKIN); \
+    if (lsc_aot_check(vm)) { \
+        LSC_AOT_LEAVE((uint16_t)((address) + 1)); \
+    } \
+} while (0)
+
+static inline uint16_t lsc_aot_load(LSC_VM *vm, uint16_t address) {
+    return (vm->page_attr[address >> LSC_PAGE_SHIFT] & LSC_PAGE_DEVICE) ? lsc_mem_read(vm, address) : lsc_mem_peek(vm, address);
+}
+
+// Whether a page marked dirty since page_dirty was cleared changed translated code. Nothing here takes snapshots.
+static int lsc_aot_check(LSC_VM *vm) {
+    for (int page = 0; page < LSC_PAGE_COUNT; ++page) {
+        if (!vm->page_dirty[page] || !lsc_aot_code_page[page]) {
+            continue;
+        }
+        for (int a = page << LSC_PAGE_SHIFT; a < (page + 1) << LSC_PAGE_SHIFT; ++a) {
+            if (lsc_aot_code[a] && lsc_mem_peek(vm, a) != lsc_aot_original[a]) {
+                lsc_aot_stale = 1;
+            }
+        }
+    }
+    return lsc_aot_stale;
+}
+
+static const uint16_t lsc_aot_image_3000[] = {
+    0x2C17, 0x5020, 0x1029, 0x1029, 0x4801, 0x0FFA, 0x1DBD, 0x7F80,
+    0x7181, 0x123E, 0x0808, 0x103F, 0x4FF9, 0x7382, 0x103F, 0x4FF6,
+    0x6582, 0x1242, 0x0E01, 0x1220, 0x6181, 0x6F80, 0x1DA3, 0xC1C0,
+    0xFD00,
+};
+
+static const LSC_AOT_SEGMENT lsc_aot_image[] = {
+    {0x3000, 25, lsc_aot_image_3000},
+};
+
+static const uint16_t lsc_aot_registers[LSC_R_COUNT] = {0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x3000, 0x0002};
+
+static const LSC_AOT_RANGE lsc_aot_code_ranges[] = {
+    {0x3000, 24},
+};
+
+static const uint16_t lsc_aot_leaders[] = {
+    0x3000, 0x3005, 0x3006, 0x300D, 0x3010, 0x3013, 0x3014,
+};
+
+static void lsc_aot_run(LSC_VM *vm) {
+    uint16_t *const *m = vm->memory;
+    (void)m;
+    uint16_t r[8];
+    for (int i = 0; i < 8; ++i) {
+        r[i] = vm->reg[i];
+    }
+    uint16_t cc = lsc_cond_value(vm->reg[LSC_R_COND]);
+    uint16_t pc = vm->reg[LSC_R_PC];
+
+    goto lsc_aot_dispatch; // Also where JMP, RET and JSRR come back to
+lsc_aot_dispatch:
+    switch (pc) {
+        case 0x3000: goto L3000;
+        case 0x3005: goto L3005;
+        case 0x3006: goto L3006;
+        case 0x300D: goto L300D;
+        case 0x3010: goto L3010;
+        case 0x3013: goto L3013;
+        case 0x3014: goto L3014;
+        default: goto lsc_aot_leave;
+    }
+
+L3000:
+    // x3000: LD x2C17
+    r[6] = m[0x30][0x18];
+    cc = r[6];
+    // x3001: AND x5020
+    r[0] = r[0] & 0x0000;
+    cc = r[0];
+    // x3002: ADD x1029
+    r[0] = r[0] + 0x0009;
+    cc = r[0];
+    // x3003: ADD x1029
+    r[0] = r[0] + 0x0009;
+    cc = r[0];
+    // x3004: JSR x4801
+    r[7] = 0x3005;
+    goto L3006;
+L3005:
+    // x3005: BR x0FFA
+    goto L3000;
+L3006:
+    // x3006: ADD x1DBD
+    r[6] = r[6] + 0xFFFD;
+    cc = r[6];
+    // x3007: STR x7F80
+    LSC_AOT_STORE((uint16_t)(r[6] + 0x0000), r[7], 0x3008);
+    // x3008: STR x7181
+    LSC_AOT_STORE((uint16_t)(r[6] + 0x0001), r[0], 0x3009);
+    // x3009: ADD x123E
+    r[1] = r[0] + 0xFFFE;
+    cc = r[1];
+    // x300A: BR x0808
+    if ((int16_t)cc < 0) goto L3013;
+    // x300B: ADD x103F
+    r[0] = r[0] + 0xFFFF;
+    cc = r[0];
+    // x300C: JSR x4FF9
+    r[7] = 0x300D;
+    goto L3006;
+L300D:
+    // x300D: STR x7382
+    LSC_AOT_STORE((uint16_t)(r[6] + 0x0002), r[1], 0x300E);
+    // x300E: ADD x103F
+    r[0] = r[0] + 0xFFFF;
+    cc = r[0];
+    // x300F: JSR x4FF6
+    r[7] = 0x3010;
+    goto L3006;
+L3010:
+    // x3010: LDR x6582
+    r[2] = LSC_AOT_LOAD((uint16_t)(r[6] + 0x0002));
+    cc = r[2];
+    // x3011: ADD x1242
+    r[1] = r[1] + r[2];
+    cc = r[1];
+    // x3012: BR x0E01
+    goto L3014;
+L3013:
+    // x3013: ADD x1220
+    r[1] = r[0] + 0x0000;
+    cc = r[1];
+L3014:
+    // x3014: LDR x6181
+    r[0] = LSC_AOT_LOAD((uint16_t)(r[6] + 0x0001));
+    cc = r[0];
+    // x3015: LDR x6F80
+    r[7] = LSC_AOT_LOAD((uint16_t)(r[6] + 0x0000));
+    cc = r[7];
+    // x3016: ADD x1DA3
+    r[6] = r[6] + 0x0003;
+    cc = r[6];
+    // x3017: JMP xC1C0
+    pc = r[7];
+    goto lsc_aot_dispatch;
+
+lsc_aot_leave:
+    for (int i = 0; i < 8; ++i) {
+        vm->reg[i] = r[i];
+    }
+    vm->reg[LSC_R_PC] = pc;
+    vm->reg[LSC_R_COND] = lsc_cond_flags(cc);
+    for (int page = 0; page < LSC_PAGE_COUNT; ++page) {
+        if (lsc_aot_touched[page]) {
+            lsc_aot_touched[page] = 0;
+            lsc_mem_invalidate(vm, page << LSC_PAGE_SHIFT, LSC_PAGE_SIZE);
+        }
+    }
+}
+
+static void lsc_aot_start(LSC_VM *vm) {
+    for (size_t i = 0; i < sizeof(lsc_aot_image) / sizeof(lsc_aot_image[0]); ++i) {
+        const LSC_AOT_SEGMENT *s = &lsc_aot_image[i];
+        for (uint32_t i = 0; i < s->count; ++i) {
+            if (!lsc_mem_poke(vm, s->first + i, s->words[i])) {
+                printf("out of memory\n");
+                exit(1);
+            }
+        }
+        memcpy(lsc_aot_original + s->first, s->words, s->count * sizeof(uint16_t));
+        lsc_mem_invalidate(vm, s->first, s->count);
+    }
+    for (size_t i = 0; i < sizeof(lsc_aot_code_ranges) / sizeof(lsc_aot_code_ranges[0]); ++i) {
+        for (uint32_t a = lsc_aot_code_ranges[i].first; a < lsc_aot_code_ranges[i].first + lsc_aot_code_ranges[i].count; ++a) {
+            lsc_aot_code[a] = 1;
+            lsc_aot_code_page[a >> LSC_PAGE_SHIFT] = 1;
+        }
+    }
+    for (uint32_t a = 0; a < LSC_MEMORY_MAX; ++a) {
+        lsc_aot_slow[a] = lsc_aot_code[a] || (vm->page_attr[a >> LSC_PAGE_SHIFT] & LSC_PAGE_DEVICE);
+    }
+    memcpy(vm->reg, lsc_aot_registers, sizeof(vm->reg));
+
+    // The interpreter stops where translated code can take over again
+    for (size_t i = 0; i < sizeof(lsc_aot_leaders) / sizeof(lsc_aot_leaders[0]); ++i) {
+        if (!lsc_vm_breakpoint(vm, lsc_aot_leaders[i], 1)) {
+            lsc_aot_out_of_memory();
+        }
+    }
+}
+
+/*
+The interpreter, from where translated code left off to the next block it has. Whether it stored into translated code
+is looked at once it stops. Once translated code is stale, the blocks are no place to stop and it runs to the end.
+*/
+static void lsc_aot_interpret(LSC_VM *vm) {
+    if (lsc_aot_stale) {
+        lsc_vm_run(vm, UINT64_MAX);
+        return;
+    }
+    memset(vm->page_dirty, 0, sizeof(vm->page_dirty));
+    lsc_vm_run(vm, UINT64_MAX);
+    if (lsc_aot_check(vm)) {
+        for (size_t i = 0; i < sizeof(lsc_aot_leaders) / sizeof(lsc_aot_leaders[0]); ++i) {
+            lsc_vm_breakpoint(vm, lsc_aot_leaders[i], 0);
+        }
+    }
+}
+
+static void lsc_aot_interrupt(int signal) {
+    lsc_console_restore(lsc_aot_console);
+    _exit(128 + signal);
+}
+
+int main(int argc, char **argv) {
+    LSC_VM *vm = lsc_vm_create();
+    if (!vm) {
+        printf("out of memory\n");
+        return 1;
+    }
+    for (int j = 1; j < argc; ++j) {
+        if (strncmp(argv[j], "--disk=", 7) != 0 || vm->block) {
+            printf("%s [--disk=file]\n", argv[0]);
+            return 2;
+        }
+        vm->block = lsc_block_open(argv[j] + 7);
+        if (!vm->block) {
+            printf("failed to open disk: %s\n", argv[j] + 7);
+            return 1;
+        }
+    }
+    lsc_aot_start(vm);
+
+    vm->console = lsc_console_create(STDIN_FILENO, STDOUT_FILENO);
+    if (!vm->console) {
+        printf("out of memory\n");
+        return 1;
+    }
+    lsc_aot_console = vm->console;
+    signal(SIGINT, lsc_aot_interrupt);
+
+    while (!vm->halted && !vm->faulted) {
+        if (!lsc_aot_stale) {
+            lsc_aot_run(vm);
+        }
+        if (vm->halted || vm->faulted) {
+            break;
+        }
+        lsc_aot_interpret(vm);
+    }
+    lsc_console_flush(vm);
+
+    lsc_aot_console = NULL;
+    lsc_console_destroy(vm->console);
+    vm->console = NULL;
+    if (vm->faulted) {
+        printf("illegal instruction x%04X at x%04X\n", lsc_mem_peek(vm, vm->reg[LSC_R_PC]), vm->reg[LSC_R_PC]);
+    }
+    lsc_block_close(vm->block);
+    lsc_vm_destroy(vm);
+    return 0;
+}
@@ -0,0 +1,116 @@
+#include "lsc_analyze.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Addresses still to be walked
+typedef struct {
+    uint16_t *addresses;
+    uint32_t depth;
+} LSC_ANALYZE_STACK;
+
+static int lsc_analyze_is_device(const LSC_VM *vm, uint16_t address) {
+    return (vm->page_attr[address >> LSC_PAGE_SHIFT] & LSC_PAGE_DEVICE) != 0;
+}
+
+// Queue address to be walked, as the start of a block when it is something jumps to. Each one is queued only once.
+static void lsc_analyze_push(LSC_ANALYSIS *analysis, LSC_ANALYZE_STACK *stack, const LSC_VM *vm, uint16_t address, int leader) {
+    if (lsc_analyze_is_device(vm, address)) {
+        return;
+    }
+    if (leader) {
+        analysis->leader[address] = 1;
+    }
+    if (!analysis->code[address]) {
+        analysis->code[address] = 1;
+        stack->addresses[stack->depth++] = address;
+    }
+}
+
+// JMP/RET/JSRR targets end the path, but the return address of a JSRR is still walked: its RET comes back to it
+static void lsc_analyze_walk(LSC_ANALYSIS *analysis, LSC_ANALYZE_STACK *stack, const LSC_VM *vm) {
+    lsc_analyze_push(analysis, stack, vm, vm->reg[LSC_R_PC], 1);
+
+    while (stack->depth) {
+        uint16_t address = stack->addresses[--stack->depth];
+        uint16_t instr = lsc_mem_peek(vm, address);
+        uint16_t next = address + 1;
+        // Falling off the end of memory comes back in at 0, which is not the next word of anything
+        int wraps = next == 0;
+
+        switch (instr >> 12) {
+            case LSC_OP_BR:
+                if (instr & 0x0E00) {
+                    lsc_analyze_push(analysis, stack, vm, next + lsc_sign_extend(instr & 0x1FF, 9), 1);
+                }
+                if ((instr & 0x0E00) != 0x0E00) {
+                    lsc_analyze_push(analysis, stack, vm, next, wraps);
+                }
+                break;
+            case LSC_OP_JSR:
+                if (instr & 0x0800) {
+                    lsc_analyze_push(analysis, stack, vm, next + lsc_sign_extend(instr & 0x7FF, 11), 1);
+                }
+                lsc_analyze_push(analysis, stack, vm, next, 1);
+                break;
+            case LSC_OP_TRAP:
+                // A TRAP that waits for a key is run again from the start, so it starts a block of its own
+                analysis->leader[address] = 1;
+                if ((instr & 0xFF) != LSC_TRAP_HALT) {
+                    lsc_analyze_push(analysis, stack, vm, next, wraps);
+                }
+                break;
+            case LSC_OP_JMP:
+            case LSC_OP_RTI:
+            case LSC_OP_RES:
+                break;
+            default:
+                lsc_analyze_push(analysis, stack, vm, next, wraps);
+                break;
+        }
+    }
+}
+
+LSC_ANALYSIS *lsc_analyze(const LSC_VM *vm) {
+    LSC_ANALYSIS *analysis = calloc(1, sizeof(*analysis));
+    LSC_ANALYZE_STACK stack = {malloc(LSC_MEMORY_MAX * sizeof(uint16_t)), 0};
+    if (!analysis || !stack.addresses) {
+        free(analysis);
+        free(stack.addresses);
+        return NULL;
+    }
+    lsc_analyze_walk(analysis, &stack, vm);
+    free(stack.addresses);
+
+    for (uint32_t page = 0; page < LSC_PAGE_COUNT; ++page) {
+        int code = 0;
+        int data = 0;
+        for (uint32_t a = page << LSC_PAGE_SHIFT; a < (page + 1) << LSC_PAGE_SHIFT; ++a) {
+            code |= analysis->code[a];
+            data |= !analysis->code[a] && lsc_mem_peek(vm, a);
+        }
+        analysis->page_class[page] = code ? (data ? LSC_PAGE_MIXED : LSC_PAGE_CODE) : (data ? LSC_PAGE_DATA : LSC_PAGE_EMPTY);
+    }
+    return analysis;
+}
+
+void lsc_analyze_free(LSC_ANALYSIS *analysis) {
+    free(analysis);
+}
+
+void lsc_analyze_predecode(LSC_VM *vm, const LSC_ANALYSIS *analysis) {
+    for (uint32_t a = 0; a < LSC_MEMORY_MAX; ++a) {
+        if (analysis->code[a] && lsc_decoded(vm, a)->op == LSC_OP_DECODE) {
+            lsc_decode(vm, a);
+        }
+    }
+}
+
+void lsc_analyze_print(const LSC_ANALYSIS *analysis) {
+    uint32_t counts[LSC_PAGE_CLASS_COUNT] = {0};
+    for (uint32_t page = 0; page < LSC_PAGE_COUNT; ++page) {
+        ++counts[analysis->page_class[page]];
+    }
+    printf("pages: %u code, %u data, %u code and data, %u empty\n", counts[LSC_PAGE_CODE], counts[LSC_PAGE_DATA],
+           counts[LSC_PAGE_MIXED], counts[LSC_PAGE_EMPTY]);
+}
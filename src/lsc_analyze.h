@@ -0,0 +1,49 @@
+#ifndef LSC_ANALYZE_H
+#define LSC_ANALYZE_H
+
+#include "lsc_vm.h"
+
+/*
+Static analysis of a loaded program
+
+Which words of memory are instructions, found the way a disassembler would: start at PC and follow every path out of
+it (fall through, branch targets, JSR targets, and the addresses calls and traps return to). JMP, RET and JSRR targets
+are only known at run time, so they end a path. Device pages are never walked.
+
+Each page is then classed by what is on it: code, data, both, or nothing at all.
+
+What it is used for:
+- lsc_analyze_predecode decodes everything found before the program starts, so its pages are marked in page_code from
+  the first instruction on, and the first pass through the code runs without stopping to decode it
+- Stores to pages that are not in page_code (data) skip invalidating anything, see lsc_mem_write. The analysis is only
+  a head start for that: code it could not find (a jump table, code written at run time) marks its page the first time
+  it is decoded, and stores there take the careful path from then on.
+- lsc_aot.c translates exactly the code it found
+*/
+
+enum {
+    LSC_PAGE_EMPTY = 0, // All zero
+    LSC_PAGE_DATA, // Words, none of them found as code
+    LSC_PAGE_CODE, // Code, and nothing else but zeros
+    LSC_PAGE_MIXED, // Code and data on the same page. Stores to the data keep invalidating.
+    LSC_PAGE_CLASS_COUNT
+};
+
+typedef struct {
+    uint8_t code[LSC_MEMORY_MAX]; // The word was reached as an instruction
+    uint8_t leader[LSC_MEMORY_MAX]; // A basic block starts there: the entry, anything jumped or returned to, every TRAP
+    uint8_t page_class[LSC_PAGE_COUNT]; // LSC_PAGE_*
+} LSC_ANALYSIS;
+
+// Analyze vm's memory from its PC. Returns NULL when out of memory.
+LSC_ANALYSIS *lsc_analyze(const LSC_VM *vm);
+
+void lsc_analyze_free(LSC_ANALYSIS *analysis);
+
+// Decode every instruction the analysis found that is not decoded yet (an extended image comes decoded already)
+void lsc_analyze_predecode(LSC_VM *vm, const LSC_ANALYSIS *analysis);
+
+// How many pages are of each class
+void lsc_analyze_print(const LSC_ANALYSIS *analysis);
+
+#endif
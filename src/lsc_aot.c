@@ -0,0 +1,526 @@
+#include "lsc_aot.h"
+
+#include "lsc_analyze.h"
+
+#include <stdio.h>
+
+enum {
+    LSC_AOT_GAP = 16, // Runs of fewer zero words than this are written into the image rather than splitting it
+    LSC_AOT_LINE = 8, // Image words per line of output
+};
+
+static const char *const lsc_aot_names[16] = {
+    "BR", "ADD", "LD", "ST", "JSR", "AND", "LDR", "STR", "RTI", "NOT", "LDI", "STI", "JMP", "RES", "LEA", "TRAP",
+};
+
+static int lsc_aot_is_device(const LSC_VM *vm, uint16_t address) {
+    return (vm->page_attr[address >> LSC_PAGE_SHIFT] & LSC_PAGE_DEVICE) != 0;
+}
+
+// Continue at address: a goto when it was translated, otherwise leave it to the interpreter
+static void lsc_aot_jump(FILE *out, const LSC_ANALYSIS *analysis, uint16_t address) {
+    if (analysis->code[address]) {
+        fprintf(out, "goto L%04X;", address);
+    } else {
+        fprintf(out, "LSC_AOT_LEAVE(0x%04X);", address);
+    }
+}
+
+// Load from a fixed address. Only device pages can give anything but what memory holds.
+static void lsc_aot_load(FILE *out, const LSC_VM *vm, uint16_t address) {
+    if (lsc_aot_is_device(vm, address)) {
+        fprintf(out, "lsc_mem_read(vm, 0x%04X)", address);
+    } else {
+        fprintf(out, "m[0x%02X][0x%02X]", address >> LSC_PAGE_SHIFT, address & (LSC_PAGE_SIZE - 1));
+    }
+}
+
+// Store to a fixed address, which the analysis already knows is a device, code, or neither
+static void lsc_aot_store(FILE *out, const LSC_VM *vm, const LSC_ANALYSIS *analysis, uint16_t address, int sr, uint16_t next) {
+    if (analysis->code[address]) {
+        fprintf(out, "    LSC_AOT_STORE_CODE(0x%04X, r[%d], 0x%04X);\n", address, sr, next);
+    } else if (lsc_aot_is_device(vm, address)) {
+        fprintf(out, "    lsc_mem_write(vm, 0x%04X, r[%d]);\n", address, sr);
+    } else {
+        fprintf(out, "    LSC_AOT_POKE(0x%04X, r[%d]);\n", address, sr);
+    }
+}
+
+// The C for the instruction at address
+static void lsc_aot_instruction(FILE *out, const LSC_VM *vm, const LSC_ANALYSIS *analysis, uint16_t address) {
+    uint16_t instr = lsc_mem_peek(vm, address);
+    uint16_t next = address + 1;
+    int dr = (instr >> 9) & 0x7;
+    int sr1 = (instr >> 6) & 0x7;
+    int sr2 = instr & 0x7;
+    uint16_t imm5 = lsc_sign_extend(instr & 0x1F, 5);
+    uint16_t offset6 = lsc_sign_extend(instr & 0x3F, 6);
+    uint16_t target9 = next + lsc_sign_extend(instr & 0x1FF, 9);
+    int falls_through = 1;
+
+    if (analysis->leader[address]) {
+        fprintf(out, "L%04X:\n", address);
+    }
+    fprintf(out, "    // x%04X: %s x%04X\n", address, lsc_aot_names[instr >> 12], instr);
+
+    switch (instr >> 12) {
+        case LSC_OP_ADD:
+        case LSC_OP_AND: {
+            char op = (instr >> 12) == LSC_OP_ADD ? '+' : '&';
+            if (instr & 0x20) {
+                fprintf(out, "    r[%d] = r[%d] %c 0x%04X;\n", dr, sr1, op, imm5);
+            } else {
+                fprintf(out, "    r[%d] = r[%d] %c r[%d];\n", dr, sr1, op, sr2);
+            }
+            fprintf(out, "    cc = r[%d];\n", dr);
+            break;
+        }
+        case LSC_OP_NOT:
+            fprintf(out, "    r[%d] = ~r[%d];\n", dr, sr1);
+            fprintf(out, "    cc = r[%d];\n", dr);
+            break;
+        case LSC_OP_BR: {
+            // The flags are the sign of cc, so every condition is a signed compare with 0
+            static const char *const conditions[8] = {
+                NULL, "(int16_t)cc > 0", "cc == 0", "(int16_t)cc >= 0",
+                "(int16_t)cc < 0", "cc != 0", "(int16_t)cc <= 0", NULL,
+            };
+            int flags = (instr >> 9) & 0x7;
+            if (flags == 0x7) {
+                fprintf(out, "    ");
+                lsc_aot_jump(out, analysis, target9);
+                fprintf(out, "\n");
+                falls_through = 0;
+            } else if (flags) {
+                fprintf(out, "    if (%s) ", conditions[flags]);
+                lsc_aot_jump(out, analysis, target9);
+                fprintf(out, "\n");
+            }
+            break;
+        }
+        case LSC_OP_JMP:
+            fprintf(out, "    pc = r[%d];\n", sr1);
+            fprintf(out, "    goto lsc_aot_dispatch;\n");
+            falls_through = 0;
+            break;
+        case LSC_OP_JSR:
+            if (instr & 0x0800) {
+                fprintf(out, "    r[7] = 0x%04X;\n    ", next);
+                lsc_aot_jump(out, analysis, next + lsc_sign_extend(instr & 0x7FF, 11));
+                fprintf(out, "\n");
+            } else {
+                // The target is read before R7 changes, JSRR R7 jumps to the old R7
+                fprintf(out, "    pc = r[%d];\n", sr1);
+                fprintf(out, "    r[7] = 0x%04X;\n", next);
+                fprintf(out, "    goto lsc_aot_dispatch;\n");
+            }
+            falls_through = 0;
+            break;
+        case LSC_OP_LD:
+            fprintf(out, "    r[%d] = ", dr);
+            lsc_aot_load(out, vm, target9);
+            fprintf(out, ";\n    cc = r[%d];\n", dr);
+            break;
+        case LSC_OP_LDI:
+            fprintf(out, "    r[%d] = LSC_AOT_LOAD(", dr);
+            lsc_aot_load(out, vm, target9);
+            fprintf(out, ");\n    cc = r[%d];\n", dr);
+            break;
+        case LSC_OP_LDR:
+            fprintf(out, "    r[%d] = LSC_AOT_LOAD((uint16_t)(r[%d] + 0x%04X));\n", dr, sr1, offset6);
+            fprintf(out, "    cc = r[%d];\n", dr);
+            break;
+        case LSC_OP_LEA:
+            fprintf(out, "    r[%d] = 0x%04X;\n", dr, target9);
+            fprintf(out, "    cc = r[%d];\n", dr);
+            break;
+        case LSC_OP_ST:
+            lsc_aot_store(out, vm, analysis, target9, dr, next);
+            break;
+        case LSC_OP_STI:
+            fprintf(out, "    LSC_AOT_STORE(");
+            lsc_aot_load(out, vm, target9);
+            fprintf(out, ", r[%d], 0x%04X);\n", dr, next);
+            break;
+        case LSC_OP_STR:
+            fprintf(out, "    LSC_AOT_STORE((uint16_t)(r[%d] + 0x%04X), r[%d], 0x%04X);\n", sr1, offset6, dr, next);
+            break;
+        case LSC_OP_TRAP:
+            if ((instr & 0xFF) == LSC_TRAP_HALT) {
+                fprintf(out, "    r[7] = 0x%04X;\n", next);
+                fprintf(out, "    vm->halted = 1;\n");
+                fprintf(out, "    LSC_AOT_LEAVE(0x%04X);\n", next);
+                falls_through = 0;
+            } else if ((instr & 0xFF) == LSC_TRAP_BLKIN) {
+                fprintf(out, "    LSC_AOT_TRAP_BLKIN(0x%04X);\n", address);
+            } else {
+                fprintf(out, "    LSC_AOT_TRAP(0x%04X, 0x%02X);\n", address, instr & 0xFF);
+            }
+            break;
+        default:
+            // RTI and the reserved opcode: the interpreter stops on them with PC on the instruction
+            fprintf(out, "    vm->faulted = 1;\n");
+            fprintf(out, "    LSC_AOT_LEAVE(0x%04X);\n", address);
+            falls_through = 0;
+            break;
+    }
+
+    // Falling through to the next word is free when it is the next thing in the output
+    if (falls_through && (next == 0 || !analysis->code[next])) {
+        fprintf(out, "    ");
+        lsc_aot_jump(out, analysis, next);
+        fprintf(out, "\n");
+    }
+}
+
+// First address >= from (and below the end of memory) that is or is not in set, LSC_MEMORY_MAX if none is
+static uint32_t lsc_aot_find(const uint8_t *set, uint32_t from, int in) {
+    while (from < LSC_MEMORY_MAX && (set[from] != 0) != in) {
+        ++from;
+    }
+    return from;
+}
+
+// One past the end of the image segment starting at start: its last nonzero word before a long enough run of zeros
+static uint32_t lsc_aot_segment_end(const LSC_VM *vm, uint32_t start) {
+    uint32_t end = start;
+    uint32_t zeros = 0;
+    while (end + zeros < LSC_MEMORY_MAX && zeros < LSC_AOT_GAP) {
+        if (lsc_mem_peek(vm, end + zeros)) {
+            end += zeros + 1;
+            zeros = 0;
+        } else {
+            ++zeros;
+        }
+    }
+    return end;
+}
+
+// The image itself: runs of nonzero memory, short zero gaps included. Memory past them is zero, as in a new VM.
+static void lsc_aot_write_image(FILE *out, const LSC_VM *vm) {
+    for (uint32_t start = 0; start < LSC_MEMORY_MAX; ++start) {
+        if (lsc_mem_peek(vm, start) == 0) {
+            continue;
+        }
+        uint32_t end = lsc_aot_segment_end(vm, start);
+        fprintf(out, "static const uint16_t lsc_aot_image_%04X[] = {", start);
+        for (uint32_t a = start; a < end; ++a) {
+            fprintf(out, "%s0x%04X,", (a - start) % LSC_AOT_LINE ? " " : "\n    ", lsc_mem_peek(vm, a));
+        }
+        fprintf(out, "\n};\n\n");
+        start = end;
+    }
+
+    // Every segment ended on a zero (or the end of memory), so this finds the same ones again
+    fprintf(out, "static const LSC_AOT_SEGMENT lsc_aot_image[] = {\n");
+    for (uint32_t start = 0; start < LSC_MEMORY_MAX; ++start) {
+        if (lsc_mem_peek(vm, start) == 0) {
+            continue;
+        }
+        uint32_t end = lsc_aot_segment_end(vm, start);
+        fprintf(out, "    {0x%04X, %u, lsc_aot_image_%04X},\n", start, end - start, start);
+        start = end;
+    }
+    fprintf(out, "};\n\n");
+}
+
+// Everything in the generated file that does not depend on the program. Compiled code only reads what it needs.
+static const char lsc_aot_prologue[] =
+    "#include <signal.h>\n"
+    "#include <stdint.h>\n"
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <string.h>\n"
+    "#include <unistd.h>\n"
+    "\n"
+    "#include \"lsc_block.h\"\n"
+    "#include \"lsc_console.h\"\n"
+    "#include \"lsc_vm.h\"\n"
+    "\n"
+    "typedef struct {\n"
+    "    uint16_t first;\n"
+    "    uint32_t count;\n"
+    "    const uint16_t *words;\n"
+    "} LSC_AOT_SEGMENT;\n"
+    "\n"
+    "typedef struct {\n"
+    "    uint16_t first;\n"
+    "    uint32_t count;\n"
+    "} LSC_AOT_RANGE;\n"
+    "\n"
+    "static uint16_t lsc_aot_original[LSC_MEMORY_MAX]; // Memory as translated\n"
+    "static uint8_t lsc_aot_code[LSC_MEMORY_MAX]; // Words translated as instructions\n"
+    "static uint8_t lsc_aot_code_page[LSC_PAGE_COUNT];\n"
+    "static uint8_t lsc_aot_slow[LSC_MEMORY_MAX]; // Code or a device: stores there go through lsc_mem_write\n"
+    "static uint8_t lsc_aot_touched[LSC_PAGE_COUNT]; // Pages stored to without lsc_mem_write, see lsc_aot_leave\n"
+    "static int lsc_aot_stale; // Translated code was changed, the interpreter runs everything from now on\n"
+    "static LSC_CONSOLE *lsc_aot_console;\n"
+    "\n"
+    "// Like the interpreter's own loading, a store with no page to go to stops the program\n"
+    "static void lsc_aot_out_of_memory(void) {\n"
+    "    lsc_console_restore(lsc_aot_console);\n"
+    "    printf(\"out of memory\\n\");\n"
+    "    exit(1);\n"
+    "}\n"
+    "\n"
+    "#define LSC_AOT_LEAVE(next) do { pc = (next); goto lsc_aot_leave; } while (0)\n"
+    "\n"
+    "#define LSC_AOT_LOAD(address) lsc_aot_load(vm, (address))\n"
+    "\n"
+    "// A store to plain memory the VM may not own yet (see Memory in lsc_vm.h)\n"
+    "#define LSC_AOT_POKE(address, value) do { \\\n"
+    "    uint16_t p_ = (address); \\\n"
+    "    if (!lsc_mem_poke(vm, p_, (value))) { \\\n"
+    "        lsc_aot_out_of_memory(); \\\n"
+    "    } \\\n"
+    "    lsc_aot_touched[p_ >> LSC_PAGE_SHIFT] = 1; \\\n"
+    "} while (0)\n"
+    "\n"
+    "#define LSC_AOT_STORE_CODE(address, value, next) do { \\\n"
+    "    lsc_mem_write(vm, (address), (value)); \\\n"
+    "    lsc_aot_stale = 1; \\\n"
+    "    LSC_AOT_LEAVE(next); \\\n"
+    "} while (0)\n"
+    "\n"
+    "#define LSC_AOT_STORE(address, value, next) do { \\\n"
+    "    uint16_t a_ = (address); \\\n"
+    "    if (lsc_aot_slow[a_]) { \\\n"
+    "        lsc_mem_write(vm, a_, (value)); \\\n"
+    "        if (lsc_aot_code[a_]) { \\\n"
+    "            lsc_aot_stale = 1; \\\n"
+    "            LSC_AOT_LEAVE(next); \\\n"
+    "        } \\\n"
+    "    } else { \\\n"
+    "        LSC_AOT_POKE(a_, (value)); \\\n"
+    "    } \\\n"
+    "} while (0)\n"
+    "\n"
+    "// Trap routines see the whole machine, like in the interpreter\n"
+    "#define LSC_AOT_TRAP(address, vector) do { \\\n"
+    "    for (int i_ = 0; i_ < 8; ++i_) vm->reg[i_] = r[i_]; \\\n"
+    "    vm->reg[LSC_R_PC] = (uint16_t)((address) + 1); \\\n"
+    "    vm->reg[LSC_R_COND] = lsc_cond_flags(cc); \\\n"
+    "    if (lsc_trap(vm, (vector))) { \\\n"
+    "        vm->waiting = 1; \\\n"
+    "        LSC_AOT_LEAVE(address); \\\n"
+    "    } \\\n"
+    "    for (int i_ = 0; i_ < 8; ++i_) r[i_] = vm->reg[i_]; \\\n"
+    "    r[7] = (uint16_t)((address) + 1); \\\n"
+    "    cc = lsc_cond_value(vm->reg[LSC_R_COND]); \\\n"
+    "} while (0)\n"
+    "\n"
+    "// BLKIN copies straight into memory, maybe over code\n"
+    "#define LSC_AOT_TRAP_BLKIN(address) do { \\\n"
+    "    memset(vm->page_dirty, 0, sizeof(vm->page_dirty)); \\\n"
+    "    LSC_AOT_TRAP((address), LSC_TRAP_BLKIN); \\\n"
+    "    if (lsc_aot_check(vm)) { \\\n"
+    "        LSC_AOT_LEAVE((uint16_t)((address) + 1)); \\\n"
+    "    } \\\n"
+    "} while (0)\n"
+    "\n"
+    "static inline uint16_t lsc_aot_load(LSC_VM *vm, uint16_t address) {\n"
+    "    return (vm->page_attr[address >> LSC_PAGE_SHIFT] & LSC_PAGE_DEVICE) ? lsc_mem_read(vm, address) : lsc_mem_peek(vm, address);\n"
+    "}\n"
+    "\n"
+    "// Whether a page marked dirty since page_dirty was cleared changed translated code. Nothing here takes snapshots.\n"
+    "static int lsc_aot_check(LSC_VM *vm) {\n"
+    "    for (int page = 0; page < LSC_PAGE_COUNT; ++page) {\n"
+    "        if (!vm->page_dirty[page] || !lsc_aot_code_page[page]) {\n"
+    "            continue;\n"
+    "        }\n"
+    "        for (int a = page << LSC_PAGE_SHIFT; a < (page + 1) << LSC_PAGE_SHIFT; ++a) {\n"
+    "            if (lsc_aot_code[a] && lsc_mem_peek(vm, a) != lsc_aot_original[a]) {\n"
+    "                lsc_aot_stale = 1;\n"
+    "            }\n"
+    "        }\n"
+    "    }\n"
+    "    return lsc_aot_stale;\n"
+    "}\n"
+    "\n";
+
+// The host side: load the image, then run translated code and the interpreter in turns
+static const char lsc_aot_epilogue[] =
+    "static void lsc_aot_start(LSC_VM *vm) {\n"
+    "    for (size_t i = 0; i < sizeof(lsc_aot_image) / sizeof(lsc_aot_image[0]); ++i) {\n"
+    "        const LSC_AOT_SEGMENT *s = &lsc_aot_image[i];\n"
+    "        for (uint32_t i = 0; i < s->count; ++i) {\n"
+    "            if (!lsc_mem_poke(vm, s->first + i, s->words[i])) {\n"
+    "                printf(\"out of memory\\n\");\n"
+    "                exit(1);\n"
+    "            }\n"
+    "        }\n"
+    "        memcpy(lsc_aot_original + s->first, s->words, s->count * sizeof(uint16_t));\n"
+    "        lsc_mem_invalidate(vm, s->first, s->count);\n"
+    "    }\n"
+    "    for (size_t i = 0; i < sizeof(lsc_aot_code_ranges) / sizeof(lsc_aot_code_ranges[0]); ++i) {\n"
+    "        for (uint32_t a = lsc_aot_code_ranges[i].first; a < lsc_aot_code_ranges[i].first + lsc_aot_code_ranges[i].count; ++a) {\n"
+    "            lsc_aot_code[a] = 1;\n"
+    "            lsc_aot_code_page[a >> LSC_PAGE_SHIFT] = 1;\n"
+    "        }\n"
+    "    }\n"
+    "    for (uint32_t a = 0; a < LSC_MEMORY_MAX; ++a) {\n"
+    "        lsc_aot_slow[a] = lsc_aot_code[a] || (vm->page_attr[a >> LSC_PAGE_SHIFT] & LSC_PAGE_DEVICE);\n"
+    "    }\n"
+    "    memcpy(vm->reg, lsc_aot_registers, sizeof(vm->reg));\n"
+    "\n"
+    "    // The interpreter stops where translated code can take over again\n"
+    "    for (size_t i = 0; i < sizeof(lsc_aot_leaders) / sizeof(lsc_aot_leaders[0]); ++i) {\n"
+    "        if (!lsc_vm_breakpoint(vm, lsc_aot_leaders[i], 1)) {\n"
+    "            lsc_aot_out_of_memory();\n"
+    "        }\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "/*\n"
+    "The interpreter, from where translated code left off to the next block it has. Whether it stored into translated code\n"
+    "is looked at once it stops. Once translated code is stale, the blocks are no place to stop and it runs to the end.\n"
+    "*/\n"
+    "static void lsc_aot_interpret(LSC_VM *vm) {\n"
+    "    if (lsc_aot_stale) {\n"
+    "        lsc_vm_run(vm, UINT64_MAX);\n"
+    "        return;\n"
+    "    }\n"
+    "    memset(vm->page_dirty, 0, sizeof(vm->page_dirty));\n"
+    "    lsc_vm_run(vm, UINT64_MAX);\n"
+    "    if (lsc_aot_check(vm)) {\n"
+    "        for (size_t i = 0; i < sizeof(lsc_aot_leaders) / sizeof(lsc_aot_leaders[0]); ++i) {\n"
+    "            lsc_vm_breakpoint(vm, lsc_aot_leaders[i], 0);\n"
+    "        }\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static void lsc_aot_interrupt(int signal) {\n"
+    "    lsc_console_restore(lsc_aot_console);\n"
+    "    _exit(128 + signal);\n"
+    "}\n"
+    "\n"
+    "int main(int argc, char **argv) {\n"
+    "    LSC_VM *vm = lsc_vm_create();\n"
+    "    if (!vm) {\n"
+    "        printf(\"out of memory\\n\");\n"
+    "        return 1;\n"
+    "    }\n"
+    "    for (int j = 1; j < argc; ++j) {\n"
+    "        if (strncmp(argv[j], \"--disk=\", 7) != 0 || vm->block) {\n"
+    "            printf(\"%s [--disk=file]\\n\", argv[0]);\n"
+    "            return 2;\n"
+    "        }\n"
+    "        vm->block = lsc_block_open(argv[j] + 7);\n"
+    "        if (!vm->block) {\n"
+    "            printf(\"failed to open disk: %s\\n\", argv[j] + 7);\n"
+    "            return 1;\n"
+    "        }\n"
+    "    }\n"
+    "    lsc_aot_start(vm);\n"
+    "\n"
+    "    vm->console = lsc_console_create(STDIN_FILENO, STDOUT_FILENO);\n"
+    "    if (!vm->console) {\n"
+    "        printf(\"out of memory\\n\");\n"
+    "        return 1;\n"
+    "    }\n"
+    "    lsc_aot_console = vm->console;\n"
+    "    signal(SIGINT, lsc_aot_interrupt);\n"
+    "\n"
+    "    while (!vm->halted && !vm->faulted) {\n"
+    "        if (!lsc_aot_stale) {\n"
+    "            lsc_aot_run(vm);\n"
+    "        }\n"
+    "        if (vm->halted || vm->faulted) {\n"
+    "            break;\n"
+    "        }\n"
+    "        lsc_aot_interpret(vm);\n"
+    "    }\n"
+    "    lsc_console_flush(vm);\n"
+    "\n"
+    "    lsc_aot_console = NULL;\n"
+    "    lsc_console_destroy(vm->console);\n"
+    "    vm->console = NULL;\n"
+    "    if (vm->faulted) {\n"
+    "        printf(\"illegal instruction x%04X at x%04X\\n\", lsc_mem_peek(vm, vm->reg[LSC_R_PC]), vm->reg[LSC_R_PC]);\n"
+    "    }\n"
+    "    lsc_block_close(vm->block);\n"
+    "    lsc_vm_destroy(vm);\n"
+    "    return 0;\n"
+    "}\n";
+
+int lsc_aot_write(const LSC_VM *vm, const char *path) {
+    LSC_ANALYSIS *analysis = lsc_analyze(vm);
+    if (!analysis) {
+        return 0;
+    }
+
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        lsc_analyze_free(analysis);
+        return 0;
+    }
+
+    fprintf(out, "/*\nTranslated from an LC-3 image by lsc_vm --aot, see lsc_aot.h. Build with the VM's sources, all but main.c:\n\n");
+    fprintf(out, "    gcc -O2 -I<lsc_vm>/src %s <lsc_vm>/src/lsc_*.c -pthread\n*/\n\n", path);
+    fputs(lsc_aot_prologue, out);
+
+    lsc_aot_write_image(out, vm);
+
+    fprintf(out, "static const uint16_t lsc_aot_registers[LSC_R_COUNT] = {");
+    for (int r = 0; r < LSC_R_COUNT; ++r) {
+        fprintf(out, "%s0x%04X", r ? ", " : "", vm->reg[r]);
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static const LSC_AOT_RANGE lsc_aot_code_ranges[] = {\n");
+    for (uint32_t a = lsc_aot_find(analysis->code, 0, 1); a < LSC_MEMORY_MAX; a = lsc_aot_find(analysis->code, a, 1)) {
+        uint32_t end = lsc_aot_find(analysis->code, a, 0);
+        fprintf(out, "    {0x%04X, %u},\n", a, end - a);
+        a = end;
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static const uint16_t lsc_aot_leaders[] = {");
+    int leaders = 0;
+    for (uint32_t a = 0; a < LSC_MEMORY_MAX; ++a) {
+        if (analysis->leader[a]) {
+            fprintf(out, "%s0x%04X,", leaders++ % LSC_AOT_LINE ? " " : "\n    ", a);
+        }
+    }
+    fprintf(out, "\n};\n\n");
+
+    // The program: r and cc are the registers while it runs, vm->reg only outside it
+    fprintf(out, "static void lsc_aot_run(LSC_VM *vm) {\n");
+    fprintf(out, "    uint16_t *const *m = vm->memory;\n");
+    fprintf(out, "    (void)m;\n");
+    fprintf(out, "    uint16_t r[8];\n");
+    fprintf(out, "    for (int i = 0; i < 8; ++i) {\n        r[i] = vm->reg[i];\n    }\n");
+    fprintf(out, "    uint16_t cc = lsc_cond_value(vm->reg[LSC_R_COND]);\n");
+    fprintf(out, "    uint16_t pc = vm->reg[LSC_R_PC];\n\n");
+
+    fprintf(out, "    goto lsc_aot_dispatch; // Also where JMP, RET and JSRR come back to\n");
+    fprintf(out, "lsc_aot_dispatch:\n    switch (pc) {\n");
+    for (uint32_t a = 0; a < LSC_MEMORY_MAX; ++a) {
+        if (analysis->leader[a]) {
+            fprintf(out, "        case 0x%04X: goto L%04X;\n", a, a);
+        }
+    }
+    fprintf(out, "        default: goto lsc_aot_leave;\n    }\n\n");
+
+    for (uint32_t a = 0; a < LSC_MEMORY_MAX; ++a) {
+        if (analysis->code[a]) {
+            lsc_aot_instruction(out, vm, analysis, a);
+        }
+    }
+
+    // The interpreter decodes memory lazily, and has to see the stores that skipped lsc_mem_write
+    fprintf(out, "\nlsc_aot_leave:\n");
+    fprintf(out, "    for (int i = 0; i < 8; ++i) {\n        vm->reg[i] = r[i];\n    }\n");
+    fprintf(out, "    vm->reg[LSC_R_PC] = pc;\n");
+    fprintf(out, "    vm->reg[LSC_R_COND] = lsc_cond_flags(cc);\n");
+    fprintf(out, "    for (int page = 0; page < LSC_PAGE_COUNT; ++page) {\n");
+    fprintf(out, "        if (lsc_aot_touched[page]) {\n");
+    fprintf(out, "            lsc_aot_touched[page] = 0;\n");
+    fprintf(out, "            lsc_mem_invalidate(vm, page << LSC_PAGE_SHIFT, LSC_PAGE_SIZE);\n");
+    fprintf(out, "        }\n    }\n}\n\n");
+
+    fputs(lsc_aot_epilogue, out);
+
+    lsc_analyze_free(analysis);
+    return fclose(out) == 0;
+}
@@ -0,0 +1,32 @@
+#ifndef LSC_AOT_H
+#define LSC_AOT_H
+
+#include "lsc_vm.h"
+
+/*
+Ahead-of-time translation to C
+
+lsc_vm --aot=image.c image.obj
+gcc -O2 -Isrc image.c $(ls src/lsc_*.c) -o image -pthread
+
+For a fixed image that gets run over and over, the interpreter is pure overhead. This walks the program the way a
+disassembler would, following every branch and JSR from the start PC, and writes out one C function for the code it
+found: a label per basic block, the registers in locals, branches and JSR as plain gotos. The C compiler does the rest.
+The output is a program of its own (the image words are in it) that links against the other lsc_*.c files.
+
+Everything static translation cannot know is left to the interpreter, in the same VM:
+- JMP, RET and JSRR jump through a switch over every block. A target that is not one (a jump table, code the walk
+  never reached, code built at run time) leaves the C code, and the interpreter runs until PC is back on a block (every
+  block has a breakpoint on it for that, see lsc_vm_breakpoint).
+- Loads and stores to device pages go through lsc_mem_read/lsc_mem_write. Other loads and stores are plain array
+  accesses.
+- A store into translated code (self-modifying code, or a BLKIN over it) means the C no longer says what memory does.
+  The interpreter runs the rest of the program.
+
+The translated code does not count cycles, and runs until the program halts, faults or leaves it.
+*/
+
+// Translate the program in vm's memory, starting at its PC, to a C file at path. Returns 0 if path cannot be written.
+int lsc_aot_write(const LSC_VM *vm, const char *path);
+
+#endif
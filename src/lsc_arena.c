@@ -0,0 +1,106 @@
+#include "lsc_arena.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct LSC_ARENA_BLOCK {
+    LSC_ARENA_BLOCK *next;
+    size_t size; // Bytes after the header
+};
+
+// The header, rounded up so the first allocation is aligned too
+#define LSC_ARENA_HEADER ((sizeof(LSC_ARENA_BLOCK) + LSC_ARENA_ALIGN - 1) & ~(size_t)(LSC_ARENA_ALIGN - 1))
+
+static char *lsc_arena_data(LSC_ARENA_BLOCK *block) {
+    return (char *)block + LSC_ARENA_HEADER;
+}
+
+// Returns 0 for sizes so big that rounding them up would wrap
+static size_t lsc_arena_round(size_t size) {
+    if (size > SIZE_MAX / 2) {
+        return 0;
+    }
+    return (size + LSC_ARENA_ALIGN - 1) & ~(size_t)(LSC_ARENA_ALIGN - 1);
+}
+
+// Move on to a block with room for size bytes: the next kept one if it is big enough, otherwise a new one in front of it
+static int lsc_arena_next_block(LSC_ARENA *arena, size_t size) {
+    LSC_ARENA_BLOCK **link = arena->current ? &arena->current->next : &arena->first;
+    LSC_ARENA_BLOCK *block = *link;
+
+    if (!block || block->size < size) {
+        // As big as every block so far, so the number of blocks only grows with the log of the size
+        size_t block_size = arena->size > LSC_ARENA_MIN_BLOCK ? arena->size : LSC_ARENA_MIN_BLOCK;
+        while (block_size < size) {
+            block_size *= 2;
+        }
+        LSC_ARENA_BLOCK *fresh = malloc(LSC_ARENA_HEADER + block_size);
+        if (!fresh) {
+            return 0;
+        }
+        fresh->size = block_size;
+        fresh->next = block;
+        *link = fresh;
+        arena->size += block_size;
+        block = fresh;
+    }
+
+    arena->current = block;
+    arena->next = lsc_arena_data(block);
+    arena->end = arena->next + block->size;
+    return 1;
+}
+
+void *lsc_arena_alloc(LSC_ARENA *arena, size_t size) {
+    size = lsc_arena_round(size ? size : 1);
+    if (!size) {
+        return NULL;
+    }
+    if ((size_t)(arena->end - arena->next) < size && !lsc_arena_next_block(arena, size)) {
+        return NULL;
+    }
+    void *p = arena->next;
+    arena->next += size;
+    return p;
+}
+
+void *lsc_arena_zalloc(LSC_ARENA *arena, size_t size) {
+    void *p = lsc_arena_alloc(arena, size);
+    if (p) {
+        memset(p, 0, size);
+    }
+    return p;
+}
+
+void *lsc_arena_grow(LSC_ARENA *arena, void *old, size_t old_size, size_t new_size) {
+    size_t old_rounded = lsc_arena_round(old_size);
+    size_t new_rounded = lsc_arena_round(new_size);
+    if (old && new_rounded && (char *)old + old_rounded == arena->next &&
+        new_rounded - old_rounded <= (size_t)(arena->end - arena->next)) {
+        arena->next = (char *)old + new_rounded;
+        return old;
+    }
+
+    void *p = lsc_arena_alloc(arena, new_size);
+    if (p && old) {
+        memcpy(p, old, old_size);
+    }
+    return p;
+}
+
+void lsc_arena_reset(LSC_ARENA *arena) {
+    arena->current = arena->first;
+    arena->next = arena->first ? lsc_arena_data(arena->first) : NULL;
+    arena->end = arena->first ? arena->next + arena->first->size : NULL;
+}
+
+void lsc_arena_free(LSC_ARENA *arena) {
+    LSC_ARENA_BLOCK *block = arena->first;
+    while (block) {
+        LSC_ARENA_BLOCK *next = block->next;
+        free(block);
+        block = next;
+    }
+    memset(arena, 0, sizeof(*arena));
+}
@@ -0,0 +1,53 @@
+#ifndef LSC_ARENA_H
+#define LSC_ARENA_H
+
+#include <stddef.h>
+
+/*
+Bump allocator
+
+Every VM has one (vm->arena), and everything it needs while running comes from there instead of malloc: the JIT's block
+table, breakpoints, the input and output buffers, an attached profile or trace. Nothing is ever freed on its own.
+lsc_arena_reset takes it all back at once by moving the pointer back to the start, which is what lsc_vm_clear does
+between programs, and the blocks themselves are kept for the next one. A batch worker that reuses one VM for every job
+stops calling malloc once its arena has grown to fit the biggest job, so workers never meet in the allocator.
+
+Blocks are chained: when the current one is full the next kept block is used, or a new one twice the size of the last
+is added. Allocations are LSC_ARENA_ALIGN aligned.
+*/
+
+typedef struct LSC_ARENA_BLOCK LSC_ARENA_BLOCK;
+
+typedef struct {
+    LSC_ARENA_BLOCK *first;
+    LSC_ARENA_BLOCK *current; // Where allocations come from, the blocks after it are free
+    char *next; // Next free byte in current
+    char *end; // End of current
+    size_t size; // Bytes in all blocks
+} LSC_ARENA;
+
+enum {
+    LSC_ARENA_ALIGN = 16,
+    LSC_ARENA_MIN_BLOCK = 64 << 10, // Smallest block to malloc
+};
+
+// Uninitialised, NULL when out of memory
+void *lsc_arena_alloc(LSC_ARENA *arena, size_t size);
+
+// Zeroed, NULL when out of memory
+void *lsc_arena_zalloc(LSC_ARENA *arena, size_t size);
+
+/*
+Make an allocation bigger (old may be NULL). The most recent allocation grows where it is when there is room after it,
+anything else moves to a new allocation and the old one is wasted until the next reset. Returns NULL when out of memory,
+and old is left as it was.
+*/
+void *lsc_arena_grow(LSC_ARENA *arena, void *old, size_t old_size, size_t new_size);
+
+// Forget every allocation, keeping the blocks for what comes next
+void lsc_arena_reset(LSC_ARENA *arena);
+
+// Give the blocks back to the system, leaving an empty arena
+void lsc_arena_free(LSC_ARENA *arena);
+
+#endif
@@ -0,0 +1,840 @@
+#include "lsc_asm.h"
+#include "lsc_fuse.h"
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+enum {
+    LSC_ASM_MAX_TOKENS = 6, // Label, opcode and up to 3 operands, plus one too many to complain about
+    LSC_ASM_MAX_LINE = 1024,
+};
+
+// How an opcode's operands are encoded
+typedef enum {
+    LSC_ASM_OPERATE, // ADD, AND: DR, SR1, SR2 or imm5
+    LSC_ASM_NOT, // DR, SR
+    LSC_ASM_BR, // PCoffset9, the nzp bits are in the opcode
+    LSC_ASM_PC9, // LD, LDI, LEA, ST, STI: DR/SR, PCoffset9
+    LSC_ASM_BASE6, // LDR, STR: DR/SR, BaseR, offset6
+    LSC_ASM_PC11, // JSR: PCoffset11
+    LSC_ASM_BASE, // JMP, JSRR: BaseR
+    LSC_ASM_NONE, // RET, RTI, the trap names: no operands
+    LSC_ASM_TRAP, // TRAP: trapvect8
+    LSC_ASM_ORIG,
+    LSC_ASM_END,
+    LSC_ASM_FILL,
+    LSC_ASM_BLKW,
+    LSC_ASM_STRINGZ,
+} LSC_ASM_KIND;
+
+typedef struct {
+    const char *name;
+    LSC_ASM_KIND kind;
+    uint16_t bits; // The instruction with every operand 0
+} LSC_ASM_OPCODE;
+
+static const LSC_ASM_OPCODE lsc_asm_opcodes[] = {
+    {"ADD", LSC_ASM_OPERATE, 0x1000},
+    {"AND", LSC_ASM_OPERATE, 0x5000},
+    {"NOT", LSC_ASM_NOT, 0x903F},
+    {"BR", LSC_ASM_BR, 0x0E00},
+    {"BRN", LSC_ASM_BR, 0x0800},
+    {"BRZ", LSC_ASM_BR, 0x0400},
+    {"BRP", LSC_ASM_BR, 0x0200},
+    {"BRNZ", LSC_ASM_BR, 0x0C00},
+    {"BRNP", LSC_ASM_BR, 0x0A00},
+    {"BRZP", LSC_ASM_BR, 0x0600},
+    {"BRNZP", LSC_ASM_BR, 0x0E00},
+    {"LD", LSC_ASM_PC9, 0x2000},
+    {"LDI", LSC_ASM_PC9, 0xA000},
+    {"LEA", LSC_ASM_PC9, 0xE000},
+    {"ST", LSC_ASM_PC9, 0x3000},
+    {"STI", LSC_ASM_PC9, 0xB000},
+    {"LDR", LSC_ASM_BASE6, 0x6000},
+    {"STR", LSC_ASM_BASE6, 0x7000},
+    {"JSR", LSC_ASM_PC11, 0x4800},
+    {"JSRR", LSC_ASM_BASE, 0x4000},
+    {"JMP", LSC_ASM_BASE, 0xC000},
+    {"RET", LSC_ASM_NONE, 0xC1C0},
+    {"RTI", LSC_ASM_NONE, 0x8000},
+    {"TRAP", LSC_ASM_TRAP, 0xF000},
+    {"GETC", LSC_ASM_NONE, 0xF000 | LSC_TRAP_GETC},
+    {"OUT", LSC_ASM_NONE, 0xF000 | LSC_TRAP_OUT},
+    {"PUTS", LSC_ASM_NONE, 0xF000 | LSC_TRAP_PUTS},
+    {"IN", LSC_ASM_NONE, 0xF000 | LSC_TRAP_IN},
+    {"PUTSP", LSC_ASM_NONE, 0xF000 | LSC_TRAP_PUTSP},
+    {"HALT", LSC_ASM_NONE, 0xF000 | LSC_TRAP_HALT},
+    {"BLKIN", LSC_ASM_NONE, 0xF000 | LSC_TRAP_BLKIN},
+    {"BLKOUT", LSC_ASM_NONE, 0xF000 | LSC_TRAP_BLKOUT},
+    {".ORIG", LSC_ASM_ORIG, 0},
+    {".END", LSC_ASM_END, 0},
+    {".FILL", LSC_ASM_FILL, 0},
+    {".BLKW", LSC_ASM_BLKW, 0},
+    {".STRINGZ", LSC_ASM_STRINGZ, 0},
+};
+
+// One line, split up. A quoted string stays one token, quotes included.
+typedef struct {
+    const char *label;
+    const LSC_ASM_OPCODE *opcode;
+    const char *operands[LSC_ASM_MAX_TOKENS];
+    int operand_count;
+    char text[LSC_ASM_MAX_LINE];
+} LSC_ASM_LINE;
+
+typedef struct {
+    LSC_ASM *out;
+    int pass; // 1 finds the labels and section sizes, 2 writes the words
+    int line;
+    int in_section;
+    uint32_t pc;
+    size_t section; // Index of the current section, or of the next one outside of one
+    uint32_t *targets; // BR and JSR targets, for LSC_ASM_BLOCK
+    size_t target_count;
+    size_t target_capacity;
+} LSC_ASM_STATE;
+
+// Stop with an error. Only the first one is kept.
+static int lsc_asm_error(LSC_ASM_STATE *state, const char *format, ...) {
+    if (state->out->error[0]) {
+        return 0;
+    }
+    int n = snprintf(state->out->error, sizeof(state->out->error), "line %d: ", state->line);
+    va_list args;
+    va_start(args, format);
+    vsnprintf(state->out->error + n, sizeof(state->out->error) - n, format, args);
+    va_end(args);
+    return 0;
+}
+
+static const LSC_ASM_OPCODE *lsc_asm_find_opcode(const char *token) {
+    for (size_t i = 0; i < sizeof(lsc_asm_opcodes) / sizeof(lsc_asm_opcodes[0]); ++i) {
+        if (strcasecmp(token, lsc_asm_opcodes[i].name) == 0) {
+            return &lsc_asm_opcodes[i];
+        }
+    }
+    return NULL;
+}
+
+// Split one line into tokens, in place in line->text. Returns 0 on an unterminated string or too many operands.
+static int lsc_asm_split(LSC_ASM_STATE *state, LSC_ASM_LINE *line, const char *start, size_t length) {
+    if (length >= sizeof(line->text)) {
+        return lsc_asm_error(state, "line too long");
+    }
+    memcpy(line->text, start, length);
+    line->text[length] = '\0';
+
+    const char *tokens[LSC_ASM_MAX_TOKENS];
+    int count = 0;
+    char *p = line->text;
+    while (*p && *p != ';') {
+        if (isspace((unsigned char)*p) || *p == ',') {
+            *p++ = '\0';
+            continue;
+        }
+        if (count == LSC_ASM_MAX_TOKENS) {
+            return lsc_asm_error(state, "too many operands");
+        }
+        tokens[count++] = p;
+        if (*p == '"') {
+            // Up to the closing quote, skipping escaped ones
+            for (++p; *p != '"'; ++p) {
+                if (!*p || (*p == '\\' && !*++p)) {
+                    return lsc_asm_error(state, "unterminated string");
+                }
+            }
+            ++p;
+        } else {
+            while (*p && *p != ';' && *p != ',' && !isspace((unsigned char)*p)) {
+                ++p;
+            }
+        }
+    }
+    *p = '\0';
+
+    // Whatever comes before the opcode is a label
+    int first = 0;
+    line->label = NULL;
+    line->opcode = NULL;
+    if (count && !lsc_asm_find_opcode(tokens[0])) {
+        line->label = tokens[first++];
+    }
+    if (first < count) {
+        line->opcode = lsc_asm_find_opcode(tokens[first]);
+        if (!line->opcode) {
+            return lsc_asm_error(state, "unknown instruction %s", tokens[first]);
+        }
+        ++first;
+    }
+    line->operand_count = count - first;
+    for (int i = first; i < count; ++i) {
+        line->operands[i - first] = tokens[i];
+    }
+    return 1;
+}
+
+// #decimal, xhex or decimal, with an optional - after the prefix. Returns 0 if token is not a number.
+static int lsc_asm_number(const char *token, long *value) {
+    int base = 10;
+    if (*token == '#') {
+        ++token;
+    } else if ((*token == 'x' || *token == 'X') && token[1]) {
+        base = 16;
+        ++token;
+    }
+    int negative = *token == '-';
+    if (negative) {
+        ++token;
+    }
+    if (!*token) {
+        return 0;
+    }
+
+    long v = 0;
+    for (; *token; ++token) {
+        int digit;
+        if (isdigit((unsigned char)*token)) {
+            digit = *token - '0';
+        } else if (base == 16 && isxdigit((unsigned char)*token)) {
+            digit = tolower((unsigned char)*token) - 'a' + 10;
+        } else {
+            return 0;
+        }
+        v = v * base + digit;
+        if (v > 0x1FFFF) {
+            return 0;
+        }
+    }
+    *value = negative ? -v : v;
+    return 1;
+}
+
+static int lsc_asm_is_register(const char *token) {
+    return (token[0] == 'R' || token[0] == 'r') && token[1] >= '0' && token[1] <= '7' && !token[2];
+}
+
+static int lsc_asm_register(LSC_ASM_STATE *state, const char *token, int *reg) {
+    if (lsc_asm_is_register(token)) {
+        *reg = token[1] - '0';
+        return 1;
+    }
+    return lsc_asm_error(state, "expected a register, got %s", token);
+}
+
+// A number between low and high
+static int lsc_asm_immediate(LSC_ASM_STATE *state, const char *token, long low, long high, long *value) {
+    if (!lsc_asm_number(token, value)) {
+        return lsc_asm_error(state, "expected a number, got %s", token);
+    }
+    if (*value < low || *value > high) {
+        return lsc_asm_error(state, "%s is out of range (%ld to %ld)", token, low, high);
+    }
+    return 1;
+}
+
+static int lsc_asm_symbol_compare(const void *a, const void *b) {
+    return strcmp(((const LSC_ASM_SYMBOL *)a)->name, ((const LSC_ASM_SYMBOL *)b)->name);
+}
+
+// The address of a label. Symbols are sorted by name after the first pass, so this is a binary search.
+static const LSC_ASM_SYMBOL *lsc_asm_lookup(const LSC_ASM *out, const char *name) {
+    LSC_ASM_SYMBOL key = {(char *)name, 0};
+    return bsearch(&key, out->symbols, out->symbol_count, sizeof(key), lsc_asm_symbol_compare);
+}
+
+// A label or a number, as an address. Only the second pass knows labels.
+static int lsc_asm_address(LSC_ASM_STATE *state, const char *token, long *value) {
+    if (lsc_asm_number(token, value)) {
+        return 1;
+    }
+    if (state->pass == 1) {
+        *value = 0;
+        return 1;
+    }
+    const LSC_ASM_SYMBOL *symbol = lsc_asm_lookup(state->out, token);
+    if (!symbol) {
+        return lsc_asm_error(state, "undefined label %s", token);
+    }
+    *value = symbol->address;
+    return 1;
+}
+
+/*
+A PC-relative operand of bits bits: a label (made relative to the next instruction) or a number (already relative).
+Labels are checked for range in the second pass only, when they are known.
+*/
+static int lsc_asm_offset(LSC_ASM_STATE *state, const char *token, int bits, uint16_t *field) {
+    long low = -(1L << (bits - 1));
+    long high = (1L << (bits - 1)) - 1;
+    long value;
+    if (lsc_asm_number(token, &value)) {
+        if (value < low || value > high) {
+            return lsc_asm_error(state, "%s is out of range (%ld to %ld)", token, low, high);
+        }
+    } else {
+        if (!lsc_asm_address(state, token, &value)) {
+            return 0;
+        }
+        value -= state->pc + 1;
+        if (state->pass == 2 && (value < low || value > high)) {
+            return lsc_asm_error(state, "%s is too far away", token);
+        }
+    }
+    *field = value & ((1 << bits) - 1);
+    return 1;
+}
+
+// .STRINGZ: decode the quoted token into out (which may be NULL), returns the number of characters
+static size_t lsc_asm_string(const char *token, uint16_t *out) {
+    size_t n = 0;
+    for (const char *p = token + 1; *p != '"'; ++p) {
+        char c = *p;
+        if (c == '\\') {
+            switch (*++p) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case '0': c = '\0'; break;
+                default: c = *p; break;
+            }
+        }
+        if (out) {
+            out[n] = (uint8_t)c;
+        }
+        ++n;
+    }
+    return n;
+}
+
+static int lsc_asm_add_target(LSC_ASM_STATE *state, uint32_t address) {
+    if (state->target_count == state->target_capacity) {
+        size_t capacity = state->target_capacity ? state->target_capacity * 2 : 64;
+        uint32_t *targets = realloc(state->targets, capacity * sizeof(*targets));
+        if (!targets) {
+            return lsc_asm_error(state, "out of memory");
+        }
+        state->targets = targets;
+        state->target_capacity = capacity;
+    }
+    state->targets[state->target_count++] = address;
+    return 1;
+}
+
+static int lsc_asm_operands(LSC_ASM_STATE *state, const LSC_ASM_LINE *line, int count) {
+    if (line->operand_count != count) {
+        return lsc_asm_error(state, "%s takes %d operand%s", line->opcode->name, count, count == 1 ? "" : "s");
+    }
+    return 1;
+}
+
+// Encode one instruction. In the first pass only the operand count and number ranges are checked.
+static int lsc_asm_instruction(LSC_ASM_STATE *state, const LSC_ASM_LINE *line, uint16_t *word) {
+    const LSC_ASM_OPCODE *opcode = line->opcode;
+    const char *const *op = line->operands;
+    uint16_t w = opcode->bits;
+    uint16_t field;
+    long value;
+    int r0, r1, r2;
+
+    switch (opcode->kind) {
+        case LSC_ASM_OPERATE:
+            if (!lsc_asm_operands(state, line, 3) || !lsc_asm_register(state, op[0], &r0) || !lsc_asm_register(state, op[1], &r1)) {
+                return 0;
+            }
+            w |= r0 << 9 | r1 << 6;
+            if ((op[2][0] == 'R' || op[2][0] == 'r') && op[2][1]) {
+                if (!lsc_asm_register(state, op[2], &r2)) {
+                    return 0;
+                }
+                w |= r2;
+            } else {
+                if (!lsc_asm_immediate(state, op[2], -16, 15, &value)) {
+                    return 0;
+                }
+                w |= 0x20 | (value & 0x1F);
+            }
+            break;
+        case LSC_ASM_NOT:
+            if (!lsc_asm_operands(state, line, 2) || !lsc_asm_register(state, op[0], &r0) || !lsc_asm_register(state, op[1], &r1)) {
+                return 0;
+            }
+            w |= r0 << 9 | r1 << 6;
+            break;
+        case LSC_ASM_BR:
+            if (!lsc_asm_operands(state, line, 1) || !lsc_asm_offset(state, op[0], 9, &field)) {
+                return 0;
+            }
+            w |= field;
+            break;
+        case LSC_ASM_PC9:
+            if (!lsc_asm_operands(state, line, 2) || !lsc_asm_register(state, op[0], &r0) || !lsc_asm_offset(state, op[1], 9, &field)) {
+                return 0;
+            }
+            w |= r0 << 9 | field;
+            break;
+        case LSC_ASM_BASE6:
+            if (!lsc_asm_operands(state, line, 3) || !lsc_asm_register(state, op[0], &r0) || !lsc_asm_register(state, op[1], &r1) ||
+                !lsc_asm_immediate(state, op[2], -32, 31, &value)) {
+                return 0;
+            }
+            w |= r0 << 9 | r1 << 6 | (value & 0x3F);
+            break;
+        case LSC_ASM_PC11:
+            if (!lsc_asm_operands(state, line, 1) || !lsc_asm_offset(state, op[0], 11, &field)) {
+                return 0;
+            }
+            w |= field;
+            break;
+        case LSC_ASM_BASE:
+            if (!lsc_asm_operands(state, line, 1) || !lsc_asm_register(state, op[0], &r1)) {
+                return 0;
+            }
+            w |= r1 << 6;
+            break;
+        case LSC_ASM_NONE:
+            if (!lsc_asm_operands(state, line, 0)) {
+                return 0;
+            }
+            break;
+        case LSC_ASM_TRAP:
+            if (!lsc_asm_operands(state, line, 1) || !lsc_asm_immediate(state, op[0], 0, 0xFF, &value)) {
+                return 0;
+            }
+            w |= value;
+            break;
+        default:
+            return lsc_asm_error(state, "not an instruction");
+    }
+
+    // Where the branch goes starts a block
+    if (state->pass == 2 && (opcode->kind == LSC_ASM_BR || opcode->kind == LSC_ASM_PC11)) {
+        uint16_t offset = opcode->kind == LSC_ASM_BR ? lsc_sign_extend(w & 0x1FF, 9) : lsc_sign_extend(w & 0x7FF, 11);
+        if (!lsc_asm_add_target(state, (uint16_t)(state->pc + 1 + offset))) {
+            return 0;
+        }
+    }
+
+    *word = w;
+    return 1;
+}
+
+// Whatever follows this instruction starts a block: it is a branch, jump, call or trap
+static int lsc_asm_ends_block(const LSC_ASM_OPCODE *opcode) {
+    switch (opcode->kind) {
+        case LSC_ASM_BR:
+        case LSC_ASM_PC11:
+        case LSC_ASM_BASE:
+        case LSC_ASM_TRAP:
+        case LSC_ASM_NONE: // RET, RTI and the trap names
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int lsc_asm_label(LSC_ASM_STATE *state, const char *label) {
+    size_t length = strlen(label);
+    if (length && label[length - 1] == ':') {
+        --length;
+    }
+    int valid = length && (isalpha((unsigned char)label[0]) || label[0] == '_');
+    for (size_t i = 1; i < length; ++i) {
+        valid = valid && (isalnum((unsigned char)label[i]) || label[i] == '_');
+    }
+    if (!valid || lsc_asm_is_register(label)) {
+        return lsc_asm_error(state, "bad label %s", label);
+    }
+    if (!state->in_section) {
+        return lsc_asm_error(state, "label %s is outside of a .ORIG section", label);
+    }
+    if (state->pass == 2) {
+        return 1;
+    }
+
+    LSC_ASM *out = state->out;
+    LSC_ASM_SYMBOL *symbols = realloc(out->symbols, (out->symbol_count + 1) * sizeof(*symbols));
+    char *name = malloc(length + 1);
+    if (symbols) {
+        out->symbols = symbols;
+    }
+    if (!symbols || !name) {
+        free(name);
+        return lsc_asm_error(state, "out of memory");
+    }
+    memcpy(name, label, length);
+    name[length] = '\0';
+    out->symbols[out->symbol_count].name = name;
+    out->symbols[out->symbol_count].address = state->pc;
+    ++out->symbol_count;
+    return 1;
+}
+
+static int lsc_asm_line(LSC_ASM_STATE *state, const LSC_ASM_LINE *line) {
+    LSC_ASM *out = state->out;
+    const LSC_ASM_OPCODE *opcode = line->opcode;
+    LSC_ASM_SECTION *section = state->in_section && state->pass == 2 ? &out->sections[state->section] : NULL;
+    uint32_t at = section ? state->pc - section->origin : 0;
+
+    // .ORIG first, so a label on its line belongs to the section it starts
+    if (opcode && opcode->kind == LSC_ASM_ORIG) {
+        long origin;
+        if (state->in_section) {
+            return lsc_asm_error(state, ".ORIG inside a section, .END the last one first");
+        }
+        if (!lsc_asm_operands(state, line, 1) || !lsc_asm_immediate(state, line->operands[0], 0, 0xFFFF, &origin)) {
+            return 0;
+        }
+        if (state->pass == 1) {
+            LSC_ASM_SECTION *sections = realloc(out->sections, (out->section_count + 1) * sizeof(*sections));
+            if (!sections) {
+                return lsc_asm_error(state, "out of memory");
+            }
+            out->sections = sections;
+            memset(&sections[out->section_count], 0, sizeof(*sections));
+            sections[out->section_count++].origin = origin;
+        }
+        state->in_section = 1;
+        state->pc = origin;
+        return line->label ? lsc_asm_label(state, line->label) : 1;
+    }
+
+    if (line->label && !lsc_asm_label(state, line->label)) {
+        return 0;
+    }
+    if (!opcode) {
+        return 1;
+    }
+    if (!state->in_section) {
+        return lsc_asm_error(state, "%s is outside of a .ORIG section", opcode->name);
+    }
+    if (section && line->label) {
+        section->flags[at] |= LSC_ASM_BLOCK;
+    }
+
+    uint32_t size = 1;
+    switch (opcode->kind) {
+        case LSC_ASM_END:
+            state->in_section = 0;
+            ++state->section;
+            return 1;
+        case LSC_ASM_FILL: {
+            long value;
+            if (!lsc_asm_operands(state, line, 1)) {
+                return 0;
+            }
+            if (lsc_asm_number(line->operands[0], &value)) {
+                if (value < -0x8000 || value > 0xFFFF) {
+                    return lsc_asm_error(state, "%s does not fit in 16 bits", line->operands[0]);
+                }
+            } else if (!lsc_asm_address(state, line->operands[0], &value)) {
+                return 0;
+            }
+            if (section) {
+                section->words[at] = value;
+            }
+            break;
+        }
+        case LSC_ASM_BLKW: {
+            long count;
+            if (!lsc_asm_operands(state, line, 1) || !lsc_asm_immediate(state, line->operands[0], 1, LSC_MEMORY_MAX, &count)) {
+                return 0;
+            }
+            size = count;
+            break;
+        }
+        case LSC_ASM_STRINGZ:
+            if (!lsc_asm_operands(state, line, 1)) {
+                return 0;
+            }
+            if (line->operands[0][0] != '"') {
+                return lsc_asm_error(state, ".STRINGZ takes a quoted string");
+            }
+            size = lsc_asm_string(line->operands[0], NULL) + 1;
+            if (section) {
+                lsc_asm_string(line->operands[0], section->words + at);
+            }
+            break;
+        default: {
+            uint16_t word = 0;
+            if (!lsc_asm_instruction(state, line, &word)) {
+                return 0;
+            }
+            if (section) {
+                section->words[at] = word;
+                section->flags[at] |= LSC_ASM_INSTRUCTION;
+                if (lsc_asm_ends_block(opcode) && at + 1 < section->count) {
+                    section->flags[at + 1] |= LSC_ASM_BLOCK;
+                }
+            }
+            break;
+        }
+    }
+
+    if (state->pc + size > LSC_MEMORY_MAX) {
+        return lsc_asm_error(state, "section runs past the end of memory");
+    }
+    state->pc += size;
+    if (state->pass == 1) {
+        out->sections[state->section].count = state->pc - out->sections[state->section].origin;
+    }
+    return 1;
+}
+
+// One pass over the whole source
+static int lsc_asm_pass(LSC_ASM_STATE *state, const char *source, size_t size) {
+    LSC_ASM_LINE *line = malloc(sizeof(*line));
+    if (!line) {
+        return lsc_asm_error(state, "out of memory");
+    }
+
+    state->line = 0;
+    state->in_section = 0;
+    state->section = 0;
+    state->pc = 0;
+    int ok = 1;
+    for (size_t start = 0; ok && start < size;) {
+        const char *end = memchr(source + start, '\n', size - start);
+        size_t length = end ? (size_t)(end - (source + start)) : size - start;
+        ++state->line;
+        ok = lsc_asm_split(state, line, source + start, length) && lsc_asm_line(state, line);
+        start += length + 1;
+    }
+    free(line);
+    return ok;
+}
+
+// Mark where the BR and JSR targets that land on instructions are
+static void lsc_asm_mark_targets(LSC_ASM *out, const LSC_ASM_STATE *state) {
+    for (size_t i = 0; i < state->target_count; ++i) {
+        for (size_t s = 0; s < out->section_count; ++s) {
+            LSC_ASM_SECTION *section = &out->sections[s];
+            uint32_t at = state->targets[i] - section->origin;
+            if (state->targets[i] >= section->origin && at < section->count && (section->flags[at] & LSC_ASM_INSTRUCTION)) {
+                section->flags[at] |= LSC_ASM_BLOCK;
+            }
+        }
+    }
+}
+
+LSC_ASM *lsc_asm_source(const char *source, size_t size) {
+    LSC_ASM *out = calloc(1, sizeof(*out));
+    if (!out) {
+        return NULL;
+    }
+
+    LSC_ASM_STATE state = {.out = out, .pass = 1};
+    if (!lsc_asm_pass(&state, source, size)) {
+        free(state.targets);
+        return out;
+    }
+
+    // Every label is known now. Sorted, duplicates end up next to each other.
+    qsort(out->symbols, out->symbol_count, sizeof(out->symbols[0]), lsc_asm_symbol_compare);
+    for (size_t i = 1; i < out->symbol_count; ++i) {
+        if (strcmp(out->symbols[i - 1].name, out->symbols[i].name) == 0) {
+            snprintf(out->error, sizeof(out->error), "label %s is defined twice", out->symbols[i].name);
+            return out;
+        }
+    }
+
+    for (size_t s = 0; s < out->section_count; ++s) {
+        LSC_ASM_SECTION *section = &out->sections[s];
+        section->words = calloc(section->count ? section->count : 1, sizeof(uint16_t));
+        section->flags = calloc(section->count ? section->count : 1, sizeof(uint8_t));
+        if (!section->words || !section->flags) {
+            lsc_asm_free(out);
+            return NULL;
+        }
+        // The first word is where the section is entered
+        section->flags[0] |= LSC_ASM_BLOCK;
+    }
+
+    state.pass = 2;
+    if (lsc_asm_pass(&state, source, size)) {
+        lsc_asm_mark_targets(out, &state);
+        for (size_t s = 0; s < out->section_count; ++s) {
+            // Only instructions start blocks, a label on data does not
+            for (uint32_t at = 0; at < out->sections[s].count; ++at) {
+                if (!(out->sections[s].flags[at] & LSC_ASM_INSTRUCTION)) {
+                    out->sections[s].flags[at] &= ~LSC_ASM_BLOCK;
+                }
+            }
+        }
+    }
+    free(state.targets);
+    return out;
+}
+
+LSC_ASM *lsc_asm_file(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+
+    size_t size = 0;
+    size_t capacity = 64 * 1024;
+    char *source = malloc(capacity);
+    size_t n;
+    while (source && (n = fread(source + size, 1, capacity - size, file)) > 0) {
+        size += n;
+        if (size == capacity) {
+            char *bigger = realloc(source, capacity * 2);
+            if (!bigger) {
+                free(source);
+                source = NULL;
+                break;
+            }
+            source = bigger;
+            capacity *= 2;
+        }
+    }
+    int failed = ferror(file);
+    fclose(file);
+    if (!source || failed) {
+        free(source);
+        return NULL;
+    }
+
+    LSC_ASM *out = lsc_asm_source(source, size);
+    free(source);
+    return out;
+}
+
+void lsc_asm_free(LSC_ASM *assembly) {
+    if (!assembly) {
+        return;
+    }
+    for (size_t s = 0; s < assembly->section_count; ++s) {
+        free(assembly->sections[s].words);
+        free(assembly->sections[s].flags);
+    }
+    for (size_t i = 0; i < assembly->symbol_count; ++i) {
+        free(assembly->symbols[i].name);
+    }
+    free(assembly->sections);
+    free(assembly->symbols);
+    free(assembly);
+}
+
+int lsc_asm_load(LSC_VM *vm, const LSC_ASM *assembly) {
+    for (size_t s = 0; s < assembly->section_count; ++s) {
+        const LSC_ASM_SECTION *section = &assembly->sections[s];
+        uint32_t stored = 0;
+        while (stored < section->count && lsc_mem_poke(vm, section->origin + stored, section->words[stored])) {
+            ++stored;
+        }
+        lsc_mem_invalidate(vm, section->origin, stored);
+        if (stored < section->count) {
+            return 0;
+        }
+    }
+
+    // Only once everything is in memory, so superinstructions see the words that follow them
+    for (size_t s = 0; s < assembly->section_count; ++s) {
+        const LSC_ASM_SECTION *section = &assembly->sections[s];
+        for (uint32_t at = 0; at < section->count; ++at) {
+            if (section->flags[at] & LSC_ASM_INSTRUCTION) {
+                lsc_decode(vm, section->origin + at);
+            }
+        }
+    }
+    return 1;
+}
+
+static void lsc_asm_put16(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void lsc_asm_put32(uint8_t *p, uint32_t v) {
+    lsc_asm_put16(p, v & 0xFFFF);
+    lsc_asm_put16(p + 2, v >> 16);
+}
+
+int lsc_asm_write_obj(const LSC_ASM *assembly, const char *path) {
+    if (assembly->section_count != 1) {
+        return 0;
+    }
+    const LSC_ASM_SECTION *section = &assembly->sections[0];
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        return 0;
+    }
+
+    // Big-endian, origin first
+    uint8_t word[2] = {section->origin >> 8, section->origin & 0xFF};
+    fwrite(word, 1, sizeof(word), file);
+    for (uint32_t at = 0; at < section->count; ++at) {
+        word[0] = section->words[at] >> 8;
+        word[1] = section->words[at] & 0xFF;
+        fwrite(word, 1, sizeof(word), file);
+    }
+    int failed = ferror(file);
+    return fclose(file) == 0 && !failed;
+}
+
+static void lsc_asm_pad(FILE *file, size_t written) {
+    static const uint8_t zeros[4];
+    fwrite(zeros, 1, (4 - written % 4) % 4, file);
+}
+
+int lsc_asm_write_image(const LSC_ASM *assembly, const char *path) {
+    // The decoded entries come from a VM of its own with the program loaded, so they are exactly what it would decode
+    LSC_VM *vm = lsc_vm_create();
+    if (!vm) {
+        return 0;
+    }
+    FILE *file = lsc_asm_load(vm, assembly) ? fopen(path, "wb") : NULL;
+    if (!file) {
+        lsc_vm_destroy(vm);
+        return 0;
+    }
+
+    uint8_t header[16] = "LSCIMG1";
+    lsc_asm_put32(header + 8, assembly->section_count);
+    lsc_asm_put32(header + 12, assembly->symbol_count);
+    fwrite(header, 1, sizeof(header), file);
+
+    for (size_t s = 0; s < assembly->section_count; ++s) {
+        const LSC_ASM_SECTION *section = &assembly->sections[s];
+        uint8_t bytes[8] = {0};
+        lsc_asm_put16(bytes, section->origin);
+        lsc_asm_put32(bytes + 4, section->count);
+        fwrite(bytes, 1, sizeof(bytes), file);
+
+        for (uint32_t at = 0; at < section->count; ++at) {
+            lsc_asm_put16(bytes, lsc_mem_peek(vm, section->origin + at));
+            fwrite(bytes, 1, 2, file);
+        }
+        for (uint32_t at = 0; at < section->count; ++at) {
+            LSC_DECODED d = *lsc_decoded(vm, section->origin + at);
+            // Whatever follows the section may be different when it is loaded, so no superinstruction runs past it
+            if (d.op >= LSC_OP_FUSED_FIRST && d.op < LSC_OP_DECODE && at + lsc_fuse_length(d.op) > section->count) {
+                d.op = d.base;
+            }
+            uint8_t entry[8] = {d.op, d.dr, d.sr1, d.sr2, 0, 0, d.base, 0};
+            lsc_asm_put16(entry + 4, d.imm);
+            fwrite(entry, 1, sizeof(entry), file);
+        }
+        fwrite(section->flags, 1, section->count, file);
+        lsc_asm_pad(file, section->count * 11);
+    }
+
+    for (size_t i = 0; i < assembly->symbol_count; ++i) {
+        uint8_t bytes[4];
+        size_t length = strlen(assembly->symbols[i].name);
+        lsc_asm_put16(bytes, assembly->symbols[i].address);
+        lsc_asm_put16(bytes + 2, length);
+        fwrite(bytes, 1, sizeof(bytes), file);
+        fwrite(assembly->symbols[i].name, 1, length, file);
+        lsc_asm_pad(file, length);
+    }
+
+    lsc_vm_destroy(vm);
+    int failed = ferror(file);
+    return fclose(file) == 0 && !failed;
+}
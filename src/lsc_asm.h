@@ -0,0 +1,77 @@
+#ifndef LSC_ASM_H
+#define LSC_ASM_H
+
+#include "lsc_vm.h"
+
+/*
+Assembler
+
+lsc_vm prog.asm                   assemble and run, no .obj in between
+lsc_vm --asm=prog.obj prog.asm    write a standard image
+lsc_vm --asm=prog.lsx prog.asm    write an extended image (any name not ending in .obj)
+
+The usual LC-3 assembly, as in the example above LSC_PC_START:
+- one instruction or directive per line, optionally after a label (a trailing colon is allowed), ; starts a comment
+- every opcode, BR with any of n, z and p, RET, JSRR, and the trap names GETC, OUT, PUTS, IN, PUTSP, HALT, BLKIN, BLKOUT
+- .ORIG, .FILL (a number or a label), .BLKW, .STRINGZ (with \n, \t, \r, \0, \\ and \" escapes), .END
+- numbers as #decimal, xhex or plain decimal, - allowed after the prefix
+Opcodes and register names are not case sensitive, labels are. Each .ORIG starts a section that runs to its .END, and a
+file may have several (a standard image only holds one).
+
+Extended image format (all numbers little-endian):
+- "LSCIMG1\0", then the section count and the symbol count (32 bits each)
+- per section: origin (16 bits), 16 bits of zero, word count (32 bits), then the words, one LSC_DECODED entry per word
+  (8 bytes: op, dr, sr1, sr2, imm (16 bits), base, 0), one flag byte per word (LSC_ASM_INSTRUCTION, LSC_ASM_BLOCK), and
+  zeros up to a multiple of 4 bytes
+- per symbol: address (16 bits), name length (16 bits), the name, zeros up to a multiple of 4 bytes
+
+lsc_vm_load reads either kind. From an extended image it also takes the predecoded entries (superinstructions
+included), so nothing is decoded when the program starts. Words that are not instructions are left undecoded, unless a
+superinstruction before them had to look at them. The flags and symbols are for tools: which words the assembler put
+instructions in, and where basic blocks start (labels, branch and JSR targets, and whatever follows a branch, jump or
+TRAP).
+*/
+
+enum {
+    LSC_ASM_INSTRUCTION = 1 << 0, // The word is an instruction, not .FILL/.BLKW/.STRINGZ data
+    LSC_ASM_BLOCK = 1 << 1, // A basic block starts at it
+};
+
+typedef struct {
+    uint16_t origin;
+    uint32_t count;
+    uint16_t *words;
+    uint8_t *flags; // LSC_ASM_INSTRUCTION and LSC_ASM_BLOCK, one per word
+} LSC_ASM_SECTION;
+
+typedef struct {
+    char *name;
+    uint16_t address;
+} LSC_ASM_SYMBOL;
+
+typedef struct {
+    LSC_ASM_SECTION *sections;
+    size_t section_count;
+    LSC_ASM_SYMBOL *symbols;
+    size_t symbol_count;
+    char error[256]; // Empty when it assembled, otherwise "line N: what is wrong". Nothing else is filled in then.
+} LSC_ASM;
+
+// Assemble size bytes of source text. Returns NULL when out of memory.
+LSC_ASM *lsc_asm_source(const char *source, size_t size);
+
+// Assemble the file at path. Returns NULL if it cannot be read or when out of memory.
+LSC_ASM *lsc_asm_file(const char *path);
+
+void lsc_asm_free(LSC_ASM *assembly);
+
+// Put every section into memory and decode its instructions, like loading the extended image would. Returns 0 when out of memory.
+int lsc_asm_load(LSC_VM *vm, const LSC_ASM *assembly);
+
+// Write a standard image. Returns 0 if path cannot be written, or there is not exactly one section.
+int lsc_asm_write_obj(const LSC_ASM *assembly, const char *path);
+
+// Write an extended image. Returns 0 if path cannot be written or when out of memory.
+int lsc_asm_write_image(const LSC_ASM *assembly, const char *path);
+
+#endif
@@ -0,0 +1,497 @@
+#include "lsc_batch.h"
+#include "lsc_dispatch.h"
+#include "lsc_lanes.h"
+#include "lsc_snapshot.h"
+#include "lsc_vm.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    char **images;
+    int image_count;
+
+    // Filled in by whichever worker ran the job
+    int status; // LSC_VM_HALTED, LSC_VM_BUDGET_EXHAUSTED and so on
+    const char *load_failed; // The image that could not be loaded, NULL if they all loaded
+    int ran; // 0 if no worker had a VM to run it in
+    uint64_t cycles;
+    LSC_OUTPUT output;
+} LSC_BATCH_JOB;
+
+/*
+A worker's deque of job indices, jobs[top] to jobs[bottom - 1].
+
+Jobs never create more jobs, so a deque only ever shrinks and a fixed array is enough. A mutex per deque is plenty: a
+lock is taken once per job, and a job is a whole VM run.
+*/
+typedef struct {
+    pthread_mutex_t lock;
+    int *jobs;
+    int top;
+    int bottom;
+} LSC_DEQUE;
+
+typedef struct LSC_BATCH LSC_BATCH;
+
+typedef struct {
+    LSC_BATCH *batch;
+    int id;
+    pthread_t thread;
+    LSC_DEQUE deque;
+    uint32_t rng; // Picks steal victims
+    int steals;
+    LSC_ARENA output; // The output of every job this worker ran, kept until it has been printed
+} LSC_WORKER;
+
+struct LSC_BATCH {
+    LSC_BATCH_JOB *jobs;
+    int job_count;
+    LSC_WORKER *workers;
+    int worker_count;
+    int engine;
+    uint64_t max_cycles;
+    LSC_METRICS *metrics; // NULL unless counting
+};
+
+static double lsc_batch_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Owner end: newest job first
+static int lsc_deque_pop(LSC_DEQUE *q) {
+    int job = -1;
+    pthread_mutex_lock(&q->lock);
+    if (q->top < q->bottom) {
+        job = q->jobs[--q->bottom];
+    }
+    pthread_mutex_unlock(&q->lock);
+    return job;
+}
+
+// Thief end: oldest job first, so a thief and the owner rarely want the same job
+static int lsc_deque_steal(LSC_DEQUE *q) {
+    int job = -1;
+    pthread_mutex_lock(&q->lock);
+    if (q->top < q->bottom) {
+        job = q->jobs[q->top++];
+    }
+    pthread_mutex_unlock(&q->lock);
+    return job;
+}
+
+static int lsc_worker_next(LSC_WORKER *w) {
+    int job = lsc_deque_pop(&w->deque);
+    if (job >= 0) {
+        return job;
+    }
+
+    // Try every other worker once, starting somewhere random so thieves spread out
+    LSC_BATCH *batch = w->batch;
+    w->rng = w->rng * 1103515245 + 12345;
+    int start = (w->rng >> 16) % batch->worker_count;
+    for (int i = 0; i < batch->worker_count; ++i) {
+        LSC_WORKER *victim = &batch->workers[(start + i) % batch->worker_count];
+        if (victim == w) {
+            continue;
+        }
+        job = lsc_deque_steal(&victim->deque);
+        if (job >= 0) {
+            ++w->steals;
+            return job;
+        }
+    }
+
+    // Nothing left anywhere, and nothing new will turn up
+    return -1;
+}
+
+// Does job load the same base images (all but its last image) as base_job?
+static int lsc_batch_same_base(const LSC_BATCH_JOB *job, const LSC_BATCH_JOB *base_job) {
+    if (!base_job || job->image_count != base_job->image_count) {
+        return 0;
+    }
+    for (int i = 0; i < job->image_count - 1; ++i) {
+        if (strcmp(job->images[i], base_job->images[i]) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+Jobs usually share their first images (trap handlers, libraries) and differ in the last one. The machine with just the
+base images loaded is kept as a snapshot, so the next job with the same base restores it, which only maps back the pages
+the last job wrote, and loads nothing but its own last image. Anything else gets lsc_vm_clear, which hands everything the
+last program allocated back to the VM's arena at once.
+*/
+typedef struct {
+    LSC_SNAPSHOT *snap;
+    const LSC_BATCH_JOB *job;
+} LSC_BATCH_BASE;
+
+// Get vm ready to run job. Returns 0, with job->load_failed set, if one of its images could not be loaded.
+static int lsc_worker_load(LSC_VM *vm, LSC_BATCH_JOB *job, LSC_BATCH_BASE *base) {
+    LSC_METRICS_COUNTERS *counters = vm->metrics;
+
+    if (lsc_batch_same_base(job, base->job)) {
+        lsc_snapshot_restore(vm, base->snap);
+    } else {
+        lsc_snapshot_release(base->snap);
+        base->snap = NULL;
+        base->job = NULL;
+
+        lsc_vm_clear(vm);
+        for (int i = 0; i < job->image_count - 1; ++i) {
+            if (!lsc_vm_load(vm, job->images[i])) {
+                job->load_failed = job->images[i];
+                break;
+            }
+        }
+        if (job->load_failed) {
+            if (counters) {
+                lsc_metrics_add(&counters->load_failures, 1);
+            }
+            return 0;
+        }
+
+        // Out of memory only costs the next job the reload
+        base->snap = lsc_snapshot_take(vm);
+        base->job = base->snap ? job : NULL;
+    }
+
+    const char *last = job->images[job->image_count - 1];
+    if (!lsc_vm_load(vm, last)) {
+        job->load_failed = last;
+        if (counters) {
+            lsc_metrics_add(&counters->load_failures, 1);
+        }
+        return 0;
+    }
+
+    // Jobs have no keyboard, GETC reads end of input
+    lsc_vm_input_end(vm);
+    return 1;
+}
+
+// Keep what job's run left in vm
+static void lsc_worker_finish(LSC_WORKER *w, LSC_VM *vm, LSC_BATCH_JOB *job, int status) {
+    job->ran = 1;
+    job->status = status;
+    job->cycles = vm->cycles;
+    if (vm->metrics) {
+        lsc_metrics_add(&vm->metrics->jobs[status], 1);
+    }
+
+    // The VM keeps its buffer for the next job. Out of memory only loses this job's output.
+    job->output.data = vm->output.len ? lsc_arena_alloc(&w->output, vm->output.len) : NULL;
+    if (job->output.data) {
+        memcpy(job->output.data, vm->output.data, vm->output.len);
+        job->output.len = job->output.cap = vm->output.len;
+    }
+    vm->output.len = 0;
+}
+
+// A VM for one of w's jobs, or NULL if out of memory
+static LSC_VM *lsc_worker_vm(LSC_WORKER *w) {
+    LSC_VM *vm = lsc_vm_create();
+    if (vm) {
+        vm->engine = w->batch->engine;
+        vm->metrics = w->batch->metrics ? lsc_metrics_worker(w->batch->metrics, w->id) : NULL;
+    }
+    return vm;
+}
+
+// Run jobs in vm one at a time until there are none left anywhere
+static void lsc_worker_run(LSC_WORKER *w, LSC_VM *vm) {
+    LSC_BATCH *batch = w->batch;
+    LSC_BATCH_BASE base = {NULL, NULL};
+    int index;
+    while ((index = lsc_worker_next(w)) >= 0) {
+        LSC_BATCH_JOB *job = &batch->jobs[index];
+        if (lsc_worker_load(vm, job, &base)) {
+            lsc_worker_finish(w, vm, job, lsc_vm_run(vm, batch->max_cycles));
+        }
+    }
+    lsc_snapshot_release(base.snap);
+}
+
+/*
+One VM per worker, reused for every job rather than created for each one. A worker that cannot get one takes no jobs,
+and the others steal its deque empty. If none of them could, lsc_batch_main reports the jobs as not run.
+*/
+static void *lsc_worker_main(void *arg) {
+    LSC_WORKER *w = arg;
+    LSC_VM *vm = lsc_worker_vm(w);
+    if (vm) {
+        lsc_worker_run(w, vm);
+        lsc_vm_destroy(vm);
+    }
+    return NULL;
+}
+
+/*
+With --lanes a worker keeps LSC_LANE_COUNT VMs, loads that many jobs at once and runs them as one group (see
+lsc_lanes.h). Jobs next to each other in the deque are usually the same program, which is what makes a good group.
+Short of memory for a whole group it runs one job at a time instead, as lsc_worker_main does.
+*/
+static void *lsc_worker_lanes_main(void *arg) {
+    LSC_WORKER *w = arg;
+    LSC_BATCH *batch = w->batch;
+
+    LSC_LANES *lanes = lsc_lanes_create();
+    LSC_VM *vms[LSC_LANE_COUNT] = {0};
+    // Without the lanes to run a group in, one VM is all it can use
+    int wanted = lanes ? LSC_LANE_COUNT : 1;
+    int created = 0;
+    while (created < wanted && (vms[created] = lsc_worker_vm(w))) {
+        ++created;
+    }
+
+    if (created == LSC_LANE_COUNT) {
+        LSC_BATCH_BASE base = {NULL, NULL};
+        LSC_BATCH_JOB *jobs[LSC_LANE_COUNT];
+        int status[LSC_LANE_COUNT];
+        int more = 1;
+        while (more) {
+            int count = 0;
+            while (count < LSC_LANE_COUNT) {
+                int index = lsc_worker_next(w);
+                if (index < 0) {
+                    more = 0;
+                    break;
+                }
+                jobs[count] = &batch->jobs[index];
+                count += lsc_worker_load(vms[count], jobs[count], &base);
+            }
+
+            lsc_lanes_run(lanes, vms, count, batch->max_cycles, status);
+            for (int i = 0; i < count; ++i) {
+                lsc_worker_finish(w, vms[i], jobs[i], status[i]);
+            }
+        }
+        lsc_snapshot_release(base.snap);
+    } else if (created > 0) {
+        lsc_worker_run(w, vms[0]);
+    }
+
+    for (int i = 0; i < created; ++i) {
+        lsc_vm_destroy(vms[i]);
+    }
+    lsc_lanes_free(lanes);
+    return NULL;
+}
+
+int lsc_batch_read(const char *jobs_path, LSC_BATCH_IMAGES **jobs, int *job_count) {
+    *jobs = NULL;
+    *job_count = 0;
+    FILE *file = fopen(jobs_path, "r");
+    if (!file) {
+        return 0;
+    }
+
+    int cap = 0;
+    char *line = NULL;
+    size_t line_cap = 0;
+    int ok = 1;
+
+    while (ok && getline(&line, &line_cap, file) != -1) {
+        LSC_BATCH_IMAGES job;
+        memset(&job, 0, sizeof(job));
+        int image_cap = 0;
+
+        char *save;
+        for (char *image = strtok_r(line, " \t\r\n", &save); image; image = strtok_r(NULL, " \t\r\n", &save)) {
+            if (job.image_count == 0 && image[0] == '#') {
+                break;
+            }
+            if (job.image_count == image_cap) {
+                int grown_cap = image_cap ? image_cap * 2 : 4;
+                char **grown = realloc(job.images, grown_cap * sizeof(char *));
+                if (!grown) {
+                    ok = 0;
+                    break;
+                }
+                job.images = grown;
+                image_cap = grown_cap;
+            }
+            job.images[job.image_count] = strdup(image);
+            if (!job.images[job.image_count]) {
+                ok = 0;
+                break;
+            }
+            ++job.image_count;
+        }
+
+        if (ok && job.image_count > 0 && *job_count == cap) {
+            int grown_cap = cap ? cap * 2 : 64;
+            LSC_BATCH_IMAGES *grown = realloc(*jobs, grown_cap * sizeof(LSC_BATCH_IMAGES));
+            if (grown) {
+                *jobs = grown;
+                cap = grown_cap;
+            } else {
+                ok = 0;
+            }
+        }
+
+        if (!ok || job.image_count == 0) {
+            for (int i = 0; i < job.image_count; ++i) {
+                free(job.images[i]);
+            }
+            free(job.images);
+            continue;
+        }
+        (*jobs)[(*job_count)++] = job;
+    }
+
+    // getline also stops short of the end when the read fails, or it cannot grow the line
+    int result = !ok ? -1 : feof(file) ? 1 : ferror(file) ? 0 : -1;
+    free(line);
+    fclose(file);
+    if (result <= 0) {
+        lsc_batch_free(*jobs, *job_count);
+        *jobs = NULL;
+        *job_count = 0;
+    }
+    return result;
+}
+
+void lsc_batch_free(LSC_BATCH_IMAGES *jobs, int job_count) {
+    for (int j = 0; j < job_count; ++j) {
+        for (int i = 0; i < jobs[j].image_count; ++i) {
+            free(jobs[j].images[i]);
+        }
+        free(jobs[j].images);
+    }
+    free(jobs);
+}
+
+int lsc_batch_main(const char *jobs_path, int workers, int engine, uint64_t max_cycles, int lanes,
+    LSC_METRICS *metrics) {
+    LSC_BATCH batch;
+    memset(&batch, 0, sizeof(batch));
+    batch.engine = engine;
+    batch.max_cycles = max_cycles;
+    batch.metrics = metrics;
+
+    LSC_BATCH_IMAGES *images;
+    int read = lsc_batch_read(jobs_path, &images, &batch.job_count);
+    if (read <= 0) {
+        if (read < 0) {
+            printf("out of memory\n");
+        } else {
+            printf("failed to read jobs: %s\n", jobs_path);
+        }
+        return 1;
+    }
+    batch.jobs = calloc(batch.job_count ? batch.job_count : 1, sizeof(LSC_BATCH_JOB));
+    if (!batch.jobs) {
+        printf("out of memory\n");
+        lsc_batch_free(images, batch.job_count);
+        return 1;
+    }
+    for (int j = 0; j < batch.job_count; ++j) {
+        batch.jobs[j].images = images[j].images;
+        batch.jobs[j].image_count = images[j].image_count;
+    }
+
+    if (workers < 1) {
+        workers = 1;
+    }
+    // More workers than jobs would only have threads with nothing to do
+    if (batch.job_count > 0 && workers > batch.job_count) {
+        workers = batch.job_count;
+    }
+    batch.worker_count = workers;
+    batch.workers = calloc(workers, sizeof(LSC_WORKER));
+    int allocated = batch.workers != NULL;
+    for (int i = 0; allocated && i < workers; ++i) {
+        batch.workers[i].deque.jobs = malloc((batch.job_count / workers + 1) * sizeof(int));
+        allocated = batch.workers[i].deque.jobs != NULL;
+    }
+    if (!allocated) {
+        printf("out of memory\n");
+        for (int i = 0; batch.workers && i < workers; ++i) {
+            free(batch.workers[i].deque.jobs);
+        }
+        free(batch.workers);
+        free(batch.jobs);
+        lsc_batch_free(images, batch.job_count);
+        return 1;
+    }
+
+    // Deal the jobs out round-robin, stealing evens things out from there
+    for (int i = 0; i < workers; ++i) {
+        LSC_WORKER *w = &batch.workers[i];
+        w->batch = &batch;
+        w->id = i;
+        w->rng = 0x9E3779B9u * (i + 1);
+        pthread_mutex_init(&w->deque.lock, NULL);
+    }
+    for (int j = 0; j < batch.job_count; ++j) {
+        LSC_DEQUE *q = &batch.workers[j % workers].deque;
+        q->jobs[q->bottom++] = j;
+    }
+
+    double start = lsc_batch_now();
+    for (int i = 0; i < workers; ++i) {
+        pthread_create(&batch.workers[i].thread, NULL, lanes ? lsc_worker_lanes_main : lsc_worker_main,
+            &batch.workers[i]);
+    }
+    for (int i = 0; i < workers; ++i) {
+        pthread_join(batch.workers[i].thread, NULL);
+    }
+    double seconds = lsc_batch_now() - start;
+
+    // Only now does anything touch stdout
+    int exit_code = 0;
+    uint64_t cycles = 0;
+    int steals = 0;
+
+    for (int j = 0; j < batch.job_count; ++j) {
+        LSC_BATCH_JOB *job = &batch.jobs[j];
+
+        printf("== job %d:", j + 1);
+        for (int i = 0; i < job->image_count; ++i) {
+            printf(" %s", job->images[i]);
+        }
+
+        if (job->load_failed) {
+            printf(" (failed to load image: %s)\n", job->load_failed);
+            exit_code = 1;
+        } else if (!job->ran) {
+            printf(" (not run: out of memory)\n");
+            exit_code = 1;
+        } else {
+            printf(" (%s, %llu cycles)\n",
+                lsc_vm_status_name(job->status),
+                (unsigned long long)job->cycles);
+            fwrite(job->output.data, 1, job->output.len, stdout);
+            if (job->output.len && job->output.data[job->output.len - 1] != '\n') {
+                putchar('\n');
+            }
+        }
+        cycles += job->cycles;
+    }
+    lsc_batch_free(images, batch.job_count);
+
+    for (int i = 0; i < workers; ++i) {
+        steals += batch.workers[i].steals;
+        lsc_arena_free(&batch.workers[i].output);
+        pthread_mutex_destroy(&batch.workers[i].deque.lock);
+        free(batch.workers[i].deque.jobs);
+    }
+
+    printf("batch: %d jobs, %d workers (%s%s), %d steals, %.4f seconds, %.2f jobs/sec, %.2f MIPS\n",
+        batch.job_count, workers, lanes ? "lanes, " : "", lsc_dispatch_name(engine), steals, seconds,
+        batch.job_count / seconds, cycles / seconds / 1e6);
+
+    free(batch.jobs);
+    free(batch.workers);
+    return exit_code;
+}
@@ -0,0 +1,54 @@
+#ifndef LSC_BATCH_H
+#define LSC_BATCH_H
+
+#include <stdint.h>
+
+#include "lsc_metrics.h"
+
+/*
+Batch mode
+
+lsc_vm --batch jobs.txt [--lanes] -j N
+
+jobs.txt holds one job per line: the image files to load for that job, separated by spaces (the same list the command
+line takes). Blank lines and lines starting with # are skipped.
+
+Every job runs in its own VM until it halts or has run max_cycles instructions. Jobs are spread over N worker threads
+using work stealing:
+- Each worker has its own deque of jobs and takes work from the bottom of it
+- A worker with an empty deque steals from the top of someone else's
+
+Job lengths vary by orders of magnitude, so handing out a fixed share up front would leave most workers idle while one
+grinds through the long jobs.
+
+Every job's console output goes into its own buffer. Nothing is printed until all workers are done, then the outputs
+are printed in job order followed by the aggregate jobs/sec.
+
+With lanes, each worker takes LSC_LANE_COUNT jobs at a time and runs them in lockstep (see lsc_lanes.h). The results are
+the same either way.
+
+With metrics (it may be NULL, see lsc_metrics.h), worker i counts into lsc_metrics_worker(metrics, i) while it runs, so
+it needs counters for at least as many workers.
+
+A worker that is out of memory for its VM leaves its jobs to the others. Jobs no worker could run are printed as not
+run.
+
+Returns the process exit code: 0, or 1 if any job's images could not be loaded or any job was not run.
+*/
+int lsc_batch_main(const char *jobs_path, int workers, int engine, uint64_t max_cycles, int lanes,
+    LSC_METRICS *metrics);
+
+// The image files of one job
+typedef struct {
+    char **images;
+    int image_count;
+} LSC_BATCH_IMAGES;
+
+/*
+Read a jobs file, for anything else that takes one (see lsc_diff.h): *jobs gets *job_count lists of images. Returns 1,
+0 if the file could not be read, or -1 if out of memory (nothing is kept either way). Free them with lsc_batch_free.
+*/
+int lsc_batch_read(const char *jobs_path, LSC_BATCH_IMAGES **jobs, int *job_count);
+void lsc_batch_free(LSC_BATCH_IMAGES *jobs, int job_count);
+
+#endif
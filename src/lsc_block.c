@@ -0,0 +1,133 @@
+#include "lsc_block.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct LSC_BLOCK {
+    uint8_t *data;
+    size_t words; // Whole words on the disk, an odd trailing byte is not one
+    int writable;
+    size_t mapped; // Bytes mmap'd by lsc_block_open, 0 for a wrapped buffer
+};
+
+LSC_BLOCK *lsc_block_wrap(void *data, size_t size, int writable) {
+    LSC_BLOCK *block = calloc(1, sizeof(LSC_BLOCK));
+    if (!block) {
+        return NULL;
+    }
+    block->data = data;
+    block->words = size / sizeof(uint16_t);
+    block->writable = writable;
+    return block;
+}
+
+LSC_BLOCK *lsc_block_open(const char *path) {
+    int writable = 1;
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        writable = 0;
+        fd = open(path, O_RDONLY);
+    }
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+
+    // An empty file is a disk with no blocks, there is nothing to map
+    void *data = NULL;
+    size_t size = (size_t)st.st_size;
+    if (size) {
+        data = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    }
+    // The mapping keeps the file open by itself
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    LSC_BLOCK *block = lsc_block_wrap(data, size, writable);
+    if (!block) {
+        if (size) {
+            munmap(data, size);
+        }
+        return NULL;
+    }
+    block->mapped = size;
+    return block;
+}
+
+void lsc_block_close(LSC_BLOCK *block) {
+    if (!block) {
+        return;
+    }
+    if (block->mapped) {
+        munmap(block->data, block->mapped);
+    }
+    free(block);
+}
+
+/*
+How many of the words a BLKIN/BLKOUT asked for can be copied: the disk, memory and the first device page after address
+all cut it short. offset is where on the disk it starts, in words.
+*/
+static size_t lsc_block_count(LSC_VM *vm, size_t offset) {
+    const LSC_BLOCK *block = vm->block;
+    uint16_t address = vm->reg[LSC_R_R0];
+    size_t count = vm->reg[LSC_R_R1];
+
+    if (offset >= block->words) {
+        return 0;
+    }
+    if (count > block->words - offset) {
+        count = block->words - offset;
+    }
+    if (count > (size_t)(LSC_MEMORY_MAX - address)) {
+        count = LSC_MEMORY_MAX - address;
+    }
+
+    // Copying bypasses lsc_mem_read/lsc_mem_write, so it must stay out of device registers
+    for (uint32_t a = address; a < address + count; a = (a | (LSC_PAGE_SIZE - 1)) + 1) {
+        if (vm->page_attr[a >> LSC_PAGE_SHIFT] & LSC_PAGE_DEVICE) {
+            count = a - address;
+            break;
+        }
+    }
+    return count;
+}
+
+void lsc_block_in(LSC_VM *vm) {
+    size_t count = 0;
+
+    if (vm->block) {
+        size_t offset = (size_t)vm->reg[LSC_R_R2] * LSC_BLOCK_WORDS;
+        count = lsc_block_count(vm, offset);
+        if (count) {
+            // Out of memory for the pages copies less, which R1 says
+            uint16_t address = vm->reg[LSC_R_R0];
+            count = lsc_mem_load(vm, address, vm->block->data + offset * sizeof(uint16_t), count);
+            lsc_mem_invalidate(vm, address, count);
+        }
+    }
+    vm->reg[LSC_R_R1] = count;
+}
+
+void lsc_block_out(LSC_VM *vm) {
+    size_t count = 0;
+
+    if (vm->block && vm->block->writable) {
+        size_t offset = (size_t)vm->reg[LSC_R_R2] * LSC_BLOCK_WORDS;
+        count = lsc_block_count(vm, offset);
+        if (count) {
+            lsc_mem_save(vm, vm->block->data + offset * sizeof(uint16_t), vm->reg[LSC_R_R0], count);
+        }
+    }
+    vm->reg[LSC_R_R1] = count;
+}
@@ -0,0 +1,40 @@
+#ifndef LSC_BLOCK_H
+#define LSC_BLOCK_H
+
+#include "lsc_vm.h"
+
+/*
+Block device
+
+lsc_vm --disk=data.bin image.obj
+
+A disk is a host file (or buffer) of big-endian words, the same byte order as images, which the program sees as blocks
+of LSC_BLOCK_WORDS words. Two traps move a whole range between it and memory in one go, instead of one GETC per
+character:
+- TRAP x26 (BLKIN): copy R1 words from the disk, starting at block R2, into memory starting at R0
+- TRAP x27 (BLKOUT): copy R1 words of memory starting at R0 onto the disk, starting at block R2
+
+Both leave the number of words actually copied in R1. That is fewer than asked at the end of the disk, the end of memory
+or a device's page (see LSC_DEVICE), and 0 without a disk or for BLKOUT to a read-only one.
+
+A file is mmap'd, so BLKIN swaps words straight from the page cache into memory and BLKOUT straight back into it, with no
+buffer in between and no system call per transfer. The kernel writes changed pages back to the file by itself.
+*/
+
+enum {
+    LSC_BLOCK_WORDS = 256, // Words per block, so block N starts at word N * 256 of the disk
+};
+
+// Open path as a disk, writable if the file allows it. Returns NULL if it cannot be opened or mapped.
+LSC_BLOCK *lsc_block_open(const char *path);
+
+// A host buffer of size bytes as a disk. data must be 2-byte aligned, and stays owned by the caller.
+LSC_BLOCK *lsc_block_wrap(void *data, size_t size, int writable);
+
+void lsc_block_close(LSC_BLOCK *block);
+
+// The BLKIN and BLKOUT traps, for vm->block
+void lsc_block_in(LSC_VM *vm);
+void lsc_block_out(LSC_VM *vm);
+
+#endif
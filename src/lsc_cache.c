@@ -0,0 +1,366 @@
+#include "lsc_cache.h"
+#include "lsc_dispatch.h"
+#include "lsc_jit.h"
+#include "lsc_metrics.h"
+#include "lsc_page.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+File format, in host byte order (a file is only ever read back by the build that wrote it):
+- LSC_CACHE_HEADER
+- the LSC_ANALYSIS
+- entry_count LSC_DECODED, one for each word the analysis found as code, in address order
+- block_count compiled blocks: an LSC_CACHE_BLOCK, the span words it was compiled from, its relocations and its code,
+  padded to 8 bytes
+*/
+typedef struct {
+    char magic[8];
+    uint32_t version; // LSC_CACHE_VERSION
+    uint32_t layout; // lsc_cache_layout() of the build that wrote it
+    uint64_t key;
+    uint32_t entry_count;
+    uint32_t block_count;
+    uint64_t checksum; // lsc_cache_hash of everything after the header
+} LSC_CACHE_HEADER;
+
+typedef struct {
+    uint16_t start;
+    uint16_t span;
+    uint16_t max_retired;
+    uint16_t reloc_count;
+    uint16_t size;
+    uint16_t reserved[3];
+} LSC_CACHE_BLOCK;
+
+static const char lsc_cache_magic[8] = "LSCCCH1";
+
+struct LSC_CACHE {
+    uint64_t key;
+    int hit; // lsc_cache_load put an entry back
+    char *path;
+
+    // From lsc_cache_keep
+    LSC_ANALYSIS *analysis;
+    LSC_DECODED *entries;
+    uint32_t entry_count;
+};
+
+// What has to match for a file's tables to mean the same thing here
+static uint32_t lsc_cache_layout(void) {
+    return (uint32_t)sizeof(LSC_DECODED) | LSC_OP_COUNT << 8 | LSC_FUSED_COUNT << 16 | LSC_HAVE_JIT << 24 |
+           (uint32_t)(sizeof(void *) == 8) << 25;
+}
+
+static const uint64_t lsc_cache_hash_seed = 14695981039346656037u;
+
+// Continues hash over size bytes, eight at a time (so pieces hashed one after another only give the same result as
+// hashing them at once when all but the last are a multiple of 8 long). Mixed after every step, so every bit of the input reaches every bit of
+// the result (a plain multiply would leave the low bits depending on the low bits alone).
+static uint64_t lsc_cache_hash(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+    for (; size > 0; bytes += 8, size = size > 8 ? size - 8 : 0) {
+        uint64_t chunk = 0;
+        memcpy(&chunk, bytes, size < 8 ? size : 8);
+        hash = (hash ^ chunk) * 0x9E3779B97F4A7C15u;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+// Everything the analysis and the decoded entries depend on. Pages nothing was loaded into are only counted, not hashed.
+static uint64_t lsc_cache_key(const LSC_VM *vm) {
+    uint64_t hash = lsc_cache_hash_seed;
+    for (uint32_t page = 0; page < LSC_PAGE_COUNT; ++page) {
+        uint32_t tag = page | (uint32_t)(vm->page_attr[page] & LSC_PAGE_DEVICE) << 8 | (vm->memory[page] == lsc_page_zero) << 16;
+        hash = lsc_cache_hash(hash, &tag, sizeof(tag));
+        if (vm->memory[page] != lsc_page_zero) {
+            hash = lsc_cache_hash(hash, vm->memory[page], LSC_PAGE_SIZE * sizeof(uint16_t));
+        }
+    }
+    uint32_t extra[] = {vm->reg[LSC_R_PC], (uint32_t)vm->fuse, LSC_CACHE_VERSION, lsc_cache_layout()};
+    return lsc_cache_hash(hash, extra, sizeof(extra));
+}
+
+static size_t lsc_cache_pad(size_t size) {
+    return (size + 7) & ~(size_t)7;
+}
+
+LSC_CACHE *lsc_cache_open(const LSC_VM *vm, const char *dir) {
+    LSC_CACHE *cache = calloc(1, sizeof(LSC_CACHE));
+    size_t path_size = strlen(dir) + 24;
+    char *path = malloc(path_size);
+    if (!cache || !path) {
+        free(cache);
+        free(path);
+        return NULL;
+    }
+    cache->key = lsc_cache_key(vm);
+    snprintf(path, path_size, "%s/%016llx.lsc", dir, (unsigned long long)cache->key);
+    cache->path = path;
+    return cache;
+}
+
+// Whether the analysis from a file is one lsc_analyze could have made, with count words of code
+static int lsc_cache_analysis_ok(const LSC_ANALYSIS *analysis, uint32_t count) {
+    uint32_t code = 0;
+    for (uint32_t a = 0; a < LSC_MEMORY_MAX; ++a) {
+        if (analysis->code[a] > 1 || analysis->leader[a] > 1) {
+            return 0;
+        }
+        code += analysis->code[a];
+    }
+    for (uint32_t page = 0; page < LSC_PAGE_COUNT; ++page) {
+        if (analysis->page_class[page] >= LSC_PAGE_CLASS_COUNT) {
+            return 0;
+        }
+    }
+    return code == count;
+}
+
+// Put back every block that fits in the file and was compiled from what memory holds now
+static void lsc_cache_install_blocks(LSC_VM *vm, const uint8_t *at, const uint8_t *end, uint32_t block_count) {
+    for (uint32_t b = 0; b < block_count; ++b) {
+        LSC_CACHE_BLOCK record;
+        if ((size_t)(end - at) < sizeof(record)) {
+            return;
+        }
+        memcpy(&record, at, sizeof(record));
+        const uint16_t *words = (const uint16_t *)(const void *)(at + sizeof(record));
+        const uint16_t *relocs = words + record.span;
+        const uint8_t *code = (const uint8_t *)(relocs + record.reloc_count);
+        size_t length = lsc_cache_pad(sizeof(record) + ((size_t)record.span + record.reloc_count) * 2 + record.size);
+        if ((size_t)(end - at) < length) {
+            return;
+        }
+        at += length;
+
+        if ((uint32_t)record.start + record.span > LSC_MEMORY_MAX) {
+            continue;
+        }
+        int same = 1;
+        for (uint16_t i = 0; i < record.span && same; ++i) {
+            same = lsc_mem_peek(vm, record.start + i) == words[i];
+        }
+        if (same) {
+            LSC_JIT_CODE block = {record.start, record.span, record.max_retired, record.reloc_count, record.size, code, relocs};
+            lsc_jit_install(vm, &block);
+        }
+    }
+}
+
+// Copy the analysis, and the entries for what it found from entries (in address order) or else from vm
+static int lsc_cache_note(LSC_CACHE *cache, const LSC_ANALYSIS *analysis, const LSC_DECODED *entries, const LSC_VM *vm) {
+    uint32_t count = 0;
+    for (uint32_t a = 0; a < LSC_MEMORY_MAX; ++a) {
+        count += analysis->code[a] != 0;
+    }
+    free(cache->analysis);
+    free(cache->entries);
+    cache->analysis = malloc(sizeof(LSC_ANALYSIS));
+    cache->entries = malloc((count ? count : 1) * sizeof(LSC_DECODED));
+    cache->entry_count = count;
+    if (!cache->analysis || !cache->entries) {
+        free(cache->analysis);
+        free(cache->entries);
+        cache->analysis = NULL;
+        cache->entries = NULL;
+        return 0;
+    }
+
+    memcpy(cache->analysis, analysis, sizeof(LSC_ANALYSIS));
+    if (entries) {
+        memcpy(cache->entries, entries, count * sizeof(LSC_DECODED));
+        return 1;
+    }
+    uint32_t e = 0;
+    for (uint32_t a = 0; a < LSC_MEMORY_MAX; ++a) {
+        if (analysis->code[a]) {
+            // Marked for lsc_decode_put to leave out, if something made it undecoded again already
+            cache->entries[e++] = *lsc_decoded(vm, a);
+        }
+    }
+    return 1;
+}
+
+// lsc_cache_load, without counting the hit or miss
+static LSC_ANALYSIS *lsc_cache_read(LSC_CACHE *cache, LSC_VM *vm) {
+    int fd = open(cache->path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    size_t minimum = sizeof(LSC_CACHE_HEADER) + sizeof(LSC_ANALYSIS);
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < minimum) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)st.st_size;
+    const uint8_t *file = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) {
+        return NULL;
+    }
+
+    LSC_CACHE_HEADER header;
+    memcpy(&header, file, sizeof(header));
+    const uint8_t *at = file + sizeof(header);
+    const LSC_DECODED *entries = (const LSC_DECODED *)(const void *)(at + sizeof(LSC_ANALYSIS));
+    size_t entries_end = minimum + (size_t)header.entry_count * sizeof(LSC_DECODED);
+
+    LSC_ANALYSIS *analysis = NULL;
+    if (memcmp(header.magic, lsc_cache_magic, sizeof(header.magic)) == 0 && header.version == LSC_CACHE_VERSION &&
+        header.layout == lsc_cache_layout() && header.key == cache->key && header.entry_count <= LSC_MEMORY_MAX &&
+        entries_end <= size && lsc_cache_hash(lsc_cache_hash_seed, at, size - sizeof(header)) == header.checksum &&
+        lsc_cache_analysis_ok((const LSC_ANALYSIS *)(const void *)at, header.entry_count)) {
+        analysis = malloc(sizeof(LSC_ANALYSIS));
+    }
+    if (!analysis) {
+        munmap((void *)file, size);
+        return NULL;
+    }
+    memcpy(analysis, at, sizeof(LSC_ANALYSIS));
+
+    // Noted again, in case this run compiles more and the entry is written back
+    if (!lsc_cache_note(cache, analysis, entries, vm)) {
+        munmap((void *)file, size);
+        free(analysis);
+        return NULL;
+    }
+
+    uint32_t e = 0;
+    for (uint32_t a = 0; a < LSC_MEMORY_MAX; ++a) {
+        if (analysis->code[a]) {
+            LSC_DECODED entry = entries[e++];
+            if (lsc_decoded(vm, a)->op == LSC_OP_DECODE) {
+                lsc_decode_put(vm, a, entry);
+            }
+        }
+    }
+    lsc_decode_trim_fused(vm, 0, LSC_MEMORY_MAX);
+
+    // Native code is no use to the other engines, and would only make stores to it slower
+    if (vm->engine == LSC_DISPATCH_JIT && !vm->profile && !vm->trace) {
+        lsc_cache_install_blocks(vm, file + entries_end, file + size, header.block_count);
+    }
+
+    munmap((void *)file, size);
+    cache->hit = 1;
+    return analysis;
+}
+
+LSC_ANALYSIS *lsc_cache_load(LSC_CACHE *cache, LSC_VM *vm) {
+    LSC_ANALYSIS *analysis = lsc_cache_read(cache, vm);
+    if (vm->metrics) {
+        lsc_metrics_add(analysis ? &vm->metrics->cache_hits : &vm->metrics->cache_misses, 1);
+    }
+    return analysis;
+}
+
+int lsc_cache_keep(LSC_CACHE *cache, const LSC_VM *vm, const LSC_ANALYSIS *analysis) {
+    return lsc_cache_note(cache, analysis, NULL, vm);
+}
+
+// Write size bytes, adding them to the checksum
+static int lsc_cache_put(FILE *file, uint64_t *checksum, const void *data, size_t size) {
+    *checksum = lsc_cache_hash(*checksum, data, size);
+    return fwrite(data, 1, size, file) == size;
+}
+
+// Each block goes out as one piece, the way lsc_cache_install_blocks reads it
+static int lsc_cache_write_blocks(FILE *file, uint64_t *checksum, const LSC_VM *vm) {
+    for (uint32_t start = 0; start < LSC_MEMORY_MAX; ++start) {
+        LSC_JIT_CODE block;
+        if (!lsc_jit_block(vm, start, &block)) {
+            continue;
+        }
+        LSC_CACHE_BLOCK record = {block.start, block.span, block.max_retired, block.reloc_count, block.size, {0}};
+        size_t length = lsc_cache_pad(sizeof(record) + ((size_t)block.span + block.reloc_count) * 2 + block.size);
+        uint8_t *piece = calloc(1, length);
+        if (!piece) {
+            return 0;
+        }
+        memcpy(piece, &record, sizeof(record));
+        uint16_t *words = (uint16_t *)(void *)(piece + sizeof(record));
+        for (uint16_t i = 0; i < block.span; ++i) {
+            words[i] = lsc_mem_peek(vm, block.start + i);
+        }
+        memcpy(words + block.span, block.relocs, block.reloc_count * sizeof(uint16_t));
+        memcpy((uint8_t *)(words + block.span + block.reloc_count), block.code, block.size);
+        int ok = lsc_cache_put(file, checksum, piece, length);
+        free(piece);
+        if (!ok) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int lsc_cache_write(const LSC_CACHE *cache, const LSC_VM *vm) {
+    if (!cache->analysis || (cache->hit && lsc_jit_compiled(vm) == 0)) {
+        return 1;
+    }
+
+    LSC_CACHE_HEADER header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, lsc_cache_magic, sizeof(header.magic));
+    header.version = LSC_CACHE_VERSION;
+    header.layout = lsc_cache_layout();
+    header.key = cache->key;
+    header.entry_count = cache->entry_count;
+    for (uint32_t start = 0; start < LSC_MEMORY_MAX; ++start) {
+        LSC_JIT_CODE block;
+        header.block_count += (uint32_t)lsc_jit_block(vm, start, &block);
+    }
+
+    // Cut at the last slash for the directory, which may be there already (and if it cannot be made, fopen says so)
+    size_t path_length = strlen(cache->path);
+    char *temporary = malloc(path_length + 32);
+    if (!temporary) {
+        return 0;
+    }
+    memcpy(temporary, cache->path, path_length + 1);
+    *strrchr(temporary, '/') = 0;
+    mkdir(temporary, 0777);
+
+    snprintf(temporary, path_length + 32, "%s.%ld.tmp", cache->path, (long)getpid());
+    FILE *file = fopen(temporary, "wb");
+    if (!file) {
+        free(temporary);
+        return 0;
+    }
+    // The header goes in again at the end, once the checksum is known
+    header.checksum = lsc_cache_hash_seed;
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             lsc_cache_put(file, &header.checksum, cache->analysis, sizeof(LSC_ANALYSIS)) &&
+             lsc_cache_put(file, &header.checksum, cache->entries, cache->entry_count * sizeof(LSC_DECODED)) &&
+             lsc_cache_write_blocks(file, &header.checksum, vm) && fseek(file, 0, SEEK_SET) == 0 &&
+             fwrite(&header, sizeof(header), 1, file) == 1;
+    ok &= fclose(file) == 0;
+    ok = ok && rename(temporary, cache->path) == 0;
+    if (!ok) {
+        unlink(temporary);
+    }
+    free(temporary);
+    return ok;
+}
+
+const char *lsc_cache_path(const LSC_CACHE *cache) {
+    return cache->path;
+}
+
+void lsc_cache_free(LSC_CACHE *cache) {
+    if (!cache) {
+        return;
+    }
+    free(cache->path);
+    free(cache->analysis);
+    free(cache->entries);
+    free(cache);
+}
@@ -0,0 +1,59 @@
+#ifndef LSC_CACHE_H
+#define LSC_CACHE_H
+
+#include "lsc_analyze.h"
+#include "lsc_vm.h"
+
+/*
+Code cache
+
+lsc_vm --cache=dir image.obj ...
+
+Every start pays again for work that only depends on what was loaded: the analysis, decoding what it found, and
+compiling the hot blocks. With --cache, that work is kept in dir, one file per program. The file is named after a hash of
+the machine as loaded: every word of memory (so the images' contents and origins), the start PC, which pages are
+devices, and whether superinstructions are on.
+
+The next start that loads the same thing maps the file and puts it all back:
+- the analysis, and the table entries for everything it found, are copied in
+- blocks the JIT compiled last time are copied into its executable memory with their pointers into the VM patched (see
+  lsc_jit_install), so code that was hot runs natively from the first time it is reached. A block only goes back if
+  memory holds the words it was compiled from, so code the program wrote at run time gets compiled again instead.
+
+The file is written when the run is over, if it is new or the JIT compiled something it did not have. It is written
+under another name and then renamed, so a start reading it at the same time sees all of the old file or all of the new.
+
+Files are for the build that wrote them: another version of the tables, or another kind of host, is just a miss. So is
+a file that was cut short or damaged, which a checksum catches. The directory still has to be trusted like the binary
+itself is, since what is in it runs as native code.
+*/
+
+enum {
+    LSC_CACHE_VERSION = 2, // Goes up whenever LSC_DECODED, the opcodes or the JIT's code change meaning
+};
+
+typedef struct LSC_CACHE LSC_CACHE;
+
+// The entry in dir for vm as it is loaded now. Nothing is read yet. Returns NULL when out of memory.
+LSC_CACHE *lsc_cache_open(const LSC_VM *vm, const char *dir);
+
+/*
+Put what the entry holds back into vm. Returns its analysis (free it with lsc_analyze_free), or NULL if there is no
+usable entry, and then vm is left as it was.
+
+Compiled blocks only go back when vm runs under the JIT engine, with no profile or trace attached.
+*/
+LSC_ANALYSIS *lsc_cache_load(LSC_CACHE *cache, LSC_VM *vm);
+
+// Note the analysis and the entries it decoded, before the program runs and changes anything. Returns 0 when out of memory.
+int lsc_cache_keep(LSC_CACHE *cache, const LSC_VM *vm, const LSC_ANALYSIS *analysis);
+
+// Write the entry out once the run is over, if there is anything new for it (see above). Returns 0 if it could not be.
+int lsc_cache_write(const LSC_CACHE *cache, const LSC_VM *vm);
+
+// Where the entry lives, for messages
+const char *lsc_cache_path(const LSC_CACHE *cache);
+
+void lsc_cache_free(LSC_CACHE *cache);
+
+#endif
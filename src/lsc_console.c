@@ -0,0 +1,247 @@
+#include "lsc_console.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+struct LSC_CONSOLE {
+    int in_fd;
+    int out_fd;
+
+    /*
+    Keys, keys[tail % N] to keys[(head - 1) % N]. One producer (the reader thread, which moves head) and one consumer
+    (the VM, which moves tail), so checking for a key is a single atomic load with no lock.
+
+    lock and wakeup are only used to sleep: the VM waiting for a key in GETC, or the reader waiting for room.
+    */
+    uint8_t keys[LSC_CONSOLE_KEYS];
+    uint32_t head;
+    uint32_t tail;
+    int eof; // The reader thread saw the end of input (or an error)
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+
+    pthread_t reader;
+    int reader_started;
+
+    uint16_t kbdr; // The last key read through KBDR, which is what KBDR keeps returning until the next one
+
+    int raw; // The terminal was switched out of line mode, saved is how it was before
+    struct termios saved;
+};
+
+LSC_CONSOLE *lsc_console_create(int in_fd, int out_fd) {
+    LSC_CONSOLE *console = calloc(1, sizeof(LSC_CONSOLE));
+    if (!console) {
+        return NULL;
+    }
+    console->in_fd = in_fd;
+    console->out_fd = out_fd;
+    pthread_mutex_init(&console->lock, NULL);
+    pthread_cond_init(&console->wakeup, NULL);
+    return console;
+}
+
+void lsc_console_restore(LSC_CONSOLE *console) {
+    if (console && console->raw) {
+        tcsetattr(console->in_fd, TCSANOW, &console->saved);
+    }
+}
+
+void lsc_console_destroy(LSC_CONSOLE *console) {
+    if (!console) {
+        return;
+    }
+    if (console->reader_started) {
+        // The reader spends its life blocked in read(), which is a cancellation point
+        pthread_cancel(console->reader);
+        pthread_join(console->reader, NULL);
+    }
+    lsc_console_restore(console);
+    pthread_cond_destroy(&console->wakeup);
+    pthread_mutex_destroy(&console->lock);
+    free(console);
+}
+
+static void lsc_console_unlock(void *lock) {
+    pthread_mutex_unlock(lock);
+}
+
+static void *lsc_console_reader(void *arg) {
+    LSC_CONSOLE *console = arg;
+
+    for (;;) {
+        // Wait for room in the ring
+        pthread_mutex_lock(&console->lock);
+        pthread_cleanup_push(lsc_console_unlock, &console->lock);
+        while (console->head - __atomic_load_n(&console->tail, __ATOMIC_ACQUIRE) == LSC_CONSOLE_KEYS) {
+            pthread_cond_wait(&console->wakeup, &console->lock);
+        }
+        pthread_cleanup_pop(1);
+
+        // Only this thread moves head, so it can read it plainly
+        uint8_t key;
+        ssize_t n = read(console->in_fd, &key, 1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        pthread_mutex_lock(&console->lock);
+        if (n == 1) {
+            console->keys[console->head % LSC_CONSOLE_KEYS] = key;
+            __atomic_store_n(&console->head, console->head + 1, __ATOMIC_RELEASE);
+        } else {
+            __atomic_store_n(&console->eof, 1, __ATOMIC_RELEASE);
+        }
+        pthread_cond_broadcast(&console->wakeup);
+        pthread_mutex_unlock(&console->lock);
+
+        if (n != 1) {
+            return NULL;
+        }
+    }
+}
+
+/*
+The first time the program wants the keyboard: take the terminal out of line mode (so keys arrive as they are pressed,
+without echo, like on the real machine) and start the reader thread.
+*/
+static void lsc_console_start(LSC_CONSOLE *console) {
+    if (console->reader_started) {
+        return;
+    }
+    console->reader_started = 1;
+
+    if (isatty(console->in_fd) && tcgetattr(console->in_fd, &console->saved) == 0) {
+        struct termios raw = console->saved;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        console->raw = tcsetattr(console->in_fd, TCSANOW, &raw) == 0;
+    }
+
+    if (pthread_create(&console->reader, NULL, lsc_console_reader, console) != 0) {
+        console->reader_started = 0;
+        console->eof = 1;
+    }
+}
+
+static int lsc_console_key_ready(LSC_CONSOLE *console) {
+    return __atomic_load_n(&console->head, __ATOMIC_ACQUIRE) != console->tail;
+}
+
+// Take the next key, which must be ready
+static uint16_t lsc_console_take(LSC_CONSOLE *console) {
+    uint16_t key = console->keys[console->tail % LSC_CONSOLE_KEYS];
+
+    pthread_mutex_lock(&console->lock);
+    __atomic_store_n(&console->tail, console->tail + 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&console->wakeup);
+    pthread_mutex_unlock(&console->lock);
+    return key;
+}
+
+void lsc_console_flush(LSC_VM *vm) {
+    LSC_CONSOLE *console = vm->console;
+    if (!console) {
+        return;
+    }
+
+    const char *data = vm->output.data;
+    size_t left = vm->output.len;
+    while (left) {
+        ssize_t n = write(console->out_fd, data, left);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            // Nowhere to write it, drop it rather than spin
+            break;
+        }
+        data += n;
+        left -= n;
+    }
+    vm->output.len = 0;
+}
+
+// The next key queued by the host, if there is one. Returns 0xFFFF otherwise.
+static uint16_t lsc_input_take(LSC_INPUT *in) {
+    if (in->pos == in->len) {
+        return 0xFFFF;
+    }
+    in->last = in->data[in->pos++];
+    return in->last;
+}
+
+int lsc_console_must_wait(LSC_VM *vm) {
+    return !vm->console && vm->input.pos == vm->input.len && !vm->input.ended;
+}
+
+uint16_t lsc_console_getc(LSC_VM *vm) {
+    LSC_CONSOLE *console = vm->console;
+    if (!console) {
+        return lsc_input_take(&vm->input);
+    }
+    lsc_console_start(console);
+
+    if (!lsc_console_key_ready(console)) {
+        pthread_mutex_lock(&console->lock);
+        while (!lsc_console_key_ready(console) && !__atomic_load_n(&console->eof, __ATOMIC_ACQUIRE)) {
+            pthread_cond_wait(&console->wakeup, &console->lock);
+        }
+        pthread_mutex_unlock(&console->lock);
+
+        if (!lsc_console_key_ready(console)) {
+            return 0xFFFF;
+        }
+    }
+    return lsc_console_take(console);
+}
+
+uint16_t lsc_device_read(LSC_VM *vm, void *context, uint16_t address) {
+    LSC_CONSOLE *console = vm->console;
+    (void)context;
+
+    switch (address) {
+        case LSC_MR_KBSR:
+            if (!console) {
+                return vm->input.pos < vm->input.len ? 0x8000 : 0;
+            }
+            lsc_console_start(console);
+            return lsc_console_key_ready(console) ? 0x8000 : 0;
+        case LSC_MR_KBDR:
+            if (!console) {
+                lsc_input_take(&vm->input);
+                return vm->input.last;
+            }
+            if (lsc_console_key_ready(console)) {
+                console->kbdr = lsc_console_take(console);
+            }
+            return console->kbdr;
+        case LSC_MR_DSR:
+            // Output never has to wait
+            return 0x8000;
+        default:
+            return lsc_mem_peek(vm, address);
+    }
+}
+
+int lsc_device_write(LSC_VM *vm, void *context, uint16_t address, uint16_t value) {
+    (void)context;
+    switch (address) {
+        case LSC_MR_DDR:
+            lsc_output_putc(vm, (char)(value & 0xFF));
+            if ((value & 0xFF) == '\n') {
+                lsc_console_flush(vm);
+            }
+            return 1;
+        case LSC_MR_KBSR:
+        case LSC_MR_KBDR:
+        case LSC_MR_DSR:
+            // Read-only as far as the program is concerned
+            return 1;
+        default:
+            return 0;
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef LSC_CONSOLE_H
+#define LSC_CONSOLE_H
+
+#include "lsc_vm.h"
+
+/*
+Console
+
+Connects a VM to a real terminal (or any pair of file descriptors). Without one, output only collects in vm->output and
+the keyboard reads whatever the host queued with lsc_vm_input (see LSC_INPUT).
+
+Output is buffered in vm->output and written with a single write() when:
+- a trap (OUT, PUTS, PUTSP) or a write to DDR finishes a line
+- the buffer is full (LSC_CONSOLE_BUFFER bytes)
+- the program is about to wait for a key (GETC, IN)
+- lsc_vm_run returns, which covers HALT
+
+So PUTS of a long string is one write(), not one per character.
+
+The keyboard is read by a background thread into a small ring. Polling KBSR, reading KBDR and GETC only look at the ring,
+so the interpreter loop never makes a syscall just to check for a key. The thread is only started (and the terminal only
+switched out of line mode) the first time the program touches the keyboard.
+*/
+
+enum {
+    LSC_CONSOLE_BUFFER = 4096,
+    LSC_CONSOLE_KEYS = 256, // Keys read ahead of the program
+};
+
+// Returns NULL when out of memory. Nothing is read from in_fd until the program asks for a key.
+LSC_CONSOLE *lsc_console_create(int in_fd, int out_fd);
+
+// Stops the reader thread and puts the terminal back the way it was
+void lsc_console_destroy(LSC_CONSOLE *console);
+
+// Only puts the terminal back. Async-signal-safe, for an interrupt handler. NULL is ignored.
+void lsc_console_restore(LSC_CONSOLE *console);
+
+// Write out whatever is in vm->output if vm has a console
+void lsc_console_flush(LSC_VM *vm);
+
+// Wait for the next key. Returns 0xFFFF at end of input. Without a console, takes the next key from vm->input.
+uint16_t lsc_console_getc(LSC_VM *vm);
+
+// Whether lsc_console_getc has nothing to give yet: no console, and vm->input is empty but has not ended
+int lsc_console_must_wait(LSC_VM *vm);
+
+// The console's registers in the device page (see LSC_DEVICE_BASE), as an LSC_DEVICE. context is unused.
+uint16_t lsc_device_read(LSC_VM *vm, void *context, uint16_t address);
+int lsc_device_write(LSC_VM *vm, void *context, uint16_t address, uint16_t value);
+
+#endif
@@ -0,0 +1,574 @@
+#include "lsc_diff.h"
+#include "lsc_batch.h"
+#include "lsc_dispatch.h"
+#include "lsc_jit.h"
+#include "lsc_lanes.h"
+#include "lsc_profile.h"
+#include "lsc_snapshot.h"
+#include "lsc_vm.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// One way of running a program
+typedef struct {
+    const char *name;
+    int engine; // LSC_DISPATCH_*
+    int fuse;
+    int profile; // Under the profiling interpreter instead of engine
+    int lanes; // In a group of lanes (see lsc_lanes.h) instead of engine
+} LSC_DIFF_ENGINE;
+
+static const LSC_DIFF_ENGINE lsc_diff_engines[] = {
+    {"switch", LSC_DISPATCH_SWITCH, 0, 0, 0}, // The reference, everything else is compared with it
+    {"switch+fuse", LSC_DISPATCH_SWITCH, 1, 0, 0},
+#if LSC_HAVE_COMPUTED_GOTO
+    {"threaded", LSC_DISPATCH_THREADED, 0, 0, 0},
+    {"threaded+fuse", LSC_DISPATCH_THREADED, 1, 0, 0},
+#endif
+#if LSC_HAVE_JIT
+    {"jit", LSC_DISPATCH_JIT, 0, 0, 0},
+    {"jit+fuse", LSC_DISPATCH_JIT, 1, 0, 0},
+#endif
+    {"profile", LSC_DISPATCH_SWITCH, 1, 1, 0},
+#if LSC_HAVE_LANES
+    {"lanes", LSC_DISPATCH_SWITCH, 0, 0, 1},
+#endif
+};
+
+#define LSC_DIFF_ENGINE_COUNT ((int)(sizeof(lsc_diff_engines) / sizeof(lsc_diff_engines[0])))
+
+enum {
+    LSC_DIFF_ORIGIN = 0x3000, // Where random programs go, and start
+    LSC_DIFF_MIN_LENGTH = 16, // Words in a random program
+    LSC_DIFF_MAX_LENGTH = 512,
+    LSC_DIFF_REACH = 32, // Random branches go at most this far back, and a quarter of it forward
+    LSC_DIFF_TEXT = 256, // Longest report
+    LSC_DIFF_LANES = 4, // VMs in the lanes engine's group. Enough to split and join, a full group costs too much.
+};
+
+// An engine that disagreed on a program
+typedef struct LSC_DIFF_REPORT {
+    struct LSC_DIFF_REPORT *next;
+    uint64_t program;
+    int engine;
+    char text[LSC_DIFF_TEXT];
+} LSC_DIFF_REPORT;
+
+typedef struct LSC_DIFF LSC_DIFF;
+
+typedef struct {
+    LSC_DIFF *diff;
+    pthread_t thread;
+    LSC_VM *source; // Where each program is put together before its snapshot is taken
+    LSC_VM *vms[LSC_DIFF_ENGINE_COUNT]; // One per engine, in the order of lsc_diff_engines
+    LSC_LANES *lanes;
+    LSC_VM *companions[LSC_DIFF_LANES - 1]; // The rest of the lanes engine's group
+    uint64_t programs; // Programs this worker ran
+    uint64_t cycles; // Instructions it ran, on every engine
+    LSC_DIFF_REPORT *reports;
+    int load_failed; // A job's images could not be loaded
+} LSC_DIFF_WORKER;
+
+struct LSC_DIFF {
+    LSC_BATCH_IMAGES *jobs; // NULL for random programs
+    uint64_t programs;
+    uint64_t seed;
+    uint64_t check;
+    uint64_t max_cycles;
+    uint64_t next; // The next program to hand out, taken with an atomic add
+};
+
+static double lsc_diff_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// splitmix64: neighbouring seeds give unrelated streams, so program i and i + 1 have nothing in common
+static uint64_t lsc_diff_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15u);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9u;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBu;
+    return z ^ (z >> 31);
+}
+
+/*
+An instruction for a random program. Branches and JSR stay close, so programs loop inside themselves (and get hot
+enough for the JIT) rather than running off into the zeros around them. JMP is RET half the time. Traps never touch a
+disk, and one in eight of them halts.
+*/
+static uint16_t lsc_diff_instruction(uint64_t *rng) {
+    static const uint8_t ops[] = {
+        LSC_OP_ADD, LSC_OP_ADD, LSC_OP_ADD, LSC_OP_AND, LSC_OP_AND, LSC_OP_NOT, LSC_OP_BR, LSC_OP_BR, LSC_OP_BR,
+        LSC_OP_BR, LSC_OP_LD, LSC_OP_LDR, LSC_OP_LDR, LSC_OP_LDI, LSC_OP_ST, LSC_OP_STR, LSC_OP_STR, LSC_OP_STI,
+        LSC_OP_JMP, LSC_OP_JSR, LSC_OP_JSR, LSC_OP_LEA, LSC_OP_LEA, LSC_OP_TRAP,
+    };
+    static const uint8_t traps[] = {0x20, 0x21, 0x21, 0x21, 0x22, 0x23, 0x24, 0x25};
+
+    uint64_t r = lsc_diff_random(rng);
+    uint16_t op = ops[r % sizeof(ops)];
+    uint16_t bits = (r >> 8) & 0xFFF;
+    uint16_t near = (uint16_t)((r >> 24) % (LSC_DIFF_REACH + LSC_DIFF_REACH / 4) - LSC_DIFF_REACH);
+    uint16_t base = (r >> 32) & 1 ? LSC_R_R7 : (r >> 33) & 7;
+
+    switch (op) {
+        case LSC_OP_BR:
+            bits = (uint16_t)((1 + (r >> 40) % 7) << 9) | (near & 0x1FF);
+            break;
+        case LSC_OP_JSR:
+            bits = bits & 0x800 ? 0x800 | (near & 0x7FF) : base << 6;
+            break;
+        case LSC_OP_JMP:
+            bits = base << 6;
+            break;
+        case LSC_OP_TRAP:
+            bits = traps[(r >> 40) % sizeof(traps)];
+            break;
+        default:
+            break;
+    }
+    return (uint16_t)(op << 12 | bits);
+}
+
+/*
+Put random program seed into vm, which is cleared. Now and then a word is anything at all, which covers RTI, the
+reserved opcode and encodings lsc_diff_instruction never makes. Half the registers point into the program, so loads
+read it and stores overwrite it. Returns 0 when out of memory.
+*/
+static int lsc_diff_generate(LSC_VM *vm, uint64_t seed) {
+    uint64_t rng = seed;
+    uint32_t length = LSC_DIFF_MIN_LENGTH + lsc_diff_random(&rng) % (LSC_DIFF_MAX_LENGTH - LSC_DIFF_MIN_LENGTH + 1);
+
+    for (uint32_t i = 0; i < length; ++i) {
+        uint16_t address = LSC_DIFF_ORIGIN + i;
+        uint16_t *words = lsc_mem_page(vm, address >> LSC_PAGE_SHIFT);
+        if (!words) {
+            return 0;
+        }
+        uint64_t r = lsc_diff_random(&rng);
+        words[address & (LSC_PAGE_SIZE - 1)] = r % 8 == 0 ? (uint16_t)(r >> 16) : lsc_diff_instruction(&rng);
+    }
+
+    for (int reg = LSC_R_R0; reg <= LSC_R_R7; ++reg) {
+        uint64_t r = lsc_diff_random(&rng);
+        vm->reg[reg] = r & 1 ? (uint16_t)(LSC_DIFF_ORIGIN + (r >> 1) % length) : (uint16_t)(r >> 16);
+    }
+    vm->reg[LSC_R_PC] = LSC_DIFF_ORIGIN;
+    return 1;
+}
+
+// Note something about program for the end, from engine (or -1 when it is about the program itself)
+static void lsc_diff_report(LSC_DIFF_WORKER *w, uint64_t program, int engine, const char *format, ...) {
+    LSC_DIFF_REPORT *report = malloc(sizeof(LSC_DIFF_REPORT));
+    if (!report) {
+        return;
+    }
+    report->program = program;
+    report->engine = engine;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(report->text, sizeof(report->text), format, args);
+    va_end(args);
+    report->next = w->reports;
+    w->reports = report;
+}
+
+// Program index in w->source, and a snapshot of it for every engine to start from. NULL if it could not be loaded.
+static LSC_SNAPSHOT *lsc_diff_prepare(LSC_DIFF_WORKER *w, uint64_t index) {
+    LSC_DIFF *diff = w->diff;
+    LSC_VM *vm = w->source;
+    lsc_vm_clear(vm);
+
+    if (!diff->jobs) {
+        if (!lsc_diff_generate(vm, diff->seed + index)) {
+            lsc_diff_report(w, index, -1, "out of memory");
+            return NULL;
+        }
+    } else {
+        const LSC_BATCH_IMAGES *job = &diff->jobs[index];
+        for (int i = 0; i < job->image_count; ++i) {
+            if (!lsc_vm_load(vm, job->images[i])) {
+                lsc_diff_report(w, index, -1, "failed to load image: %s", job->images[i]);
+                w->load_failed = 1;
+                return NULL;
+            }
+        }
+    }
+
+    LSC_SNAPSHOT *snap = lsc_snapshot_take(vm);
+    if (!snap) {
+        lsc_diff_report(w, index, -1, "out of memory");
+    }
+    return snap;
+}
+
+/*
+Put engine e's VM back at the start of program index, with nothing left over from the one before. The lanes engine's
+VM runs in a group of LSC_DIFF_LANES: every other lane runs the same program, odd lanes from random registers of their
+own (the same every time for one program), so the group splits and comes back together while even lanes keep it
+company.
+*/
+static void lsc_diff_start(LSC_DIFF_WORKER *w, int e, LSC_SNAPSHOT *snap, uint64_t index) {
+    LSC_VM *vm = w->vms[e];
+    const LSC_DIFF_ENGINE *engine = &lsc_diff_engines[e];
+    if (engine->profile) {
+        // A profile only ever grows, so it starts again in an empty arena
+        lsc_vm_clear(vm);
+        vm->profile = lsc_profile_create(vm);
+        lsc_vm_input_end(vm);
+    } else if (engine->engine == LSC_DISPATCH_JIT) {
+        // Otherwise hit counts from earlier programs would decide what gets compiled when
+        lsc_jit_reset(vm);
+    }
+    lsc_snapshot_restore(vm, snap);
+    vm->output.len = 0;
+
+    if (engine->lanes) {
+        uint64_t rng = ~(w->diff->seed + index);
+        for (int c = 0; c < LSC_DIFF_LANES - 1; ++c) {
+            LSC_VM *companion = w->companions[c];
+            lsc_snapshot_restore(companion, snap);
+            companion->output.len = 0;
+            if (c % 2 == 0) { // Lane c + 1
+                for (int reg = LSC_R_R0; reg <= LSC_R_R7; ++reg) {
+                    companion->reg[reg] = (uint16_t)lsc_diff_random(&rng);
+                }
+            }
+        }
+    }
+}
+
+// Run engine e's VM for at most step instructions. Returns what lsc_vm_run would.
+static int lsc_diff_run(LSC_DIFF_WORKER *w, int e, uint64_t step) {
+    if (!lsc_diff_engines[e].lanes) {
+        return lsc_vm_run(w->vms[e], step);
+    }
+    LSC_VM *group[LSC_DIFF_LANES];
+    int status[LSC_DIFF_LANES];
+    group[0] = w->vms[e];
+    memcpy(group + 1, w->companions, sizeof(w->companions));
+    lsc_lanes_run(w->lanes, group, LSC_DIFF_LANES, step, status);
+    return status[0];
+}
+
+// Start engine e over and run count instructions of program index, in the same steps lsc_diff_program runs them in
+static void lsc_diff_replay(LSC_DIFF_WORKER *w, int e, LSC_SNAPSHOT *snap, uint64_t index, uint64_t count) {
+    uint64_t check = w->diff->check;
+    lsc_diff_start(w, e, snap, index);
+    while (count) {
+        uint64_t step = count < check ? count : check;
+        lsc_diff_run(w, e, step);
+        count -= step;
+    }
+}
+
+/*
+Does vm differ from ref? If it does and what is not NULL, the first difference is described there. The first output
+bytes of both are known to be the same already.
+*/
+static int lsc_diff_compare(const LSC_VM *ref, const LSC_VM *vm, size_t output, char *what, size_t size) {
+    static const char *const names[LSC_R_COUNT] = {"R0", "R1", "R2", "R3", "R4", "R5", "R6", "R7", "PC", "COND"};
+    char unused[1];
+    if (!what) {
+        what = unused;
+        size = sizeof(unused);
+    }
+
+    if (vm->cycles != ref->cycles) {
+        snprintf(what, size, "retired %llu instructions, expected %llu", (unsigned long long)vm->cycles,
+            (unsigned long long)ref->cycles);
+        return 1;
+    }
+    if (vm->halted != ref->halted || vm->faulted != ref->faulted) {
+        snprintf(what, size, "%s, expected %s", vm->halted ? "halted" : vm->faulted ? "faulted" : "running",
+            ref->halted ? "halted" : ref->faulted ? "faulted" : "running");
+        return 1;
+    }
+    for (int r = 0; r < LSC_R_COUNT; ++r) {
+        if (vm->reg[r] != ref->reg[r]) {
+            snprintf(what, size, "%s = x%04X, expected x%04X", names[r], vm->reg[r], ref->reg[r]);
+            return 1;
+        }
+    }
+
+    // Pages both still share with the snapshot (or the zero page) are the same without looking
+    for (uint32_t page = 0; page < LSC_PAGE_COUNT; ++page) {
+        const uint16_t *a = ref->memory[page];
+        const uint16_t *b = vm->memory[page];
+        if (a == b || memcmp(a, b, LSC_PAGE_SIZE * sizeof(uint16_t)) == 0) {
+            continue;
+        }
+        uint32_t i = 0;
+        while (a[i] == b[i]) {
+            ++i;
+        }
+        snprintf(what, size, "memory x%04X = x%04X, expected x%04X", page * LSC_PAGE_SIZE + i, b[i], a[i]);
+        return 1;
+    }
+
+    size_t length = vm->output.len < ref->output.len ? vm->output.len : ref->output.len;
+    for (size_t i = output; i < length; ++i) {
+        if (vm->output.data[i] != ref->output.data[i]) {
+            snprintf(what, size, "output byte %zu = x%02X, expected x%02X", i, vm->output.data[i], ref->output.data[i]);
+            return 1;
+        }
+    }
+    if (vm->output.len != ref->output.len) {
+        snprintf(what, size, "%zu bytes of output, expected %zu", vm->output.len, ref->output.len);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+Engine e and the reference agree after lo instructions of program index and not after hi: find the instruction where
+they part, and report it.
+*/
+static void lsc_diff_locate(LSC_DIFF_WORKER *w, uint64_t index, int e, LSC_SNAPSHOT *snap, uint64_t lo, uint64_t hi) {
+    LSC_VM *ref = w->vms[0];
+    LSC_VM *vm = w->vms[e];
+
+    while (hi - lo > 1) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        lsc_diff_replay(w, 0, snap, index, mid);
+        lsc_diff_replay(w, e, snap, index, mid);
+        if (lsc_diff_compare(ref, vm, 0, NULL, 0)) {
+            hi = mid;
+        } else {
+            lo = mid;
+        }
+    }
+
+    // The instruction that went wrong is the one the reference runs next after lo
+    lsc_diff_replay(w, 0, snap, index, lo);
+    uint16_t pc = ref->reg[LSC_R_PC];
+    uint16_t instr = lsc_mem_peek(ref, pc);
+
+    char what[LSC_DIFF_TEXT / 2];
+    lsc_diff_replay(w, 0, snap, index, hi);
+    lsc_diff_replay(w, e, snap, index, hi);
+    if (!lsc_diff_compare(ref, vm, 0, what, sizeof(what))) {
+        snprintf(what, sizeof(what), "but not when run again");
+    }
+
+    // Native code runs a block at a time, so what went wrong can be anywhere in the block that ends there
+    char block[48] = "";
+    for (int back = 0; back < LSC_JIT_MAX_BLOCK; ++back) {
+        LSC_JIT_CODE code;
+        if (lsc_jit_block(vm, (uint16_t)(pc - back), &code) && back == code.span - 1) {
+            uint16_t last = code.start + code.span - 1;
+            snprintf(block, sizeof(block), " in native block x%04X-x%04X", code.start, last);
+            break;
+        }
+    }
+    lsc_diff_report(w, index, e, "%s differs after instruction %llu, at x%04X (x%04X)%s: %s", lsc_diff_engines[e].name,
+        (unsigned long long)hi, pc, instr, block, what);
+}
+
+// Run program index on every engine in lockstep, comparing them after every step
+static void lsc_diff_program(LSC_DIFF_WORKER *w, uint64_t index) {
+    LSC_DIFF *diff = w->diff;
+    LSC_SNAPSHOT *snap = lsc_diff_prepare(w, index);
+    if (!snap) {
+        return;
+    }
+
+    int live[LSC_DIFF_ENGINE_COUNT]; // Still agreeing with the reference
+    for (int e = 0; e < LSC_DIFF_ENGINE_COUNT; ++e) {
+        lsc_diff_start(w, e, snap, index);
+        live[e] = 1;
+    }
+
+    LSC_VM *ref = w->vms[0];
+    size_t output = 0; // Bytes of output every live engine has the same
+    uint64_t done = 0;
+    while (done < diff->max_cycles) {
+        uint64_t step = diff->max_cycles - done < diff->check ? diff->max_cycles - done : diff->check;
+        int running = 0;
+        for (int e = 0; e < LSC_DIFF_ENGINE_COUNT; ++e) {
+            if (live[e]) {
+                running |= lsc_diff_run(w, e, step) == LSC_VM_BUDGET_EXHAUSTED;
+            }
+        }
+        for (int e = 1; e < LSC_DIFF_ENGINE_COUNT; ++e) {
+            if (live[e] && lsc_diff_compare(ref, w->vms[e], output, NULL, 0)) {
+                live[e] = 0;
+                w->cycles += w->vms[e]->cycles;
+                lsc_diff_locate(w, index, e, snap, done, done + step);
+
+                // The reference was run again to find it, so it has to catch up
+                lsc_diff_replay(w, 0, snap, index, done + step);
+            }
+        }
+        output = ref->output.len;
+        done += step;
+        if (!running) {
+            break;
+        }
+    }
+
+    for (int e = 0; e < LSC_DIFF_ENGINE_COUNT; ++e) {
+        if (live[e]) {
+            w->cycles += w->vms[e]->cycles;
+        }
+    }
+    ++w->programs;
+    lsc_snapshot_release(snap);
+}
+
+static void *lsc_diff_worker_main(void *arg) {
+    LSC_DIFF_WORKER *w = arg;
+    LSC_DIFF *diff = w->diff;
+
+    // Created here, so their pages come from this thread's slab
+    w->source = lsc_vm_create();
+    int ok = w->source != NULL;
+    for (int e = 0; e < LSC_DIFF_ENGINE_COUNT; ++e) {
+        w->vms[e] = lsc_vm_create();
+        if (!w->vms[e]) {
+            ok = 0;
+            continue;
+        }
+        w->vms[e]->engine = lsc_diff_engines[e].engine;
+        w->vms[e]->fuse = lsc_diff_engines[e].fuse;
+        // Programs have no keyboard, GETC reads end of input
+        lsc_vm_input_end(w->vms[e]);
+    }
+    w->lanes = lsc_lanes_create();
+    ok &= w->lanes != NULL;
+    for (int c = 0; c < LSC_DIFF_LANES - 1; ++c) {
+        w->companions[c] = lsc_vm_create();
+        if (!w->companions[c]) {
+            ok = 0;
+            continue;
+        }
+        lsc_vm_input_end(w->companions[c]);
+    }
+
+    // Programs take about as long as each other, so handing them out one at a time is all the balancing needed
+    uint64_t index;
+    while (ok && (index = __atomic_fetch_add(&diff->next, 1, __ATOMIC_RELAXED)) < diff->programs) {
+        lsc_diff_program(w, index);
+    }
+
+    lsc_vm_destroy(w->source);
+    for (int e = 0; e < LSC_DIFF_ENGINE_COUNT; ++e) {
+        lsc_vm_destroy(w->vms[e]);
+    }
+    lsc_lanes_free(w->lanes);
+    for (int c = 0; c < LSC_DIFF_LANES - 1; ++c) {
+        lsc_vm_destroy(w->companions[c]);
+    }
+    return NULL;
+}
+
+// Program order, then engine order
+static int lsc_diff_report_order(const void *a, const void *b) {
+    const LSC_DIFF_REPORT *x = *(LSC_DIFF_REPORT *const *)a;
+    const LSC_DIFF_REPORT *y = *(LSC_DIFF_REPORT *const *)b;
+    if (x->program != y->program) {
+        return x->program < y->program ? -1 : 1;
+    }
+    return (x->engine > y->engine) - (x->engine < y->engine);
+}
+
+int lsc_diff_main(const char *jobs_path, uint64_t programs, uint64_t seed, uint64_t check, uint64_t max_cycles,
+    int workers) {
+    LSC_DIFF diff;
+    memset(&diff, 0, sizeof(diff));
+    diff.programs = programs;
+    diff.seed = seed;
+    diff.check = check;
+    diff.max_cycles = max_cycles;
+
+    int job_count = 0;
+    if (jobs_path) {
+        int read = lsc_batch_read(jobs_path, &diff.jobs, &job_count);
+        if (read <= 0) {
+            if (read < 0) {
+                printf("out of memory\n");
+            } else {
+                printf("failed to read jobs: %s\n", jobs_path);
+            }
+            return 1;
+        }
+        diff.programs = (uint64_t)job_count;
+    }
+
+    if (workers < 1) {
+        workers = 1;
+    }
+    if (diff.programs > 0 && (uint64_t)workers > diff.programs) {
+        workers = (int)diff.programs;
+    }
+    LSC_DIFF_WORKER *w = calloc(workers, sizeof(LSC_DIFF_WORKER));
+
+    double start = lsc_diff_now();
+    for (int i = 0; i < workers; ++i) {
+        w[i].diff = &diff;
+        pthread_create(&w[i].thread, NULL, lsc_diff_worker_main, &w[i]);
+    }
+    for (int i = 0; i < workers; ++i) {
+        pthread_join(w[i].thread, NULL);
+    }
+    double seconds = lsc_diff_now() - start;
+
+    // Only now does anything touch stdout
+    uint64_t ran = 0;
+    uint64_t cycles = 0;
+    size_t report_count = 0;
+    int exit_code = 0;
+    for (int i = 0; i < workers; ++i) {
+        ran += w[i].programs;
+        cycles += w[i].cycles;
+        exit_code |= w[i].load_failed;
+        for (LSC_DIFF_REPORT *r = w[i].reports; r; r = r->next) {
+            ++report_count;
+        }
+    }
+    LSC_DIFF_REPORT **reports = malloc((report_count ? report_count : 1) * sizeof(LSC_DIFF_REPORT *));
+    size_t n = 0;
+    for (int i = 0; i < workers; ++i) {
+        for (LSC_DIFF_REPORT *r = w[i].reports; r; r = r->next) {
+            reports[n++] = r;
+        }
+    }
+    qsort(reports, report_count, sizeof(LSC_DIFF_REPORT *), lsc_diff_report_order);
+
+    uint64_t differ = 0;
+    for (size_t i = 0; i < report_count; ++i) {
+        const LSC_DIFF_REPORT *r = reports[i];
+        if (i == 0 || reports[i - 1]->program != r->program) {
+            if (diff.jobs) {
+                printf("== job %llu:", (unsigned long long)r->program + 1);
+                for (int j = 0; j < diff.jobs[r->program].image_count; ++j) {
+                    printf(" %s", diff.jobs[r->program].images[j]);
+                }
+                printf("\n");
+            } else {
+                printf("== program %llu (--seed=%llu --programs=1)\n", (unsigned long long)r->program,
+                    (unsigned long long)(seed + r->program));
+            }
+            differ += r->engine >= 0;
+        }
+        printf("%s\n", r->text);
+        exit_code = 1;
+    }
+
+    printf("diff: %llu programs, %d engines, %d workers, %llu differ, %.4f seconds, %.0f programs/sec, %.2f MIPS\n",
+        (unsigned long long)ran, LSC_DIFF_ENGINE_COUNT, workers, (unsigned long long)differ, seconds, ran / seconds,
+        cycles / seconds / 1e6);
+
+    for (size_t i = 0; i < report_count; ++i) {
+        free(reports[i]);
+    }
+    free(reports);
+    free(w);
+    lsc_batch_free(diff.jobs, job_count);
+    return exit_code;
+}
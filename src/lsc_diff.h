@@ -0,0 +1,46 @@
+#ifndef LSC_DIFF_H
+#define LSC_DIFF_H
+
+#include <stdint.h>
+
+/*
+Differential testing
+
+lsc_vm --diff-engines [--programs=N] [--seed=S] [--check=N] [--cycles=N] [-j N]
+lsc_vm --diff-engines=jobs.txt [--check=N] [--cycles=N] [-j N]
+
+Every engine is meant to run a program exactly the same way, and this checks that they do. Each program runs on every
+way of running one this build has: the switch, threaded and JIT engines, each with and without superinstructions, the
+profiling interpreter, and lockstep lanes (see lsc_lanes.h) in a small group with copies of the program, some of them
+from other registers so the group splits. All of them start from one snapshot of the program and run in lockstep, N
+instructions at a time (--check, 10000 by default). After every step each is compared against the switch engine without
+superinstructions: registers, memory, how many instructions retired, halted or faulted, and the output so far. Budgets
+are exact on every engine (see lsc_dispatch.h), so they have all run the same instructions when they are compared.
+
+An engine that disagrees is followed no further. The step it went wrong in is searched for the first instruction after
+which it differs, by running it and the reference again from the snapshot (in the same steps, so the engine sees the
+same budgets as the first time), and that instruction, its PC and the first thing that differs are reported.
+
+Without a jobs file, the programs are random (see lsc_diff_generate): a few hundred words at x3000, mostly instructions
+that stay nearby, with registers pointing into the program so it stores over its own code. Program i is made from seed
+S + i alone, so --seed=S+i --programs=1 gives the same program again. With one (the --batch format), each job is a
+program. They run for at most --cycles instructions, 100000 by default.
+
+Programs are spread over N worker threads, each with a VM per engine reused for every program. Nothing depends on
+which worker ran what, or in which order: each program starts on freshly reset engines. Reports are printed in program
+order once every worker is done, followed by the totals. For the JIT engines a report also names the native block that
+ran last, since native code retires a block at a time and what went wrong can be anywhere in it.
+
+Returns the process exit code: 0 when every engine agreed on every program, 1 when one did not or a job could not
+be loaded.
+*/
+
+enum {
+    LSC_DIFF_CHECK = 10000, // Instructions between compares, without --check
+    LSC_DIFF_CYCLES = 100000, // Most instructions run per program, without --cycles
+};
+
+int lsc_diff_main(const char *jobs_path, uint64_t programs, uint64_t seed, uint64_t check, uint64_t max_cycles,
+    int workers);
+
+#endif
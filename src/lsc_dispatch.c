@@ -0,0 +1,216 @@
+#include "lsc_dispatch.h"
+#include "lsc_jit.h"
+#include "lsc_profile.h"
+#include "lsc_trace.h"
+#include "lsc_vm.h"
+
+#include <string.h>
+
+/*
+The switch loop, looking at the budget on every instruction. Finishes off the last LSC_DISPATCH_SLACK or so
+instructions of a run for the other two, which only look at it at checkpoints. The loop with no hooks: see lsc_loop.h.
+*/
+#define LSC_LOOP_NAME lsc_run_exact
+#define LSC_LOOP_STATIC
+#include "lsc_loop.h"
+
+uint64_t lsc_run_switch(LSC_VM *vm, uint64_t budget) {
+    uint64_t executed = 0;
+    uint16_t cc;
+
+    // Carry on from a checkpoint only while the next one is sure to come before the budget runs out
+    if (budget <= LSC_DISPATCH_SLACK) {
+        return lsc_run_exact(vm, budget);
+    }
+    uint64_t limit = budget - LSC_DISPATCH_SLACK;
+    cc = lsc_cond_value(vm->reg[LSC_R_COND]);
+
+    for (;;) {
+        uint16_t pc = vm->reg[LSC_R_PC]++;
+        LSC_DECODED *d = lsc_decoded(vm, pc);
+        uint8_t op = d->op;
+
+lsc_switch_dispatch:
+        switch (op) {
+#define LSC_CASE(op) case op:
+// Straight on to the next instruction, which saves looking up its page (see lsc_decoded_next)
+#define LSC_NEXT \
+    ++executed; \
+    pc = vm->reg[LSC_R_PC]++; \
+    d = lsc_decoded_next(vm, d, pc); \
+    op = d->op; \
+    goto lsc_switch_dispatch
+#define LSC_JUMP if (++executed > limit) goto lsc_switch_tail; continue
+#define LSC_CHECKPOINT if (executed > limit) { vm->reg[LSC_R_PC] = pc; goto lsc_switch_tail; }
+#define LSC_DISPATCH() op = d->op; goto lsc_switch_dispatch
+#define LSC_DISPATCH_BASE() op = d->base; goto lsc_switch_dispatch
+#define LSC_STOP ++executed; goto lsc_switch_done
+#define LSC_YIELD vm->reg[LSC_R_PC] = pc; goto lsc_switch_done
+#define LSC_STEP \
+    ++executed; \
+    pc = vm->reg[LSC_R_PC]++; \
+    d = lsc_decoded_next(vm, d, pc)
+#include "lsc_ops.h"
+#undef LSC_CASE
+#undef LSC_NEXT
+#undef LSC_JUMP
+#undef LSC_CHECKPOINT
+#undef LSC_DISPATCH
+#undef LSC_DISPATCH_BASE
+#undef LSC_STOP
+#undef LSC_YIELD
+#undef LSC_STEP
+            default: break;
+        }
+
+        ++executed;
+    }
+
+lsc_switch_tail:
+    vm->reg[LSC_R_COND] = lsc_cond_flags(cc);
+    return executed + lsc_run_exact(vm, budget - executed);
+
+lsc_switch_done:
+    vm->reg[LSC_R_COND] = lsc_cond_flags(cc);
+    return executed;
+}
+
+#if LSC_HAVE_COMPUTED_GOTO
+uint64_t lsc_run_threaded(LSC_VM *vm, uint64_t budget) {
+    /*
+    One label per handler. &&label is the address of that label, so the table maps every opcode straight to the code
+    that runs it.
+    */
+    static void *const lsc_labels[LSC_OP_COUNT] = {
+        [LSC_OP_BR] = &&lsc_label_LSC_OP_BR,
+        [LSC_OP_ADD] = &&lsc_label_LSC_OP_ADD,
+        [LSC_OP_LD] = &&lsc_label_LSC_OP_LD,
+        [LSC_OP_ST] = &&lsc_label_LSC_OP_ST,
+        [LSC_OP_JSR] = &&lsc_label_LSC_OP_JSR,
+        [LSC_OP_AND] = &&lsc_label_LSC_OP_AND,
+        [LSC_OP_LDR] = &&lsc_label_LSC_OP_LDR,
+        [LSC_OP_STR] = &&lsc_label_LSC_OP_STR,
+        [LSC_OP_RTI] = &&lsc_label_LSC_OP_RTI,
+        [LSC_OP_NOT] = &&lsc_label_LSC_OP_NOT,
+        [LSC_OP_LDI] = &&lsc_label_LSC_OP_LDI,
+        [LSC_OP_STI] = &&lsc_label_LSC_OP_STI,
+        [LSC_OP_JMP] = &&lsc_label_LSC_OP_JMP,
+        [LSC_OP_RES] = &&lsc_label_LSC_OP_RES,
+        [LSC_OP_LEA] = &&lsc_label_LSC_OP_LEA,
+        [LSC_OP_TRAP] = &&lsc_label_LSC_OP_TRAP,
+        [LSC_OP_ADDI] = &&lsc_label_LSC_OP_ADDI,
+        [LSC_OP_ANDI] = &&lsc_label_LSC_OP_ANDI,
+        [LSC_OP_JSRR] = &&lsc_label_LSC_OP_JSRR,
+        [LSC_OP_CHECK] = &&lsc_label_LSC_OP_CHECK,
+        [LSC_OP_LOAD_CONST] = &&lsc_label_LSC_OP_LOAD_CONST,
+        [LSC_OP_ADD_BR] = &&lsc_label_LSC_OP_ADD_BR,
+        [LSC_OP_ADDI_BR] = &&lsc_label_LSC_OP_ADDI_BR,
+        [LSC_OP_LDR_ADDI_STR] = &&lsc_label_LSC_OP_LDR_ADDI_STR,
+        [LSC_OP_DECODE] = &&lsc_label_LSC_OP_DECODE,
+        [LSC_OP_BREAK] = &&lsc_label_LSC_OP_BREAK,
+    };
+
+    uint64_t executed = 0;
+    uint16_t cc;
+    uint16_t pc;
+    LSC_DECODED *d;
+
+    // See lsc_run_switch
+    if (budget <= LSC_DISPATCH_SLACK) {
+        return lsc_run_exact(vm, budget);
+    }
+    uint64_t limit = budget - LSC_DISPATCH_SLACK;
+    cc = lsc_cond_value(vm->reg[LSC_R_COND]);
+
+    pc = vm->reg[LSC_R_PC]++;
+    d = lsc_decoded(vm, pc);
+    goto *lsc_labels[d->op];
+
+#define LSC_CASE(op) lsc_label_##op:
+#define LSC_DISPATCH() goto *lsc_labels[d->op]
+#define LSC_DISPATCH_BASE() goto *lsc_labels[d->base]
+#define LSC_CHECKPOINT if (executed > limit) { vm->reg[LSC_R_PC] = pc; goto lsc_threaded_tail; }
+#define LSC_STOP ++executed; goto lsc_threaded_done
+#define LSC_YIELD vm->reg[LSC_R_PC] = pc; goto lsc_threaded_done
+#define LSC_STEP \
+    ++executed; \
+    pc = vm->reg[LSC_R_PC]++; \
+    d = lsc_decoded_next(vm, d, pc)
+// Fetch and jump to the next handler from inside this one, so each handler has its own indirect branch
+#define LSC_NEXT \
+    ++executed; \
+    pc = vm->reg[LSC_R_PC]++; \
+    d = lsc_decoded_next(vm, d, pc); \
+    goto *lsc_labels[d->op]
+#define LSC_JUMP \
+    if (++executed > limit) goto lsc_threaded_tail; \
+    pc = vm->reg[LSC_R_PC]++; \
+    d = lsc_decoded(vm, pc); \
+    goto *lsc_labels[d->op]
+#include "lsc_ops.h"
+#undef LSC_CASE
+#undef LSC_NEXT
+#undef LSC_JUMP
+#undef LSC_CHECKPOINT
+#undef LSC_DISPATCH
+#undef LSC_DISPATCH_BASE
+#undef LSC_STOP
+#undef LSC_YIELD
+#undef LSC_STEP
+
+lsc_threaded_tail:
+    vm->reg[LSC_R_COND] = lsc_cond_flags(cc);
+    return executed + lsc_run_exact(vm, budget - executed);
+
+lsc_threaded_done:
+    vm->reg[LSC_R_COND] = lsc_cond_flags(cc);
+    return executed;
+}
+#else
+uint64_t lsc_run_threaded(LSC_VM *vm, uint64_t budget) {
+    return lsc_run_switch(vm, budget);
+}
+#endif
+
+uint64_t lsc_run(LSC_VM *vm, int engine, uint64_t budget) {
+    // Tools get loops of their own (see lsc_loop.h), picked once per run, so the engines themselves know nothing about
+    // profiling or tracing
+    if (vm->profile && vm->trace) {
+        return lsc_run_trace_profile(vm, budget);
+    }
+    if (vm->profile) {
+        return lsc_run_profile(vm, budget);
+    }
+    if (vm->trace) {
+        return lsc_run_trace(vm, budget);
+    }
+
+    switch (engine) {
+        case LSC_DISPATCH_THREADED: return lsc_run_threaded(vm, budget);
+        case LSC_DISPATCH_JIT: return lsc_run_jit(vm, budget);
+        case LSC_DISPATCH_SWITCH:
+        default: return lsc_run_switch(vm, budget);
+    }
+}
+
+static const char *const lsc_dispatch_names[LSC_DISPATCH_COUNT] = {
+    [LSC_DISPATCH_SWITCH] = "switch",
+    [LSC_DISPATCH_THREADED] = "threaded",
+    [LSC_DISPATCH_JIT] = "jit",
+};
+
+const char *lsc_dispatch_name(int engine) {
+    if (engine < 0 || engine >= LSC_DISPATCH_COUNT) {
+        return "unknown";
+    }
+    return lsc_dispatch_names[engine];
+}
+
+int lsc_dispatch_from_name(const char *name) {
+    for (int engine = 0; engine < LSC_DISPATCH_COUNT; ++engine) {
+        if (strcmp(name, lsc_dispatch_names[engine]) == 0) {
+            return engine;
+        }
+    }
+    return -1;
+}
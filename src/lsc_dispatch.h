@@ -0,0 +1,66 @@
+#ifndef LSC_DISPATCH_H
+#define LSC_DISPATCH_H
+
+#include <stdint.h>
+
+#include "lsc_vm.h"
+
+/*
+Dispatch engines
+
+A dispatch engine is the loop that fetches the next instruction and jumps to its handler. They all run the same handlers
+(see lsc_ops.h), they only differ in how they get from one handler to the next.
+
+- LSC_DISPATCH_SWITCH: one switch statement. Every instruction goes back through the same indirect branch at the top of the loop
+- LSC_DISPATCH_THREADED: every handler ends in its own indirect jump to the next handler (GCC's labels-as-values).
+  The CPU can then predict each jump based on which instruction came before it.
+- LSC_DISPATCH_JIT: the switch loop, plus native code for hot basic blocks (see lsc_jit.h)
+
+Each engine executes at most budget instructions on vm and returns how many it executed. They stop early when the
+machine halts, faults or has to wait for a key, and only then.
+
+The switch and threaded engines do not compare against the budget on every instruction, only at checkpoints: after
+anything that may jump (LSC_JUMP) and before the instruction at the last address of each page (LSC_OP_CHECK).
+Straight-line code cannot get past a page end, so there are never more than LSC_DISPATCH_SLACK instructions between two
+checkpoints. Once fewer than that are left, a loop that does compare every time runs the rest, so budgets stay exact.
+The JIT already checks once per native block.
+*/
+enum {
+    LSC_DISPATCH_SWITCH = 0,
+    LSC_DISPATCH_THREADED,
+    LSC_DISPATCH_JIT,
+    LSC_DISPATCH_COUNT
+};
+
+enum {
+    LSC_DISPATCH_SLACK = LSC_PAGE_SIZE, // Most instructions retired from one checkpoint to the next
+};
+
+/*
+Computed goto is a GCC extension (clang supports it too). Anywhere else, or when built with -DLSC_NO_COMPUTED_GOTO, the
+threaded engine falls back to the switch engine.
+*/
+#if defined(__GNUC__) && !defined(LSC_NO_COMPUTED_GOTO)
+#define LSC_HAVE_COMPUTED_GOTO 1
+#else
+#define LSC_HAVE_COMPUTED_GOTO 0
+#endif
+
+// The engine used when --dispatch= is not given. Can be overridden at build time with -DLSC_DISPATCH_DEFAULT=...
+#ifndef LSC_DISPATCH_DEFAULT
+#if LSC_HAVE_COMPUTED_GOTO
+#define LSC_DISPATCH_DEFAULT LSC_DISPATCH_THREADED
+#else
+#define LSC_DISPATCH_DEFAULT LSC_DISPATCH_SWITCH
+#endif
+#endif
+
+uint64_t lsc_run_switch(LSC_VM *vm, uint64_t budget);
+uint64_t lsc_run_threaded(LSC_VM *vm, uint64_t budget);
+uint64_t lsc_run(LSC_VM *vm, int engine, uint64_t budget);
+
+// Engine name <-> id, for --dispatch=. Returns -1 for an unknown name.
+const char *lsc_dispatch_name(int engine);
+int lsc_dispatch_from_name(const char *name);
+
+#endif
@@ -0,0 +1,105 @@
+#include "lsc_fuse.h"
+
+#include <stdio.h>
+
+static const struct {
+    const char *name;
+    int length; // Instructions in the sequence
+} lsc_fuse_info[LSC_FUSED_COUNT] = {
+    [LSC_OP_LOAD_CONST - LSC_OP_FUSED_FIRST] = {"and0+addi", 2},
+    [LSC_OP_ADD_BR - LSC_OP_FUSED_FIRST] = {"add+br", 2},
+    [LSC_OP_ADDI_BR - LSC_OP_FUSED_FIRST] = {"addi+br", 2},
+    [LSC_OP_LDR_ADDI_STR - LSC_OP_FUSED_FIRST] = {"ldr+addi+str", 3},
+};
+
+/*
+The entry n words after address, decoded on its own if it has not been yet. NULL if that would be past the end of
+memory, or a budget checkpoint (see LSC_OP_CHECK), which a superinstruction must not step over.
+
+Only the fields are used, so it does not matter whether that entry is itself a superinstruction.
+*/
+static const LSC_DECODED *lsc_fuse_next(LSC_VM *vm, uint16_t address, int n) {
+    if ((uint32_t)address + n >= LSC_MEMORY_MAX) {
+        return NULL;
+    }
+    uint16_t next = address + n;
+    if (lsc_is_checkpoint(next)) {
+        return NULL;
+    }
+    const LSC_DECODED *d = lsc_decoded(vm, next);
+    if (d->op == LSC_OP_DECODE) {
+        d = lsc_decode_single(vm, next);
+    }
+    // Neither may a breakpoint, or it would never be hit
+    if (d->op == LSC_OP_BREAK) {
+        return NULL;
+    }
+    return d;
+}
+
+void lsc_fuse(LSC_VM *vm, uint16_t address) {
+    LSC_DECODED *d = lsc_decoded(vm, address);
+    const LSC_DECODED *n1;
+    const LSC_DECODED *n2;
+
+    // A checkpoint stays one, and so does a breakpoint
+    if (d->op == LSC_OP_CHECK || d->op == LSC_OP_BREAK) {
+        return;
+    }
+
+    switch (d->base) {
+        case LSC_OP_ANDI:
+            // AND DR, SR1, #0 clears DR, the ADD then reads it
+            n1 = lsc_fuse_next(vm, address, 1);
+            if (d->imm == 0 && n1 && n1->base == LSC_OP_ADDI && n1->sr1 == d->dr) {
+                d->op = LSC_OP_LOAD_CONST;
+            }
+            break;
+        case LSC_OP_ADD:
+        case LSC_OP_ADDI:
+            n1 = lsc_fuse_next(vm, address, 1);
+            if (n1 && n1->base == LSC_OP_BR) {
+                d->op = (d->base == LSC_OP_ADD) ? LSC_OP_ADD_BR : LSC_OP_ADDI_BR;
+            }
+            break;
+        case LSC_OP_LDR:
+            // LDR R, BaseR, off; ADD R, R, #imm; STR R, BaseR, off. BaseR must not be R, or the STR goes somewhere else.
+            n1 = lsc_fuse_next(vm, address, 1);
+            n2 = lsc_fuse_next(vm, address, 2);
+            if (n1 && n2 && d->dr != d->sr1 &&
+                n1->base == LSC_OP_ADDI && n1->dr == d->dr && n1->sr1 == d->dr &&
+                n2->base == LSC_OP_STR && n2->dr == d->dr && n2->sr1 == d->sr1 && n2->imm == d->imm) {
+                d->op = LSC_OP_LDR_ADDI_STR;
+            }
+            break;
+        default: break;
+    }
+}
+
+int lsc_fuse_length(int op) {
+    return lsc_fuse_info[op - LSC_OP_FUSED_FIRST].length;
+}
+
+const char *lsc_fuse_name(int op) {
+    if (op < LSC_OP_FUSED_FIRST || op >= LSC_OP_FUSED_FIRST + LSC_FUSED_COUNT) {
+        return "unknown";
+    }
+    return lsc_fuse_info[op - LSC_OP_FUSED_FIRST].name;
+}
+
+void lsc_fuse_print_stats(const LSC_VM *vm) {
+    uint64_t covered = 0;
+
+    printf("%-14s %14s %14s\n", "superinstr", "runs", "instructions");
+    for (int i = 0; i < LSC_FUSED_COUNT; ++i) {
+        uint64_t instructions = vm->fused[i] * lsc_fuse_info[i].length;
+        covered += instructions;
+        printf("%-14s %14llu %14llu\n", lsc_fuse_info[i].name,
+            (unsigned long long)vm->fused[i], (unsigned long long)instructions);
+    }
+
+    // A run cut short by the budget still counts every part, so this can be a hair over the real figure
+    printf("%llu of %llu instructions (%.1f%%) ran inside superinstructions\n",
+        (unsigned long long)covered, (unsigned long long)vm->cycles,
+        vm->cycles ? covered * 100.0 / vm->cycles : 0.0);
+}
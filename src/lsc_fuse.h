@@ -0,0 +1,39 @@
+#ifndef LSC_FUSE_H
+#define LSC_FUSE_H
+
+#include "lsc_vm.h"
+
+/*
+Superinstructions
+
+The same few instruction sequences turn up over and over in LC-3 code:
+- AND R, R, #0 then ADD R, R, #imm: load a constant
+- ADD then BR: a loop counter, like the LOOP PROGRAM example in lsc_vm.h
+- LDR, ADD #imm, STR to the same address: read-modify-write of a variable
+
+When the predecoder sees the first instruction of one of these, it rewrites its entry into a single superinstruction
+(LSC_OP_LOAD_CONST and friends). The interpreter loops then run the whole sequence with one dispatch instead of one per
+instruction, which is where most of their time goes on tight loops.
+
+Nothing else changes:
+- The entries of the other instructions in the sequence stay as they are, so jumping into the middle still works
+- A superinstruction still retires one instruction per part, and stops part way if the budget runs out
+- Writing to any instruction in the sequence takes the superinstruction apart again (see lsc_mem_write)
+- Sequences never wrap around the end of memory, or cover the last address of a page (see LSC_OP_CHECK)
+
+The JIT compiles the instructions one by one (LSC_DECODED.base), so it is not affected.
+*/
+
+// Turn the entry at address, which has just been decoded, into a superinstruction if a sequence starts there
+void lsc_fuse(LSC_VM *vm, uint16_t address);
+
+// Instructions superinstruction op runs
+int lsc_fuse_length(int op);
+
+// Name of superinstruction op, for the statistics
+const char *lsc_fuse_name(int op);
+
+// Print how many times each superinstruction ran in vm since it was last reset
+void lsc_fuse_print_stats(const LSC_VM *vm);
+
+#endif
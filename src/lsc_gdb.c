@@ -0,0 +1,538 @@
+#include "lsc_gdb.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+struct LSC_GDB {
+    int listener;
+    int client; // -1 while no debugger is attached
+    int stopped; // The debugger has the machine, nothing runs until it says so
+    int signal; // Why it stopped, for the ? packet: SIGTRAP (5), SIGINT (2) or SIGILL (4)
+
+    // Bytes received but not looked at yet, in[pos] to in[len - 1]
+    uint8_t in[LSC_GDB_PACKET_MAX];
+    size_t pos;
+    size_t len;
+
+    char packet[LSC_GDB_PACKET_MAX]; // The last packet received, without $ and checksum
+    char reply[LSC_GDB_PACKET_MAX];
+};
+
+// What the debugger asked for once a packet has been handled
+enum {
+    LSC_GDB_STAY = 0, // Stay stopped and wait for the next packet
+    LSC_GDB_CONTINUE,
+    LSC_GDB_STEP,
+    LSC_GDB_DETACH, // Also what happens when the connection drops
+    LSC_GDB_KILL,
+};
+
+// Nothing to read yet, from lsc_gdb_read without waiting
+enum { LSC_GDB_NOTHING = -2 };
+
+static const char lsc_gdb_xfer[] = "qXfer:features:read:target.xml:";
+
+static const char lsc_gdb_target_xml[] =
+    "<?xml version=\"1.0\"?>\n"
+    "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">\n"
+    "<target version=\"1.0\">\n"
+    "  <feature name=\"org.lsc_vm.lc3\">\n"
+    "    <reg name=\"r0\" bitsize=\"16\" type=\"int16\" regnum=\"0\"/>\n"
+    "    <reg name=\"r1\" bitsize=\"16\" type=\"int16\"/>\n"
+    "    <reg name=\"r2\" bitsize=\"16\" type=\"int16\"/>\n"
+    "    <reg name=\"r3\" bitsize=\"16\" type=\"int16\"/>\n"
+    "    <reg name=\"r4\" bitsize=\"16\" type=\"int16\"/>\n"
+    "    <reg name=\"r5\" bitsize=\"16\" type=\"int16\"/>\n"
+    "    <reg name=\"r6\" bitsize=\"16\" type=\"data_ptr\"/>\n"
+    "    <reg name=\"r7\" bitsize=\"16\" type=\"code_ptr\"/>\n"
+    "    <reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>\n"
+    "    <reg name=\"cond\" bitsize=\"16\" type=\"uint16\"/>\n"
+    "  </feature>\n"
+    "</target>\n";
+
+LSC_GDB *lsc_gdb_listen(uint16_t port) {
+    LSC_GDB *gdb = calloc(1, sizeof(LSC_GDB));
+    if (!gdb) {
+        return NULL;
+    }
+    gdb->client = -1;
+
+    gdb->listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (gdb->listener < 0) {
+        free(gdb);
+        return NULL;
+    }
+    int on = 1;
+    setsockopt(gdb->listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    // Loopback only: whoever attaches can read and write all of the machine
+    struct sockaddr_in address = {0};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(gdb->listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(gdb->listener, 1) != 0 ||
+        fcntl(gdb->listener, F_SETFL, O_NONBLOCK) != 0) {
+        close(gdb->listener);
+        free(gdb);
+        return NULL;
+    }
+    return gdb;
+}
+
+void lsc_gdb_close(LSC_GDB *gdb) {
+    if (!gdb) {
+        return;
+    }
+    if (gdb->client >= 0) {
+        close(gdb->client);
+    }
+    close(gdb->listener);
+    free(gdb);
+}
+
+static void lsc_gdb_write(LSC_GDB *gdb, const void *data, size_t size) {
+    const char *p = data;
+    while (size && gdb->client >= 0) {
+        ssize_t n = send(gdb->client, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            // Gone, the next read notices
+            return;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+}
+
+// Next byte from the debugger, -1 once it has gone away. Without wait, LSC_GDB_NOTHING if there is none yet.
+static int lsc_gdb_read(LSC_GDB *gdb, int wait) {
+    if (gdb->pos == gdb->len) {
+        ssize_t n;
+        do {
+            n = recv(gdb->client, gdb->in, sizeof(gdb->in), wait ? 0 : MSG_DONTWAIT);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0 && !wait && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return LSC_GDB_NOTHING;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        gdb->pos = 0;
+        gdb->len = (size_t)n;
+    }
+    return gdb->in[gdb->pos++];
+}
+
+static int lsc_gdb_hex_digit(int c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Parse hex digits at *p, moving *p past them
+static uint32_t lsc_gdb_hex(const char **p) {
+    uint32_t value = 0;
+    for (int digit; (digit = lsc_gdb_hex_digit(**p)) >= 0; ++*p) {
+        value = value << 4 | (uint32_t)digit;
+    }
+    return value;
+}
+
+// The next 16 bit register value at *p, four hex digits high byte first
+static int lsc_gdb_hex16(const char **p, uint16_t *value) {
+    *value = 0;
+    for (int i = 0; i < 4; ++i) {
+        int digit = lsc_gdb_hex_digit((*p)[i]);
+        if (digit < 0) {
+            return 0;
+        }
+        *value = (uint16_t)(*value << 4 | digit);
+    }
+    *p += 4;
+    return 1;
+}
+
+static void lsc_gdb_send(LSC_GDB *gdb, const char *data) {
+    static const char digits[] = "0123456789abcdef";
+    size_t len = strlen(data);
+    uint8_t sum = 0;
+    for (size_t i = 0; i < len; ++i) {
+        sum += (uint8_t)data[i];
+    }
+    char tail[3] = {'#', digits[sum >> 4], digits[sum & 0xF]};
+    lsc_gdb_write(gdb, "$", 1);
+    lsc_gdb_write(gdb, data, len);
+    lsc_gdb_write(gdb, tail, sizeof(tail));
+}
+
+// Wait for the next packet and acknowledge it. Returns 0 once the debugger has gone away.
+static int lsc_gdb_receive(LSC_GDB *gdb) {
+    for (;;) {
+        int c = lsc_gdb_read(gdb, 1);
+        if (c < 0) {
+            return 0;
+        }
+        // Acks, and Ctrl-C while the machine is stopped anyway
+        if (c != '$') {
+            continue;
+        }
+
+        size_t len = 0;
+        uint8_t sum = 0;
+        while ((c = lsc_gdb_read(gdb, 1)) >= 0 && c != '#') {
+            sum += (uint8_t)c;
+            if (len < sizeof(gdb->packet) - 1) {
+                gdb->packet[len++] = (char)c;
+            }
+        }
+        int high = c < 0 ? -1 : lsc_gdb_read(gdb, 1);
+        int low = high < 0 ? -1 : lsc_gdb_read(gdb, 1);
+        if (low < 0) {
+            return 0;
+        }
+        if ((lsc_gdb_hex_digit(high) << 4 | lsc_gdb_hex_digit(low)) != sum) {
+            lsc_gdb_write(gdb, "-", 1);
+            continue;
+        }
+        lsc_gdb_write(gdb, "+", 1);
+        gdb->packet[len] = '\0';
+        return 1;
+    }
+}
+
+static void lsc_gdb_drop(LSC_GDB *gdb, LSC_VM *vm) {
+    // The program carries on as if nobody had been there
+    if (vm->breakpoints) {
+        for (uint32_t a = 0; a < LSC_MEMORY_MAX; ++a) {
+            if (vm->breakpoints[a]) {
+                lsc_vm_breakpoint(vm, (uint16_t)a, 0);
+            }
+        }
+    }
+    close(gdb->client);
+    gdb->client = -1;
+    gdb->stopped = 0;
+    gdb->pos = gdb->len = 0;
+}
+
+// Take a debugger that has connected, if there is one
+static void lsc_gdb_accept(LSC_GDB *gdb) {
+    int client = accept(gdb->listener, NULL, NULL);
+    if (client < 0) {
+        return;
+    }
+    int on = 1;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    gdb->client = client;
+    gdb->stopped = 1;
+    gdb->signal = 2;
+}
+
+// Stop the machine for the debugger and tell it why
+static void lsc_gdb_stop(LSC_GDB *gdb, int signal) {
+    char reply[4];
+    gdb->stopped = 1;
+    gdb->signal = signal;
+    sprintf(reply, "S%02x", signal);
+    lsc_gdb_send(gdb, reply);
+}
+
+// Run the one instruction at PC, even if a breakpoint is on it
+static int lsc_gdb_step(LSC_VM *vm) {
+    uint16_t pc = vm->reg[LSC_R_PC];
+    int armed = vm->breakpoints && vm->breakpoints[pc];
+    if (armed) {
+        lsc_vm_breakpoint(vm, pc, 0);
+    }
+    int status = lsc_vm_run(vm, 1);
+    if (armed) {
+        lsc_vm_breakpoint(vm, pc, 1);
+    }
+    return status;
+}
+
+// Byte i of memory from word address on, high byte of each word first
+static uint8_t lsc_gdb_get_byte(const LSC_VM *vm, uint32_t address, uint32_t i) {
+    uint16_t word = lsc_mem_peek(vm, (uint16_t)(address + i / 2));
+    return (i & 1) ? word & 0xFF : word >> 8;
+}
+
+// Returns 0 when out of memory
+static int lsc_gdb_set_byte(LSC_VM *vm, uint32_t address, uint32_t i, uint8_t value) {
+    uint16_t word = lsc_mem_peek(vm, (uint16_t)(address + i / 2));
+    word = (i & 1) ? (word & 0xFF00) | value : (uint16_t)(value << 8) | (word & 0xFF);
+    return lsc_mem_poke(vm, (uint16_t)(address + i / 2), word);
+}
+
+static void lsc_gdb_read_memory(LSC_GDB *gdb, LSC_VM *vm, const char *args) {
+    uint32_t address = lsc_gdb_hex(&args);
+    if (*args++ != ',') {
+        strcpy(gdb->reply, "E01");
+        return;
+    }
+    uint32_t length = lsc_gdb_hex(&args);
+    if (length > (sizeof(gdb->reply) - 1) / 2) {
+        length = (sizeof(gdb->reply) - 1) / 2;
+    }
+    if (address >= LSC_MEMORY_MAX) {
+        strcpy(gdb->reply, "E02");
+        return;
+    }
+    if (length > (LSC_MEMORY_MAX - address) * 2) {
+        length = (LSC_MEMORY_MAX - address) * 2;
+    }
+    for (uint32_t i = 0; i < length; ++i) {
+        sprintf(gdb->reply + 2 * i, "%02x", lsc_gdb_get_byte(vm, address, i));
+    }
+    gdb->reply[2 * length] = '\0';
+}
+
+static void lsc_gdb_write_memory(LSC_GDB *gdb, LSC_VM *vm, const char *args) {
+    uint32_t address = lsc_gdb_hex(&args);
+    if (*args++ != ',') {
+        strcpy(gdb->reply, "E01");
+        return;
+    }
+    uint32_t length = lsc_gdb_hex(&args);
+    if (*args++ != ':' || address >= LSC_MEMORY_MAX || length > (LSC_MEMORY_MAX - address) * 2 ||
+        strlen(args) != 2 * (size_t)length) {
+        strcpy(gdb->reply, "E02");
+        return;
+    }
+    for (uint32_t i = 0; i < length; ++i) {
+        int high = lsc_gdb_hex_digit(args[2 * i]);
+        int low = lsc_gdb_hex_digit(args[2 * i + 1]);
+        if (high < 0 || low < 0) {
+            strcpy(gdb->reply, "E03");
+            return;
+        }
+    }
+    strcpy(gdb->reply, "OK");
+    for (uint32_t i = 0; i < length; ++i) {
+        uint8_t value = (uint8_t)(lsc_gdb_hex_digit(args[2 * i]) << 4 | lsc_gdb_hex_digit(args[2 * i + 1]));
+        if (!lsc_gdb_set_byte(vm, address, i, value)) {
+            strcpy(gdb->reply, "E04");
+            break;
+        }
+    }
+    // Breakpoints in there are decoded again from the breakpoint table, like everything else
+    lsc_mem_invalidate(vm, (uint16_t)address, (length + 1) / 2);
+}
+
+static void lsc_gdb_breakpoint(LSC_GDB *gdb, LSC_VM *vm, const char *args, int set) {
+    // Z0 and Z1 (software and hardware) are the same thing here
+    if ((args[0] != '0' && args[0] != '1') || args[1] != ',') {
+        gdb->reply[0] = '\0';
+        return;
+    }
+    args += 2;
+    uint32_t address = lsc_gdb_hex(&args);
+    if (address >= LSC_MEMORY_MAX) {
+        strcpy(gdb->reply, "E02");
+        return;
+    }
+    strcpy(gdb->reply, lsc_vm_breakpoint(vm, (uint16_t)address, set) ? "OK" : "E04");
+}
+
+static void lsc_gdb_target(LSC_GDB *gdb, const char *args) {
+    uint32_t offset = lsc_gdb_hex(&args);
+    if (*args++ != ',') {
+        strcpy(gdb->reply, "E01");
+        return;
+    }
+    uint32_t length = lsc_gdb_hex(&args);
+    size_t size = sizeof(lsc_gdb_target_xml) - 1;
+    if (offset >= size) {
+        strcpy(gdb->reply, "l");
+        return;
+    }
+    if (length > sizeof(gdb->reply) - 2) {
+        length = sizeof(gdb->reply) - 2;
+    }
+    size_t n = size - offset < length ? size - offset : length;
+    gdb->reply[0] = offset + n == size ? 'l' : 'm';
+    memcpy(gdb->reply + 1, lsc_gdb_target_xml + offset, n);
+    gdb->reply[n + 1] = '\0';
+}
+
+// Answer the packet in gdb->packet. Everything not handled here gets the empty reply, which means unsupported.
+static int lsc_gdb_command(LSC_GDB *gdb, LSC_VM *vm) {
+    const char *p = gdb->packet;
+    const char *args = p + 1;
+    gdb->reply[0] = '\0';
+
+    switch (p[0]) {
+        case '?':
+            sprintf(gdb->reply, "S%02x", gdb->signal);
+            break;
+        case 'g':
+            for (int r = 0; r < LSC_R_COUNT; ++r) {
+                sprintf(gdb->reply + 4 * r, "%04x", vm->reg[r]);
+            }
+            break;
+        case 'G': {
+            uint16_t reg[LSC_R_COUNT];
+            for (int r = 0; r < LSC_R_COUNT; ++r) {
+                if (!lsc_gdb_hex16(&args, &reg[r])) {
+                    strcpy(gdb->reply, "E01");
+                    return LSC_GDB_STAY;
+                }
+            }
+            memcpy(vm->reg, reg, sizeof(reg));
+            strcpy(gdb->reply, "OK");
+            break;
+        }
+        case 'p': {
+            uint32_t r = lsc_gdb_hex(&args);
+            if (r >= LSC_R_COUNT) {
+                strcpy(gdb->reply, "E01");
+            } else {
+                sprintf(gdb->reply, "%04x", vm->reg[r]);
+            }
+            break;
+        }
+        case 'P': {
+            uint32_t r = lsc_gdb_hex(&args);
+            uint16_t value;
+            if (r >= LSC_R_COUNT || *args++ != '=' || !lsc_gdb_hex16(&args, &value)) {
+                strcpy(gdb->reply, "E01");
+            } else {
+                vm->reg[r] = value;
+                strcpy(gdb->reply, "OK");
+            }
+            break;
+        }
+        case 'm':
+            lsc_gdb_read_memory(gdb, vm, args);
+            break;
+        case 'M':
+            lsc_gdb_write_memory(gdb, vm, args);
+            break;
+        case 'Z':
+        case 'z':
+            lsc_gdb_breakpoint(gdb, vm, args, p[0] == 'Z');
+            break;
+        case 'c':
+        case 's':
+            // Optionally from somewhere else
+            if (*args) {
+                vm->reg[LSC_R_PC] = (uint16_t)lsc_gdb_hex(&args);
+            }
+            return p[0] == 'c' ? LSC_GDB_CONTINUE : LSC_GDB_STEP;
+        case 'D':
+            lsc_gdb_send(gdb, "OK");
+            return LSC_GDB_DETACH;
+        case 'k':
+            return LSC_GDB_KILL;
+        case 'H':
+        case 'T':
+            // The one thread
+            strcpy(gdb->reply, "OK");
+            break;
+        case 'q':
+            if (strncmp(p, "qSupported", 10) == 0) {
+                sprintf(gdb->reply, "PacketSize=%x;qXfer:features:read+", LSC_GDB_PACKET_MAX);
+            } else if (strncmp(p, lsc_gdb_xfer, sizeof(lsc_gdb_xfer) - 1) == 0) {
+                lsc_gdb_target(gdb, p + sizeof(lsc_gdb_xfer) - 1);
+            } else if (strcmp(p, "qAttached") == 0) {
+                strcpy(gdb->reply, "1");
+            } else if (strcmp(p, "qC") == 0) {
+                strcpy(gdb->reply, "QC1");
+            } else if (strcmp(p, "qfThreadInfo") == 0) {
+                strcpy(gdb->reply, "m1");
+            } else if (strcmp(p, "qsThreadInfo") == 0) {
+                strcpy(gdb->reply, "l");
+            }
+            break;
+        default: break;
+    }
+    lsc_gdb_send(gdb, gdb->reply);
+    return LSC_GDB_STAY;
+}
+
+int lsc_gdb_run(LSC_GDB *gdb, LSC_VM *vm, uint64_t max_cycles) {
+    uint64_t left = max_cycles;
+
+    for (;;) {
+        if (gdb->client < 0) {
+            lsc_gdb_accept(gdb);
+        } else if (!gdb->stopped) {
+            // Ctrl-C comes as a single 0x03 outside any packet, anything else (acks) is skipped
+            int c = lsc_gdb_read(gdb, 0);
+            while (c >= 0 && c != 0x03) {
+                c = lsc_gdb_read(gdb, 0);
+            }
+            if (c == -1) {
+                lsc_gdb_drop(gdb, vm);
+            } else if (c == 0x03) {
+                lsc_gdb_stop(gdb, 2);
+            }
+        }
+
+        // Stopped: do what the debugger says until it lets the machine run again
+        while (gdb->client >= 0 && gdb->stopped) {
+            int action = lsc_gdb_receive(gdb) ? lsc_gdb_command(gdb, vm) : LSC_GDB_DETACH;
+            if (action == LSC_GDB_DETACH) {
+                lsc_gdb_drop(gdb, vm);
+            } else if (action == LSC_GDB_KILL) {
+                lsc_gdb_drop(gdb, vm);
+                vm->halted = 1;
+                return LSC_VM_HALTED;
+            } else if (action != LSC_GDB_STAY) {
+                // An illegal instruction is tried again, the debugger may have changed it (or PC)
+                vm->faulted = 0;
+                // Get off a breakpoint under PC first, which is also all a step does
+                uint64_t before = vm->cycles;
+                int status = LSC_VM_BUDGET_EXHAUSTED;
+                if (left && (action == LSC_GDB_STEP || (vm->breakpoints && vm->breakpoints[vm->reg[LSC_R_PC]]))) {
+                    status = lsc_gdb_step(vm);
+                }
+                left -= vm->cycles - before;
+                if (status == LSC_VM_HALTED || !left) {
+                    lsc_gdb_send(gdb, "W00");
+                    lsc_gdb_drop(gdb, vm);
+                    return status;
+                }
+                if (status == LSC_VM_FAULT) {
+                    lsc_gdb_stop(gdb, 4);
+                } else if (action == LSC_GDB_STEP) {
+                    lsc_gdb_stop(gdb, 5);
+                } else {
+                    gdb->stopped = 0;
+                }
+            }
+        }
+
+        uint64_t before = vm->cycles;
+        int status = lsc_vm_run_until(vm, left, lsc_vm_clock() + LSC_GDB_POLL_NS);
+        left -= vm->cycles - before;
+
+        if (status == LSC_VM_BREAKPOINT) {
+            lsc_gdb_stop(gdb, 5);
+        } else if (status == LSC_VM_FAULT && gdb->client >= 0) {
+            lsc_gdb_stop(gdb, 4);
+        } else if (status != LSC_VM_BUDGET_EXHAUSTED || !left) {
+            if (gdb->client >= 0 && status != LSC_VM_FAULT) {
+                lsc_gdb_send(gdb, "W00");
+            }
+            return status;
+        }
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef LSC_GDB_H
+#define LSC_GDB_H
+
+#include "lsc_vm.h"
+
+/*
+Remote debugging over the GDB remote serial protocol
+
+lsc_vm --gdb=1234 image.obj
+
+The program starts running straight away. A debugger can connect to port 1234 on the loopback interface at any time,
+which stops the machine, and detaching lets it carry on, so a long-running VM can be looked at while it misbehaves.
+
+What the debugger sees:
+- registers 0-9: R0-R7, PC and COND, 16 bits each (g, G, p, P). qXfer:features:read:target.xml describes them.
+- memory (m, M): addresses are word addresses, like PC, and every word is two bytes, high byte first (the byte order of
+  an image). So m3000,4 reads the words at x3000 and x3001. Device registers show what is stored under them, reading
+  one for real would take a key.
+- breakpoints (Z0/Z1, z0/z1), continue (c), single-step (s), Ctrl-C while running, detach (D), kill (k)
+Stop replies are S05 for a breakpoint or step, S02 for Ctrl-C or attaching, S04 for an illegal instruction (the machine
+stays stopped on it, and tries it again when continued), and W00 once it halted or used up --cycles.
+
+Breakpoints are entries of the predecode table (see lsc_vm_breakpoint), not a list anything checks, so a VM runs
+exactly as fast with --gdb as without while nothing is set. The stub itself only looks for a debugger (or Ctrl-C)
+between slices of LSC_GDB_POLL_NS. A program blocked in GETC waiting for a key answers once it has its key.
+
+GDB itself has no LC-3 target, so this is for clients that speak the protocol (or GDB's maint packet).
+*/
+
+enum {
+    LSC_GDB_PACKET_MAX = 4096, // Longest packet either side sends, advertised as PacketSize
+};
+
+// Nanoseconds between looking for a debugger, or Ctrl-C from one, while the machine runs
+#define LSC_GDB_POLL_NS 10000000u
+
+typedef struct LSC_GDB LSC_GDB;
+
+// Listen on port of the loopback interface. Returns NULL if it cannot, or when out of memory.
+LSC_GDB *lsc_gdb_listen(uint16_t port);
+
+void lsc_gdb_close(LSC_GDB *gdb);
+
+// lsc_vm_run, with a debugger able to attach. Returns how the machine stopped (a kill counts as halted).
+int lsc_gdb_run(LSC_GDB *gdb, LSC_VM *vm, uint64_t max_cycles);
+
+#endif
@@ -0,0 +1,264 @@
+#include "lsc_fuse.h"
+#include "lsc_vm.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/*
+LC-3 images are stored big-endian, but most computers we run on (x86, ARM) are little-endian.
+So every 16 bit word has to have its two bytes swapped after reading.
+*/
+static uint16_t lsc_swap16(uint16_t x) {
+    return (x << 8) | (x >> 8);
+}
+
+/*
+Swapping 8 words (16 bytes) at a time:
+- SSSE3: pshufb picks the bytes of each word back out in the other order
+- SSE2 (every x86-64 CPU): shift every word left and right by 8 and OR the halves back together
+- NEON: vrev16 reverses the bytes inside every 16 bit lane
+
+Whatever is left over at the end (fewer than 8 words) is done one word at a time.
+
+src does not have to be aligned: in an mmap'd file the words start 2 bytes in, after the origin, so unaligned loads are
+used throughout.
+*/
+void lsc_swap_copy(uint16_t *dst, const void *src, size_t count) {
+    const uint8_t *in = src;
+    size_t i = 0;
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    // Already in host order
+    memcpy(dst, in, count * sizeof(uint16_t));
+    i = count;
+#elif defined(__SSSE3__)
+    const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i * 2));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_shuffle_epi8(v, swap));
+    }
+#elif defined(__SSE2__)
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i * 2));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128((__m128i *)(dst + i), v);
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 8 <= count; i += 8) {
+        uint8x16_t v = vld1q_u8(in + i * 2);
+        vst1q_u8((uint8_t *)(dst + i), vrev16q_u8(v));
+    }
+#endif
+
+    for (; i < count; ++i) {
+        uint16_t word;
+        memcpy(&word, in + i * 2, sizeof(word));
+        dst[i] = lsc_swap16(word);
+    }
+}
+
+static uint16_t lsc_image_le16(const uint8_t *p) {
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t lsc_image_le32(const uint8_t *p) {
+    return lsc_image_le16(p) | (uint32_t)lsc_image_le16(p + 2) << 16;
+}
+
+// Whether entry is something the engines can run for address: real opcodes, registers in range, checkpoints in place
+static int lsc_decode_entry_ok(const LSC_VM *vm, uint16_t address, const LSC_DECODED *entry) {
+    if (entry->base >= LSC_OP_CHECK || entry->dr > 7 || entry->sr1 > 7 || entry->sr2 > 7) {
+        return 0;
+    }
+    if (lsc_is_checkpoint(address)) {
+        return entry->op == LSC_OP_CHECK;
+    }
+    return entry->op == entry->base || (vm->fuse && entry->op >= LSC_OP_FUSED_FIRST && entry->op < LSC_OP_DECODE);
+}
+
+int lsc_decode_put(LSC_VM *vm, uint16_t address, LSC_DECODED entry) {
+    if (entry.op == LSC_OP_DECODE || !lsc_decode_entry_ok(vm, address, &entry)) {
+        return 0;
+    }
+    LSC_CODE_PAGE *code = lsc_code_page(vm, address >> LSC_PAGE_SHIFT);
+    if (!code) {
+        return 0;
+    }
+    code->decoded[address & (LSC_PAGE_SIZE - 1)] = entry;
+    vm->page_code[address >> LSC_PAGE_SHIFT] = 1;
+    return 1;
+}
+
+void lsc_decode_trim_fused(LSC_VM *vm, uint16_t address, uint32_t count) {
+    for (uint32_t i = 0; i < count; ++i) {
+        LSC_DECODED *d = lsc_decoded(vm, (uint16_t)(address + i));
+        if (d->op < LSC_OP_FUSED_FIRST || d->op >= LSC_OP_DECODE) {
+            continue;
+        }
+        for (uint32_t n = 1; n < (uint32_t)lsc_fuse_length(d->op); ++n) {
+            if (i + n >= count || lsc_decoded(vm, (uint16_t)(address + i + n))->op == LSC_OP_DECODE) {
+                d->op = d->base;
+                break;
+            }
+        }
+    }
+}
+
+/*
+Extended image (see lsc_asm.h): sections of words and their decoded entries. Each section is loaded like a standard
+image, then its entries are put in place, so nothing is decoded when it runs.
+
+Entries are checked before they are used (see lsc_decode_put), and a superinstruction is only kept when the words it
+covers in its section have entries too. With --no-fuse, superinstructions go back to their first instruction.
+*/
+static int lsc_vm_load_extended(LSC_VM *vm, const uint8_t *image, size_t size) {
+    if (size < 16) {
+        return 0;
+    }
+    uint32_t section_count = lsc_image_le32(image + 8);
+    size_t at = 16;
+
+    for (uint32_t s = 0; s < section_count; ++s) {
+        if (size - at < 8) {
+            return 0;
+        }
+        uint16_t origin = lsc_image_le16(image + at);
+        uint32_t count = lsc_image_le32(image + at + 4);
+        at += 8;
+        // Words, entries and flags, padded to 4 bytes
+        size_t length = ((size_t)count * 11 + 3) & ~(size_t)3;
+        if (count > (uint32_t)(LSC_MEMORY_MAX - origin) || size - at < length) {
+            return 0;
+        }
+
+        const uint8_t *words = image + at;
+        const uint8_t *entries = words + (size_t)count * 2;
+        uint32_t stored = 0;
+        while (stored < count && lsc_mem_poke(vm, origin + stored, lsc_image_le16(words + stored * 2))) {
+            ++stored;
+        }
+        lsc_mem_invalidate(vm, origin, stored);
+        if (stored < count) {
+            return 0;
+        }
+
+        for (uint32_t i = 0; i < count; ++i) {
+            const uint8_t *e = entries + (size_t)i * 8;
+            LSC_DECODED entry = {e[0], e[1], e[2], e[3], lsc_image_le16(e + 4), e[6], 0};
+            if (!vm->fuse && entry.op >= LSC_OP_FUSED_FIRST && entry.op < LSC_OP_DECODE) {
+                entry.op = entry.base;
+            }
+            lsc_decode_put(vm, origin + i, entry);
+        }
+        lsc_decode_trim_fused(vm, origin, count);
+        at += length;
+    }
+    return 1;
+}
+
+/*
+Image file format:
+- First word: the origin, the address in memory the image should be placed at
+- Rest: the words to place starting at origin
+
+An extended image starts with "LSCIMG1\0" instead. A standard image whose first four words happen to spell that (an
+origin of x4C53) would be taken for one.
+*/
+int lsc_vm_load_image(LSC_VM *vm, const void *image, size_t size) {
+    if (size >= 8 && memcmp(image, "LSCIMG1", 8) == 0) {
+        return lsc_vm_load_extended(vm, image, size);
+    }
+    if (size < sizeof(uint16_t)) {
+        return 0;
+    }
+
+    uint16_t origin;
+    lsc_swap_copy(&origin, image, 1);
+
+    // Never read past the end of memory. An odd trailing byte is not a whole word, so it is dropped.
+    size_t count = (size - sizeof(uint16_t)) / sizeof(uint16_t);
+    if (count > (size_t)(LSC_MEMORY_MAX - origin)) {
+        count = LSC_MEMORY_MAX - origin;
+    }
+
+    size_t stored = lsc_mem_load(vm, origin, (const uint8_t *)image + sizeof(uint16_t), count);
+    lsc_mem_invalidate(vm, origin, stored);
+    return stored == count;
+}
+
+/*
+Loading goes straight from the page cache into memory: the file is mmap'd and swapped in one pass, rather than read()
+into a buffer and then swapped in place.
+
+Files that cannot be mapped (pipes, some special files) fall back to read() into a temporary buffer.
+*/
+enum {
+    // The largest image that can matter: the origin plus all of memory
+    LSC_IMAGE_MAX_SIZE = sizeof(uint16_t) * (LSC_MEMORY_MAX + 1),
+    // An extended one has 11 bytes per word, and may have sections over each other. This fills memory several times.
+    LSC_IMAGE_MAX_EXTENDED_SIZE = 64 * LSC_MEMORY_MAX,
+};
+
+static int lsc_vm_load_stream(LSC_VM *vm, int fd) {
+    size_t max_size = LSC_IMAGE_MAX_EXTENDED_SIZE;
+    uint8_t *buffer = malloc(max_size);
+    if (!buffer) {
+        return 0;
+    }
+
+    size_t size = 0;
+    ssize_t n;
+    while (size < max_size && (n = read(fd, buffer + size, max_size - size)) > 0) {
+        size += n;
+    }
+
+    int loaded = lsc_vm_load_image(vm, buffer, size);
+    free(buffer);
+    return loaded;
+}
+
+int lsc_vm_load(LSC_VM *vm, const char *image_path) {
+    int fd = open(image_path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        int loaded = lsc_vm_load_stream(vm, fd);
+        close(fd);
+        return loaded;
+    }
+
+    // Anything past the end of memory is ignored, so there is no point mapping it
+    size_t max_size = LSC_IMAGE_MAX_SIZE;
+    char magic[8];
+    if (pread(fd, magic, sizeof(magic), 0) == sizeof(magic) && memcmp(magic, "LSCIMG1", 8) == 0) {
+        max_size = LSC_IMAGE_MAX_EXTENDED_SIZE;
+    }
+    size_t size = (size_t)st.st_size < max_size ? (size_t)st.st_size : max_size;
+
+    void *image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (image == MAP_FAILED) {
+        int loaded = lsc_vm_load_stream(vm, fd);
+        close(fd);
+        return loaded;
+    }
+
+    int loaded = lsc_vm_load_image(vm, image, size);
+    munmap(image, size);
+    close(fd);
+    return loaded;
+}
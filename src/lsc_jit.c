@@ -0,0 +1,980 @@
+#include "lsc_jit.h"
+#include "lsc_dispatch.h"
+#include "lsc_metrics.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if LSC_HAVE_JIT
+#include <sys/mman.h>
+#endif
+
+/*
+A native block is called like a C function:
+- reg: vm->reg
+- memory: vm->memory, the page table (see Memory in lsc_vm.h)
+- budget: most instructions it may retire, at least the block's max_retired
+
+A block that branches back to its own start loops natively for as long as the budget allows.
+
+It returns the number of LC-3 instructions it retired. If bit 31 is set it stopped early because a store hit compiled
+code, and the address of that store is in jit->dirty_address.
+*/
+typedef uint32_t (*LSC_JIT_ENTRY)(uint16_t *reg, uint16_t *const *memory, uint32_t budget);
+
+enum {
+    LSC_JIT_DIRTY = 1u << 31,
+    LSC_JIT_MAX_BUDGET = 1u << 30, // Keeps the retired count clear of LSC_JIT_DIRTY
+};
+
+// Native stores index vm->code and a code page's entries with a scale of 8
+_Static_assert(sizeof(LSC_DECODED) == 8, "LSC_DECODED must be 8 bytes");
+_Static_assert(sizeof(LSC_CODE_PAGE *) == 8, "code page pointers must be 8 bytes");
+
+// ... and take the page of the address from its high byte
+_Static_assert(LSC_PAGE_SHIFT == 8, "native stores assume 256 word pages");
+
+typedef struct {
+    LSC_JIT_ENTRY entry; // NULL when no block starts here
+    uint16_t span; // Addresses covered, starting at the block's own address
+    uint16_t max_retired; // Most instructions one call can retire
+    uint16_t size; // Bytes of code. Its relocations come right after it (see lsc_jit_block).
+} LSC_JIT_BLOCK;
+
+struct LSC_JIT {
+    // Indexed by the block's start address
+    LSC_JIT_BLOCK blocks[LSC_MEMORY_MAX];
+
+    // Branch target hit counters. UINT16_MAX means the block could not be compiled, so stop trying.
+    uint16_t hits[LSC_MEMORY_MAX];
+
+    uint16_t dirty_address;
+
+    /*
+    Executable memory
+
+    One big mapping per VM (vm->jit_code), handed out front to back. Blocks that get invalidated are not given back; when
+    the buffer fills up every block is thrown away and compiling starts over from the front.
+    */
+    size_t code_used;
+    int unavailable; // mmap failed (e.g. W^X policy), interpret only
+    uint32_t compiled; // Blocks compiled here, rather than put back by lsc_jit_install
+};
+
+/*
+Relocations
+
+A block's code only depends on where it is for the pointers into the VM it loads (mov r11, imm64), every jump in it is
+relative to itself. Each of those pointers is noted with what it points at, so a block can be moved to another VM's
+executable memory and have them patched (see lsc_jit_install). A relocation is the offset of the pointer in the code,
+with its LSC_JIT_RELOC_* in the bits above LSC_JIT_RELOC_SHIFT.
+*/
+enum {
+    LSC_JIT_RELOC_PAGE_ATTR,
+    LSC_JIT_RELOC_CODE,
+    LSC_JIT_RELOC_PAGE_DIRTY,
+    LSC_JIT_RELOC_PAGE_CODE,
+    LSC_JIT_RELOC_DIRTY_ADDRESS,
+    LSC_JIT_RELOC_COUNT,
+    LSC_JIT_RELOC_SHIFT = 13,
+};
+
+// The JIT's state, from the arena the first time. NULL when out of memory.
+static LSC_JIT *lsc_jit_state(LSC_VM *vm) {
+    if (!vm->jit) {
+        vm->jit = lsc_arena_zalloc(&vm->arena, sizeof(LSC_JIT));
+    }
+    return vm->jit;
+}
+
+// Where the relocations of a block go, after its size bytes of code: how many there are, then each one
+static uint16_t *lsc_jit_relocs(uint8_t *code, uint16_t size) {
+    return (uint16_t *)(void *)(code + ((size + 1u) & ~1u));
+}
+
+static int lsc_jit_branches(uint8_t op) {
+    return op == LSC_OP_BR || op == LSC_OP_JMP || op == LSC_OP_JSR || op == LSC_OP_JSRR;
+}
+
+enum {
+    LSC_JIT_CODE_SIZE = 4 << 20,
+    LSC_JIT_MAX_CODE = 8192, // Room for the largest block: 32 stores come to about 5 KB, their relocations 400 bytes
+    LSC_JIT_MAX_RELOCS = LSC_JIT_MAX_BLOCK * 6, // STI: two page checks and four for the store
+};
+
+_Static_assert(LSC_JIT_MAX_CODE <= 1 << LSC_JIT_RELOC_SHIFT, "relocation offsets must fit below LSC_JIT_RELOC_SHIFT");
+
+#if LSC_HAVE_JIT
+
+static void *lsc_jit_target(LSC_VM *vm, int target) {
+    void *const targets[LSC_JIT_RELOC_COUNT] = {
+        [LSC_JIT_RELOC_PAGE_ATTR] = vm->page_attr,
+        [LSC_JIT_RELOC_CODE] = vm->code,
+        [LSC_JIT_RELOC_PAGE_DIRTY] = vm->page_dirty,
+        [LSC_JIT_RELOC_PAGE_CODE] = vm->page_code,
+        [LSC_JIT_RELOC_DIRTY_ADDRESS] = &vm->jit->dirty_address,
+    };
+    return targets[target];
+}
+
+/*
+x86-64 registers, using the numbers the instruction encoding uses. 8-15 need a REX prefix.
+*/
+enum {
+    LSC_X64_RAX = 0, LSC_X64_RCX, LSC_X64_RDX, LSC_X64_RBX, LSC_X64_RSP, LSC_X64_RBP, LSC_X64_RSI, LSC_X64_RDI,
+    LSC_X64_R8, LSC_X64_R9, LSC_X64_R10, LSC_X64_R11, LSC_X64_R12, LSC_X64_R13, LSC_X64_R14, LSC_X64_R15,
+};
+
+/*
+Where each LC-3 register lives while a block runs.
+
+- rdi holds vm->reg and rsi holds vm->memory, the page table (the first two System V arguments)
+- rax, rcx, rdx, r10 and r11 are scratch
+- Host registers only hold the low 16 bits faithfully. Anything that cares about the upper bits (addresses, flags, the
+  write back) only looks at the low 16.
+*/
+static const uint8_t lsc_x64_reg[8] = {
+    LSC_X64_RBX, LSC_X64_RBP, LSC_X64_R12, LSC_X64_R13, LSC_X64_R14, LSC_X64_R15, LSC_X64_R8, LSC_X64_R9,
+};
+
+typedef struct {
+    LSC_VM *vm;
+    uint8_t *start;
+    uint8_t *p;
+    uint32_t epilogue_fixups[LSC_JIT_MAX_BLOCK * 3 + 2]; // rel32 offsets that must point at the epilogue
+    int fixup_count;
+    uint16_t relocs[LSC_JIT_MAX_RELOCS];
+    int reloc_count;
+} LSC_X64;
+
+static void lsc_x64_u8(LSC_X64 *x, uint8_t v) {
+    *x->p++ = v;
+}
+
+static void lsc_x64_u32(LSC_X64 *x, uint32_t v) {
+    memcpy(x->p, &v, 4);
+    x->p += 4;
+}
+
+static void lsc_x64_u64(LSC_X64 *x, uint64_t v) {
+    memcpy(x->p, &v, 8);
+    x->p += 8;
+}
+
+// REX prefix, only emitted when one of the registers is r8-r15
+static void lsc_x64_rex(LSC_X64 *x, int reg, int index, int base) {
+    uint8_t rex = 0x40 | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+    if (rex != 0x40) {
+        lsc_x64_u8(x, rex);
+    }
+}
+
+static uint8_t lsc_x64_modrm(int mod, int reg, int rm) {
+    return (mod << 6) | ((reg & 7) << 3) | (rm & 7);
+}
+
+// op dst, src where op is 0x89 (mov), 0x01 (add) or 0x21 (and), 32 bit
+static void lsc_x64_rr(LSC_X64 *x, uint8_t op, int dst, int src) {
+    lsc_x64_rex(x, src, 0, dst);
+    lsc_x64_u8(x, op);
+    lsc_x64_u8(x, lsc_x64_modrm(3, src, dst));
+}
+
+// op dst, imm32 where ext is 0 (add) or 4 (and)
+static void lsc_x64_ri(LSC_X64 *x, int ext, int dst, int32_t imm) {
+    lsc_x64_rex(x, 0, 0, dst);
+    lsc_x64_u8(x, 0x81);
+    lsc_x64_u8(x, lsc_x64_modrm(3, ext, dst));
+    lsc_x64_u32(x, (uint32_t)imm);
+}
+
+// mov dst, imm32
+static void lsc_x64_mov_ri(LSC_X64 *x, int dst, uint32_t imm) {
+    lsc_x64_rex(x, 0, 0, dst);
+    lsc_x64_u8(x, 0xB8 + (dst & 7));
+    lsc_x64_u32(x, imm);
+}
+
+// not dst
+static void lsc_x64_not(LSC_X64 *x, int dst) {
+    lsc_x64_rex(x, 0, 0, dst);
+    lsc_x64_u8(x, 0xF7);
+    lsc_x64_u8(x, lsc_x64_modrm(3, 2, dst));
+}
+
+// movzx dst, src16
+static void lsc_x64_movzx_rr(LSC_X64 *x, int dst, int src) {
+    lsc_x64_rex(x, dst, 0, src);
+    lsc_x64_u8(x, 0x0F);
+    lsc_x64_u8(x, 0xB7);
+    lsc_x64_u8(x, lsc_x64_modrm(3, dst, src));
+}
+
+// movzx dst, word [rdi + disp] (read an LC-3 register)
+static void lsc_x64_load_reg(LSC_X64 *x, int dst, int lc3_reg) {
+    lsc_x64_rex(x, dst, 0, LSC_X64_RDI);
+    lsc_x64_u8(x, 0x0F);
+    lsc_x64_u8(x, 0xB7);
+    lsc_x64_u8(x, lsc_x64_modrm(1, dst, LSC_X64_RDI));
+    lsc_x64_u8(x, lc3_reg * 2);
+}
+
+// mov word [rdi + disp], src16 (write an LC-3 register)
+static void lsc_x64_store_reg(LSC_X64 *x, int lc3_reg, int src) {
+    lsc_x64_u8(x, 0x66);
+    lsc_x64_rex(x, src, 0, LSC_X64_RDI);
+    lsc_x64_u8(x, 0x89);
+    lsc_x64_u8(x, lsc_x64_modrm(1, src, LSC_X64_RDI));
+    lsc_x64_u8(x, lc3_reg * 2);
+}
+
+// rcx = the words of the page of eax, edx = where eax is in it
+static void lsc_x64_page(LSC_X64 *x) {
+    // movzx ecx, ah; mov rcx, [rsi + rcx*8]; movzx edx, al
+    lsc_x64_u8(x, 0x0F); lsc_x64_u8(x, 0xB6); lsc_x64_u8(x, 0xCC);
+    lsc_x64_u8(x, 0x48); lsc_x64_u8(x, 0x8B); lsc_x64_u8(x, 0x0C); lsc_x64_u8(x, 0xCE);
+    lsc_x64_u8(x, 0x0F); lsc_x64_u8(x, 0xB6); lsc_x64_u8(x, 0xD0);
+}
+
+// movzx dst, word [rcx + rdx*2] (read memory[eax], eax is left alone)
+static void lsc_x64_load_mem(LSC_X64 *x, int dst) {
+    lsc_x64_page(x);
+    lsc_x64_rex(x, dst, 0, LSC_X64_RCX);
+    lsc_x64_u8(x, 0x0F);
+    lsc_x64_u8(x, 0xB7);
+    lsc_x64_u8(x, lsc_x64_modrm(0, dst, 4));
+    lsc_x64_u8(x, 0x51); // SIB: scale 2, index rdx, base rcx
+}
+
+// mov word [rcx + rdx*2], src16 (write memory[eax], which must be a page the VM owns)
+static void lsc_x64_store_mem(LSC_X64 *x, int src) {
+    lsc_x64_page(x);
+    lsc_x64_u8(x, 0x66);
+    lsc_x64_rex(x, src, 0, LSC_X64_RCX);
+    lsc_x64_u8(x, 0x89);
+    lsc_x64_u8(x, lsc_x64_modrm(0, src, 4));
+    lsc_x64_u8(x, 0x51);
+}
+
+// mov r11, imm64 with the address of a table in the VM (LSC_JIT_RELOC_*)
+static void lsc_x64_mov_r11_vm(LSC_X64 *x, int target) {
+    lsc_x64_u8(x, 0x49);
+    lsc_x64_u8(x, 0xBB);
+    x->relocs[x->reloc_count++] = (uint16_t)((x->p - x->start) | target << LSC_JIT_RELOC_SHIFT);
+    lsc_x64_u64(x, (uint64_t)(uintptr_t)lsc_jit_target(x->vm, target));
+}
+
+// jmp rel32 to the epilogue, patched once the epilogue has been emitted
+static void lsc_x64_jmp_epilogue(LSC_X64 *x) {
+    lsc_x64_u8(x, 0xE9);
+    x->epilogue_fixups[x->fixup_count++] = (uint32_t)(x->p - x->start);
+    lsc_x64_u32(x, 0);
+}
+
+// Emit a near conditional jump (0x0F cc) with a placeholder, return where to patch it
+static uint8_t *lsc_x64_jcc(LSC_X64 *x, uint8_t cc) {
+    lsc_x64_u8(x, 0x0F);
+    lsc_x64_u8(x, cc);
+    uint8_t *patch = x->p;
+    lsc_x64_u32(x, 0);
+    return patch;
+}
+
+// Point a jump emitted by lsc_x64_jcc at the current position
+static void lsc_x64_land(LSC_X64 *x, uint8_t *patch) {
+    uint32_t rel = (uint32_t)(x->p - (patch + 4));
+    memcpy(patch, &rel, 4);
+}
+
+/*
+Write COND from the last value that would have set the flags.
+
+Flags are computed lazily inside a block: only the last flag-setting instruction before an exit matters, so COND is only
+written at exits (and before a BR reads it). Branchless:
+- eax = P, then Z if the value is zero, then N if its sign bit is set
+*/
+static void lsc_x64_flush_flags(LSC_X64 *x, int flag_reg) {
+    if (flag_reg < 0) {
+        return;
+    }
+    int h = lsc_x64_reg[flag_reg];
+
+    // test h16, h16
+    lsc_x64_u8(x, 0x66);
+    lsc_x64_rex(x, h, 0, h);
+    lsc_x64_u8(x, 0x85);
+    lsc_x64_u8(x, lsc_x64_modrm(3, h, h));
+
+    lsc_x64_mov_ri(x, LSC_X64_RAX, LSC_FL_POS);
+    lsc_x64_mov_ri(x, LSC_X64_RCX, LSC_FL_ZRO);
+    lsc_x64_u8(x, 0x0F); lsc_x64_u8(x, 0x44); lsc_x64_u8(x, 0xC1); // cmovz eax, ecx
+    lsc_x64_mov_ri(x, LSC_X64_RCX, LSC_FL_NEG);
+    lsc_x64_u8(x, 0x0F); lsc_x64_u8(x, 0x48); lsc_x64_u8(x, 0xC1); // cmovs eax, ecx
+
+    lsc_x64_store_reg(x, LSC_R_COND, LSC_X64_RAX);
+}
+
+// add r10d, imm32 (r10d counts retired instructions)
+static void lsc_x64_retire(LSC_X64 *x, uint32_t retired) {
+    lsc_x64_ri(x, 0, LSC_X64_R10, (int32_t)retired);
+}
+
+// Leave the block with PC = next_pc (already in edx if next_pc < 0) having retired `retired` more instructions
+static void lsc_x64_exit(LSC_X64 *x, int32_t next_pc, uint32_t retired) {
+    if (next_pc >= 0) {
+        lsc_x64_mov_ri(x, LSC_X64_RDX, (uint32_t)next_pc);
+    }
+    lsc_x64_retire(x, retired);
+    lsc_x64_jmp_epilogue(x);
+}
+
+/*
+Branch back to the top of the block if the budget allows another full pass, else leave with PC = start.
+
+COND has already been written by the BR, so the next pass can start with nothing pending.
+*/
+static void lsc_x64_loop(LSC_X64 *x, uint8_t *top, uint16_t start, uint32_t retired) {
+    lsc_x64_retire(x, retired);
+
+    // mov eax, [rsp] (the budget); sub eax, r10d; cmp eax, retired
+    lsc_x64_u8(x, 0x8B); lsc_x64_u8(x, 0x04); lsc_x64_u8(x, 0x24);
+    lsc_x64_u8(x, 0x44); lsc_x64_u8(x, 0x29); lsc_x64_u8(x, 0xD0);
+    lsc_x64_u8(x, 0x3D); lsc_x64_u32(x, retired);
+    uint8_t *out_of_budget = lsc_x64_jcc(x, 0x82); // jb out_of_budget
+
+    // jmp top
+    lsc_x64_u8(x, 0xE9);
+    lsc_x64_u32(x, (uint32_t)(top - (x->p + 4)));
+
+    lsc_x64_land(x, out_of_budget);
+    lsc_x64_exit(x, start, 0);
+}
+
+// eax = the 16 bit address base + offset
+static void lsc_x64_address(LSC_X64 *x, int lc3_base, uint16_t offset) {
+    lsc_x64_rr(x, 0x89, LSC_X64_RAX, lsc_x64_reg[lc3_base]);
+    lsc_x64_ri(x, 0, LSC_X64_RAX, (int16_t)offset);
+    lsc_x64_movzx_rr(x, LSC_X64_RAX, LSC_X64_RAX);
+}
+
+/*
+Leave the block before the instruction at address if the page of eax has any of attributes (see LSC_PAGE_DEVICE), so
+the interpreter does the access through lsc_mem_read/lsc_mem_write. Native code knows nothing about devices, and only
+stores to pages the VM owns: loads check for LSC_PAGE_DEVICE, stores for LSC_PAGE_SHARED as well.
+*/
+static void lsc_x64_page_check(LSC_X64 *x, uint8_t attributes, int flag_reg, uint16_t address, uint16_t span) {
+    // movzx ecx, ah; mov r11, page_attr; test byte [r11 + rcx], attributes
+    lsc_x64_u8(x, 0x0F); lsc_x64_u8(x, 0xB6); lsc_x64_u8(x, 0xCC);
+    lsc_x64_mov_r11_vm(x, LSC_JIT_RELOC_PAGE_ATTR);
+    lsc_x64_u8(x, 0x41); lsc_x64_u8(x, 0xF6); lsc_x64_u8(x, 0x04); lsc_x64_u8(x, 0x0B); lsc_x64_u8(x, attributes);
+    uint8_t *memory = lsc_x64_jcc(x, 0x84); // jz memory
+
+    lsc_x64_flush_flags(x, flag_reg);
+    lsc_x64_exit(x, address, span);
+    lsc_x64_land(x, memory);
+}
+
+// End the block just before the instruction at address, leaving that one to the interpreter. Returns the block's span.
+static uint16_t lsc_x64_end_before(LSC_X64 *x, uint16_t address, uint16_t span, int flag_reg, uint16_t *max_retired) {
+    if (span == 0) {
+        return 0;
+    }
+    lsc_x64_flush_flags(x, flag_reg);
+    lsc_x64_exit(x, address, span);
+    *max_retired = span;
+    return span;
+}
+
+/*
+Store src to memory[eax], the native version of lsc_mem_write.
+
+It marks the page dirty, and like the interpreter it skips the rest on a page nothing has been decoded from. Otherwise
+it resets the predecode entry, and the two before it in case a superinstruction covers this address. Those two stay in
+the page (superinstructions never reach across one), wrapping round to its end at the start of it, which only means that
+entry is decoded again. If the address is covered by compiled code the block exits right after the store, so the
+dispatcher can throw away the stale blocks before anything runs them.
+*/
+static void lsc_x64_store(LSC_X64 *x, int lc3_src, int flag_reg, uint16_t next_pc, uint32_t retired) {
+    lsc_x64_store_mem(x, lsc_x64_reg[lc3_src]);
+
+    // movzx ecx, ah (the page); mov r11, page_dirty; mov byte [r11 + rcx], 1
+    lsc_x64_u8(x, 0x0F); lsc_x64_u8(x, 0xB6); lsc_x64_u8(x, 0xCC);
+    lsc_x64_mov_r11_vm(x, LSC_JIT_RELOC_PAGE_DIRTY);
+    lsc_x64_u8(x, 0x41); lsc_x64_u8(x, 0xC6); lsc_x64_u8(x, 0x04); lsc_x64_u8(x, 0x0B);
+    lsc_x64_u8(x, 0x01);
+
+    // mov r11, page_code; cmp byte [r11 + rcx], 0
+    lsc_x64_mov_r11_vm(x, LSC_JIT_RELOC_PAGE_CODE);
+    lsc_x64_u8(x, 0x41); lsc_x64_u8(x, 0x80); lsc_x64_u8(x, 0x3C); lsc_x64_u8(x, 0x0B);
+    lsc_x64_u8(x, 0x00);
+    uint8_t *data = lsc_x64_jcc(x, 0x84); // je data
+
+    // mov r11, code; mov r11, [r11 + rcx*8] (the page's own, since page_code is set)
+    lsc_x64_mov_r11_vm(x, LSC_JIT_RELOC_CODE);
+    lsc_x64_u8(x, 0x4D); lsc_x64_u8(x, 0x8B); lsc_x64_u8(x, 0x1C); lsc_x64_u8(x, 0xCB);
+
+    for (int back = 0; back < LSC_FUSE_MAX; ++back) {
+        // lea ecx, [rax - back]; movzx ecx, cl; mov byte [r11 + rcx*8], LSC_OP_DECODE
+        lsc_x64_u8(x, 0x8D); lsc_x64_u8(x, 0x48); lsc_x64_u8(x, (uint8_t)-back);
+        lsc_x64_u8(x, 0x0F); lsc_x64_u8(x, 0xB6); lsc_x64_u8(x, 0xC9);
+        lsc_x64_u8(x, 0x41); lsc_x64_u8(x, 0xC6); lsc_x64_u8(x, 0x04); lsc_x64_u8(x, 0xCB);
+        lsc_x64_u8(x, LSC_OP_DECODE);
+    }
+
+    // movzx ecx, al; cmp byte [r11 + rcx + jit_code_map], 0
+    lsc_x64_u8(x, 0x0F); lsc_x64_u8(x, 0xB6); lsc_x64_u8(x, 0xC8);
+    lsc_x64_u8(x, 0x41); lsc_x64_u8(x, 0x80); lsc_x64_u8(x, 0xBC); lsc_x64_u8(x, 0x0B);
+    lsc_x64_u32(x, (uint32_t)offsetof(LSC_CODE_PAGE, jit_code_map));
+    lsc_x64_u8(x, 0x00);
+
+    uint8_t *clean = lsc_x64_jcc(x, 0x84); // je clean
+
+    // mov word [r11], ax (the dirty address)
+    lsc_x64_mov_r11_vm(x, LSC_JIT_RELOC_DIRTY_ADDRESS);
+    lsc_x64_u8(x, 0x66); lsc_x64_u8(x, 0x41); lsc_x64_u8(x, 0x89); lsc_x64_u8(x, 0x03);
+    lsc_x64_flush_flags(x, flag_reg);
+    lsc_x64_exit(x, next_pc, retired | LSC_JIT_DIRTY);
+
+    lsc_x64_land(x, clean);
+    lsc_x64_land(x, data);
+}
+
+/*
+Compile the block starting at start. Returns the number of addresses it covers, or 0 if not even the first
+instruction could be compiled.
+*/
+static uint16_t lsc_jit_compile_x64(LSC_X64 *x, uint16_t start, uint16_t *max_retired) {
+    static const uint8_t pushes[] = {
+        0x53, // push rbx
+        0x55, // push rbp
+        0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57, // push r12-r15
+        0x52, // push rdx (the budget, read back from [rsp])
+        0x45, 0x31, 0xD2, // xor r10d, r10d
+    };
+    memcpy(x->p, pushes, sizeof(pushes));
+    x->p += sizeof(pushes);
+
+    for (int r = 0; r < 8; ++r) {
+        lsc_x64_load_reg(x, lsc_x64_reg[r], r);
+    }
+
+    uint8_t *top = x->p;
+
+    int flag_reg = -1; // LC-3 register holding the last flag-setting result, -1 if COND is already up to date
+    uint16_t span = 0;
+    int ended = 0;
+
+    while (!ended && span < LSC_JIT_MAX_BLOCK && (uint32_t)start + span < LSC_MEMORY_MAX) {
+        uint16_t address = start + span;
+        uint16_t next = address + 1;
+
+        LSC_DECODED *entry = lsc_decoded(x->vm, address);
+        if (entry->op == LSC_OP_DECODE) {
+            entry = lsc_decode(x->vm, address);
+        }
+        // No memory for its code page, so nothing could note compiled code covers it: the interpreter runs it
+        if (entry == &x->vm->spare) {
+            return lsc_x64_end_before(x, address, span, flag_reg, max_retired);
+        }
+        LSC_DECODED d = *entry;
+        // The interpreter stops on a breakpoint, so it has to be the one to get there
+        if (d.op == LSC_OP_BREAK) {
+            return lsc_x64_end_before(x, address, span, flag_reg, max_retired);
+        }
+        // Superinstructions are for the interpreter, native code is compiled one instruction at a time
+        d.op = d.base;
+
+        int dr = lsc_x64_reg[d.dr];
+        int sr1 = lsc_x64_reg[d.sr1];
+        int sr2 = lsc_x64_reg[d.sr2];
+        uint32_t retired = span + 1;
+
+        // Loads and stores whose address is fixed and in a device's page are left to the interpreter, like TRAP
+        int fixed_address = d.op == LSC_OP_LD || d.op == LSC_OP_LDI || d.op == LSC_OP_ST || d.op == LSC_OP_STI;
+        if (fixed_address && (x->vm->page_attr[(uint16_t)(next + d.imm) >> LSC_PAGE_SHIFT] & LSC_PAGE_DEVICE)) {
+            return lsc_x64_end_before(x, address, span, flag_reg, max_retired);
+        }
+
+        switch (d.op) {
+            case LSC_OP_ADD:
+            case LSC_OP_AND: {
+                uint8_t op = (d.op == LSC_OP_ADD) ? 0x01 : 0x21;
+                // Both are commutative, so dr == sr2 can use sr1 as the other operand
+                if (dr == sr2) {
+                    lsc_x64_rr(x, op, dr, sr1);
+                } else {
+                    if (dr != sr1) {
+                        lsc_x64_rr(x, 0x89, dr, sr1);
+                    }
+                    lsc_x64_rr(x, op, dr, sr2);
+                }
+                flag_reg = d.dr;
+                break;
+            }
+            case LSC_OP_ADDI:
+            case LSC_OP_ANDI: {
+                if (dr != sr1) {
+                    lsc_x64_rr(x, 0x89, dr, sr1);
+                }
+                lsc_x64_ri(x, (d.op == LSC_OP_ADDI) ? 0 : 4, dr, (int16_t)d.imm);
+                flag_reg = d.dr;
+                break;
+            }
+            case LSC_OP_NOT: {
+                if (dr != sr1) {
+                    lsc_x64_rr(x, 0x89, dr, sr1);
+                }
+                lsc_x64_not(x, dr);
+                flag_reg = d.dr;
+                break;
+            }
+            case LSC_OP_LEA: {
+                lsc_x64_mov_ri(x, dr, (uint16_t)(next + d.imm));
+                flag_reg = d.dr;
+                break;
+            }
+            case LSC_OP_LD:
+            case LSC_OP_LDI: {
+                lsc_x64_mov_ri(x, LSC_X64_RAX, (uint16_t)(next + d.imm));
+                if (d.op == LSC_OP_LDI) {
+                    lsc_x64_load_mem(x, LSC_X64_RAX);
+                    lsc_x64_page_check(x, LSC_PAGE_DEVICE, flag_reg, address, span);
+                }
+                lsc_x64_load_mem(x, dr);
+                flag_reg = d.dr;
+                break;
+            }
+            case LSC_OP_LDR: {
+                lsc_x64_address(x, d.sr1, d.imm);
+                lsc_x64_page_check(x, LSC_PAGE_DEVICE, flag_reg, address, span);
+                lsc_x64_load_mem(x, dr);
+                flag_reg = d.dr;
+                break;
+            }
+            case LSC_OP_ST:
+            case LSC_OP_STI: {
+                lsc_x64_mov_ri(x, LSC_X64_RAX, (uint16_t)(next + d.imm));
+                if (d.op == LSC_OP_STI) {
+                    lsc_x64_load_mem(x, LSC_X64_RAX);
+                }
+                // Even a fixed address may be on a page the VM does not own by the time this runs
+                lsc_x64_page_check(x, 0xFF, flag_reg, address, span);
+                lsc_x64_store(x, d.dr, flag_reg, next, retired);
+                break;
+            }
+            case LSC_OP_STR: {
+                lsc_x64_address(x, d.sr1, d.imm);
+                lsc_x64_page_check(x, 0xFF, flag_reg, address, span);
+                lsc_x64_store(x, d.dr, flag_reg, next, retired);
+                break;
+            }
+            case LSC_OP_BR: {
+                uint16_t target = next + d.imm;
+                uint8_t nzp = d.dr;
+
+                if (nzp == 0) {
+                    // Never taken, so it is a no-op
+                    break;
+                }
+
+                lsc_x64_flush_flags(x, flag_reg);
+                flag_reg = -1;
+
+                if (nzp != (LSC_FL_NEG | LSC_FL_ZRO | LSC_FL_POS)) {
+                    // test byte [rdi + COND], nzp
+                    lsc_x64_u8(x, 0xF6);
+                    lsc_x64_u8(x, lsc_x64_modrm(1, 0, LSC_X64_RDI));
+                    lsc_x64_u8(x, LSC_R_COND * 2);
+                    lsc_x64_u8(x, nzp);
+                    uint8_t *not_taken = lsc_x64_jcc(x, 0x84); // jz not_taken
+                    if (target == start) {
+                        lsc_x64_loop(x, top, start, retired);
+                    } else {
+                        lsc_x64_exit(x, target, retired);
+                    }
+                    lsc_x64_land(x, not_taken);
+                    lsc_x64_exit(x, next, retired);
+                } else if (target == start) {
+                    lsc_x64_loop(x, top, start, retired);
+                } else {
+                    lsc_x64_exit(x, target, retired);
+                }
+                ended = 1;
+                break;
+            }
+            case LSC_OP_JMP: {
+                lsc_x64_flush_flags(x, flag_reg);
+                lsc_x64_movzx_rr(x, LSC_X64_RDX, sr1);
+                lsc_x64_exit(x, -1, retired);
+                ended = 1;
+                break;
+            }
+            case LSC_OP_JSR: {
+                lsc_x64_flush_flags(x, flag_reg);
+                lsc_x64_mov_ri(x, lsc_x64_reg[LSC_R_R7], next);
+                lsc_x64_exit(x, (uint16_t)(next + d.imm), retired);
+                ended = 1;
+                break;
+            }
+            case LSC_OP_JSRR: {
+                // Read BaseR before R7 is overwritten, JSRR R7 is allowed
+                lsc_x64_flush_flags(x, flag_reg);
+                lsc_x64_movzx_rr(x, LSC_X64_RDX, sr1);
+                lsc_x64_mov_ri(x, lsc_x64_reg[LSC_R_R7], next);
+                lsc_x64_exit(x, -1, retired);
+                ended = 1;
+                break;
+            }
+            default: {
+                // TRAP, RTI, RES: leave them to the interpreter
+                return lsc_x64_end_before(x, address, span, flag_reg, max_retired);
+            }
+        }
+
+        ++span;
+    }
+
+    if (!ended) {
+        // Ran out of room (or memory), carry on at the next address
+        lsc_x64_flush_flags(x, flag_reg);
+        lsc_x64_exit(x, (uint16_t)(start + span), span);
+    }
+
+    *max_retired = span;
+    return span;
+}
+
+// Write every register back, set PC from edx and return r10d
+static void lsc_x64_epilogue(LSC_X64 *x) {
+    uint32_t here = (uint32_t)(x->p - x->start);
+    for (int i = 0; i < x->fixup_count; ++i) {
+        uint32_t at = x->epilogue_fixups[i];
+        uint32_t rel = here - (at + 4);
+        memcpy(x->start + at, &rel, 4);
+    }
+
+    for (int r = 0; r < 8; ++r) {
+        lsc_x64_store_reg(x, r, lsc_x64_reg[r]);
+    }
+    lsc_x64_store_reg(x, LSC_R_PC, LSC_X64_RDX);
+    lsc_x64_rr(x, 0x89, LSC_X64_RAX, LSC_X64_R10); // mov eax, r10d
+
+    static const uint8_t pops[] = {
+        0x5A, // pop rdx
+        0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, // pop r15-r12
+        0x5D, // pop rbp
+        0x5B, // pop rbx
+        0xC3, // ret
+    };
+    memcpy(x->p, pops, sizeof(pops));
+    x->p += sizeof(pops);
+}
+
+// Map the executable memory the first time it is needed. Returns 0 if there is none.
+static int lsc_jit_map(LSC_VM *vm) {
+    LSC_JIT *jit = vm->jit;
+    if (!vm->jit_code && !jit->unavailable) {
+        void *code = mmap(NULL, LSC_JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (code == MAP_FAILED) {
+            jit->unavailable = 1;
+        } else {
+            vm->jit_code = code;
+        }
+    }
+    return !jit->unavailable;
+}
+
+// Make the code at jit->code_used, with its relocations in place after it, the block for start
+static void lsc_jit_add(LSC_VM *vm, uint16_t start, uint16_t span, uint16_t max_retired, uint16_t size) {
+    LSC_JIT *jit = vm->jit;
+    uint8_t *code = (uint8_t *)vm->jit_code + jit->code_used;
+    uint16_t *relocs = lsc_jit_relocs(code, size);
+
+    // Keep every block 16 byte aligned, which is what the CPU likes jump targets to be
+    size_t end = (size_t)((uint8_t *)(relocs + 1 + relocs[0]) - (uint8_t *)vm->jit_code);
+    jit->code_used = (end + 15) & ~(size_t)15;
+
+    LSC_JIT_BLOCK *block = &jit->blocks[start];
+    block->entry = (LSC_JIT_ENTRY)(void *)code;
+    block->span = span;
+    block->max_retired = max_retired;
+    block->size = size;
+
+    // Every address was decoded on a code page of the VM's own, see lsc_jit_compile_x64 and lsc_jit_install
+    for (uint16_t i = 0; i < span; ++i) {
+        ++*lsc_code_map(vm, (uint16_t)(start + i));
+    }
+}
+
+static void lsc_jit_compile(LSC_VM *vm, uint16_t start) {
+    LSC_JIT *jit = vm->jit;
+
+    // Left to the interpreter while a breakpoint is there, and free to get hot again once it is gone
+    if (vm->breakpoints && vm->breakpoints[start]) {
+        jit->hits[start] = 0;
+        return;
+    }
+
+    if (!lsc_jit_map(vm)) {
+        jit->hits[start] = UINT16_MAX;
+        return;
+    }
+
+    if (LSC_JIT_CODE_SIZE - jit->code_used < LSC_JIT_MAX_CODE) {
+        lsc_jit_reset(vm);
+    }
+
+    LSC_X64 x;
+    x.vm = vm;
+    x.start = x.p = (uint8_t *)vm->jit_code + jit->code_used;
+    x.fixup_count = 0;
+    x.reloc_count = 0;
+
+    uint16_t max_retired = 0;
+    uint16_t span = lsc_jit_compile_x64(&x, start, &max_retired);
+    if (span == 0) {
+        jit->hits[start] = UINT16_MAX;
+        return;
+    }
+    lsc_x64_epilogue(&x);
+
+    uint16_t size = (uint16_t)(x.p - x.start);
+    uint16_t *relocs = lsc_jit_relocs(x.start, size);
+    relocs[0] = (uint16_t)x.reloc_count;
+    memcpy(relocs + 1, x.relocs, x.reloc_count * sizeof(uint16_t));
+    lsc_jit_add(vm, start, span, max_retired, size);
+    ++jit->compiled;
+    if (vm->metrics) {
+        lsc_metrics_add(&vm->metrics->jit_compiles, 1);
+    }
+}
+
+int lsc_jit_install(LSC_VM *vm, const LSC_JIT_CODE *code) {
+    LSC_JIT *jit = lsc_jit_state(vm);
+    if (!jit || !lsc_jit_map(vm) || jit->blocks[code->start].entry) {
+        return 0;
+    }
+    if (code->span == 0 || code->span > LSC_JIT_MAX_BLOCK || (uint32_t)code->start + code->span > LSC_MEMORY_MAX ||
+        code->size > LSC_JIT_MAX_CODE - 2 * (LSC_JIT_MAX_RELOCS + 2) || code->reloc_count > LSC_JIT_MAX_RELOCS) {
+        return 0;
+    }
+    // Rather than throw away what is there already
+    if (LSC_JIT_CODE_SIZE - jit->code_used < LSC_JIT_MAX_CODE) {
+        return 0;
+    }
+
+    // Stores to it have to find it, as they would if its code had been decoded here
+    for (uint32_t a = code->start; a < (uint32_t)code->start + code->span; ++a) {
+        if (!lsc_code_page(vm, a >> LSC_PAGE_SHIFT)) {
+            return 0;
+        }
+        vm->page_code[a >> LSC_PAGE_SHIFT] = 1;
+    }
+
+    uint8_t *p = (uint8_t *)vm->jit_code + jit->code_used;
+    memcpy(p, code->code, code->size);
+    uint16_t *relocs = lsc_jit_relocs(p, code->size);
+    relocs[0] = code->reloc_count;
+    for (uint16_t i = 0; i < code->reloc_count; ++i) {
+        uint16_t reloc = code->relocs[i];
+        uint16_t at = reloc & ((1u << LSC_JIT_RELOC_SHIFT) - 1);
+        int target = reloc >> LSC_JIT_RELOC_SHIFT;
+        // Nothing is a block until lsc_jit_add, so giving up here leaves no trace
+        if (target >= LSC_JIT_RELOC_COUNT || at < 2 || at + 8u > code->size || p[at - 2] != 0x49 || p[at - 1] != 0xBB) {
+            return 0;
+        }
+        uint64_t pointer = (uint64_t)(uintptr_t)lsc_jit_target(vm, target);
+        memcpy(p + at, &pointer, sizeof(pointer));
+        relocs[1 + i] = reloc;
+    }
+    lsc_jit_add(vm, code->start, code->span, code->max_retired, code->size);
+    return 1;
+}
+
+static void lsc_jit_free_code(LSC_VM *vm) {
+    if (vm->jit_code) {
+        munmap(vm->jit_code, LSC_JIT_CODE_SIZE);
+        vm->jit_code = NULL;
+    }
+}
+
+#else
+
+static void lsc_jit_compile(LSC_VM *vm, uint16_t start) {
+    vm->jit->hits[start] = UINT16_MAX;
+}
+
+int lsc_jit_install(LSC_VM *vm, const LSC_JIT_CODE *code) {
+    (void)vm;
+    (void)code;
+    return 0;
+}
+
+static void lsc_jit_free_code(LSC_VM *vm) {
+    (void)vm;
+}
+
+#endif
+
+// No compiled code anywhere. Only code pages of the VM's own can say there is any.
+static void lsc_jit_clear_map(LSC_VM *vm) {
+    for (uint32_t page = 0; page < LSC_PAGE_COUNT; ++page) {
+        if (vm->code[page] != &lsc_code_none) {
+            memset(vm->code[page]->jit_code_map, 0, sizeof(vm->code[page]->jit_code_map));
+        }
+    }
+}
+
+void lsc_jit_reset(LSC_VM *vm) {
+    LSC_JIT *jit = vm->jit;
+    lsc_jit_clear_map(vm);
+    if (!jit) {
+        return;
+    }
+    memset(jit->blocks, 0, sizeof(jit->blocks));
+    memset(jit->hits, 0, sizeof(jit->hits));
+    jit->code_used = 0;
+}
+
+void lsc_jit_invalidate(LSC_VM *vm, uint16_t address) {
+    LSC_JIT *jit = vm->jit;
+
+    // Any block covering address must start at most LSC_JIT_MAX_BLOCK - 1 addresses before it
+    for (int back = 0; back < LSC_JIT_MAX_BLOCK && *lsc_code_map(vm, address); ++back) {
+        uint16_t start = address - back;
+        LSC_JIT_BLOCK *block = &jit->blocks[start];
+        if (block->entry && back < block->span) {
+            for (uint16_t i = 0; i < block->span; ++i) {
+                --*lsc_code_map(vm, (uint16_t)(start + i));
+            }
+            block->entry = NULL;
+            // The code may be different now, give it a chance to get hot again
+            jit->hits[start] = 0;
+        }
+    }
+}
+
+int lsc_jit_block(const LSC_VM *vm, uint16_t start, LSC_JIT_CODE *code) {
+    if (!vm->jit || !vm->jit->blocks[start].entry) {
+        return 0;
+    }
+    const LSC_JIT_BLOCK *block = &vm->jit->blocks[start];
+    code->start = start;
+    code->span = block->span;
+    code->max_retired = block->max_retired;
+    code->size = block->size;
+    code->code = (const uint8_t *)(void *)block->entry;
+    const uint16_t *relocs = lsc_jit_relocs((uint8_t *)(void *)block->entry, block->size);
+    code->reloc_count = relocs[0];
+    code->relocs = relocs + 1;
+    return 1;
+}
+
+uint32_t lsc_jit_compiled(const LSC_VM *vm) {
+    return vm->jit ? vm->jit->compiled : 0;
+}
+
+void lsc_jit_clear(LSC_VM *vm) {
+    if (!vm->jit) {
+        return;
+    }
+    // The state itself belongs to the arena
+    vm->jit = NULL;
+    lsc_jit_clear_map(vm);
+}
+
+void lsc_jit_destroy(LSC_VM *vm) {
+    lsc_jit_clear(vm);
+    lsc_jit_free_code(vm);
+}
+
+uint64_t lsc_run_jit(LSC_VM *vm, uint64_t budget) {
+    uint64_t executed = 0;
+
+    LSC_JIT *jit = lsc_jit_state(vm);
+    if (!jit) {
+        // No room for the JIT, the interpreter alone is still correct
+        return lsc_run_switch(vm, budget);
+    }
+    uint16_t cc = lsc_cond_value(vm->reg[LSC_R_COND]);
+
+    while (executed < budget) {
+        // Tier 0: interpret one instruction
+        uint16_t pc = vm->reg[LSC_R_PC]++;
+        LSC_DECODED *d = lsc_decoded(vm, pc);
+        uint8_t op = d->op;
+
+lsc_jit_dispatch:
+        switch (op) {
+#define LSC_CASE(op) case op:
+#define LSC_NEXT break
+#define LSC_JUMP break
+#define LSC_CHECKPOINT (void)0
+#define LSC_DISPATCH() op = d->op; goto lsc_jit_dispatch
+#define LSC_DISPATCH_BASE() op = d->base; goto lsc_jit_dispatch
+#define LSC_STOP ++executed; goto lsc_jit_done
+#define LSC_YIELD vm->reg[LSC_R_PC] = pc; goto lsc_jit_done
+#define LSC_STEP \
+    if (++executed >= budget) goto lsc_jit_done; \
+    pc = vm->reg[LSC_R_PC]++; \
+    d = lsc_decoded_next(vm, d, pc)
+#include "lsc_ops.h"
+#undef LSC_CASE
+#undef LSC_NEXT
+#undef LSC_JUMP
+#undef LSC_CHECKPOINT
+#undef LSC_DISPATCH
+#undef LSC_DISPATCH_BASE
+#undef LSC_STOP
+#undef LSC_YIELD
+#undef LSC_STEP
+            default: break;
+        }
+        ++executed;
+
+        if (!lsc_jit_branches(d->base)) {
+            continue;
+        }
+
+        // Tier 1: keep running native blocks for as long as control lands on one. Native code reads and writes COND itself.
+        vm->reg[LSC_R_COND] = lsc_cond_flags(cc);
+        for (;;) {
+            uint16_t target = vm->reg[LSC_R_PC];
+            LSC_JIT_BLOCK *block = &jit->blocks[target];
+
+            if (!block->entry) {
+                if (jit->hits[target] == UINT16_MAX || ++jit->hits[target] < LSC_JIT_HOT) {
+                    break;
+                }
+                lsc_jit_compile(vm, target);
+                if (!block->entry) {
+                    break;
+                }
+            }
+
+            // Never run past the budget, let the interpreter finish off the last few instructions
+            if (block->max_retired > budget - executed) {
+                break;
+            }
+
+            uint64_t left = budget - executed;
+            uint32_t retired = block->entry(vm->reg, vm->memory, left < LSC_JIT_MAX_BUDGET ? (uint32_t)left : LSC_JIT_MAX_BUDGET);
+            if (retired & LSC_JIT_DIRTY) {
+                lsc_jit_invalidate(vm, jit->dirty_address);
+                retired &= ~LSC_JIT_DIRTY;
+            }
+            executed += retired;
+
+            // Left straight away (a device register access), so the interpreter has to run that instruction
+            if (retired == 0) {
+                break;
+            }
+        }
+        cc = lsc_cond_value(vm->reg[LSC_R_COND]);
+    }
+
+lsc_jit_done:
+    vm->reg[LSC_R_COND] = lsc_cond_flags(cc);
+    return executed;
+}
@@ -0,0 +1,85 @@
+#ifndef LSC_JIT_H
+#define LSC_JIT_H
+
+#include <stdint.h>
+
+#include "lsc_vm.h"
+
+/*
+Basic-block JIT
+
+The JIT engine is the switch interpreter (tier 0) plus a compiler for hot code (tier 1).
+
+1. Every time a BR, JMP, JSR or JSRR lands on an address, that address' hit counter goes up
+2. Once it reaches LSC_JIT_HOT, the basic block starting there is compiled to native code
+3. From then on, landing on that address runs the native block instead of interpreting it
+
+A basic block runs from its start address up to and including the first instruction that changes the PC (or up to
+LSC_JIT_MAX_BLOCK instructions). Inside a block, R0-R7 live in host registers and are only written back to lsc_reg when
+the block exits.
+
+The interpreter stays the correctness reference: anything the compiler does not support ends the block, and the
+interpreter runs it instead.
+
+Only x86-64 hosts get native code. Everywhere else the JIT engine runs tier 0 on its own.
+*/
+#if defined(__x86_64__) && !defined(LSC_NO_JIT)
+#define LSC_HAVE_JIT 1
+#else
+#define LSC_HAVE_JIT 0
+#endif
+
+enum {
+    LSC_JIT_HOT = 50, // Hits on a branch target before its block is compiled
+    LSC_JIT_MAX_BLOCK = 32, // Most instructions compiled into one block
+};
+
+/*
+lsc_code_map(vm, address) counts how many compiled blocks cover each address (see Code pages in lsc_vm.h).
+
+This lets a store find out whether it just overwrote compiled code with a single byte load. Blocks can overlap (a branch
+into the middle of an existing block starts a new one), which is why it is a count and not a flag.
+*/
+
+// Throw away every compiled block and hit counter
+void lsc_jit_reset(LSC_VM *vm);
+
+// Throw away every compiled block covering address (called after a store into compiled code)
+void lsc_jit_invalidate(LSC_VM *vm, uint16_t address);
+
+/*
+A compiled block, as the code cache (see lsc_cache.h) keeps it between runs. The code only depends on where it is for
+the pointers into the VM it uses, and relocs says where those are, so it can be put back into another VM.
+*/
+typedef struct {
+    uint16_t start;
+    uint16_t span; // Addresses covered from start
+    uint16_t max_retired;
+    uint16_t reloc_count;
+    uint16_t size; // Bytes of code
+    const uint8_t *code;
+    const uint16_t *relocs;
+} LSC_JIT_CODE;
+
+// Fill in code for the block compiled at start. Returns 0 if there is none.
+int lsc_jit_block(const LSC_VM *vm, uint16_t start, LSC_JIT_CODE *code);
+
+/*
+Put a block from lsc_jit_block (of this VM or another one, in this process or an earlier one) back for the JIT engine to
+run. Whoever calls it has made sure memory holds the words it was compiled from. Returns 0 if it could not: there is no
+native code on this host, no executable memory or no room in it, a block starts there already, or code is not a block.
+*/
+int lsc_jit_install(LSC_VM *vm, const LSC_JIT_CODE *code);
+
+// Blocks compiled since the JIT's state was last cleared, not counting installed ones
+uint32_t lsc_jit_compiled(const LSC_VM *vm);
+
+// Forget the JIT's state, which lives in vm->arena, before the arena is reset. The executable memory is kept.
+void lsc_jit_clear(LSC_VM *vm);
+
+// lsc_jit_clear, and unmap the executable memory too
+void lsc_jit_destroy(LSC_VM *vm);
+
+uint64_t lsc_run_jit(LSC_VM *vm, uint64_t budget);
+
+#endif
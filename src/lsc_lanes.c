@@ -0,0 +1,498 @@
+#include "lsc_lanes.h"
+#include "lsc_metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if LSC_HAVE_LANES
+
+// A register of every lane, and the same as signed numbers for sign tests
+typedef uint16_t LSC_LANE_WORDS __attribute__((vector_size(LSC_LANE_COUNT * sizeof(uint16_t))));
+typedef int16_t LSC_LANE_SIGNED __attribute__((vector_size(LSC_LANE_COUNT * sizeof(uint16_t))));
+
+_Static_assert(LSC_LANE_COUNT <= 16, "lane masks are 16 bit vectors of one bit per lane");
+
+// What the group knows about an address, LSC_LANES.known
+enum {
+    LSC_LANES_UNKNOWN = 0, // Not looked at since a lane last stored to it
+    LSC_LANES_SAME, // Every running lane holds the same word, and decoded has it
+    LSC_LANES_DIFFERENT, // Some lane holds another word
+};
+
+struct LSC_LANES {
+    LSC_LANE_WORDS reg[LSC_R_R7 + 1]; // R0-R7. PC is the group's while a lane runs, and COND is cc.
+    LSC_LANE_WORDS cc; // The last flag-setting result of each lane, like cc in lsc_ops.h
+
+    LSC_VM *vm[LSC_LANE_COUNT];
+    int index[LSC_LANE_COUNT]; // Which of the caller's VMs each lane is
+    uint16_t pc[LSC_LANE_COUNT]; // Where each lane is, when it is not in the group running now
+    uint64_t left[LSC_LANE_COUNT]; // Instructions each lane may still run
+    int count;
+    uint32_t running; // Lanes that have not stopped
+
+    uint8_t known[LSC_MEMORY_MAX];
+    LSC_DECODED decoded[LSC_MEMORY_MAX]; // The word every lane holds, decoded, where known says so
+};
+
+// One bit per lane, to turn a mask of lanes into a vector of 0xFFFF and 0
+static const LSC_LANE_WORDS lsc_lane_bits = {
+    1u << 0, 1u << 1, 1u << 2, 1u << 3, 1u << 4, 1u << 5, 1u << 6, 1u << 7,
+    1u << 8, 1u << 9, 1u << 10, 1u << 11, 1u << 12, 1u << 13, 1u << 14, 1u << 15,
+};
+
+/*
+Why do the helpers take and give vectors through pointers?
+- A vector wider than the build's registers (16 lanes without AVX) is passed in memory anyway, and GCC warns that the
+  ABI for that changed. They are all inlined.
+*/
+static inline void lsc_lanes_mask(LSC_LANE_WORDS *mask, uint32_t lanes) {
+    *mask = (LSC_LANE_WORDS)((lsc_lane_bits & (uint16_t)lanes) != 0);
+}
+
+static inline int lsc_lanes_zero(const LSC_LANE_WORDS *v) {
+    uint64_t q[sizeof(*v) / sizeof(uint64_t)];
+    memcpy(q, v, sizeof(*v));
+    uint64_t any = 0;
+    for (size_t i = 0; i < sizeof(q) / sizeof(q[0]); ++i) {
+        any |= q[i];
+    }
+    return any == 0;
+}
+
+// lsc_cond_flags for every lane at once
+static inline void lsc_lanes_flags(LSC_LANE_WORDS *flags, const LSC_LANE_WORDS *v) {
+    LSC_LANE_WORDS zero = (LSC_LANE_WORDS)(*v == 0);
+    LSC_LANE_WORDS neg = (LSC_LANE_WORDS)((LSC_LANE_SIGNED)*v < 0);
+    *flags = (zero & LSC_FL_ZRO) | (neg & LSC_FL_NEG) | (~(zero | neg) & LSC_FL_POS);
+}
+
+// A load in one lane. Plain memory is read straight from the page, like the engines do.
+static uint16_t lsc_lanes_read(LSC_VM *vm, uint16_t address) {
+    if (vm->page_attr[address >> LSC_PAGE_SHIFT] & LSC_PAGE_DEVICE) {
+        return lsc_mem_read(vm, address);
+    }
+    return lsc_mem_peek(vm, address);
+}
+
+// A store in one lane, which every other lane may not have made
+static void lsc_lanes_write(LSC_LANES *lanes, LSC_VM *vm, uint16_t address, uint16_t value) {
+    lsc_mem_write(vm, address, value);
+    lanes->known[address] = LSC_LANES_UNKNOWN;
+}
+
+// Can vm run in a lane at all? See lsc_lanes.h.
+static int lsc_lanes_fit(const LSC_VM *vm) {
+    // Two devices: devices[0], which is never used, and the console's registers
+    return !vm->profile && !vm->trace && !vm->breakpoints && !vm->console && !vm->block && vm->device_count <= 2;
+}
+
+// Lane l's registers back into its VM
+static void lsc_lanes_store(LSC_LANES *lanes, int l) {
+    LSC_VM *vm = lanes->vm[l];
+    for (int r = 0; r <= LSC_R_R7; ++r) {
+        vm->reg[r] = lanes->reg[r][l];
+    }
+    vm->reg[LSC_R_PC] = lanes->pc[l];
+    vm->reg[LSC_R_COND] = lsc_cond_flags(lanes->cc[l]);
+}
+
+// The group ran steps instructions and is now at pc. Every lane in it carries on from there on its own.
+static void lsc_lanes_leave(LSC_LANES *lanes, uint32_t group, uint16_t pc, uint64_t steps) {
+    for (uint32_t bits = group; bits; bits &= bits - 1) {
+        int l = __builtin_ctz(bits);
+        LSC_VM *vm = lanes->vm[l];
+        lanes->pc[l] = pc;
+        lanes->left[l] -= steps;
+        vm->cycles += steps;
+        if (vm->metrics) {
+            lsc_metrics_add(&vm->metrics->instructions, steps);
+        }
+    }
+}
+
+// How far group can run before one of its lanes is out of budget, or the metrics want to see how far they got
+static uint64_t lsc_lanes_budget(const LSC_LANES *lanes, uint32_t group) {
+    uint64_t budget = LSC_VM_SLICE;
+    for (uint32_t bits = group; bits; bits &= bits - 1) {
+        int l = __builtin_ctz(bits);
+        if (lanes->left[l] < budget) {
+            budget = lanes->left[l];
+        }
+    }
+    return budget;
+}
+
+// The next group: lanes still running at the lowest PC there is. Lanes out of budget stop here. Returns 0 once every
+// lane has stopped.
+static uint32_t lsc_lanes_select(LSC_LANES *lanes, uint16_t *pc) {
+    uint32_t group = 0;
+    uint16_t lowest = 0;
+    for (uint32_t bits = lanes->running; bits; bits &= bits - 1) {
+        int l = __builtin_ctz(bits);
+        if (lanes->left[l] == 0) {
+            lanes->running &= ~(1u << l);
+        } else if (!group || lanes->pc[l] < lowest) {
+            group = 1u << l;
+            lowest = lanes->pc[l];
+        } else if (lanes->pc[l] == lowest) {
+            group |= 1u << l;
+        }
+    }
+
+    *pc = lowest;
+    return group;
+}
+
+// Does every running lane hold the same word at address? Decodes it for all of them if so.
+static uint8_t lsc_lanes_check(LSC_LANES *lanes, uint16_t address) {
+    uint16_t word = lsc_mem_peek(lanes->vm[__builtin_ctz(lanes->running)], address);
+    uint8_t known = LSC_LANES_SAME;
+    for (uint32_t bits = lanes->running; bits; bits &= bits - 1) {
+        if (lsc_mem_peek(lanes->vm[__builtin_ctz(bits)], address) != word) {
+            known = LSC_LANES_DIFFERENT;
+            break;
+        }
+    }
+    if (known == LSC_LANES_SAME) {
+        lanes->decoded[address] = lsc_decode_word(word);
+    }
+    lanes->known[address] = known;
+    return known;
+}
+
+// The lanes of group holding the same word at address as the first of them
+static uint32_t lsc_lanes_agree(LSC_LANES *lanes, uint32_t group, uint16_t address) {
+    uint16_t word = lsc_mem_peek(lanes->vm[__builtin_ctz(group)], address);
+    uint32_t agree = 0;
+    for (uint32_t bits = group; bits; bits &= bits - 1) {
+        int l = __builtin_ctz(bits);
+        if (lsc_mem_peek(lanes->vm[l], address) == word) {
+            agree |= 1u << l;
+        }
+    }
+    return agree;
+}
+
+LSC_LANES *lsc_lanes_create(void) {
+    // Vectors want their alignment, which malloc does not promise past 16 bytes. The size is a multiple of it already.
+    LSC_LANES *lanes = aligned_alloc(_Alignof(LSC_LANES), sizeof(LSC_LANES));
+    if (lanes) {
+        memset(lanes, 0, sizeof(LSC_LANES));
+    }
+    return lanes;
+}
+
+void lsc_lanes_free(LSC_LANES *lanes) {
+    free(lanes);
+}
+
+void lsc_lanes_run(LSC_LANES *lanes, LSC_VM **vms, int count, uint64_t max_cycles, int *status) {
+    lanes->count = 0;
+    lanes->running = 0;
+    memset(lanes->known, LSC_LANES_UNKNOWN, sizeof(lanes->known));
+
+    for (int i = 0; i < count; ++i) {
+        LSC_VM *vm = vms[i];
+        if (!lsc_lanes_fit(vm)) {
+            status[i] = lsc_vm_run(vm, max_cycles);
+            continue;
+        }
+        int l = lanes->count++;
+        lanes->vm[l] = vm;
+        lanes->index[l] = i;
+        for (int r = 0; r <= LSC_R_R7; ++r) {
+            lanes->reg[r][l] = vm->reg[r];
+        }
+        lanes->cc[l] = lsc_cond_value(vm->reg[LSC_R_COND]);
+        lanes->pc[l] = vm->reg[LSC_R_PC];
+        lanes->left[l] = max_cycles;
+
+        // Same as lsc_vm_run: halted and faulted machines stay that way, a waiting one tries the trap again
+        vm->waiting = 0;
+        vm->at_breakpoint = 0;
+        if (!vm->halted && !vm->faulted) {
+            lanes->running |= 1u << l;
+        }
+    }
+
+    LSC_LANE_WORDS *reg = lanes->reg;
+    LSC_LANE_WORDS mask = {0};
+    uint32_t group = 0;
+    uint16_t pc = 0;
+    uint64_t budget = 0;
+    uint64_t steps = 0;
+
+    // Vector results only go into the lanes of the group
+#define LSC_LANES_SET(dst, value) \
+    do { \
+        LSC_LANE_WORDS set_ = (value); \
+        (dst) = (set_ & mask) | ((dst) & ~mask); \
+    } while (0)
+
+    // Every lane of the group ran the instruction, and carries on at next. The group breaks up when its budget is gone.
+#define LSC_LANES_NEXT(next) \
+    pc = (next); \
+    ++steps; \
+    if (--budget == 0) { \
+        lsc_lanes_leave(lanes, group, pc, steps); \
+        group = 0; \
+    } \
+    break
+
+    // Every lane of the group ran the instruction and goes on to its own next PC, so they are regrouped
+#define LSC_LANES_SPLIT(target) \
+    lsc_lanes_leave(lanes, group, pc, steps + 1); \
+    for (uint32_t bits = group; bits; bits &= bits - 1) { \
+        int l = __builtin_ctz(bits); \
+        lanes->pc[l] = (target); \
+    } \
+    group = 0; \
+    break
+
+    // Each lane of the group in turn, for what every lane does on its own VM
+#define LSC_LANES_EACH(l) for (uint32_t bits_ = group, l = 0; bits_ && (l = __builtin_ctz(bits_), 1); bits_ &= bits_ - 1)
+
+    for (;;) {
+        if (!group) {
+            group = lsc_lanes_select(lanes, &pc);
+            if (!group) {
+                break;
+            }
+            lsc_lanes_mask(&mask, group);
+            budget = lsc_lanes_budget(lanes, group);
+            steps = 0;
+        }
+
+        const LSC_DECODED *d = &lanes->decoded[pc];
+        LSC_DECODED entry;
+        uint8_t known = lanes->known[pc];
+        if (known == LSC_LANES_UNKNOWN) {
+            known = lsc_lanes_check(lanes, pc);
+        }
+        if (known == LSC_LANES_DIFFERENT) {
+            // Only the lanes with the group's first word go on, the others wait here
+            uint32_t agree = lsc_lanes_agree(lanes, group, pc);
+            if (agree != group) {
+                lsc_lanes_leave(lanes, group, pc, steps);
+                group = agree;
+                lsc_lanes_mask(&mask, group);
+                budget = lsc_lanes_budget(lanes, group);
+                steps = 0;
+            }
+            entry = lsc_decode_word(lsc_mem_peek(lanes->vm[__builtin_ctz(group)], pc));
+            d = &entry;
+        }
+
+        uint16_t next = pc + 1;
+        switch (d->op) {
+            case LSC_OP_ADD: {
+                LSC_LANE_WORDS v = reg[d->sr1] + reg[d->sr2];
+                LSC_LANES_SET(reg[d->dr], v);
+                LSC_LANES_SET(lanes->cc, v);
+                LSC_LANES_NEXT(next);
+            }
+            case LSC_OP_ADDI: {
+                LSC_LANE_WORDS v = reg[d->sr1] + d->imm;
+                LSC_LANES_SET(reg[d->dr], v);
+                LSC_LANES_SET(lanes->cc, v);
+                LSC_LANES_NEXT(next);
+            }
+            case LSC_OP_AND: {
+                LSC_LANE_WORDS v = reg[d->sr1] & reg[d->sr2];
+                LSC_LANES_SET(reg[d->dr], v);
+                LSC_LANES_SET(lanes->cc, v);
+                LSC_LANES_NEXT(next);
+            }
+            case LSC_OP_ANDI: {
+                LSC_LANE_WORDS v = reg[d->sr1] & d->imm;
+                LSC_LANES_SET(reg[d->dr], v);
+                LSC_LANES_SET(lanes->cc, v);
+                LSC_LANES_NEXT(next);
+            }
+            case LSC_OP_NOT: {
+                LSC_LANE_WORDS v = ~reg[d->sr1];
+                LSC_LANES_SET(reg[d->dr], v);
+                LSC_LANES_SET(lanes->cc, v);
+                LSC_LANES_NEXT(next);
+            }
+            case LSC_OP_LEA: {
+                // The same address in every lane
+                LSC_LANE_WORDS v = (LSC_LANE_WORDS){0} + (uint16_t)(next + d->imm);
+                LSC_LANES_SET(reg[d->dr], v);
+                LSC_LANES_SET(lanes->cc, v);
+                LSC_LANES_NEXT(next);
+            }
+            case LSC_OP_BR: {
+                LSC_LANE_WORDS flags;
+                lsc_lanes_flags(&flags, &lanes->cc);
+                LSC_LANE_WORDS taken = (LSC_LANE_WORDS)((flags & d->dr) != 0) & mask;
+                LSC_LANE_WORDS not_taken = taken ^ mask;
+                uint16_t target = next + d->imm;
+                if (lsc_lanes_zero(&taken)) {
+                    LSC_LANES_NEXT(next);
+                }
+                if (lsc_lanes_zero(&not_taken)) {
+                    LSC_LANES_NEXT(target);
+                }
+                LSC_LANES_SPLIT(taken[l] ? target : next);
+            }
+            case LSC_OP_JSR: {
+                LSC_LANES_SET(reg[LSC_R_R7], (LSC_LANE_WORDS){0} + next);
+                LSC_LANES_NEXT((uint16_t)(next + d->imm));
+            }
+            case LSC_OP_JMP:
+            case LSC_OP_JSRR: {
+                LSC_LANE_WORDS target = reg[d->sr1];
+                if (d->op == LSC_OP_JSRR) {
+                    LSC_LANES_SET(reg[LSC_R_R7], (LSC_LANE_WORDS){0} + next);
+                }
+                uint16_t first = target[__builtin_ctz(group)];
+                LSC_LANE_WORDS elsewhere = (target ^ first) & mask;
+                if (lsc_lanes_zero(&elsewhere)) {
+                    LSC_LANES_NEXT(first);
+                }
+                LSC_LANES_SPLIT(target[l]);
+            }
+            case LSC_OP_LD: {
+                uint16_t address = next + d->imm;
+                LSC_LANES_EACH(l) {
+                    uint16_t v = lsc_lanes_read(lanes->vm[l], address);
+                    reg[d->dr][l] = v;
+                    lanes->cc[l] = v;
+                }
+                LSC_LANES_NEXT(next);
+            }
+            case LSC_OP_LDI: {
+                uint16_t address = next + d->imm;
+                LSC_LANES_EACH(l) {
+                    LSC_VM *vm = lanes->vm[l];
+                    uint16_t v = lsc_lanes_read(vm, lsc_lanes_read(vm, address));
+                    reg[d->dr][l] = v;
+                    lanes->cc[l] = v;
+                }
+                LSC_LANES_NEXT(next);
+            }
+            case LSC_OP_LDR: {
+                LSC_LANES_EACH(l) {
+                    uint16_t v = lsc_lanes_read(lanes->vm[l], reg[d->sr1][l] + d->imm);
+                    reg[d->dr][l] = v;
+                    lanes->cc[l] = v;
+                }
+                LSC_LANES_NEXT(next);
+            }
+            case LSC_OP_ST: {
+                uint16_t address = next + d->imm;
+                LSC_LANES_EACH(l) {
+                    lsc_lanes_write(lanes, lanes->vm[l], address, reg[d->dr][l]);
+                }
+                LSC_LANES_NEXT(next);
+            }
+            case LSC_OP_STI: {
+                uint16_t address = next + d->imm;
+                LSC_LANES_EACH(l) {
+                    LSC_VM *vm = lanes->vm[l];
+                    lsc_lanes_write(lanes, vm, lsc_lanes_read(vm, address), reg[d->dr][l]);
+                }
+                LSC_LANES_NEXT(next);
+            }
+            case LSC_OP_STR: {
+                LSC_LANES_EACH(l) {
+                    lsc_lanes_write(lanes, lanes->vm[l], reg[d->sr1][l] + d->imm, reg[d->dr][l]);
+                }
+                LSC_LANES_NEXT(next);
+            }
+            case LSC_OP_TRAP: {
+                lsc_lanes_leave(lanes, group, pc, steps);
+                if (d->imm == LSC_TRAP_HALT) {
+                    LSC_LANES_SET(reg[LSC_R_R7], (LSC_LANE_WORDS){0} + next);
+                    lsc_lanes_leave(lanes, group, next, 1);
+                    LSC_LANES_EACH(l) {
+                        LSC_VM *vm = lanes->vm[l];
+                        vm->halted = 1;
+                        if (vm->metrics) {
+                            lsc_metrics_add(&vm->metrics->traps[LSC_TRAP_HALT], 1);
+                        }
+                    }
+                    lanes->running &= ~group;
+                    group = 0;
+                    break;
+                }
+
+                // Trap routines see the whole machine, so each lane's goes into its VM first and comes back after
+                LSC_LANES_EACH(l) {
+                    LSC_VM *vm = lanes->vm[l];
+                    lanes->pc[l] = next;
+                    lsc_lanes_store(lanes, l);
+                    if (lsc_trap(vm, (uint8_t)d->imm)) {
+                        // No key yet. The TRAP runs again next time, and was not counted.
+                        vm->waiting = 1;
+                        lanes->pc[l] = pc;
+                        lanes->running &= ~(1u << l);
+                        continue;
+                    }
+                    vm->reg[LSC_R_R7] = vm->reg[LSC_R_PC];
+                    for (int r = 0; r <= LSC_R_R7; ++r) {
+                        reg[r][l] = vm->reg[r];
+                    }
+                    lanes->cc[l] = lsc_cond_value(vm->reg[LSC_R_COND]);
+                    lsc_lanes_leave(lanes, 1u << l, next, 1);
+                }
+                group = 0;
+                break;
+            }
+            default: {
+                // RTI and the reserved opcode: every lane stops on it, uncounted (see lsc_ops.h)
+                lsc_lanes_leave(lanes, group, pc, steps);
+                LSC_LANES_EACH(l) {
+                    lanes->vm[l]->faulted = 1;
+                }
+                lanes->running &= ~group;
+                group = 0;
+                break;
+            }
+        }
+    }
+
+#undef LSC_LANES_SET
+#undef LSC_LANES_NEXT
+#undef LSC_LANES_SPLIT
+#undef LSC_LANES_EACH
+
+    // Every lane has stopped, and says why the way lsc_vm_run would
+    for (int l = 0; l < lanes->count; ++l) {
+        LSC_VM *vm = lanes->vm[l];
+        lsc_lanes_store(lanes, l);
+        int *s = &status[lanes->index[l]];
+        if (vm->halted) {
+            *s = LSC_VM_HALTED;
+        } else if (vm->faulted) {
+            *s = LSC_VM_FAULT;
+        } else {
+            *s = vm->waiting ? LSC_VM_WAITING_FOR_INPUT : LSC_VM_BUDGET_EXHAUSTED;
+        }
+    }
+}
+
+#else
+
+// Nothing to keep, but NULL would mean out of memory
+struct LSC_LANES {
+    int unused;
+};
+
+LSC_LANES *lsc_lanes_create(void) {
+    return calloc(1, sizeof(LSC_LANES));
+}
+
+void lsc_lanes_free(LSC_LANES *lanes) {
+    free(lanes);
+}
+
+void lsc_lanes_run(LSC_LANES *lanes, LSC_VM **vms, int count, uint64_t max_cycles, int *status) {
+    (void)lanes;
+    for (int i = 0; i < count; ++i) {
+        status[i] = lsc_vm_run(vms[i], max_cycles);
+    }
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef LSC_LANES_H
+#define LSC_LANES_H
+
+#include <stdint.h>
+
+#include "lsc_vm.h"
+
+/*
+Lockstep lanes
+
+lsc_vm --batch jobs.txt --lanes [-j N]
+
+Many short runs of one program on different data mostly go the same way through it. Lanes run up to LSC_LANE_COUNT
+such VMs as one group, so an instruction is fetched and dispatched once for every VM at the same PC rather than once
+each. The registers are kept structure-of-arrays, each register a vector with a lane per VM, so ADD, AND, NOT and LEA
+are a single vector op across the group, and so is working out every lane's flags for a BR.
+
+Which lanes run:
+- The lanes at the lowest PC of the ones still running are the group that runs now. The rest wait.
+- A BR some lanes take and others do not (or a JMP or JSRR to different places) splits the group. Lowest PC first lets
+  the lanes that fell behind catch up, so they come back together where the paths meet: the end of an if, the exit of a
+  loop, the return from a subroutine.
+- Memory is every lane's own. The first time the group gets to an address, it checks every lane holds the same word
+  there, and decodes it once for all of them. That holds until a lane stores to the address. Where the words differ,
+  only the lanes with the first lane's word run it, and the others wait their turn.
+- Loads, stores and traps go lane by lane, to each lane's own VM.
+
+Every VM ends up exactly as lsc_vm_run(vm, max_cycles) would have left it: registers, memory, output, the cycle count
+and the status. Only the order the instructions of different VMs ran in changes, and nothing in a VM can see that.
+
+The vector ops are GCC's vector extensions, so the build's -march picks the instructions: two SSE2 ops per register by
+default, one AVX2 op with make release march=x86-64-v3. Built without them (another compiler, or -DLSC_NO_LANES), the
+VMs simply run one after the other.
+
+A VM that has to see every instruction or every store on its own (a profile, a trace, breakpoints, a console, a disk,
+or devices beyond the console's registers) runs by itself with lsc_vm_run.
+*/
+
+enum {
+    LSC_LANE_COUNT = 16, // VMs in a group, 16 lanes of 16 bits filling a 256 bit vector
+};
+
+#if defined(__GNUC__) && !defined(LSC_NO_LANES)
+#define LSC_HAVE_LANES 1
+#else
+#define LSC_HAVE_LANES 0
+#endif
+
+// A group's registers and what it knows about the lanes' code. Kept and reused, it is too big to set up for every run.
+typedef struct LSC_LANES LSC_LANES;
+
+// Returns NULL when out of memory
+LSC_LANES *lsc_lanes_create(void);
+void lsc_lanes_free(LSC_LANES *lanes);
+
+/*
+Run vms[0] to vms[count - 1] (count at most LSC_LANE_COUNT) for at most max_cycles instructions each, until every one of
+them has stopped. status[i] gets what lsc_vm_run would have returned for vms[i].
+*/
+void lsc_lanes_run(LSC_LANES *lanes, LSC_VM **vms, int count, uint64_t max_cycles, int *status);
+
+#endif
@@ -0,0 +1,102 @@
+/*
+Interpreter loop template, for the loops that have to see every instruction
+
+lsc_ops.h has the instructions. This wraps them in the plain switch loop that looks at the budget after every
+instruction, with optional hooks around each one, and defines it as a function. A file defines the hooks it wants, then
+includes this once per loop:
+
+    #define LSC_LOOP_NAME lsc_run_profile
+    #define LSC_LOOP_SETUP LSC_PROFILE *profile = vm->profile;
+    #define LSC_LOOP_RETIRE() (lsc_profile_retire(vm, profile, pc, d), 1)
+    #include "lsc_loop.h"
+
+- LSC_LOOP_NAME: the function, uint64_t LSC_LOOP_NAME(LSC_VM *vm, uint64_t budget)
+- LSC_LOOP_STATIC: define it to make the function static
+- LSC_LOOP_SETUP: statements run once at the start of the function
+- LSC_LOOP_BEGIN(): with pc and d set, before the instruction runs. 0 stops the run without it, PC left on it.
+- LSC_LOOP_RETIRE(): once the instruction has finished and been counted. 0 stops the run after it.
+
+All but the name are optional. A hook that is left out is not compiled in at all (it is a constant 1), so every
+combination of tools gets a loop of its own with no run time test of what is attached. lsc_run picks the loop instead,
+once per run. lsc_mem_read, lsc_mem_write and lsc_trap may also be #defined before the include, to see every load,
+store and trap (see lsc_trace.c).
+
+Everything is #undef'd at the end, ready for the next loop.
+*/
+
+#ifndef LSC_LOOP_SETUP
+#define LSC_LOOP_SETUP
+#endif
+#ifndef LSC_LOOP_BEGIN
+#define LSC_LOOP_BEGIN() 1
+#endif
+#ifndef LSC_LOOP_RETIRE
+#define LSC_LOOP_RETIRE() 1
+#endif
+
+#ifdef LSC_LOOP_STATIC
+static
+#endif
+uint64_t LSC_LOOP_NAME(LSC_VM *vm, uint64_t budget) {
+    uint64_t executed = 0;
+    uint16_t cc = lsc_cond_value(vm->reg[LSC_R_COND]);
+    LSC_LOOP_SETUP
+
+    while (executed < budget) {
+        // Fetch the predecoded instr at PC, then move PC onto the next one
+        uint16_t pc = vm->reg[LSC_R_PC]++;
+        LSC_DECODED *d = lsc_decoded(vm, pc);
+        uint8_t op = d->op;
+        if (!LSC_LOOP_BEGIN()) {
+            vm->reg[LSC_R_PC] = pc;
+            break;
+        }
+
+lsc_loop_dispatch:
+        switch (op) {
+#define LSC_CASE(op) case op:
+#define LSC_NEXT break
+#define LSC_JUMP break
+#define LSC_CHECKPOINT (void)0
+#define LSC_DISPATCH() op = d->op; goto lsc_loop_dispatch
+#define LSC_DISPATCH_BASE() op = d->base; goto lsc_loop_dispatch
+#define LSC_STOP ++executed; (void)LSC_LOOP_RETIRE(); goto lsc_loop_done
+#define LSC_YIELD vm->reg[LSC_R_PC] = pc; goto lsc_loop_done
+#define LSC_STEP \
+    ++executed; \
+    if (!LSC_LOOP_RETIRE() || executed >= budget) goto lsc_loop_done; \
+    pc = vm->reg[LSC_R_PC]++; \
+    d = lsc_decoded_next(vm, d, pc); \
+    if (!LSC_LOOP_BEGIN()) { \
+        vm->reg[LSC_R_PC] = pc; \
+        goto lsc_loop_done; \
+    }
+#include "lsc_ops.h"
+#undef LSC_CASE
+#undef LSC_NEXT
+#undef LSC_JUMP
+#undef LSC_CHECKPOINT
+#undef LSC_DISPATCH
+#undef LSC_DISPATCH_BASE
+#undef LSC_STOP
+#undef LSC_YIELD
+#undef LSC_STEP
+            default: break;
+        }
+
+        ++executed;
+        if (!LSC_LOOP_RETIRE()) {
+            break;
+        }
+    }
+
+lsc_loop_done:
+    vm->reg[LSC_R_COND] = lsc_cond_flags(cc);
+    return executed;
+}
+
+#undef LSC_LOOP_NAME
+#undef LSC_LOOP_STATIC
+#undef LSC_LOOP_SETUP
+#undef LSC_LOOP_BEGIN
+#undef LSC_LOOP_RETIRE
@@ -0,0 +1,205 @@
+#include "lsc_metrics.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+enum {
+    LSC_METRICS_POLL_MS = 100, // How long the server waits for a connection before looking whether it should stop
+    LSC_METRICS_SEND_MS = 1000, // How long a reader gets to take its answer
+};
+
+struct LSC_METRICS {
+    LSC_METRICS_COUNTERS *workers; // worker_count sets, each on lines of its own
+    int worker_count;
+    uint64_t start; // lsc_vm_clock when the counters were created
+
+    // The server, when there is one
+    int listener; // -1 when not serving
+    char *path;
+    pthread_t thread;
+    int stopping; // Set by lsc_metrics_free, read by the server
+};
+
+LSC_METRICS *lsc_metrics_create(int worker_count) {
+    LSC_METRICS *metrics = calloc(1, sizeof(LSC_METRICS));
+    if (!metrics) {
+        return NULL;
+    }
+    // aligned_alloc wants a size that is a multiple of the alignment, which every set already is
+    size_t size = (size_t)(worker_count > 0 ? worker_count : 1) * sizeof(LSC_METRICS_COUNTERS);
+    metrics->workers = aligned_alloc(LSC_METRICS_LINE, size);
+    if (!metrics->workers) {
+        free(metrics);
+        return NULL;
+    }
+    memset(metrics->workers, 0, size);
+    metrics->worker_count = worker_count;
+    metrics->start = lsc_vm_clock();
+    metrics->listener = -1;
+    return metrics;
+}
+
+void lsc_metrics_free(LSC_METRICS *metrics) {
+    if (!metrics) {
+        return;
+    }
+    if (metrics->listener >= 0) {
+        __atomic_store_n(&metrics->stopping, 1, __ATOMIC_RELAXED);
+        pthread_join(metrics->thread, NULL);
+        close(metrics->listener);
+        unlink(metrics->path);
+    }
+    free(metrics->path);
+    free(metrics->workers);
+    free(metrics);
+}
+
+LSC_METRICS_COUNTERS *lsc_metrics_worker(LSC_METRICS *metrics, int worker) {
+    return &metrics->workers[worker];
+}
+
+// A counter some other thread is adding to
+static uint64_t lsc_metrics_read(const uint64_t *counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static void lsc_metrics_header(FILE *out, const char *name, const char *type, const char *help) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// A counter with nothing but the worker label, at offset in every set
+static void lsc_metrics_counter(const LSC_METRICS *metrics, FILE *out, const char *name, const char *help,
+    size_t offset) {
+    lsc_metrics_header(out, name, "counter", help);
+    for (int w = 0; w < metrics->worker_count; ++w) {
+        const uint64_t *counter = (const uint64_t *)(const void *)((const char *)&metrics->workers[w] + offset);
+        fprintf(out, "%s{worker=\"%d\"} %llu\n", name, w, (unsigned long long)lsc_metrics_read(counter));
+    }
+}
+
+void lsc_metrics_write(const LSC_METRICS *metrics, FILE *out) {
+    lsc_metrics_header(out, "lsc_workers", "gauge", "Threads running VMs, each with counters of its own.");
+    fprintf(out, "lsc_workers %d\n", metrics->worker_count);
+    lsc_metrics_header(out, "lsc_uptime_seconds", "gauge", "Seconds since counting started.");
+    fprintf(out, "lsc_uptime_seconds %.3f\n", (lsc_vm_clock() - metrics->start) * 1e-9);
+
+    lsc_metrics_counter(metrics, out, "lsc_instructions_total", "LC-3 instructions retired.",
+        offsetof(LSC_METRICS_COUNTERS, instructions));
+
+    lsc_metrics_header(out, "lsc_traps_total", "counter", "Traps run, by trap vector.");
+    for (int w = 0; w < metrics->worker_count; ++w) {
+        for (int vector = 0; vector < LSC_METRICS_TRAPS; ++vector) {
+            uint64_t count = lsc_metrics_read(&metrics->workers[w].traps[vector]);
+            if (count) {
+                fprintf(out, "lsc_traps_total{worker=\"%d\",vector=\"x%02X\"} %llu\n", w, vector,
+                    (unsigned long long)count);
+            }
+        }
+    }
+
+    lsc_metrics_header(out, "lsc_jobs_total", "counter", "Runs that finished, by how they stopped.");
+    for (int w = 0; w < metrics->worker_count; ++w) {
+        for (int status = 0; status < LSC_VM_STATUS_COUNT; ++status) {
+            fprintf(out, "lsc_jobs_total{worker=\"%d\",status=\"%s\"} %llu\n", w, lsc_vm_status_name(status),
+                (unsigned long long)lsc_metrics_read(&metrics->workers[w].jobs[status]));
+        }
+    }
+    lsc_metrics_counter(metrics, out, "lsc_job_load_failures_total", "Jobs whose images could not be loaded.",
+        offsetof(LSC_METRICS_COUNTERS, load_failures));
+
+    lsc_metrics_counter(metrics, out, "lsc_cache_hits_total", "Code cache entries found and put back.",
+        offsetof(LSC_METRICS_COUNTERS, cache_hits));
+    lsc_metrics_counter(metrics, out, "lsc_cache_misses_total", "Code cache entries missing or not usable.",
+        offsetof(LSC_METRICS_COUNTERS, cache_misses));
+    lsc_metrics_counter(metrics, out, "lsc_jit_compiles_total", "Blocks compiled by the JIT.",
+        offsetof(LSC_METRICS_COUNTERS, jit_compiles));
+}
+
+// Answer one reader: everything as it is now, then close. A reader that does not take it in time is dropped.
+static void lsc_metrics_answer(const LSC_METRICS *metrics, int client) {
+    struct timeval timeout = {LSC_METRICS_SEND_MS / 1000, (LSC_METRICS_SEND_MS % 1000) * 1000};
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    char *text = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&text, &len);
+    if (!out) {
+        return;
+    }
+    lsc_metrics_write(metrics, out);
+    fclose(out);
+
+    // MSG_NOSIGNAL: a reader that hung up early must not take the process down with SIGPIPE
+    for (size_t sent = 0; text && sent < len;) {
+        ssize_t n = send(client, text + sent, len - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        sent += (size_t)n;
+    }
+    free(text);
+}
+
+static void *lsc_metrics_main(void *arg) {
+    LSC_METRICS *metrics = arg;
+    while (!__atomic_load_n(&metrics->stopping, __ATOMIC_RELAXED)) {
+        struct pollfd p = {metrics->listener, POLLIN, 0};
+        if (poll(&p, 1, LSC_METRICS_POLL_MS) <= 0) {
+            continue;
+        }
+        int client = accept(metrics->listener, NULL, NULL);
+        if (client >= 0) {
+            lsc_metrics_answer(metrics, client);
+            close(client);
+        }
+    }
+    return NULL;
+}
+
+int lsc_metrics_serve(LSC_METRICS *metrics, const char *path) {
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    if (metrics->listener >= 0 || strlen(path) >= sizeof(address.sun_path)) {
+        return 0;
+    }
+    strcpy(address.sun_path, path);
+    free(metrics->path);
+    metrics->path = strdup(path);
+    if (!metrics->path) {
+        return 0;
+    }
+
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        return 0;
+    }
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        close(listener);
+        return 0;
+    }
+    metrics->listener = listener;
+    if (listen(listener, 16) != 0 || pthread_create(&metrics->thread, NULL, lsc_metrics_main, metrics) != 0) {
+        metrics->listener = -1;
+        close(listener);
+        unlink(path);
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,90 @@
+#ifndef LSC_METRICS_H
+#define LSC_METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "lsc_vm.h"
+
+/*
+Live metrics
+
+lsc_vm --metrics=path image.obj
+lsc_vm --metrics=path --batch jobs.txt -j N
+
+A long batch, or a host running thousands of VMs, should be watchable without stopping anything. With --metrics, path
+is a Unix socket, and every connection to it is answered with the counters as they are at that moment, in the
+Prometheus text format, and then closed:
+
+    socat - UNIX-CONNECT:path
+
+Each worker thread (the one thread of a single run) counts into a set of counters of its own:
+- lsc_instructions_total: instructions retired
+- lsc_traps_total: traps run, by vector (only ones that ran at least once are shown)
+- lsc_jobs_total: runs that finished, by how they stopped, and lsc_job_load_failures_total: jobs whose images could not
+  be loaded
+- lsc_cache_hits_total, lsc_cache_misses_total: code cache entries found and not found (see lsc_cache.h)
+- lsc_jit_compiles_total: blocks the JIT compiled
+Every line has a worker label, so totals are a sum away.
+
+Nothing on the threads running VMs waits for a reader, or even knows there is one. Each set of counters has exactly one
+thread writing it, so a count going up is a plain load and store, and a set takes whole cache lines of its own, so
+workers counting never fight over a line. The server thread reads them all with atomic loads, which never see half a
+count, and takes no lock that anyone else takes. Counts from different sets are not taken at the same instant, which no
+counter needs.
+
+A VM counts into the set its metrics field points at (see LSC_VM), put there by whoever runs it. With one attached,
+lsc_vm_run retires instructions LSC_VM_SLICE at a time, and adds them after each slice, so a long run shows up within
+a millisecond or so rather than when it ends. Traps and compiles are counted as they happen. A host embedding VMs
+gives each of its threads a set with lsc_metrics_worker, and points every VM that thread runs at it.
+*/
+
+enum {
+    LSC_METRICS_LINE = 64, // Bytes in a cache line, which no two sets of counters share
+    LSC_METRICS_TRAPS = 256, // Every trapvect8
+};
+
+/*
+One thread's counters. Only that thread writes them, with lsc_metrics_add.
+
+Why align the first field?
+- Every set then starts on a cache line and its size is a whole number of lines, so an array of them shares none
+*/
+struct LSC_METRICS_COUNTERS {
+    _Alignas(LSC_METRICS_LINE) uint64_t instructions;
+    uint64_t jobs[LSC_VM_STATUS_COUNT]; // Runs that finished, by the status lsc_vm_run returned
+    uint64_t load_failures;
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    uint64_t jit_compiles;
+    uint64_t traps[LSC_METRICS_TRAPS];
+};
+
+_Static_assert(sizeof(LSC_METRICS_COUNTERS) % LSC_METRICS_LINE == 0, "a set of counters must fill whole cache lines");
+
+// Count n more. Only ever called by the thread the counter belongs to, so there is nothing to lock.
+static inline void lsc_metrics_add(uint64_t *counter, uint64_t n) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+typedef struct LSC_METRICS LSC_METRICS;
+
+// Counters for worker_count workers, all at zero. Returns NULL when out of memory.
+LSC_METRICS *lsc_metrics_create(int worker_count);
+
+// Stops serving if it was, removes the socket, and frees the counters. Every VM must be done with them by now.
+void lsc_metrics_free(LSC_METRICS *metrics);
+
+// The counters of worker, 0 to worker_count - 1
+LSC_METRICS_COUNTERS *lsc_metrics_worker(LSC_METRICS *metrics, int worker);
+
+// Write every counter as it is now, in the Prometheus text format
+void lsc_metrics_write(const LSC_METRICS *metrics, FILE *out);
+
+/*
+Answer connections to a Unix socket at path from a thread of its own, until lsc_metrics_free. A socket already at path
+(left by a run that died, say) is replaced, anything else there is not. Returns 0 if it cannot listen there.
+*/
+int lsc_metrics_serve(LSC_METRICS *metrics, const char *path);
+
+#endif
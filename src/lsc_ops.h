@@ -0,0 +1,260 @@
+/*
+Opcode handlers
+
+This file is not a normal header. It is the body of the interpreter loop, and is #included inside each dispatch engine
+(see lsc_dispatch.c). Writing every handler once means the engines can never disagree about what an instruction does.
+
+The including engine must provide:
+- vm: the LSC_VM being run
+- pc: the address of the instruction being executed. vm->reg[LSC_R_PC] already points at the next one
+- d: a variable pointing at the LSC_DECODED entry for pc. LSC_OP_DECODE points it at the entry it decoded.
+- cc: a uint16_t holding the last flag-setting result. vm->reg[LSC_R_COND] is stale while the loop runs, the engine
+  loads cc from it on entry (lsc_cond_value) and writes it back on exit (lsc_cond_flags).
+- LSC_CASE(op): starts the handler for op
+- LSC_NEXT: finishes the handler and moves on to the next instruction
+- LSC_JUMP: same, for handlers that may change PC (branches, jumps, calls, traps). Engines that do not look at the
+  budget on every instruction look at it here (see lsc_dispatch.h).
+- LSC_CHECKPOINT: leaves the loop before running the current instruction if such an engine is nearly out of budget
+- LSC_DISPATCH(): jumps to the handler for d->op without fetching (used after decoding)
+- LSC_DISPATCH_BASE(): jumps to the handler for d->base
+- LSC_STOP: counts the current instruction and leaves the loop (used by HALT)
+- LSC_YIELD: leaves the loop without counting the current instruction, with PC back on it so it runs again next time
+- LSC_STEP: counts the current instruction and moves pc and d on to the next one without dispatching, or leaves the
+  loop if that used up the budget (used by superinstructions)
+
+Why no include guard?
+- It is included once per engine on purpose
+*/
+
+LSC_CASE(LSC_OP_DECODE) {
+    // First time we have seen this address (or it was overwritten). Decode it then dispatch on the real opcode.
+    d = lsc_decode(vm, pc);
+    LSC_DISPATCH();
+}
+LSC_CASE(LSC_OP_CHECK) {
+    // Whatever is at the last address of a page (see lsc_decode_single), checked against the budget and then run as usual
+    LSC_CHECKPOINT;
+    LSC_DISPATCH_BASE();
+}
+LSC_CASE(LSC_OP_BREAK) {
+    // A debugger wants to stop here (see lsc_vm_breakpoint). It runs the instruction underneath once it has looked.
+    vm->at_breakpoint = 1;
+    LSC_YIELD;
+}
+LSC_CASE(LSC_OP_ADD) {
+    /*
+    ADD has two encodings:
+    - Register mode: 0001 (15-12) DR (11-9) SR1 (8-6) 0 (5) 00 (4-3 unused) SR2 (2-0)
+    - Immediate mode: 0001 (15-12) DR (11-9) SR1 (8-6) 1 (5) imm5 (4-0)
+
+    Immediate mode is decoded into LSC_OP_ADDI so neither case has to check bit 5 here.
+    */
+
+    // Add SR1 and SR2 then store in DR
+    vm->reg[d->dr] = vm->reg[d->sr1] + vm->reg[d->sr2];
+
+    // Remember the result so BR has sign information. The flags themselves are only worked out if a BR needs them.
+    cc = vm->reg[d->dr];
+    LSC_NEXT;
+}
+LSC_CASE(LSC_OP_ADDI) {
+    // Add the sign-extended imm5 to SR1 then store in DR
+    vm->reg[d->dr] = vm->reg[d->sr1] + d->imm;
+    cc = vm->reg[d->dr];
+    LSC_NEXT;
+}
+LSC_CASE(LSC_OP_AND) {
+    /*
+    AND has two encodings:
+    - Register mode: 0101 (15-12), DR (11-9), SR1 (8-6), 0 (5), 00 (4-3 unused), SR2 (2-0)
+    - Immediate mode: 0101 (15-12), DR (11-9), SR1 (8-6), 1 (5), imm5 (4-0)
+
+    SR1 and SR2/imm5 are ANDed. Result stored in DR. COND set based on sign.
+    */
+
+    // Bitwise AND SR1 and SR2 and store in DR
+    vm->reg[d->dr] = vm->reg[d->sr1] & vm->reg[d->sr2];
+
+    // Set COND flag (lazily)
+    cc = vm->reg[d->dr];
+    LSC_NEXT;
+}
+LSC_CASE(LSC_OP_ANDI) {
+    // Bitwise AND SR1 and the sign-extended imm5 and store in DR
+    vm->reg[d->dr] = vm->reg[d->sr1] & d->imm;
+    cc = vm->reg[d->dr];
+    LSC_NEXT;
+}
+LSC_CASE(LSC_OP_NOT) {
+    // NOT: 1001 (15-12), DR (11-9), SR (8-6), 111111 (5-0)
+    vm->reg[d->dr] = ~vm->reg[d->sr1];
+    cc = vm->reg[d->dr];
+    LSC_NEXT;
+}
+LSC_CASE(LSC_OP_BR) {
+    /*
+    BR: 0000 (15-12), n (11), z (10), p (9), PCoffset9 (8-0)
+
+    The nzp bits line up with LSC_FL_NEG/ZRO/POS so the branch is taken if any of them match COND.
+    */
+    if (d->dr & lsc_cond_flags(cc)) {
+        vm->reg[LSC_R_PC] += d->imm;
+    }
+    LSC_JUMP;
+}
+LSC_CASE(LSC_OP_JMP) {
+    // JMP: 1100 (15-12), 000 (11-9), BaseR (8-6), 000000 (5-0). RET is JMP R7.
+    vm->reg[LSC_R_PC] = vm->reg[d->sr1];
+    LSC_JUMP;
+}
+LSC_CASE(LSC_OP_JSR) {
+    // JSR: 0100 (15-12), 1 (11), PCoffset11 (10-0). Return address goes in R7.
+    vm->reg[LSC_R_R7] = vm->reg[LSC_R_PC];
+    vm->reg[LSC_R_PC] += d->imm;
+    LSC_JUMP;
+}
+LSC_CASE(LSC_OP_JSRR) {
+    // JSRR: 0100 (15-12), 0 (11), 00 (10-9), BaseR (8-6), 000000 (5-0)
+    uint16_t target = vm->reg[d->sr1];
+    vm->reg[LSC_R_R7] = vm->reg[LSC_R_PC];
+    vm->reg[LSC_R_PC] = target;
+    LSC_JUMP;
+}
+LSC_CASE(LSC_OP_LD) {
+    // LD: 0010 (15-12), DR (11-9), PCoffset9 (8-0)
+    vm->reg[d->dr] = lsc_mem_read(vm, vm->reg[LSC_R_PC] + d->imm);
+    cc = vm->reg[d->dr];
+    LSC_NEXT;
+}
+LSC_CASE(LSC_OP_LDI) {
+    /*
+    LoaD Indirect has one encoding:
+    - 1010 (15-12), DR (11-9), PCoffset9 (8-0)
+
+    This function loads a value from a location in memory into a register.
+
+    PCoffset9 is an immediate value.
+
+    The adress referred to by PCoffset9 is computed by sign-extending bits (8-0) to 16 bits then adding this to the PC. 
+    What is stored at this address is the address of the data to be loaded into DR.
+
+    LDI is particularly useful for loading values that are far away from current PC as there are only 9 bits to store the address.
+    */
+
+    // Get PC address
+    uint16_t pc_address = vm->reg[LSC_R_PC] + d->imm;
+
+    // Get the address stored at PC address, then load what is stored there into DR
+    vm->reg[d->dr] = lsc_mem_read(vm, lsc_mem_read(vm, pc_address));
+
+    // Update flags
+    cc = vm->reg[d->dr];
+
+    LSC_NEXT;
+}
+LSC_CASE(LSC_OP_LDR) {
+    // LDR: 0110 (15-12), DR (11-9), BaseR (8-6), offset6 (5-0)
+    vm->reg[d->dr] = lsc_mem_read(vm, vm->reg[d->sr1] + d->imm);
+    cc = vm->reg[d->dr];
+    LSC_NEXT;
+}
+LSC_CASE(LSC_OP_LEA) {
+    // LEA: 1110 (15-12), DR (11-9), PCoffset9 (8-0). No memory is read, only the address is computed.
+    vm->reg[d->dr] = vm->reg[LSC_R_PC] + d->imm;
+    cc = vm->reg[d->dr];
+    LSC_NEXT;
+}
+LSC_CASE(LSC_OP_ST) {
+    // ST: 0011 (15-12), SR (11-9), PCoffset9 (8-0)
+    lsc_mem_write(vm, vm->reg[LSC_R_PC] + d->imm, vm->reg[d->dr]);
+    LSC_NEXT;
+}
+LSC_CASE(LSC_OP_STI) {
+    // STI: 1011 (15-12), SR (11-9), PCoffset9 (8-0)
+    lsc_mem_write(vm, lsc_mem_read(vm, vm->reg[LSC_R_PC] + d->imm), vm->reg[d->dr]);
+    LSC_NEXT;
+}
+LSC_CASE(LSC_OP_STR) {
+    // STR: 0111 (15-12), SR (11-9), BaseR (8-6), offset6 (5-0)
+    lsc_mem_write(vm, vm->reg[d->sr1] + d->imm, vm->reg[d->dr]);
+    LSC_NEXT;
+}
+LSC_CASE(LSC_OP_TRAP) {
+    /*
+    TRAP: 1111 (15-12), 0000 (11-8), trapvect8 (7-0)
+
+    R7 gets the return address, like JSR. The trap routines themselves are in lsc_trap.
+    */
+    if (d->imm == LSC_TRAP_HALT) {
+        vm->reg[LSC_R_R7] = vm->reg[LSC_R_PC];
+        vm->halted = 1;
+        LSC_STOP;
+    }
+
+    // Trap routines see the whole machine, so COND has to be real while they run
+    vm->reg[LSC_R_COND] = lsc_cond_flags(cc);
+    if (lsc_trap(vm, d->imm)) {
+        // No key yet. Nothing has changed, so the TRAP simply runs again once the host has queued one.
+        vm->waiting = 1;
+        LSC_YIELD;
+    }
+    vm->reg[LSC_R_R7] = vm->reg[LSC_R_PC];
+    cc = lsc_cond_value(vm->reg[LSC_R_COND]);
+    LSC_JUMP;
+}
+LSC_CASE(LSC_OP_RES)
+LSC_CASE(LSC_OP_RTI) {
+    // RTI needs supervisor mode, which this machine does not have, and the reserved opcode means nothing. Stop on either.
+    vm->faulted = 1;
+    LSC_YIELD;
+}
+
+/*
+Superinstructions (see lsc_fuse.h)
+
+Each part is the plain handler for that instruction, with LSC_STEP between them instead of a dispatch. d is the entry of
+whichever part is running, so the fields are always right.
+*/
+LSC_CASE(LSC_OP_LOAD_CONST) {
+    ++vm->fused[LSC_OP_LOAD_CONST - LSC_OP_FUSED_FIRST];
+    // AND DR, SR1, #0
+    vm->reg[d->dr] = 0;
+    cc = 0;
+    LSC_STEP;
+    // ADD DR2, DR, #imm5
+    vm->reg[d->dr] = vm->reg[d->sr1] + d->imm;
+    cc = vm->reg[d->dr];
+    LSC_NEXT;
+}
+LSC_CASE(LSC_OP_ADD_BR) {
+    ++vm->fused[LSC_OP_ADD_BR - LSC_OP_FUSED_FIRST];
+    vm->reg[d->dr] = vm->reg[d->sr1] + vm->reg[d->sr2];
+    cc = vm->reg[d->dr];
+    LSC_STEP;
+    if (d->dr & lsc_cond_flags(cc)) {
+        vm->reg[LSC_R_PC] += d->imm;
+    }
+    LSC_JUMP;
+}
+LSC_CASE(LSC_OP_ADDI_BR) {
+    ++vm->fused[LSC_OP_ADDI_BR - LSC_OP_FUSED_FIRST];
+    vm->reg[d->dr] = vm->reg[d->sr1] + d->imm;
+    cc = vm->reg[d->dr];
+    LSC_STEP;
+    if (d->dr & lsc_cond_flags(cc)) {
+        vm->reg[LSC_R_PC] += d->imm;
+    }
+    LSC_JUMP;
+}
+LSC_CASE(LSC_OP_LDR_ADDI_STR) {
+    ++vm->fused[LSC_OP_LDR_ADDI_STR - LSC_OP_FUSED_FIRST];
+    vm->reg[d->dr] = lsc_mem_read(vm, vm->reg[d->sr1] + d->imm);
+    cc = vm->reg[d->dr];
+    LSC_STEP;
+    vm->reg[d->dr] = vm->reg[d->sr1] + d->imm;
+    cc = vm->reg[d->dr];
+    LSC_STEP;
+    // The store comes last, so even if it overwrites this sequence nothing stale runs
+    lsc_mem_write(vm, vm->reg[d->sr1] + d->imm, vm->reg[d->dr]);
+    LSC_NEXT;
+}
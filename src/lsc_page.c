@@ -0,0 +1,100 @@
+#include "lsc_page.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+const uint16_t lsc_page_zero[LSC_PAGE_SIZE];
+
+// A page on a free list. Its own words hold the link, so a free page costs nothing extra.
+typedef union LSC_FREE_PAGE {
+    union LSC_FREE_PAGE *next;
+    uint16_t words[LSC_PAGE_SIZE];
+} LSC_FREE_PAGE;
+
+typedef struct {
+    LSC_FREE_PAGE *free;
+    int registered; // The exit handler knows about this thread
+} LSC_PAGE_SLAB_STATE;
+
+static _Thread_local LSC_PAGE_SLAB_STATE lsc_page_slab;
+
+// Free pages of threads that have exited
+static pthread_mutex_t lsc_page_orphans_lock = PTHREAD_MUTEX_INITIALIZER;
+static LSC_FREE_PAGE *lsc_page_orphans;
+
+static pthread_once_t lsc_page_once = PTHREAD_ONCE_INIT;
+static pthread_key_t lsc_page_key;
+
+// A thread is exiting, hand its free pages on
+static void lsc_page_thread_exit(void *arg) {
+    LSC_PAGE_SLAB_STATE *slab = arg;
+    if (!slab->free) {
+        return;
+    }
+    LSC_FREE_PAGE *last = slab->free;
+    while (last->next) {
+        last = last->next;
+    }
+
+    pthread_mutex_lock(&lsc_page_orphans_lock);
+    last->next = lsc_page_orphans;
+    lsc_page_orphans = slab->free;
+    pthread_mutex_unlock(&lsc_page_orphans_lock);
+    slab->free = NULL;
+}
+
+static void lsc_page_init(void) {
+    pthread_key_create(&lsc_page_key, lsc_page_thread_exit);
+}
+
+// Make sure lsc_page_thread_exit runs for this thread
+static void lsc_page_register(LSC_PAGE_SLAB_STATE *slab) {
+    if (!slab->registered) {
+        pthread_once(&lsc_page_once, lsc_page_init);
+        pthread_setspecific(lsc_page_key, slab);
+        slab->registered = 1;
+    }
+}
+
+// Fill this thread's empty free list, from the orphans if there are any. Returns 0 when out of memory.
+static int lsc_page_refill(LSC_PAGE_SLAB_STATE *slab) {
+    lsc_page_register(slab);
+
+    pthread_mutex_lock(&lsc_page_orphans_lock);
+    slab->free = lsc_page_orphans;
+    lsc_page_orphans = NULL;
+    pthread_mutex_unlock(&lsc_page_orphans_lock);
+    if (slab->free) {
+        return 1;
+    }
+
+    LSC_FREE_PAGE *pages = malloc(LSC_PAGE_SLAB * sizeof(LSC_FREE_PAGE));
+    if (!pages) {
+        return 0;
+    }
+    for (int i = 0; i < LSC_PAGE_SLAB - 1; ++i) {
+        pages[i].next = &pages[i + 1];
+    }
+    pages[LSC_PAGE_SLAB - 1].next = NULL;
+    slab->free = pages;
+    return 1;
+}
+
+uint16_t *lsc_page_alloc(void) {
+    LSC_PAGE_SLAB_STATE *slab = &lsc_page_slab;
+    if (!slab->free && !lsc_page_refill(slab)) {
+        return NULL;
+    }
+    LSC_FREE_PAGE *page = slab->free;
+    slab->free = page->next;
+    return page->words;
+}
+
+void lsc_page_free(uint16_t *words) {
+    // A thread that destroys VMs some other thread ran may never have allocated a page itself
+    LSC_PAGE_SLAB_STATE *slab = &lsc_page_slab;
+    lsc_page_register(slab);
+    LSC_FREE_PAGE *page = (LSC_FREE_PAGE *)words;
+    page->next = slab->free;
+    slab->free = page;
+}
@@ -0,0 +1,34 @@
+#ifndef LSC_PAGE_H
+#define LSC_PAGE_H
+
+#include "lsc_vm.h"
+
+/*
+Memory pages
+
+A VM only owns the pages of memory it has stored to (see Memory in lsc_vm.h). The rest point at words that are shared: the
+zero page, or a page of a snapshot.
+
+Owned pages come from a slab per thread: a free list of pages, refilled LSC_PAGE_SLAB pages at a time with one malloc.
+Taking a page or giving one back is a couple of pointer moves with no lock, so batch workers running thousands of VMs
+never wait on each other or on malloc for memory. A page goes back to the slab of whichever thread frees it, and is
+never handed back to the system: the next VM on that thread reuses it.
+
+When a thread exits, its free pages are passed to a list every thread looks at before it mallocs another slab. That list
+is the only lock, and it is taken once per slab, not once per page.
+*/
+
+enum {
+    LSC_PAGE_SLAB = 64, // Pages per malloc, 32 KB
+};
+
+// A page of zeros, shared by every VM for every page it has not stored to. Never written.
+extern const uint16_t lsc_page_zero[LSC_PAGE_SIZE];
+
+// LSC_PAGE_SIZE words from this thread's slab, not cleared. NULL when out of memory.
+uint16_t *lsc_page_alloc(void);
+
+// Give a page from lsc_page_alloc back to this thread's slab
+void lsc_page_free(uint16_t *words);
+
+#endif
@@ -0,0 +1,147 @@
+#include "lsc_perf.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+static const char *const lsc_perf_names[LSC_PERF_COUNT] = {
+    [LSC_PERF_CYCLES] = "cycles",
+    [LSC_PERF_INSTRUCTIONS] = "instructions",
+    [LSC_PERF_BRANCH_MISSES] = "branch-misses",
+    [LSC_PERF_ICACHE_MISSES] = "L1-icache-misses",
+};
+
+const char *lsc_perf_name(int counter) {
+    if (counter < 0 || counter >= LSC_PERF_COUNT) {
+        return "unknown";
+    }
+    return lsc_perf_names[counter];
+}
+
+#ifdef __linux__
+static int lsc_perf_open_one(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    // This thread, on whichever CPU it runs
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// Count, time enabled and time running
+static int lsc_perf_read(int fd, uint64_t now[3]) {
+    return read(fd, now, 3 * sizeof(uint64_t)) == 3 * sizeof(uint64_t);
+}
+
+int lsc_perf_open(LSC_PERF *perf) {
+    static const struct {
+        uint32_t type;
+        uint64_t config;
+    } events[LSC_PERF_COUNT] = {
+        [LSC_PERF_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        [LSC_PERF_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        [LSC_PERF_BRANCH_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        [LSC_PERF_ICACHE_MISSES] = {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1I | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    };
+
+    int available = 0;
+    memset(perf, 0, sizeof(*perf));
+    for (int i = 0; i < LSC_PERF_COUNT; ++i) {
+        perf->fd[i] = lsc_perf_open_one(events[i].type, events[i].config);
+        available += perf->fd[i] >= 0;
+    }
+    return available;
+}
+
+void lsc_perf_close(LSC_PERF *perf) {
+    for (int i = 0; i < LSC_PERF_COUNT; ++i) {
+        if (perf->fd[i] >= 0) {
+            close(perf->fd[i]);
+            perf->fd[i] = -1;
+        }
+    }
+}
+
+void lsc_perf_start(LSC_PERF *perf) {
+    for (int i = 0; i < LSC_PERF_COUNT; ++i) {
+        if (perf->fd[i] >= 0 && !lsc_perf_read(perf->fd[i], perf->start[i])) {
+            memset(perf->start[i], 0, sizeof(perf->start[i]));
+        }
+    }
+    // Enabled after everything has been read, so reading is not counted
+    for (int i = 0; i < LSC_PERF_COUNT; ++i) {
+        if (perf->fd[i] >= 0) {
+            ioctl(perf->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void lsc_perf_stop(LSC_PERF *perf) {
+    for (int i = 0; i < LSC_PERF_COUNT; ++i) {
+        if (perf->fd[i] >= 0) {
+            ioctl(perf->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    for (int i = 0; i < LSC_PERF_COUNT; ++i) {
+        uint64_t now[3];
+        if (perf->fd[i] < 0 || !lsc_perf_read(perf->fd[i], now)) {
+            continue;
+        }
+        uint64_t count = now[0] - perf->start[i][0];
+        uint64_t enabled = now[1] - perf->start[i][1];
+        uint64_t running = now[2] - perf->start[i][2];
+        if (running && running < enabled) {
+            count = (uint64_t)((double)count * enabled / running);
+        }
+        perf->value[i] += count;
+    }
+}
+#else
+int lsc_perf_open(LSC_PERF *perf) {
+    memset(perf, 0, sizeof(*perf));
+    for (int i = 0; i < LSC_PERF_COUNT; ++i) {
+        perf->fd[i] = -1;
+    }
+    return 0;
+}
+
+void lsc_perf_close(LSC_PERF *perf) {
+    (void)perf;
+}
+
+void lsc_perf_start(LSC_PERF *perf) {
+    (void)perf;
+}
+
+void lsc_perf_stop(LSC_PERF *perf) {
+    (void)perf;
+}
+#endif
+
+void lsc_perf_print(const LSC_PERF *perf, uint64_t instructions) {
+    printf("%-18s %16s %12s\n", "counter", "total", "per instr");
+    for (int i = 0; i < LSC_PERF_COUNT; ++i) {
+        if (perf->fd[i] < 0) {
+            printf("%-18s %16s\n", lsc_perf_names[i], "not available");
+            continue;
+        }
+        printf("%-18s %16llu %12.3f\n", lsc_perf_names[i], (unsigned long long)perf->value[i],
+            instructions ? (double)perf->value[i] / instructions : 0.0);
+    }
+    if (perf->fd[LSC_PERF_CYCLES] >= 0 && perf->fd[LSC_PERF_INSTRUCTIONS] >= 0 && perf->value[LSC_PERF_CYCLES]) {
+        printf("IPC %.2f\n", (double)perf->value[LSC_PERF_INSTRUCTIONS] / perf->value[LSC_PERF_CYCLES]);
+    }
+}
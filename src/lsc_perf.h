@@ -0,0 +1,55 @@
+#ifndef LSC_PERF_H
+#define LSC_PERF_H
+
+#include <stdint.h>
+
+/*
+Hardware performance counters
+
+lsc_vm --bench=N --perf-counters image.obj     every engine, with counts per LC-3 instruction
+lsc_vm --perf-counters image.obj               one run (profiled too with --profile), counts after its output
+
+Time alone does not say why an engine is slow. These count what the host CPU did while the VM ran, through Linux's
+perf_event_open: cycles, instructions, branch misses and L1 instruction cache misses. Divided by the LC-3 instructions
+retired they show what each one costs, and cycles over instructions is the IPC. Dispatch shows up as branch misses
+(switch against threaded), superinstructions as fewer host instructions (--no-fuse against the default), and the JIT as
+both.
+
+Only this thread in user mode is counted, and only between lsc_perf_start and lsc_perf_stop. A counter the machine does
+not have (no PMU in a virtual machine, or perf_event_paranoid too strict) is shown as not available, and the others
+still count. Other systems have none.
+*/
+
+enum {
+    LSC_PERF_CYCLES = 0,
+    LSC_PERF_INSTRUCTIONS,
+    LSC_PERF_BRANCH_MISSES,
+    LSC_PERF_ICACHE_MISSES, // L1 instruction cache read misses
+    LSC_PERF_COUNT
+};
+
+typedef struct {
+    int fd[LSC_PERF_COUNT]; // -1 for a counter that is not available
+    uint64_t value[LSC_PERF_COUNT]; // Counted between every start and stop so far
+    uint64_t start[LSC_PERF_COUNT][3]; // Count, time enabled and time running at the last lsc_perf_start
+} LSC_PERF;
+
+// Open every counter this machine has, all stopped and at zero. Returns how many there are.
+int lsc_perf_open(LSC_PERF *perf);
+void lsc_perf_close(LSC_PERF *perf);
+
+void lsc_perf_start(LSC_PERF *perf);
+
+/*
+Add what was counted since lsc_perf_start to perf->value. When there are more counters than the CPU has, the kernel takes
+turns between them, and the counts are scaled up by how long each one was really counting.
+*/
+void lsc_perf_stop(LSC_PERF *perf);
+
+// "cycles", "instructions" and so on, as perf(1) calls them
+const char *lsc_perf_name(int counter);
+
+// Every counter, in total and per LC-3 instruction of the instructions retired, then the IPC
+void lsc_perf_print(const LSC_PERF *perf, uint64_t instructions);
+
+#endif
@@ -0,0 +1,250 @@
+#include "lsc_profile.h"
+
+#include <stdio.h>
+#include <string.h>
+
+enum {
+    LSC_PROFILE_MAX_DEPTH = 256, // Calls deeper than this are counted in the deepest frame
+    LSC_PROFILE_INITIAL_NODES = 256,
+    LSC_PROFILE_TOP = 10, // Addresses printed by lsc_profile_print
+    LSC_PROFILE_NO_PARENT = UINT32_MAX,
+};
+
+// One node of the call tree: a function, called through one particular stack
+typedef struct {
+    uint32_t parent; // Node of the caller, LSC_PROFILE_NO_PARENT for the outermost frame
+    uint16_t function; // Entry address
+    uint64_t self; // Instructions retired while this was the innermost frame
+} LSC_PROFILE_NODE;
+
+struct LSC_PROFILE {
+    LSC_ARENA *arena; // Where the nodes and index grow into
+    uint64_t ops[LSC_OP_COUNT];
+    uint32_t pcs[LSC_MEMORY_MAX]; // Parallel to memory. Saturates rather than wraps.
+
+    LSC_PROFILE_NODE *nodes;
+    uint32_t node_count;
+    uint32_t node_cap;
+
+    // (parent, function) -> node, open addressing. Slots hold node index + 1, 0 is empty.
+    uint32_t *index;
+    uint32_t index_cap;
+
+    uint32_t stack[LSC_PROFILE_MAX_DEPTH]; // Node of every active frame, stack[depth - 1] is the innermost
+    int depth;
+    uint32_t overflow; // Calls past LSC_PROFILE_MAX_DEPTH (or past running out of memory) that have not returned
+};
+
+static const char *const lsc_profile_op_names[LSC_OP_COUNT] = {
+    [LSC_OP_BR] = "BR",
+    [LSC_OP_ADD] = "ADD",
+    [LSC_OP_LD] = "LD",
+    [LSC_OP_ST] = "ST",
+    [LSC_OP_JSR] = "JSR",
+    [LSC_OP_AND] = "AND",
+    [LSC_OP_LDR] = "LDR",
+    [LSC_OP_STR] = "STR",
+    [LSC_OP_RTI] = "RTI",
+    [LSC_OP_NOT] = "NOT",
+    [LSC_OP_LDI] = "LDI",
+    [LSC_OP_STI] = "STI",
+    [LSC_OP_JMP] = "JMP",
+    [LSC_OP_RES] = "RES",
+    [LSC_OP_LEA] = "LEA",
+    [LSC_OP_TRAP] = "TRAP",
+    [LSC_OP_ADDI] = "ADDI",
+    [LSC_OP_ANDI] = "ANDI",
+    [LSC_OP_JSRR] = "JSRR",
+};
+
+LSC_PROFILE *lsc_profile_create(LSC_VM *vm) {
+    LSC_PROFILE *profile = lsc_arena_zalloc(&vm->arena, sizeof(LSC_PROFILE));
+    if (!profile) {
+        return NULL;
+    }
+    profile->arena = &vm->arena;
+
+    // Always enough room for the outermost frame, so a run can always start
+    profile->node_cap = LSC_PROFILE_INITIAL_NODES;
+    profile->index_cap = LSC_PROFILE_INITIAL_NODES * 2;
+    profile->nodes = lsc_arena_alloc(profile->arena, profile->node_cap * sizeof(LSC_PROFILE_NODE));
+    profile->index = lsc_arena_zalloc(profile->arena, profile->index_cap * sizeof(uint32_t));
+    if (!profile->nodes || !profile->index) {
+        return NULL;
+    }
+    return profile;
+}
+
+static uint32_t lsc_profile_hash(uint32_t parent, uint16_t function) {
+    return (parent * 2654435761u) ^ (function * 40503u);
+}
+
+static void lsc_profile_index_insert(uint32_t *index, uint32_t cap, const LSC_PROFILE_NODE *nodes, uint32_t node) {
+    uint32_t slot = lsc_profile_hash(nodes[node].parent, nodes[node].function) & (cap - 1);
+    while (index[slot]) {
+        slot = (slot + 1) & (cap - 1);
+    }
+    index[slot] = node + 1;
+}
+
+// Find or add the node for function called from parent. Returns LSC_PROFILE_NO_PARENT when out of memory.
+static uint32_t lsc_profile_node(LSC_PROFILE *profile, uint32_t parent, uint16_t function) {
+    uint32_t slot = lsc_profile_hash(parent, function) & (profile->index_cap - 1);
+    for (; profile->index[slot]; slot = (slot + 1) & (profile->index_cap - 1)) {
+        uint32_t node = profile->index[slot] - 1;
+        if (profile->nodes[node].parent == parent && profile->nodes[node].function == function) {
+            return node;
+        }
+    }
+
+    if (profile->node_count == profile->node_cap) {
+        uint32_t cap = profile->node_cap * 2;
+        // The old nodes and index stay in the arena until it is reset
+        LSC_PROFILE_NODE *nodes = lsc_arena_grow(profile->arena, profile->nodes,
+            profile->node_cap * sizeof(LSC_PROFILE_NODE), cap * sizeof(LSC_PROFILE_NODE));
+        if (!nodes) {
+            return LSC_PROFILE_NO_PARENT;
+        }
+        profile->nodes = nodes;
+        uint32_t *index = lsc_arena_zalloc(profile->arena, cap * 2 * sizeof(uint32_t));
+        if (!index) {
+            return LSC_PROFILE_NO_PARENT;
+        }
+        for (uint32_t node = 0; node < profile->node_count; ++node) {
+            lsc_profile_index_insert(index, cap * 2, nodes, node);
+        }
+        profile->node_cap = cap;
+        profile->index = index;
+        profile->index_cap = cap * 2;
+    }
+
+    uint32_t node = profile->node_count++;
+    profile->nodes[node].parent = parent;
+    profile->nodes[node].function = function;
+    profile->nodes[node].self = 0;
+    lsc_profile_index_insert(profile->index, profile->index_cap, profile->nodes, node);
+    return node;
+}
+
+static void lsc_profile_call(LSC_PROFILE *profile, uint16_t function) {
+    if (profile->depth == LSC_PROFILE_MAX_DEPTH) {
+        ++profile->overflow;
+        return;
+    }
+    uint32_t node = lsc_profile_node(profile, profile->stack[profile->depth - 1], function);
+    if (node == LSC_PROFILE_NO_PARENT) {
+        ++profile->overflow;
+        return;
+    }
+    profile->stack[profile->depth++] = node;
+}
+
+static void lsc_profile_return(LSC_PROFILE *profile) {
+    if (profile->overflow) {
+        --profile->overflow;
+    } else if (profile->depth > 1) {
+        // A RET out of the outermost frame has nowhere to go, it stays where it is
+        --profile->depth;
+    }
+}
+
+void lsc_profile_retire(LSC_VM *vm, LSC_PROFILE *profile, uint16_t pc, const LSC_DECODED *d) {
+    ++profile->ops[d->base];
+    profile->pcs[pc] += profile->pcs[pc] != UINT32_MAX;
+    ++profile->nodes[profile->stack[profile->depth - 1]].self;
+
+    switch (d->base) {
+        case LSC_OP_JSR:
+        case LSC_OP_JSRR:
+            lsc_profile_call(profile, vm->reg[LSC_R_PC]);
+            break;
+        case LSC_OP_JMP:
+            if (d->sr1 == LSC_R_R7) {
+                lsc_profile_return(profile);
+            }
+            break;
+        default: break;
+    }
+}
+
+void lsc_profile_begin_run(LSC_VM *vm, LSC_PROFILE *profile) {
+    // The outermost frame is wherever the first run starts. There is always room for it, see lsc_profile_create.
+    if (profile->depth == 0) {
+        profile->stack[profile->depth++] = lsc_profile_node(profile, LSC_PROFILE_NO_PARENT, vm->reg[LSC_R_PC]);
+    }
+}
+
+/*
+The exact switch loop (see lsc_loop.h) with lsc_profile_retire after every instruction. Superinstructions still retire
+each of their parts through LSC_STEP, so every address gets its own count.
+*/
+#define LSC_LOOP_NAME lsc_run_profile
+#define LSC_LOOP_SETUP \
+    LSC_PROFILE *profile = vm->profile; \
+    lsc_profile_begin_run(vm, profile);
+#define LSC_LOOP_RETIRE() (lsc_profile_retire(vm, profile, pc, d), 1)
+#include "lsc_loop.h"
+
+int lsc_profile_write(const LSC_PROFILE *profile, const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return 0;
+    }
+
+    // The outermost frame is the root of the tree, so no stack is deeper than this
+    uint16_t frames[LSC_PROFILE_MAX_DEPTH];
+
+    for (uint32_t node = 0; node < profile->node_count; ++node) {
+        if (profile->nodes[node].self == 0) {
+            continue;
+        }
+
+        // Walk up to the outermost frame, then print back down
+        int depth = 0;
+        for (uint32_t n = node; n != LSC_PROFILE_NO_PARENT && depth < LSC_PROFILE_MAX_DEPTH; n = profile->nodes[n].parent) {
+            frames[depth++] = profile->nodes[n].function;
+        }
+        for (int i = depth - 1; i >= 0; --i) {
+            fprintf(file, "x%04X%s", frames[i], i ? ";" : " ");
+        }
+        fprintf(file, "%llu\n", (unsigned long long)profile->nodes[node].self);
+    }
+
+    return fclose(file) == 0;
+}
+
+void lsc_profile_print(const LSC_PROFILE *profile) {
+    uint64_t total = 0;
+    for (int op = 0; op < LSC_OP_COUNT; ++op) {
+        total += profile->ops[op];
+    }
+    double percent = total ? 100.0 / total : 0.0;
+
+    printf("%-8s %14s %8s\n", "opcode", "instructions", "share");
+    for (int op = 0; op < LSC_OP_COUNT; ++op) {
+        if (profile->ops[op]) {
+            printf("%-8s %14llu %7.2f%%\n", lsc_profile_op_names[op], (unsigned long long)profile->ops[op],
+                profile->ops[op] * percent);
+        }
+    }
+
+    // Keep the busiest addresses in order, busiest first
+    uint32_t top[LSC_PROFILE_TOP];
+    int top_count = 0;
+    for (uint32_t address = 0; address < LSC_MEMORY_MAX; ++address) {
+        uint32_t count = profile->pcs[address];
+        if (count == 0 || (top_count == LSC_PROFILE_TOP && count <= profile->pcs[top[top_count - 1]])) {
+            continue;
+        }
+        int i = (top_count < LSC_PROFILE_TOP) ? top_count++ : top_count - 1;
+        for (; i > 0 && profile->pcs[top[i - 1]] < count; --i) {
+            top[i] = top[i - 1];
+        }
+        top[i] = address;
+    }
+
+    printf("%-8s %14s %8s\n", "address", "instructions", "share");
+    for (int i = 0; i < top_count; ++i) {
+        printf("x%04X    %14u %7.2f%%\n", top[i], profile->pcs[top[i]], profile->pcs[top[i]] * percent);
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef LSC_PROFILE_H
+#define LSC_PROFILE_H
+
+#include "lsc_vm.h"
+
+/*
+Profiler
+
+lsc_vm --profile=out.folded image.obj
+
+While a profile is attached to a VM (vm->profile), lsc_vm_run uses a separate copy of the interpreter loop that counts
+every retired instruction three ways:
+- per opcode (after predecoding, so ADD and ADD #imm are counted apart)
+- per address, in an array parallel to memory
+- per call stack. JSR/JSRR push the address they jump to, RET (JMP R7) pops it again.
+
+The normal engines never look at any of this, so they cost exactly the same whether profiling is compiled in or not.
+Native JIT code is not used while profiling.
+
+lsc_profile_write writes the stacks in the folded format flame graph tools read (flamegraph.pl, speedscope, inferno):
+one line per stack, functions named by their entry address, outermost first, then the instruction count:
+
+    x3000;x3050;x3100 1234
+*/
+
+// A profile for vm, from its arena, so it lasts until lsc_vm_clear or lsc_vm_destroy. Returns NULL when out of memory.
+LSC_PROFILE *lsc_profile_create(LSC_VM *vm);
+
+// The profiling interpreter loop, see lsc_run
+uint64_t lsc_run_profile(LSC_VM *vm, uint64_t budget);
+
+// What a profiling loop calls at the start of each run, and for the instruction at pc once it has run (see lsc_loop.h)
+void lsc_profile_begin_run(LSC_VM *vm, LSC_PROFILE *profile);
+void lsc_profile_retire(LSC_VM *vm, LSC_PROFILE *profile, uint16_t pc, const LSC_DECODED *d);
+
+// Write the folded stacks to path. Returns 1 on success and 0 if the file could not be written.
+int lsc_profile_write(const LSC_PROFILE *profile, const char *path);
+
+// Print the per-opcode counts and the busiest addresses
+void lsc_profile_print(const LSC_PROFILE *profile);
+
+#endif
@@ -0,0 +1,150 @@
+#include "lsc_snapshot.h"
+#include "lsc_page.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+One page of a snapshot. Pages are immutable and shared between every snapshot they appear in, the last snapshot to
+let go of a page frees it.
+*/
+typedef struct {
+    int refs;
+    uint16_t words[LSC_PAGE_SIZE];
+} LSC_SNAPSHOT_PAGE;
+
+struct LSC_SNAPSHOT {
+    int refs;
+    LSC_SNAPSHOT_PAGE *pages[LSC_PAGE_COUNT]; // NULL for an all-zero page
+    LSC_REGISTER reg;
+    int halted;
+    int faulted;
+    uint64_t cycles;
+};
+
+/*
+Snapshots are shared between threads (every batch worker can hold the same one), so the reference counts are atomic.
+Nothing else needs to be: the contents never change after lsc_snapshot_take returns.
+*/
+static void lsc_snapshot_ref(int *refs) {
+    __atomic_fetch_add(refs, 1, __ATOMIC_RELAXED);
+}
+
+// Returns 1 if that was the last reference
+static int lsc_snapshot_unref(int *refs) {
+    return __atomic_sub_fetch(refs, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+// NULL for an all-zero page, which lsc_mem_share takes as the zero page
+static const uint16_t *lsc_snapshot_words(const LSC_SNAPSHOT *snap, uint32_t page) {
+    return snap->pages[page] ? snap->pages[page]->words : NULL;
+}
+
+static int lsc_page_is_zero(const uint16_t *words) {
+    if (words == lsc_page_zero) {
+        return 1;
+    }
+    for (uint32_t i = 0; i < LSC_PAGE_SIZE; ++i) {
+        if (words[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+LSC_SNAPSHOT *lsc_snapshot_take(LSC_VM *vm) {
+    LSC_SNAPSHOT *snap = calloc(1, sizeof(LSC_SNAPSHOT));
+    if (!snap) {
+        return NULL;
+    }
+    snap->refs = 1;
+
+    LSC_SNAPSHOT *base = vm->snapshot;
+    for (uint32_t page = 0; page < LSC_PAGE_COUNT; ++page) {
+        // Unchanged since the last snapshot: share its copy
+        if (base && !vm->page_dirty[page]) {
+            snap->pages[page] = base->pages[page];
+            if (snap->pages[page]) {
+                lsc_snapshot_ref(&snap->pages[page]->refs);
+            }
+            continue;
+        }
+
+        const uint16_t *words = vm->memory[page];
+        if (lsc_page_is_zero(words)) {
+            continue;
+        }
+
+        LSC_SNAPSHOT_PAGE *copy = malloc(sizeof(LSC_SNAPSHOT_PAGE));
+        if (!copy) {
+            lsc_snapshot_release(snap);
+            return NULL;
+        }
+        copy->refs = 1;
+        memcpy(copy->words, words, sizeof(copy->words));
+        snap->pages[page] = copy;
+    }
+
+    memcpy(snap->reg, vm->reg, sizeof(snap->reg));
+    snap->halted = vm->halted;
+    snap->faulted = vm->faulted;
+    snap->cycles = vm->cycles;
+
+    // Memory matches the new snapshot exactly, so from now on the VM reads the snapshot's pages, and owns none until it
+    // stores to them again. Pages shared with the old snapshot are the same pages in the new one.
+    for (uint32_t page = 0; page < LSC_PAGE_COUNT; ++page) {
+        lsc_mem_share(vm, page, lsc_snapshot_words(snap, page));
+    }
+
+    // ... and it is what the next snapshot or restore compares against
+    lsc_snapshot_ref(&snap->refs);
+    lsc_snapshot_release(vm->snapshot);
+    vm->snapshot = snap;
+    memset(vm->page_dirty, 0, sizeof(vm->page_dirty));
+
+    return snap;
+}
+
+void lsc_snapshot_restore(LSC_VM *vm, LSC_SNAPSHOT *snap) {
+    LSC_SNAPSHOT *current = vm->snapshot;
+
+    for (uint32_t page = 0; page < LSC_PAGE_COUNT; ++page) {
+        /*
+        A page is already right if it has not been written since the VM last matched current, and current shares the
+        page with snap (always true when they are the same snapshot).
+        */
+        if (current && !vm->page_dirty[page] && current->pages[page] == snap->pages[page]) {
+            continue;
+        }
+
+        // Nothing is copied, the VM reads snap's page until it stores to it
+        lsc_mem_share(vm, page, lsc_snapshot_words(snap, page));
+        lsc_mem_invalidate(vm, page * LSC_PAGE_SIZE, LSC_PAGE_SIZE);
+    }
+
+    memcpy(vm->reg, snap->reg, sizeof(vm->reg));
+    vm->halted = snap->halted;
+    vm->faulted = snap->faulted;
+    vm->cycles = snap->cycles;
+
+    if (current != snap) {
+        lsc_snapshot_ref(&snap->refs);
+        lsc_snapshot_release(current);
+        vm->snapshot = snap;
+    }
+    memset(vm->page_dirty, 0, sizeof(vm->page_dirty));
+}
+
+void lsc_snapshot_release(LSC_SNAPSHOT *snap) {
+    if (!snap || !lsc_snapshot_unref(&snap->refs)) {
+        return;
+    }
+
+    for (uint32_t page = 0; page < LSC_PAGE_COUNT; ++page) {
+        LSC_SNAPSHOT_PAGE *p = snap->pages[page];
+        if (p && lsc_snapshot_unref(&p->refs)) {
+            free(p);
+        }
+    }
+    free(snap);
+}
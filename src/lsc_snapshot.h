@@ -0,0 +1,39 @@
+#ifndef LSC_SNAPSHOT_H
+#define LSC_SNAPSHOT_H
+
+#include "lsc_vm.h"
+
+/*
+Snapshots
+
+A snapshot is a frozen copy of a machine: memory, registers, halted or faulted, and the cycle count. Restoring it puts a VM back
+into exactly that state, so a prepared machine (trap handlers, libraries, a program, all loaded) can be cloned for
+every job instead of being rebuilt from the image files each time.
+
+Both directions work a page (LSC_PAGE_SIZE words) at a time:
+- A snapshot shares every page that did not change with the snapshot the VM came from, so snapshotting a VM that was
+  restored and then touched a few pages only copies those few pages. All-zero pages are never copied at all.
+- Every VM remembers which snapshot it was last restored from (or taken into), and which pages it has written since.
+  Restoring the same snapshot again only puts those dirty pages back, the rest of memory is already right and its
+  predecoded instructions and JIT blocks are kept.
+- Restoring copies nothing at all: the VM's memory points at the snapshot's pages, and a page is only copied when the VM
+  first stores to it (see Memory in lsc_vm.h). Taking a snapshot does the same for the pages it copied. Any number of
+  VMs restored from one snapshot share one copy of everything none of them has written.
+
+A snapshot never changes once it has been taken, so any number of VMs on any number of threads can restore from it at
+once. It is reference counted: the VM holds a reference to its snapshot, so it is safe to release a snapshot while VMs
+are still using it.
+
+The output buffer is not part of the machine state, restoring leaves it alone.
+*/
+
+// Returns NULL when out of memory. The caller owns the returned reference.
+LSC_SNAPSHOT *lsc_snapshot_take(LSC_VM *vm);
+
+// Put vm into the state snap was taken in
+void lsc_snapshot_restore(LSC_VM *vm, LSC_SNAPSHOT *snap);
+
+// Drop a reference. NULL is ignored.
+void lsc_snapshot_release(LSC_SNAPSHOT *snap);
+
+#endif
@@ -0,0 +1,163 @@
+#include "lsc_vm.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/*
+String traps, done in bulk
+
+PUTS and PUTSP are what logging-heavy programs spend their time in, so rather than a loop of lsc_output_putc they:
+1. Find the zero word that ends the string, 8 words at a time
+2. Make room for the whole string in the output buffer once
+3. Narrow (PUTS) or copy (PUTSP) the words straight into it, 8 or 16 characters at a time
+
+Each page of memory is stored on its own (see Memory in lsc_vm.h), so both traps work on the string a page at a time. A
+string may also run off the end of memory and carry on from address 0.
+*/
+
+size_t lsc_word_len(const uint16_t *src, size_t max) {
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= max; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(v, zero));
+        if (mask) {
+            // Two mask bits per word
+            return i + __builtin_ctz(mask) / 2;
+        }
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 8 <= max; i += 8) {
+        uint16x8_t v = vld1q_u16(src + i);
+        if (vmaxvq_u16(vceqzq_u16(v))) {
+            break;
+        }
+    }
+#endif
+
+    for (; i < max; ++i) {
+        if (src[i] == 0) {
+            return i;
+        }
+    }
+    return max;
+}
+
+void lsc_narrow_copy(char *dst, const uint16_t *src, size_t count) {
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    // packus saturates, so clear the high bytes first to get the same truncation as a (char) cast
+    const __m128i low = _mm_set1_epi16(0x00FF);
+    for (; i + 16 <= count; i += 16) {
+        __m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i *)(src + i)), low);
+        __m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i *)(src + i + 8)), low);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(a, b));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 8 <= count; i += 8) {
+        vst1_u8((uint8_t *)(dst + i), vmovn_u16(vld1q_u16(src + i)));
+    }
+#endif
+
+    for (; i < count; ++i) {
+        dst[i] = (char)src[i];
+    }
+}
+
+/*
+PUTSP: two characters per word, low byte first, and a zero high byte is skipped.
+
+On a little-endian host the bytes of the words are already in output order, so a run of words with no zero high byte is
+a plain copy. Only the (rare) words with a zero high byte need picking apart. Returns the number of characters written.
+*/
+static size_t lsc_packed_copy(char *dst, const uint16_t *src, size_t count) {
+    size_t out = 0;
+    size_t i = 0;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && defined(__SSE2__)
+    const __m128i high = _mm_set1_epi16((short)0xFF00);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, high), zero))) {
+            break;
+        }
+        _mm_storeu_si128((__m128i *)(dst + out), v);
+        out += 16;
+    }
+#endif
+
+    for (; i < count; ++i) {
+        dst[out++] = (char)(src[i] & 0xFF);
+        if (src[i] >> 8) {
+            dst[out++] = (char)(src[i] >> 8);
+        }
+    }
+    return out;
+}
+
+/*
+How many words of the string at address lie in the piece starting length words in: up to the end of that page, but
+never all the way round memory and back past address
+*/
+static size_t lsc_string_piece(uint16_t address, size_t length) {
+    size_t piece = LSC_PAGE_SIZE - ((address + length) & (LSC_PAGE_SIZE - 1));
+    return piece < LSC_MEMORY_MAX - length ? piece : LSC_MEMORY_MAX - length;
+}
+
+// Words before the zero that ends the string at address, or all of memory if there is none
+static size_t lsc_string_length(const LSC_VM *vm, uint16_t address) {
+    size_t length = 0;
+    while (length < LSC_MEMORY_MAX) {
+        size_t piece = lsc_string_piece(address, length);
+        size_t found = lsc_word_len(lsc_mem_words(vm, address + length), piece);
+        length += found;
+        if (found < piece) {
+            break;
+        }
+    }
+    return length;
+}
+
+void lsc_output_puts(LSC_VM *vm, uint16_t address) {
+    size_t length = lsc_string_length(vm, address);
+    char *dst = lsc_output_reserve(vm, length);
+    if (!dst) {
+        return;
+    }
+    for (size_t done = 0; done < length;) {
+        size_t piece = lsc_string_piece(address, done);
+        if (piece > length - done) {
+            piece = length - done;
+        }
+        lsc_narrow_copy(dst + done, lsc_mem_words(vm, address + done), piece);
+        done += piece;
+    }
+    vm->output.len += length;
+}
+
+void lsc_output_putsp(LSC_VM *vm, uint16_t address) {
+    size_t length = lsc_string_length(vm, address);
+
+    // At most two characters per word
+    char *dst = lsc_output_reserve(vm, length * 2);
+    if (!dst) {
+        return;
+    }
+    size_t written = 0;
+    for (size_t done = 0; done < length;) {
+        size_t piece = lsc_string_piece(address, done);
+        if (piece > length - done) {
+            piece = length - done;
+        }
+        written += lsc_packed_copy(dst + written, lsc_mem_words(vm, address + done), piece);
+        done += piece;
+    }
+    vm->output.len += written;
+}
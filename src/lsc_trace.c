@@ -0,0 +1,768 @@
+#include "lsc_trace.h"
+#include "lsc_profile.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+enum {
+    LSC_TRACE_CHUNK = 1 << 18, // Bytes of records handed to the writer thread at a time
+    LSC_TRACE_BUFFERS = 4, // Chunks the interpreter can get ahead of the writer before it has to wait
+    LSC_TRACE_MAX_RECORD = 64, // No record encodes to more than this
+    LSC_TRACE_MAX_WRITES = 2, // Stores one instruction can make
+    LSC_TRACE_MAX_INPUTS = 2, // Device reads one instruction can make (LDI through a device register)
+    LSC_TRACE_HEADER = 8 + LSC_R_COUNT * 2 + 8,
+
+    LSC_LZ_BITS = 14, // Size of the match finder's table
+    LSC_LZ_MIN = 4, // Shortest match worth encoding
+};
+
+static const char lsc_trace_magic[8] = "LSCTRC1";
+
+/*
+Record layout: a flags byte, then
+- LSC_TRACE_JUMPED: PC minus the address after the previous record's, zigzag varint
+- the instruction, 2 bytes
+- LSC_TRACE_INPUTS: a count byte, then each value read from outside as a varint
+- LSC_TRACE_REGS: a mask byte of R0-R7, then each changed register's new value minus its old one, zigzag varint
+- LSC_TRACE_WRITES: a count byte, then each store's address minus the previous store's (zigzag varint) and its value
+*/
+enum {
+    LSC_TRACE_JUMPED = 1 << 0,
+    LSC_TRACE_INPUTS = 1 << 1,
+    LSC_TRACE_REGS = 1 << 2,
+    LSC_TRACE_WRITES = 1 << 3,
+};
+
+// Everything one instruction did
+typedef struct {
+    uint16_t pc;
+    uint16_t instr;
+    uint8_t regs; // Mask of the registers that changed
+    uint16_t reg[8]; // New values, for the registers in regs
+    int write_count;
+    uint16_t write_address[LSC_TRACE_MAX_WRITES];
+    uint16_t write_value[LSC_TRACE_MAX_WRITES];
+    int input_count;
+    uint16_t input[LSC_TRACE_MAX_INPUTS];
+} LSC_TRACE_RECORD;
+
+struct LSC_TRACE {
+    int replaying;
+    FILE *file;
+    uint64_t count; // Records written, or matched
+
+    // Where the records so far leave the machine, which is what the next one is encoded against
+    uint16_t pc; // PC of the previous record
+    uint16_t reg[8];
+    uint16_t write_address;
+
+    LSC_TRACE_RECORD now; // The instruction running now
+    uint16_t before[8]; // Replaying: registers as the last instruction left them. Recording uses reg for this.
+
+    // Recording: the interpreter fills buffers[fill], the writer thread writes them out in the same order. size[i] is
+    // non-zero while buffers[i] is waiting for the writer.
+    uint8_t *buffers[LSC_TRACE_BUFFERS];
+    size_t size[LSC_TRACE_BUFFERS];
+    int fill;
+    size_t used; // Bytes of buffers[fill] filled so far
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int closing;
+    int failed; // A write went wrong, the file is incomplete
+    uint32_t *table; // The writer's LZ77 hash table
+    uint8_t *chunk; // The writer's compressed chunk, with its sizes in front
+
+    // Replaying: the current chunk, decompressed
+    uint8_t *raw;
+    size_t raw_len;
+    size_t raw_pos;
+    uint8_t *packed;
+    LSC_TRACE_RECORD expected; // What the instruction running now did when it was recorded
+    int have_expected; // expected is decoded but not yet matched (the instruction may run again after a wait)
+    int input_used; // Inputs of expected handed to the program so far
+    int ended; // The last record has been read
+    int diverged;
+    char message[160];
+};
+
+// Worst case size of LSC_TRACE_CHUNK bytes once compressed
+static size_t lsc_lz_bound(size_t size) {
+    // A 4 byte match far back can take 5 bytes to encode
+    return size + size / 4 + 16;
+}
+
+static size_t lsc_varint_put(uint8_t *out, uint32_t value) {
+    // Most deltas are small, so the one byte case comes first
+    if (value < 0x80) {
+        *out = (uint8_t)value;
+        return 1;
+    }
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+// Returns 0 if the varint runs past end
+static int lsc_varint_get(const uint8_t **in, const uint8_t *end, uint32_t *value) {
+    uint32_t v = 0;
+    for (int shift = 0; *in < end && shift < 35; shift += 7) {
+        uint8_t byte = *(*in)++;
+        v |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = v;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 16-bit differences, small either way round, as small unsigned numbers
+static uint32_t lsc_zigzag(uint16_t delta) {
+    int16_t d = (int16_t)delta;
+    return (uint32_t)(((int32_t)d << 1) ^ ((int32_t)d >> 15)) & 0x1FFFF;
+}
+
+static uint16_t lsc_unzigzag(uint32_t value) {
+    return (uint16_t)((value >> 1) ^ (0u - (value & 1)));
+}
+
+/*
+A plain greedy LZ77: literal count (varint), literals, then match length minus LSC_LZ_MIN and distance (varints), over
+and over. The trace of a loop is the same few records over and over, which this squeezes well, and it runs much faster
+than the interpreter makes records.
+*/
+static size_t lsc_lz_pack(const uint8_t *in, size_t size, uint8_t *out, uint32_t *table) {
+    size_t o = 0;
+    size_t literal = 0;
+    size_t i = 0;
+
+    memset(table, 0, sizeof(uint32_t) << LSC_LZ_BITS);
+    while (i + LSC_LZ_MIN <= size) {
+        uint32_t v;
+        memcpy(&v, in + i, sizeof(v));
+        uint32_t slot = (v * 2654435761u) >> (32 - LSC_LZ_BITS);
+        // Slots hold position + 1, 0 is empty
+        size_t match = table[slot];
+        table[slot] = (uint32_t)i + 1;
+        if (!match || memcmp(in + match - 1, in + i, LSC_LZ_MIN) != 0) {
+            ++i;
+            continue;
+        }
+
+        --match;
+        // Loops repeat the same records for a long way, so matches are compared 8 bytes at a time
+        size_t len = LSC_LZ_MIN;
+        while (i + len + sizeof(uint64_t) <= size) {
+            uint64_t a, b;
+            memcpy(&a, in + match + len, sizeof(a));
+            memcpy(&b, in + i + len, sizeof(b));
+            if (a != b) {
+                break;
+            }
+            len += sizeof(uint64_t);
+        }
+        while (i + len < size && in[match + len] == in[i + len]) {
+            ++len;
+        }
+        o += lsc_varint_put(out + o, (uint32_t)(i - literal));
+        memcpy(out + o, in + literal, i - literal);
+        o += i - literal;
+        o += lsc_varint_put(out + o, (uint32_t)(len - LSC_LZ_MIN));
+        o += lsc_varint_put(out + o, (uint32_t)(i - match));
+        i += len;
+        literal = i;
+    }
+
+    o += lsc_varint_put(out + o, (uint32_t)(size - literal));
+    memcpy(out + o, in + literal, size - literal);
+    return o + (size - literal);
+}
+
+// Returns 0 if in is not exactly size bytes of lsc_lz_pack output
+static int lsc_lz_unpack(const uint8_t *in, size_t in_size, uint8_t *out, size_t size) {
+    const uint8_t *end = in + in_size;
+    size_t o = 0;
+
+    while (o < size) {
+        uint32_t literal;
+        if (!lsc_varint_get(&in, end, &literal) || literal > (size_t)(end - in) || literal > size - o) {
+            return 0;
+        }
+        memcpy(out + o, in, literal);
+        in += literal;
+        o += literal;
+        if (o == size) {
+            break;
+        }
+
+        uint32_t len, distance;
+        if (!lsc_varint_get(&in, end, &len) || !lsc_varint_get(&in, end, &distance)) {
+            return 0;
+        }
+        len += LSC_LZ_MIN;
+        if (distance == 0 || distance > o || len > size - o) {
+            return 0;
+        }
+        // A match may overlap what it produces, so a wide copy must not reach past the bytes already there
+        uint32_t k = 0;
+        if (distance >= sizeof(uint64_t)) {
+            for (; k + sizeof(uint64_t) <= len; k += sizeof(uint64_t), o += sizeof(uint64_t)) {
+                memcpy(out + o, out + o - distance, sizeof(uint64_t));
+            }
+        }
+        for (; k < len; ++k, ++o) {
+            out[o] = out[o - distance];
+        }
+    }
+    return 1;
+}
+
+static void lsc_put32(uint8_t *out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static uint32_t lsc_get32(const uint8_t *in) {
+    return in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+// FNV-1a over memory, so a replay can tell it was given different images
+static uint64_t lsc_trace_hash(const LSC_VM *vm) {
+    uint64_t hash = 14695981039346656037u;
+    for (uint32_t address = 0; address < LSC_MEMORY_MAX; ++address) {
+        hash = (hash ^ lsc_mem_peek(vm, address)) * 1099511628211u;
+    }
+    return hash;
+}
+
+static void lsc_trace_header(const LSC_VM *vm, uint8_t *out) {
+    memcpy(out, lsc_trace_magic, sizeof(lsc_trace_magic));
+    for (int r = 0; r < LSC_R_COUNT; ++r) {
+        out[8 + 2 * r] = (uint8_t)vm->reg[r];
+        out[9 + 2 * r] = (uint8_t)(vm->reg[r] >> 8);
+    }
+    uint64_t hash = lsc_trace_hash(vm);
+    lsc_put32(out + 8 + LSC_R_COUNT * 2, (uint32_t)hash);
+    lsc_put32(out + 12 + LSC_R_COUNT * 2, (uint32_t)(hash >> 32));
+}
+
+// The machine as it is now is where the first record starts
+static void lsc_trace_start(LSC_TRACE *trace, const LSC_VM *vm) {
+    trace->pc = vm->reg[LSC_R_PC] - 1;
+    memcpy(trace->reg, vm->reg, sizeof(trace->reg));
+    memcpy(trace->before, vm->reg, sizeof(trace->before));
+}
+
+static size_t lsc_trace_encode(LSC_TRACE *trace, const LSC_TRACE_RECORD *record, uint8_t *out) {
+    uint8_t flags = 0;
+    uint8_t *p = out + 1;
+
+    if (record->pc != (uint16_t)(trace->pc + 1)) {
+        flags |= LSC_TRACE_JUMPED;
+        p += lsc_varint_put(p, lsc_zigzag(record->pc - (trace->pc + 1)));
+    }
+    trace->pc = record->pc;
+    *p++ = (uint8_t)record->instr;
+    *p++ = (uint8_t)(record->instr >> 8);
+
+    if (record->input_count) {
+        flags |= LSC_TRACE_INPUTS;
+        *p++ = (uint8_t)record->input_count;
+        for (int i = 0; i < record->input_count; ++i) {
+            p += lsc_varint_put(p, record->input[i]);
+        }
+    }
+    if (record->regs) {
+        flags |= LSC_TRACE_REGS;
+        *p++ = record->regs;
+        for (unsigned regs = record->regs; regs; regs &= regs - 1) {
+            int r = __builtin_ctz(regs);
+            p += lsc_varint_put(p, lsc_zigzag(record->reg[r] - trace->reg[r]));
+            trace->reg[r] = record->reg[r];
+        }
+    }
+    if (record->write_count) {
+        flags |= LSC_TRACE_WRITES;
+        *p++ = (uint8_t)record->write_count;
+        for (int i = 0; i < record->write_count; ++i) {
+            p += lsc_varint_put(p, lsc_zigzag(record->write_address[i] - trace->write_address));
+            p += lsc_varint_put(p, record->write_value[i]);
+            trace->write_address = record->write_address[i];
+        }
+    }
+
+    out[0] = flags;
+    return (size_t)(p - out);
+}
+
+// Returns 0 if the record is cut short or makes no sense
+static int lsc_trace_decode(LSC_TRACE *trace, const uint8_t **in, const uint8_t *end, LSC_TRACE_RECORD *record) {
+    uint32_t v;
+    if (*in >= end) {
+        return 0;
+    }
+    uint8_t flags = *(*in)++;
+
+    record->pc = trace->pc + 1;
+    if (flags & LSC_TRACE_JUMPED) {
+        if (!lsc_varint_get(in, end, &v)) {
+            return 0;
+        }
+        record->pc += lsc_unzigzag(v);
+    }
+    trace->pc = record->pc;
+    if (end - *in < 2) {
+        return 0;
+    }
+    record->instr = (*in)[0] | (uint16_t)((*in)[1] << 8);
+    *in += 2;
+
+    record->input_count = 0;
+    if (flags & LSC_TRACE_INPUTS) {
+        if (*in >= end || **in > LSC_TRACE_MAX_INPUTS) {
+            return 0;
+        }
+        record->input_count = *(*in)++;
+        for (int i = 0; i < record->input_count; ++i) {
+            if (!lsc_varint_get(in, end, &v)) {
+                return 0;
+            }
+            record->input[i] = (uint16_t)v;
+        }
+    }
+
+    record->regs = 0;
+    if (flags & LSC_TRACE_REGS) {
+        if (*in >= end) {
+            return 0;
+        }
+        record->regs = *(*in)++;
+        for (int r = 0; r < 8; ++r) {
+            if (record->regs & (1 << r)) {
+                if (!lsc_varint_get(in, end, &v)) {
+                    return 0;
+                }
+                trace->reg[r] += lsc_unzigzag(v);
+                record->reg[r] = trace->reg[r];
+            }
+        }
+    }
+
+    record->write_count = 0;
+    if (flags & LSC_TRACE_WRITES) {
+        if (*in >= end || **in > LSC_TRACE_MAX_WRITES) {
+            return 0;
+        }
+        record->write_count = *(*in)++;
+        for (int i = 0; i < record->write_count; ++i) {
+            uint32_t value;
+            if (!lsc_varint_get(in, end, &v) || !lsc_varint_get(in, end, &value)) {
+                return 0;
+            }
+            trace->write_address += lsc_unzigzag(v);
+            record->write_address[i] = trace->write_address;
+            record->write_value[i] = (uint16_t)value;
+        }
+    }
+    return 1;
+}
+
+// Recording
+
+static void *lsc_trace_writer(void *arg) {
+    LSC_TRACE *trace = arg;
+    uint8_t *packed = trace->chunk;
+
+    for (int next = 0;; next = (next + 1) % LSC_TRACE_BUFFERS) {
+        pthread_mutex_lock(&trace->lock);
+        while (!trace->size[next] && !trace->closing) {
+            pthread_cond_wait(&trace->changed, &trace->lock);
+        }
+        size_t size = trace->size[next];
+        pthread_mutex_unlock(&trace->lock);
+        // Closing only happens once every full buffer has been handed over, so an empty one here is the end
+        if (!size) {
+            break;
+        }
+
+        if (!trace->failed) {
+            size_t packed_size = lsc_lz_pack(trace->buffers[next], size, packed + 8, trace->table);
+            lsc_put32(packed, (uint32_t)size);
+            lsc_put32(packed + 4, (uint32_t)packed_size);
+            if (fwrite(packed, 1, 8 + packed_size, trace->file) != 8 + packed_size) {
+                trace->failed = 1;
+            }
+        }
+
+        pthread_mutex_lock(&trace->lock);
+        trace->size[next] = 0;
+        pthread_cond_broadcast(&trace->changed);
+        pthread_mutex_unlock(&trace->lock);
+    }
+    return NULL;
+}
+
+// Hand the buffer being filled to the writer and move on to the next one, once the writer is done with it
+static void lsc_trace_submit(LSC_TRACE *trace) {
+    if (!trace->used) {
+        return;
+    }
+    int next = (trace->fill + 1) % LSC_TRACE_BUFFERS;
+
+    pthread_mutex_lock(&trace->lock);
+    trace->size[trace->fill] = trace->used;
+    pthread_cond_broadcast(&trace->changed);
+    while (trace->size[next]) {
+        pthread_cond_wait(&trace->changed, &trace->lock);
+    }
+    pthread_mutex_unlock(&trace->lock);
+
+    trace->fill = next;
+    trace->used = 0;
+}
+
+// Everything a trace needs is taken from vm's arena up front, so nothing of it is freed before the arena is reset
+LSC_TRACE *lsc_trace_record(LSC_VM *vm, const char *path) {
+    LSC_TRACE *trace = lsc_arena_zalloc(&vm->arena, sizeof(LSC_TRACE));
+    if (!trace) {
+        return NULL;
+    }
+    for (int i = 0; i < LSC_TRACE_BUFFERS; ++i) {
+        trace->buffers[i] = lsc_arena_alloc(&vm->arena, LSC_TRACE_CHUNK);
+        if (!trace->buffers[i]) {
+            return NULL;
+        }
+    }
+    // The writer thread never allocates, the arena is only for the VM's own thread
+    trace->table = lsc_arena_alloc(&vm->arena, sizeof(uint32_t) << LSC_LZ_BITS);
+    trace->chunk = lsc_arena_alloc(&vm->arena, 8 + lsc_lz_bound(LSC_TRACE_CHUNK));
+    if (!trace->table || !trace->chunk) {
+        return NULL;
+    }
+
+    uint8_t header[LSC_TRACE_HEADER];
+    lsc_trace_header(vm, header);
+    trace->file = fopen(path, "wb");
+    if (!trace->file || fwrite(header, 1, sizeof(header), trace->file) != sizeof(header)) {
+        if (trace->file) {
+            fclose(trace->file);
+        }
+        return NULL;
+    }
+
+    pthread_mutex_init(&trace->lock, NULL);
+    pthread_cond_init(&trace->changed, NULL);
+    if (pthread_create(&trace->writer, NULL, lsc_trace_writer, trace) != 0) {
+        pthread_mutex_destroy(&trace->lock);
+        pthread_cond_destroy(&trace->changed);
+        fclose(trace->file);
+        return NULL;
+    }
+
+    lsc_trace_start(trace, vm);
+    return trace;
+}
+
+// Replaying
+
+// Read and decompress the next chunk. Returns 0 at the end of the trace, or if it is not a trace (see diverged).
+static int lsc_trace_next_chunk(LSC_TRACE *trace) {
+    uint8_t sizes[8];
+    trace->raw_len = trace->raw_pos = 0;
+    if (fread(sizes, 1, sizeof(sizes), trace->file) != sizeof(sizes)) {
+        snprintf(trace->message, sizeof(trace->message), "the trace is cut short");
+        trace->diverged = 1;
+        return 0;
+    }
+
+    uint32_t size = lsc_get32(sizes);
+    uint32_t packed_size = lsc_get32(sizes + 4);
+    if (size == 0) {
+        trace->ended = 1;
+        return 0;
+    }
+    if (size > LSC_TRACE_CHUNK || packed_size > lsc_lz_bound(LSC_TRACE_CHUNK) ||
+        fread(trace->packed, 1, packed_size, trace->file) != packed_size ||
+        !lsc_lz_unpack(trace->packed, packed_size, trace->raw, size)) {
+        snprintf(trace->message, sizeof(trace->message), "the trace is corrupt");
+        trace->diverged = 1;
+        return 0;
+    }
+    trace->raw_len = size;
+    return 1;
+}
+
+LSC_TRACE *lsc_trace_replay(LSC_VM *vm, const char *path) {
+    LSC_TRACE *trace = lsc_arena_zalloc(&vm->arena, sizeof(LSC_TRACE));
+    if (!trace) {
+        return NULL;
+    }
+    trace->replaying = 1;
+    trace->raw = lsc_arena_alloc(&vm->arena, LSC_TRACE_CHUNK);
+    trace->packed = lsc_arena_alloc(&vm->arena, lsc_lz_bound(LSC_TRACE_CHUNK));
+    trace->file = fopen(path, "rb");
+
+    uint8_t header[LSC_TRACE_HEADER];
+    if (!trace->raw || !trace->packed || !trace->file ||
+        fread(header, 1, sizeof(header), trace->file) != sizeof(header) ||
+        memcmp(header, lsc_trace_magic, sizeof(lsc_trace_magic)) != 0) {
+        if (trace->file) {
+            fclose(trace->file);
+        }
+        return NULL;
+    }
+
+    // A different starting point is a divergence before the first instruction, not a broken file
+    uint8_t expected[LSC_TRACE_HEADER];
+    lsc_trace_header(vm, expected);
+    if (memcmp(header, expected, sizeof(header)) != 0) {
+        snprintf(trace->message, sizeof(trace->message), "the machine does not start the way it did when recorded");
+        trace->diverged = 1;
+    }
+
+    lsc_trace_start(trace, vm);
+    if (!trace->diverged) {
+        lsc_trace_next_chunk(trace);
+    }
+    return trace;
+}
+
+int lsc_trace_close(LSC_TRACE *trace) {
+    if (!trace) {
+        return 1;
+    }
+
+    int ok;
+    if (trace->replaying) {
+        ok = !trace->diverged;
+        fclose(trace->file);
+    } else {
+        lsc_trace_submit(trace);
+        pthread_mutex_lock(&trace->lock);
+        trace->closing = 1;
+        pthread_cond_broadcast(&trace->changed);
+        pthread_mutex_unlock(&trace->lock);
+        pthread_join(trace->writer, NULL);
+        pthread_mutex_destroy(&trace->lock);
+        pthread_cond_destroy(&trace->changed);
+
+        uint8_t end[8] = {0};
+        ok = !trace->failed && fwrite(end, 1, sizeof(end), trace->file) == sizeof(end);
+        ok &= fclose(trace->file) == 0;
+    }
+    return ok;
+}
+
+void lsc_trace_print(const LSC_TRACE *trace) {
+    if (!trace->replaying) {
+        printf("trace: %llu instructions recorded\n", (unsigned long long)trace->count);
+    } else if (trace->diverged) {
+        printf("replay: diverged after %llu instructions: %s\n", (unsigned long long)trace->count, trace->message);
+    } else {
+        printf("replay: %llu instructions match the trace%s\n", (unsigned long long)trace->count,
+            trace->ended && trace->raw_pos == trace->raw_len && !trace->have_expected ? "" : ", which goes on further");
+    }
+}
+
+// The interpreter loop
+
+static void lsc_trace_diverge(LSC_TRACE *trace, const char *what, unsigned expected, unsigned got) {
+    if (!trace->diverged) {
+        snprintf(trace->message, sizeof(trace->message), "at x%04X %s x%04X, expected x%04X", trace->now.pc, what, got,
+            expected);
+        trace->diverged = 1;
+    }
+}
+
+/*
+Start the instruction at pc. When replaying, that is also where the record it should match is read. Returns 0 if the
+replay has got as far as it can.
+*/
+static int lsc_trace_begin(LSC_VM *vm, LSC_TRACE *trace, uint16_t pc) {
+    trace->now.pc = pc;
+    trace->now.instr = lsc_mem_peek(vm, pc);
+    trace->now.write_count = 0;
+    trace->now.input_count = 0;
+
+    if (!trace->replaying) {
+        return 1;
+    }
+    if (trace->diverged) {
+        return 0;
+    }
+    if (!trace->have_expected) {
+        if (trace->raw_pos == trace->raw_len) {
+            return 0;
+        }
+        const uint8_t *in = trace->raw + trace->raw_pos;
+        if (!lsc_trace_decode(trace, &in, trace->raw + trace->raw_len, &trace->expected)) {
+            snprintf(trace->message, sizeof(trace->message), "the trace is corrupt");
+            trace->diverged = 1;
+            return 0;
+        }
+        trace->raw_pos = (size_t)(in - trace->raw);
+        trace->have_expected = 1;
+        // Read on to the next chunk straight away, so the last record is known to be the last one once it is reached
+        if (trace->raw_pos == trace->raw_len) {
+            lsc_trace_next_chunk(trace);
+        }
+    }
+    trace->input_used = 0;
+    return 1;
+}
+
+/*
+Where a replay differs from the recording, the first difference found is kept for lsc_trace_print. Returns 0 if it
+differs.
+*/
+static int lsc_trace_match(LSC_TRACE *trace) {
+    const LSC_TRACE_RECORD *expected = &trace->expected;
+    const LSC_TRACE_RECORD *now = &trace->now;
+
+    if (now->pc != expected->pc) {
+        lsc_trace_diverge(trace, "PC is", expected->pc, now->pc);
+    } else if (now->instr != expected->instr) {
+        lsc_trace_diverge(trace, "the instruction is", expected->instr, now->instr);
+    } else if (now->regs != expected->regs) {
+        lsc_trace_diverge(trace, "the changed registers are", expected->regs, now->regs);
+    } else if (now->write_count != expected->write_count) {
+        lsc_trace_diverge(trace, "the number of stores is", expected->write_count, now->write_count);
+    } else if (now->input_count != expected->input_count) {
+        lsc_trace_diverge(trace, "the number of device reads is", expected->input_count, now->input_count);
+    }
+    for (int r = 0; r < 8 && !trace->diverged; ++r) {
+        if ((now->regs & (1 << r)) && now->reg[r] != expected->reg[r]) {
+            char what[16];
+            snprintf(what, sizeof(what), "R%d is", r);
+            lsc_trace_diverge(trace, what, expected->reg[r], now->reg[r]);
+        }
+    }
+    for (int i = 0; i < now->write_count && !trace->diverged; ++i) {
+        if (now->write_address[i] != expected->write_address[i]) {
+            lsc_trace_diverge(trace, "a store goes to", expected->write_address[i], now->write_address[i]);
+        } else if (now->write_value[i] != expected->write_value[i]) {
+            lsc_trace_diverge(trace, "a store writes", expected->write_value[i], now->write_value[i]);
+        }
+    }
+    return !trace->diverged;
+}
+
+// Finish the instruction started by lsc_trace_begin. Returns 0 if a replay diverged on it.
+static int lsc_trace_retire(LSC_VM *vm, LSC_TRACE *trace) {
+    LSC_TRACE_RECORD *now = &trace->now;
+    uint16_t *before = trace->replaying ? trace->before : trace->reg;
+
+    /*
+    Register by register rather than one memcmp: the instruction has only just stored to them, and a wide load of
+    narrow stores still in flight stalls until they land.
+    */
+    unsigned regs = 0;
+    for (int r = 0; r < 8; ++r) {
+        regs |= (unsigned)(vm->reg[r] != before[r]) << r;
+    }
+    now->regs = (uint8_t)regs;
+    for (; regs; regs &= regs - 1) {
+        int r = __builtin_ctz(regs);
+        now->reg[r] = vm->reg[r];
+    }
+
+    if (trace->replaying) {
+        trace->have_expected = 0;
+        if (!lsc_trace_match(trace)) {
+            return 0;
+        }
+        for (regs = now->regs; regs; regs &= regs - 1) {
+            int r = __builtin_ctz(regs);
+            trace->before[r] = now->reg[r];
+        }
+        // Nobody is watching a replay's output
+        vm->output.len = 0;
+    } else {
+        if (LSC_TRACE_CHUNK - trace->used < LSC_TRACE_MAX_RECORD) {
+            lsc_trace_submit(trace);
+        }
+        trace->used += lsc_trace_encode(trace, now, trace->buffers[trace->fill] + trace->used);
+    }
+    ++trace->count;
+    return 1;
+}
+
+// Something from outside the machine: note it when recording, hand back the recorded one when replaying
+static uint16_t lsc_trace_input(LSC_TRACE *trace, uint16_t value) {
+    LSC_TRACE_RECORD *now = &trace->now;
+    if (trace->replaying) {
+        if (trace->input_used < trace->expected.input_count) {
+            value = trace->expected.input[trace->input_used++];
+        } else {
+            lsc_trace_diverge(trace, "the number of device reads is", trace->expected.input_count,
+                now->input_count + 1);
+        }
+    }
+    if (now->input_count < LSC_TRACE_MAX_INPUTS) {
+        now->input[now->input_count++] = value;
+    }
+    return value;
+}
+
+static uint16_t lsc_trace_mem_read(LSC_VM *vm, LSC_TRACE *trace, uint16_t address) {
+    if (!(vm->page_attr[address >> LSC_PAGE_SHIFT] & LSC_PAGE_DEVICE)) {
+        return lsc_mem_peek(vm, address);
+    }
+    return lsc_trace_input(trace, trace->replaying ? 0 : lsc_mem_read(vm, address));
+}
+
+static void lsc_trace_mem_write(LSC_VM *vm, LSC_TRACE *trace, uint16_t address, uint16_t value) {
+    LSC_TRACE_RECORD *now = &trace->now;
+    if (now->write_count < LSC_TRACE_MAX_WRITES) {
+        now->write_address[now->write_count] = address;
+        now->write_value[now->write_count++] = value;
+    }
+    lsc_mem_write(vm, address, value);
+}
+
+static int lsc_trace_trap(LSC_VM *vm, LSC_TRACE *trace, uint8_t vector) {
+    if (vector != LSC_TRAP_GETC && vector != LSC_TRAP_IN) {
+        return lsc_trap(vm, vector);
+    }
+    // The key is all that matters, a replay has no keyboard to wait for
+    if (!trace->replaying && lsc_trap(vm, vector)) {
+        return 1;
+    }
+    vm->reg[LSC_R_R0] = lsc_trace_input(trace, vm->reg[LSC_R_R0]);
+    return 0;
+}
+
+/*
+The exact switch loop (see lsc_loop.h) with lsc_trace_begin and lsc_trace_retire around every instruction, and the
+loads, stores and traps in lsc_ops.h routed through the functions above. Superinstructions still retire each of their
+parts through LSC_STEP, so every instruction gets its own record. The second loop profiles as well.
+*/
+#define lsc_mem_read(vm, address) lsc_trace_mem_read(vm, trace, address)
+#define lsc_mem_write(vm, address, value) lsc_trace_mem_write(vm, trace, address, value)
+#define lsc_trap(vm, vector) lsc_trace_trap(vm, trace, vector)
+
+#define LSC_LOOP_NAME lsc_run_trace
+#define LSC_LOOP_SETUP LSC_TRACE *trace = vm->trace;
+#define LSC_LOOP_BEGIN() lsc_trace_begin(vm, trace, pc)
+#define LSC_LOOP_RETIRE() lsc_trace_retire(vm, trace)
+#include "lsc_loop.h"
+
+#define LSC_LOOP_NAME lsc_run_trace_profile
+#define LSC_LOOP_SETUP \
+    LSC_TRACE *trace = vm->trace; \
+    LSC_PROFILE *profile = vm->profile; \
+    lsc_profile_begin_run(vm, profile);
+#define LSC_LOOP_BEGIN() lsc_trace_begin(vm, trace, pc)
+#define LSC_LOOP_RETIRE() (lsc_profile_retire(vm, profile, pc, d), lsc_trace_retire(vm, trace))
+#include "lsc_loop.h"
+
+#undef lsc_mem_read
+#undef lsc_mem_write
+#undef lsc_trap
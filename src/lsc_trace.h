@@ -0,0 +1,55 @@
+#ifndef LSC_TRACE_H
+#define LSC_TRACE_H
+
+#include "lsc_vm.h"
+
+/*
+Execution traces
+
+lsc_vm --trace=run.trace image.obj
+lsc_vm --replay=run.trace image.obj
+
+While a trace is attached to a VM (vm->trace), lsc_vm_run uses a separate copy of the interpreter loop (like the
+profiler) that notes, for every instruction it retires:
+- its PC and the instruction word
+- every register it changed, and the new value
+- every store it made, address and value
+- everything it read from outside the machine: device registers, and the key GETC or IN returned
+
+Recording writes those down. Replaying runs the same images again, hands the program the recorded keys and device
+values instead of asking the devices, and checks every instruction does exactly what it did the first time. The first
+one that does not is reported, with what was expected.
+
+Records are delta-encoded against the one before (PC relative to the next address, registers relative to their old
+value, store addresses relative to the last store), which keeps most of them to 4-6 bytes. The interpreter only appends
+them to a buffer. Full buffers go to a writer thread that compresses them (a small LZ77) and writes them out, so the
+interpreter never waits for the disk unless it gets a few buffers ahead of it.
+
+File format, all numbers little-endian:
+- "LSCTRC1\0", then the registers (LSC_R_COUNT words) and a 64-bit hash of memory at the start
+- chunks: raw size (32 bits), compressed size (32 bits), compressed records. A raw size of 0 ends the trace.
+*/
+
+/*
+Start recording vm into path. The VM should be loaded and ready to run. Returns NULL if path cannot be written.
+
+The trace and its buffers come from vm's arena, so it has to be closed before lsc_vm_clear.
+*/
+LSC_TRACE *lsc_trace_record(LSC_VM *vm, const char *path);
+
+// Start replaying path on vm, which must be loaded with the same images. Returns NULL if path is not a trace.
+LSC_TRACE *lsc_trace_replay(LSC_VM *vm, const char *path);
+
+// Finish the trace. Returns 1 if a recording was all written, or a replay matched as far as it went.
+int lsc_trace_close(LSC_TRACE *trace);
+
+// Print how many instructions were recorded or matched, and where a replay diverged
+void lsc_trace_print(const LSC_TRACE *trace);
+
+// The tracing interpreter loop, see lsc_run. Stops early when a replay diverges or reaches the end of the trace.
+uint64_t lsc_run_trace(LSC_VM *vm, uint64_t budget);
+
+// The same, profiling into vm->profile as well
+uint64_t lsc_run_trace_profile(LSC_VM *vm, uint64_t budget);
+
+#endif
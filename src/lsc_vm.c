@@ -0,0 +1,658 @@
+#include "lsc_vm.h"
+#include "lsc_jit.h"
+
+#include "lsc_block.h"
+#include "lsc_console.h"
+#include "lsc_dispatch.h"
+#include "lsc_fuse.h"
+#include "lsc_metrics.h"
+#include "lsc_page.h"
+#include "lsc_snapshot.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+Two's complement:
+- Representation of a negative number
+- Think of a car meter
+    - Drive for a mile and you could end up with 00001 on the meter. This can be interpreted as +1.
+    - Say we could turn this meter back one mile to 99999. This can be intepreted as -1.
+- Lets look at an example
+    - 0001, this would be represented as +1
+    - 1111, This would be represented as -1. The left most bit shows that the value is negative.
+        - Think of this like so:
+            - MSB represents -8. The rest of the values are positive, adding to it. So -8 + 4 + 2
+
+Sign bit:
+- The leftmost bit also called the most significant bit
+- When this bit is 1 the number is negative and when 0 the number is positive
+
+Computing the Two's complement:
+1. Start with the binary representation of the number. With the leading bit being a sign bit.
+2. Invert ALL bits
+3. Add 1 to entire number, ignoring overflow
+
+Example:
+1. 0111 = +7
+2. Flip the bits: 1000 -> Negative number.
+3. Add 1 to the flipped number: 1001.
+    - Lets check this is correct: -8 + 1 = -7. So this does work :D
+*/
+
+uint16_t lsc_sign_extend(uint16_t x, int bit_count) {
+    /*
+    Lets break this down:
+    - Lets assume x = (-7) and the bit_count = 4.
+    - bit_count - 1
+        - Now we are working with 3 bits.
+    - x >> 3
+        - The >> operator shifts all bits right. Here that is done 3 times. Let's see that happening:
+            - Original number = 0000 0000 0000 1001 (you can see here that -7 has been improperly extended to form 9 rather than -7)
+            - Bitshifted number = 0000 0000 0000 0001
+    - 0000 0000 0000 0001 & 0000 0000 0000 0001
+        - This is the bitwise and operator
+            - This compares 0000 0000 0000 0001 with the binary representation of 1 which is 0000 0000 0000 0001
+    
+    What is the purpose of this?
+    - This simply just checks whether the most significant bit is 1. If it is then the number should be negative.
+    */
+    if ((x >> (bit_count - 1)) & 1) {
+        /*
+        Lets continue to break this down:
+        - 0xFFFF << 4 (bit_count)
+            - 0xFFFF is a hexadecimal number
+                - Hexadecimal works on powers of 16. 0xF(1)F(16)F(256)F(4096)
+                - Multiply by powers of 16:
+                    - F is 15
+                    - 15*1 + 15*16 + 15*256 + 15*4096 = 65535
+                        - Interesting. Where have we seen that number before? That is the maximum number a 16 bit number can store. Would logically be represented like such in binary: 1111 1111 1111 1111
+                            - This would represent -1 in binary since we are using the Two's complement
+            - The << operator shifts all bits left. This is one 4 times here. Let's see this happening:
+                - Original number: 1111 1111 1111 1111
+                - Bitshifted number: 1111 1111 1111 0000
+                    - We can see the rightmost 4 bits are where our number will be stored
+        - x |= 1111 1111 1111 0000
+            - |= is the bitwise or operator. 1 will be returned if at least 1 bit is 1. Else 0.
+            - x = 0000 0000 0000 1001 
+            - 0000 0000 0000 1001 | 1111 1111 1111 0000:
+                - 1111 1111 1111 1001
+                    - Here we get -7 properly represented in 16 bit :D.
+        */
+        x |= (0xFFFF << bit_count);
+    }
+
+    // If not negative, then the compiler can easily extend the value
+    return x;
+}
+
+void lsc_update_flags(uint16_t r, LSC_REGISTER *reg) {
+    // reg points at the whole register array, so it has to be dereferenced before indexing.
+    // Zero sets Z, a 1 in the left most bit indicates negative, anything else is positive.
+    (*reg)[LSC_R_COND] = lsc_cond_flags((*reg)[r]);
+}
+
+const LSC_CODE_PAGE lsc_code_none = {
+    .decoded = {[0 ... LSC_PAGE_SIZE - 1] = {.op = LSC_OP_DECODE, .base = LSC_OP_DECODE}},
+};
+
+LSC_CODE_PAGE *lsc_code_page(LSC_VM *vm, uint32_t page) {
+    if (vm->code[page] != &lsc_code_none) {
+        return vm->code[page];
+    }
+    // Given back all at once with the arena, by lsc_vm_clear
+    LSC_CODE_PAGE *code = lsc_arena_alloc(&vm->arena, sizeof(LSC_CODE_PAGE));
+    if (!code) {
+        return NULL;
+    }
+    memcpy(code, &lsc_code_none, sizeof(LSC_CODE_PAGE));
+    vm->code[page] = code;
+    return code;
+}
+
+// Every page back to lsc_code_none: for a new VM, and for when the arena its own pages came from is about to go
+static void lsc_code_drop(LSC_VM *vm) {
+    for (uint32_t page = 0; page < LSC_PAGE_COUNT; ++page) {
+        vm->code[page] = (LSC_CODE_PAGE *)&lsc_code_none;
+    }
+    memset(vm->page_code, 0, sizeof(vm->page_code));
+}
+
+void lsc_decode_reset(LSC_VM *vm) {
+    for (uint32_t page = 0; page < LSC_PAGE_COUNT; ++page) {
+        LSC_CODE_PAGE *code = vm->code[page];
+        if (code == &lsc_code_none) {
+            continue;
+        }
+        for (uint32_t i = 0; i < LSC_PAGE_SIZE; ++i) {
+            code->decoded[i].op = LSC_OP_DECODE;
+        }
+    }
+    memset(vm->page_code, 0, sizeof(vm->page_code));
+}
+
+LSC_DECODED lsc_decode_word(uint16_t instr) {
+    LSC_DECODED entry = {0};
+    LSC_DECODED *d = &entry;
+
+    d->op = instr >> 12;
+    d->dr = (instr >> 9) & 0x7;
+    d->sr1 = (instr >> 6) & 0x7;
+    d->sr2 = instr & 0x7;
+    d->imm = 0;
+
+    switch (d->op) {
+        case LSC_OP_ADD:
+        case LSC_OP_AND:
+            // Bit 5 selects immediate mode
+            if ((instr >> 5) & 0x1) {
+                d->op = (d->op == LSC_OP_ADD) ? LSC_OP_ADDI : LSC_OP_ANDI;
+                d->imm = lsc_sign_extend(instr & 0x1F, 5);
+            }
+            break;
+        case LSC_OP_BR:
+        case LSC_OP_LD:
+        case LSC_OP_LDI:
+        case LSC_OP_LEA:
+        case LSC_OP_ST:
+        case LSC_OP_STI:
+            d->imm = lsc_sign_extend(instr & 0x1FF, 9);
+            break;
+        case LSC_OP_LDR:
+        case LSC_OP_STR:
+            d->imm = lsc_sign_extend(instr & 0x3F, 6);
+            break;
+        case LSC_OP_JSR:
+            // Bit 11 selects PCoffset11, otherwise the address comes from BaseR
+            if ((instr >> 11) & 0x1) {
+                d->imm = lsc_sign_extend(instr & 0x7FF, 11);
+            } else {
+                d->op = LSC_OP_JSRR;
+            }
+            break;
+        case LSC_OP_TRAP:
+            d->imm = instr & 0xFF;
+            break;
+        default: break;
+    }
+    d->base = d->op;
+    return entry;
+}
+
+LSC_DECODED *lsc_decode_single(LSC_VM *vm, uint16_t address) {
+    uint32_t page = address >> LSC_PAGE_SHIFT;
+    LSC_CODE_PAGE *code = lsc_code_page(vm, page);
+    LSC_DECODED *d = code ? &code->decoded[address & (LSC_PAGE_SIZE - 1)] : &vm->spare;
+    *d = lsc_decode_word(lsc_mem_peek(vm, address));
+    if (code) {
+        vm->page_code[page] = 1;
+    }
+
+    // Budget checkpoint, so straight-line code cannot run through a whole page without the budget being looked at
+    if (lsc_is_checkpoint(address)) {
+        d->op = LSC_OP_CHECK;
+    }
+    if (vm->breakpoints && vm->breakpoints[address]) {
+        d->op = LSC_OP_BREAK;
+    }
+    return d;
+}
+
+LSC_DECODED *lsc_decode(LSC_VM *vm, uint16_t address) {
+    LSC_DECODED *d = lsc_decode_single(vm, address);
+    if (vm->fuse && d != &vm->spare) {
+        lsc_fuse(vm, address);
+    }
+    return d;
+}
+
+// A superinstruction starting up to LSC_FUSE_MAX - 1 words before address may cover it, take it apart again
+static void lsc_decode_unfuse_before(LSC_VM *vm, uint16_t address) {
+    for (int back = 1; back < LSC_FUSE_MAX; ++back) {
+        LSC_DECODED *d = lsc_decoded(vm, (uint16_t)(address - back));
+        if (d->op != d->base) {
+            d->op = LSC_OP_DECODE;
+        }
+    }
+}
+
+uint16_t lsc_mem_read(LSC_VM *vm, uint16_t address) {
+    uint8_t device = vm->page_attr[address >> LSC_PAGE_SHIFT] & LSC_PAGE_DEVICE;
+    if (device) {
+        return vm->devices[device].read(vm, vm->devices[device].context, address);
+    }
+    return lsc_mem_peek(vm, address);
+}
+
+void lsc_mem_write(LSC_VM *vm, uint16_t address, uint16_t value) {
+    uint32_t page = address >> LSC_PAGE_SHIFT;
+    uint16_t *words = vm->memory[page];
+    if (vm->page_attr[page]) {
+        uint8_t device = vm->page_attr[page] & LSC_PAGE_DEVICE;
+        if (device && vm->devices[device].write(vm, vm->devices[device].context, address, value)) {
+            return;
+        }
+        // Plain memory after all, but maybe not the VM's own yet. Out of memory drops the store.
+        words = lsc_mem_page(vm, page);
+        if (!words) {
+            return;
+        }
+    }
+    words[address & (LSC_PAGE_SIZE - 1)] = value;
+    vm->page_dirty[page] = 1;
+
+    // Nothing on a data page has been decoded, and superinstructions never reach across pages (see LSC_OP_CHECK)
+    if (!vm->page_code[page]) {
+        return;
+    }
+
+    // Whatever was decoded here is stale now. This is a plain store rather than a compare so stores stay cheap, and page
+    // code says the page is the VM's own to store to.
+    lsc_decoded(vm, address)->op = LSC_OP_DECODE;
+    lsc_decode_unfuse_before(vm, address);
+
+    // Native code compiled from this address is stale too
+    if (*lsc_code_map(vm, address)) {
+        lsc_jit_invalidate(vm, address);
+    }
+}
+
+uint16_t *lsc_mem_page(LSC_VM *vm, uint32_t page) {
+    if (!(vm->page_attr[page] & LSC_PAGE_SHARED)) {
+        return vm->memory[page];
+    }
+    uint16_t *words = lsc_page_alloc();
+    if (!words) {
+        return NULL;
+    }
+    memcpy(words, vm->memory[page], LSC_PAGE_SIZE * sizeof(uint16_t));
+    vm->memory[page] = words;
+    vm->page_attr[page] &= ~LSC_PAGE_SHARED;
+    ++vm->private_pages;
+    return words;
+}
+
+void lsc_mem_share(LSC_VM *vm, uint32_t page, const uint16_t *words) {
+    if (!(vm->page_attr[page] & LSC_PAGE_SHARED)) {
+        lsc_page_free(vm->memory[page]);
+        vm->page_attr[page] |= LSC_PAGE_SHARED;
+        --vm->private_pages;
+    }
+    // Never written through: every store looks at LSC_PAGE_SHARED first
+    vm->memory[page] = (uint16_t *)(words ? words : lsc_page_zero);
+}
+
+size_t lsc_mem_load(LSC_VM *vm, uint16_t address, const void *src, size_t count) {
+    size_t done = 0;
+    while (done < count) {
+        uint16_t a = address + done;
+        size_t n = LSC_PAGE_SIZE - (a & (LSC_PAGE_SIZE - 1));
+        if (n > count - done) {
+            n = count - done;
+        }
+        uint16_t *words = lsc_mem_page(vm, a >> LSC_PAGE_SHIFT);
+        if (!words) {
+            break;
+        }
+        lsc_swap_copy(words + (a & (LSC_PAGE_SIZE - 1)), (const uint8_t *)src + done * sizeof(uint16_t), n);
+        done += n;
+    }
+    return done;
+}
+
+void lsc_mem_save(const LSC_VM *vm, void *dst, uint16_t address, size_t count) {
+    size_t done = 0;
+    while (done < count) {
+        uint16_t a = address + done;
+        size_t n = LSC_PAGE_SIZE - (a & (LSC_PAGE_SIZE - 1));
+        if (n > count - done) {
+            n = count - done;
+        }
+        // Swapping is its own inverse, so the same copy turns host order back into big-endian
+        lsc_swap_copy((uint16_t *)((uint8_t *)dst + done * sizeof(uint16_t)), lsc_mem_words(vm, a), n);
+        done += n;
+    }
+}
+
+void lsc_mem_invalidate(LSC_VM *vm, uint16_t address, uint32_t count) {
+    if (count) {
+        for (uint32_t page = address >> LSC_PAGE_SHIFT; page <= (address + count - 1u) >> LSC_PAGE_SHIFT; ++page) {
+            vm->page_dirty[page % LSC_PAGE_COUNT] = 1;
+        }
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        uint16_t a = address + i;
+        if (!vm->page_code[a >> LSC_PAGE_SHIFT]) {
+            // Nothing to forget on the rest of this page
+            i += LSC_PAGE_SIZE - 1 - (a & (LSC_PAGE_SIZE - 1));
+            continue;
+        }
+        lsc_decoded(vm, a)->op = LSC_OP_DECODE;
+        if (*lsc_code_map(vm, a)) {
+            lsc_jit_invalidate(vm, a);
+        }
+    }
+    lsc_decode_unfuse_before(vm, address);
+}
+
+int lsc_vm_breakpoint(LSC_VM *vm, uint16_t address, int set) {
+    if (!vm->breakpoints) {
+        if (!set) {
+            return 1;
+        }
+        vm->breakpoints = lsc_arena_zalloc(&vm->arena, LSC_MEMORY_MAX);
+        if (!vm->breakpoints) {
+            return 0;
+        }
+    }
+    vm->breakpoints[address] = set != 0;
+
+    // Decoded again the next time it runs, and no superinstruction or native block may run straight over it. An entry
+    // that is LSC_OP_DECODE already may be lsc_code_none's, which is never written.
+    LSC_DECODED *d = lsc_decoded(vm, address);
+    if (d->op != LSC_OP_DECODE) {
+        d->op = LSC_OP_DECODE;
+    }
+    lsc_decode_unfuse_before(vm, address);
+    if (*lsc_code_map(vm, address)) {
+        lsc_jit_invalidate(vm, address);
+    }
+    return 1;
+}
+
+void lsc_vm_reset(LSC_VM *vm) {
+    for (int r = 0; r < LSC_R_COUNT; ++r) {
+        vm->reg[r] = 0;
+    }
+
+    // Exactly one condition flag must be set at any time.
+    vm->reg[LSC_R_COND] = LSC_FL_ZRO;
+    vm->reg[LSC_R_PC] = LSC_PC_START;
+
+    vm->halted = 0;
+    vm->faulted = 0;
+    vm->waiting = 0;
+    vm->at_breakpoint = 0;
+    vm->cycles = 0;
+    memset(vm->fused, 0, sizeof(vm->fused));
+}
+
+LSC_VM *lsc_vm_create(void) {
+    // calloc so every table and count starts at zero
+    LSC_VM *vm = calloc(1, sizeof(LSC_VM));
+    if (!vm) {
+        return NULL;
+    }
+
+    vm->engine = LSC_DISPATCH_DEFAULT;
+    vm->fuse = 1;
+
+    // Memory starts zeroed, like the real machine's. Nothing is owned until something is stored.
+    for (uint32_t page = 0; page < LSC_PAGE_COUNT; ++page) {
+        vm->memory[page] = (uint16_t *)lsc_page_zero;
+        vm->page_attr[page] = LSC_PAGE_SHARED;
+    }
+    lsc_code_drop(vm);
+
+    // The console's registers. There is always room for the first device.
+    static const LSC_DEVICE console = {lsc_device_read, lsc_device_write, NULL};
+    vm->device_count = 1;
+    lsc_vm_map_device(vm, LSC_DEVICE_BASE >> LSC_PAGE_SHIFT, 1, &console);
+    lsc_vm_reset(vm);
+    return vm;
+}
+
+// Give every page the VM owns back to the slab, so all of memory is zero
+static void lsc_vm_free_pages(LSC_VM *vm) {
+    for (uint32_t page = 0; page < LSC_PAGE_COUNT; ++page) {
+        lsc_mem_share(vm, page, NULL);
+    }
+}
+
+void lsc_vm_clear(LSC_VM *vm) {
+    lsc_vm_free_pages(vm);
+    lsc_jit_clear(vm);
+    lsc_code_drop(vm);
+    lsc_vm_reset(vm);
+
+    // Memory no longer matches any snapshot
+    lsc_snapshot_release(vm->snapshot);
+    vm->snapshot = NULL;
+
+    // Everything that came from the arena, which keeps its blocks for the next program
+    vm->breakpoints = NULL;
+    vm->profile = NULL;
+    vm->trace = NULL;
+    memset(&vm->input, 0, sizeof(vm->input));
+    memset(&vm->output, 0, sizeof(vm->output));
+    lsc_arena_reset(&vm->arena);
+}
+
+void lsc_vm_destroy(LSC_VM *vm) {
+    if (!vm) {
+        return;
+    }
+    lsc_jit_destroy(vm);
+    lsc_vm_free_pages(vm);
+    lsc_snapshot_release(vm->snapshot);
+    lsc_arena_free(&vm->arena);
+    free(vm);
+}
+
+int lsc_vm_map_device(LSC_VM *vm, uint16_t page, uint16_t page_count, const LSC_DEVICE *device) {
+    uint8_t id = 0;
+    if (device) {
+        if (vm->device_count == LSC_DEVICE_MAX) {
+            return 0;
+        }
+        id = vm->device_count++;
+        vm->devices[id] = *device;
+    }
+    for (uint32_t i = 0; i < page_count && page + i < LSC_PAGE_COUNT; ++i) {
+        vm->page_attr[page + i] = (vm->page_attr[page + i] & ~LSC_PAGE_DEVICE) | id;
+    }
+
+    // Native code checked the old mapping when it was compiled
+    lsc_jit_reset(vm);
+    return 1;
+}
+
+int lsc_vm_input(LSC_VM *vm, const void *keys, size_t count) {
+    LSC_INPUT *in = &vm->input;
+
+    // Drop the keys already read before making room for more
+    if (in->pos) {
+        memmove(in->data, in->data + in->pos, in->len - in->pos);
+        in->len -= in->pos;
+        in->pos = 0;
+    }
+    if (in->cap - in->len < count) {
+        size_t cap = in->cap ? in->cap : 64;
+        while (cap - in->len < count) {
+            cap *= 2;
+        }
+        uint8_t *data = lsc_arena_grow(&vm->arena, in->data, in->cap, cap);
+        if (!data) {
+            return 0;
+        }
+        in->data = data;
+        in->cap = cap;
+    }
+    memcpy(in->data + in->len, keys, count);
+    in->len += count;
+    return 1;
+}
+
+void lsc_vm_input_end(LSC_VM *vm) {
+    vm->input.ended = 1;
+}
+
+char *lsc_output_reserve(LSC_VM *vm, size_t count) {
+    LSC_OUTPUT *out = &vm->output;
+    if (out->cap - out->len < count && vm->console && out->len && out->cap >= LSC_CONSOLE_BUFFER) {
+        // Going to a terminal, so there is no need to keep it all
+        lsc_console_flush(vm);
+    }
+    if (out->cap - out->len < count) {
+        size_t cap = out->cap ? out->cap : 256;
+        while (cap - out->len < count) {
+            cap *= 2;
+        }
+        char *data = lsc_arena_grow(&vm->arena, out->data, out->cap, cap);
+        if (!data) {
+            return NULL;
+        }
+        out->data = data;
+        out->cap = cap;
+    }
+    return out->data + out->len;
+}
+
+void lsc_output_putc(LSC_VM *vm, char c) {
+    char *dst = lsc_output_reserve(vm, 1);
+    if (!dst) {
+        // Out of memory, drop the character rather than take the VM down
+        return;
+    }
+    *dst = c;
+    ++vm->output.len;
+}
+
+int lsc_trap(LSC_VM *vm, uint8_t vector) {
+    size_t start = vm->output.len;
+
+    // Checked before anything happens, so the trap can simply run again once there is a key
+    if ((vector == LSC_TRAP_GETC || vector == LSC_TRAP_IN) && lsc_console_must_wait(vm)) {
+        return 1;
+    }
+    if (vm->metrics) {
+        lsc_metrics_add(&vm->metrics->traps[vector], 1);
+    }
+
+    switch (vector) {
+        case LSC_TRAP_OUT: {
+            // Output the character in the low 8 bits of R0
+            lsc_output_putc(vm, (char)vm->reg[LSC_R_R0]);
+            break;
+        }
+        case LSC_TRAP_PUTS: {
+            // One character per word, starting at the address in R0, until a zero word (or all of memory has been seen)
+            lsc_output_puts(vm, vm->reg[LSC_R_R0]);
+            break;
+        }
+        case LSC_TRAP_PUTSP: {
+            // Two characters per word, low byte first, skipping a zero high byte
+            lsc_output_putsp(vm, vm->reg[LSC_R_R0]);
+            break;
+        }
+        case LSC_TRAP_GETC: {
+            // Read one character into R0, not echoed. Whatever was written so far should be on screen first.
+            lsc_console_flush(vm);
+            vm->reg[LSC_R_R0] = lsc_console_getc(vm);
+            break;
+        }
+        case LSC_TRAP_IN: {
+            // Prompt, then read one character into R0 and echo it
+            for (const char *prompt = "Enter a character: "; *prompt; ++prompt) {
+                lsc_output_putc(vm, *prompt);
+            }
+            lsc_console_flush(vm);
+            uint16_t c = lsc_console_getc(vm);
+            if (c != 0xFFFF) {
+                lsc_output_putc(vm, (char)c);
+            }
+            vm->reg[LSC_R_R0] = c;
+            break;
+        }
+        case LSC_TRAP_BLKIN: {
+            lsc_block_in(vm);
+            break;
+        }
+        case LSC_TRAP_BLKOUT: {
+            lsc_block_out(vm);
+            break;
+        }
+        default:
+            // Not a trap this machine has
+            break;
+    }
+
+    // Write out finished lines once per trap, so PUTS of a whole paragraph is still a single write()
+    if (vm->console && vm->output.len > start && memchr(vm->output.data + start, '\n', vm->output.len - start)) {
+        lsc_console_flush(vm);
+    }
+    return 0;
+}
+
+uint64_t lsc_vm_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+int lsc_vm_run_until(LSC_VM *vm, uint64_t max_cycles, uint64_t deadline) {
+    uint64_t left = max_cycles;
+    int halted = vm->halted;
+
+    // Halted and faulted machines stay that way until they are reset. A waiting one tries the trap again.
+    vm->waiting = 0;
+    vm->at_breakpoint = 0;
+    while (left && !vm->halted && !vm->faulted) {
+        // Without a deadline there is no clock to look at, so run the whole budget in one go. Metrics still want to
+        // see instructions retire as it goes (see lsc_metrics.h).
+        int sliced = deadline != LSC_VM_NO_DEADLINE || vm->metrics;
+        uint64_t slice = (!sliced || left < LSC_VM_SLICE) ? left : LSC_VM_SLICE;
+        uint64_t executed = lsc_run(vm, vm->engine, slice);
+        vm->cycles += executed;
+        left -= executed;
+        if (vm->metrics) {
+            lsc_metrics_add(&vm->metrics->instructions, executed);
+        }
+
+        // Engines only stop short of the budget when the machine stopped (halted, faulted, waiting or on a breakpoint)
+        if (executed < slice || (deadline != LSC_VM_NO_DEADLINE && lsc_vm_clock() >= deadline)) {
+            break;
+        }
+    }
+
+    // Whatever happened, whoever called us should see everything so far
+    lsc_console_flush(vm);
+
+    // HALT never gets as far as lsc_trap
+    if (vm->metrics && vm->halted && !halted) {
+        lsc_metrics_add(&vm->metrics->traps[LSC_TRAP_HALT], 1);
+    }
+
+    if (vm->halted) {
+        return LSC_VM_HALTED;
+    }
+    if (vm->faulted) {
+        return LSC_VM_FAULT;
+    }
+    if (vm->at_breakpoint) {
+        return LSC_VM_BREAKPOINT;
+    }
+    return vm->waiting ? LSC_VM_WAITING_FOR_INPUT : LSC_VM_BUDGET_EXHAUSTED;
+}
+
+int lsc_vm_run(LSC_VM *vm, uint64_t max_cycles) {
+    return lsc_vm_run_until(vm, max_cycles, LSC_VM_NO_DEADLINE);
+}
+
+static const char *const lsc_vm_status_names[LSC_VM_STATUS_COUNT] = {
+    [LSC_VM_HALTED] = "halted",
+    [LSC_VM_BUDGET_EXHAUSTED] = "budget exhausted",
+    [LSC_VM_WAITING_FOR_INPUT] = "waiting for input",
+    [LSC_VM_FAULT] = "fault",
+    [LSC_VM_BREAKPOINT] = "breakpoint",
+};
+
+const char *lsc_vm_status_name(int status) {
+    if (status < 0 || status >= LSC_VM_STATUS_COUNT) {
+        return "unknown";
+    }
+    return lsc_vm_status_names[status];
+}
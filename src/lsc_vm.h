@@ -0,0 +1,629 @@
+#ifndef LSC_VM_H
+#define LSC_VM_H
+
+/*
+This is a VM for the LC-3, a teaching computer architecture
+
+From: https://www.jmeiners.com/lc3-vm/
+
+This header holds everything the different parts of the VM share: the machine state, the instruction set and the predecoded
+instruction table. It is also the library API for hosting VMs in another program (see lsc_vm_create).
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lsc_arena.h"
+
+/*
+The LC-3 has 65,536 memory locations, which can be stored in a 16 bit unsigned integer
+Each memory location stores a 16 bit value
+
+This means the total N bits is (65,536*16)*(1/(8*1024)) KB
+*/
+#define LSC_MEMORY_MAX (1 << 16)
+
+// Memory is split into pages (see Memory below, and lsc_snapshot.h): the page of an address is its high byte
+enum {
+    LSC_PAGE_SHIFT = 8,
+    LSC_PAGE_SIZE = 1 << LSC_PAGE_SHIFT, // Words per page
+    LSC_PAGE_COUNT = LSC_MEMORY_MAX >> LSC_PAGE_SHIFT,
+};
+
+/*
+Page attributes, one byte per page in LSC_VM.page_attr
+
+- LSC_PAGE_DEVICE: which device handles loads and stores there, 0 for plain memory (see LSC_DEVICE)
+- LSC_PAGE_SHARED: the words are shared rather than the VM's own (see Memory below), and are copied before the first store
+
+Loads only look at LSC_PAGE_DEVICE. Stores need one test for both: a page with any attribute takes the slow path.
+*/
+enum {
+    LSC_PAGE_DEVICE = 0x0F,
+    LSC_PAGE_SHARED = 0x80,
+};
+
+/*
+The LC-3 has 10 total registers. Each of which stores 1 value.
+
+Why use an enum here?
+- Enum values cannot be modified. These can act as constants :)
+
+Why use an anonymous enum?
+- This will not use memory to store the enum
+*/
+enum {
+    LSC_R_R0 = 0, // General purpose start
+    LSC_R_R1,
+    LSC_R_R2,
+    LSC_R_R3,
+    LSC_R_R4,
+    LSC_R_R5,
+    LSC_R_R6,
+    LSC_R_R7, // General purpose end
+    LSC_R_PC, // Program counter (next instruction in memory to compute)
+    LSC_R_COND, // Information about previous calculation
+    LSC_R_COUNT, // N registers
+};
+
+typedef uint16_t LSC_REGISTER[LSC_R_COUNT];
+
+/*
+This is the instruction set.
+
+Each instruction has an opcode which indicates the type of task to perform and the set of parameters to provide inputs.
+
+LC-3 has 16 opcodes. Each opcode is 16 bits long. Left 4 store opcode. Rest store parameters
+*/
+enum {
+    LSC_OP_BR = 0, // Branch
+    LSC_OP_ADD, // Add
+    LSC_OP_LD, // Load
+    LSC_OP_ST, // Store
+    LSC_OP_JSR, // Jump register
+    LSC_OP_AND, // Bitwise and
+    LSC_OP_LDR, // Load register
+    LSC_OP_STR, // Store register
+    LSC_OP_RTI, // Unused
+    LSC_OP_NOT, // Bitwise not
+    LSC_OP_LDI, // Load indirect
+    LSC_OP_STI, // Store indirect
+    LSC_OP_JMP, // Jump
+    LSC_OP_RES, // Reserved/unused
+    LSC_OP_LEA, // Load effective address
+    LSC_OP_TRAP, // Execute trap
+
+    /*
+    Internal opcodes.
+
+    These never appear in an image. The predecoder (see lsc_decode) rewrites some instructions into them so the main loop
+    does not have to re-check mode bits every time the instruction is executed.
+    */
+    LSC_OP_ADDI, // ADD in immediate mode
+    LSC_OP_ANDI, // AND in immediate mode
+    LSC_OP_JSRR, // JSR with a base register rather than PCoffset11
+    LSC_OP_CHECK, // Any instruction at the last address of a page, a budget checkpoint (see lsc_dispatch.h). base says what it really is.
+
+    // Superinstructions, a whole sequence of instructions run with one dispatch (see lsc_fuse.h)
+    LSC_OP_LOAD_CONST, // AND DR, SR1, #0 then ADD DR2, DR, #imm5
+    LSC_OP_ADD_BR, // ADD (register mode) then BR
+    LSC_OP_ADDI_BR, // ADD (immediate mode) then BR
+    LSC_OP_LDR_ADDI_STR, // LDR, ADD #imm5, STR back to the same address
+
+    LSC_OP_DECODE, // Entry has not been decoded yet (or was invalidated by a store)
+    LSC_OP_BREAK, // A breakpoint (see lsc_vm_breakpoint): stops the run with PC left on it. base says what is underneath.
+    LSC_OP_COUNT // N opcodes, including internal ones
+};
+
+enum {
+    LSC_OP_FUSED_FIRST = LSC_OP_LOAD_CONST,
+    LSC_FUSED_COUNT = LSC_OP_DECODE - LSC_OP_FUSED_FIRST, // N superinstructions
+    LSC_FUSE_MAX = 3, // Most instructions in one superinstruction
+};
+
+/*
+These are the condition flags, stored by R_COND, which provide information about the most recently executed calculation.
+This allows for logical condition checking.
+
+Why use enum over #define here?
+- Enums are "type-safe" so the compiler validates whether the types are correct
+*/
+enum {
+    LSC_FL_POS = 1 << 0, // Positive sign (P)
+    LSC_FL_ZRO = 1 << 1, // Zero, so no sign (Z)
+    LSC_FL_NEG = 1 << 2, // Negative sign (N)
+};
+
+/*
+Lazy condition codes
+
+Almost every instruction sets the flags, but only BR reads them, and most flag values are overwritten before any branch
+looks. So the interpreter loops do not keep LSC_R_COND up to date: they remember the last flag-setting result instead
+and only turn it into flags when something reads them.
+
+lsc_cond_flags turns the result into flags without a branch: the shift is 0 for positive, 1 for zero and 2 for
+negative, which is exactly the bit position of LSC_FL_POS, LSC_FL_ZRO and LSC_FL_NEG.
+
+lsc_cond_value goes the other way, picking a result that gives back the same flags. It is used when entering a loop.
+*/
+static inline uint16_t lsc_cond_flags(uint16_t value) {
+    return LSC_FL_POS << ((value == 0) | ((value >> 15) << 1));
+}
+
+static inline uint16_t lsc_cond_value(uint16_t cond) {
+    if (cond & LSC_FL_NEG) {
+        return 0x8000;
+    }
+    return (cond & LSC_FL_ZRO) ? 0 : 1;
+}
+
+/*
+Let's look at an example LC-3 assembly program.
+
+HELLO WORLD PROGRAM:
+.ORIG x3000 ; This is where the program will originate from in memory
+loaded
+LEA R0, HELLO_STR ; Load the effective address of HELLO_STR into the general purpose register, R0
+PUTs ; Output the string pointed to by R0 into the console
+HALT ; Halt the program
+HELLO_STR .STRINGZ "Hello World!" ; Store this string here in the program
+.END ; EOF
+
+This is not directly compatible with the VM as it is in an assembly forl. AN assembler will transform this into the appropriate binary format.
+
+LOOP PROGRAM:
+AND R0, R0, 0 ; Clear R0
+LOOP ; This is a label
+ADD R0, R0, 1 ; Add 1 to R0 and store in R0
+ADD R1, R0, -10 ; Subtract 10 from R0 and store in R1
+BRn LOOP ; Go back to LOOP if result is negative
+BRn 
+*/
+
+// Programs are loaded at 0x3000 by convention, the space below is reserved for trap routines
+enum { LSC_PC_START = 0x3000 };
+
+/*
+Memory mapped device registers
+
+Every VM starts with the console's registers in the device page, LSC_DEVICE_BASE up. Loads and stores there go through
+lsc_device_read and lsc_device_write (see lsc_console.h), because reading or writing a device register does something.
+More devices can be mapped over other pages, see LSC_DEVICE.
+*/
+enum {
+    LSC_DEVICE_BASE = 0xFE00,
+    LSC_MR_KBSR = 0xFE00, // Keyboard status, bit 15 is set when a key is waiting
+    LSC_MR_KBDR = 0xFE02, // Keyboard data, reading it takes the key
+    LSC_MR_DSR = 0xFE04, // Display status, bit 15 is set when the display is ready
+    LSC_MR_DDR = 0xFE06, // Display data, writing it outputs a character
+};
+
+// Trap vectors, the trapvect8 field of a TRAP instruction
+enum {
+    LSC_TRAP_GETC = 0x20, // Read a character from the keyboard, not echoed
+    LSC_TRAP_OUT = 0x21, // Output a character
+    LSC_TRAP_PUTS = 0x22, // Output a string of words
+    LSC_TRAP_IN = 0x23, // Read a character from the keyboard, echoed
+    LSC_TRAP_PUTSP = 0x24, // Output a string of bytes
+    LSC_TRAP_HALT = 0x25, // Halt the program
+    LSC_TRAP_BLKIN = 0x26, // Copy a range of the disk into memory (see lsc_block.h)
+    LSC_TRAP_BLKOUT = 0x27, // Copy a range of memory onto the disk
+};
+
+/*
+Predecoded instructions
+
+Decoding an instruction means shifting and masking out its fields and sign-extending its immediates. The result depends only on the
+16 bits stored in memory, so doing it again on every execution is wasted work.
+
+The decoded entries run parallel to memory: lsc_decoded(vm, address) holds the already decoded form of the word at
+address.
+- Entries start as LSC_OP_DECODE, so the main loop decodes an address the first time it is executed
+- Every write to memory resets the entry back to LSC_OP_DECODE, so self-modifying code still behaves. So does a write
+  to any instruction a superinstruction covers.
+- Breakpoints are entries decoded as LSC_OP_BREAK, so the loops never look anything up to find them
+
+Field meaning depends on the opcode:
+- dr: DR (11-9), SR for the store instructions, the nzp mask for BR
+- sr1: SR1 / BaseR (8-6)
+- sr2: SR2 (2-0) for register mode ADD/AND
+- imm: imm5, offset6, PCoffset9, PCoffset11 or trapvect8, already sign-extended to 16 bits
+- base: op before superinstructions (or LSC_OP_CHECK) were formed. The other fields always describe the instruction at
+  this address alone.
+
+Why use uint8_t for the fields?
+- The whole entry fits in 8 bytes, so 8 entries share one 64 byte cache line
+*/
+typedef struct {
+    uint8_t op;
+    uint8_t dr;
+    uint8_t sr1;
+    uint8_t sr2;
+    uint16_t imm;
+    uint8_t base;
+    uint8_t reserved; // Unused, pads the entry to 8 bytes so indexing the table is a single shift
+} LSC_DECODED;
+
+/*
+Code pages
+
+The decoded entries and the JIT's code map (see lsc_jit.h) are paged like memory: code[page] has them for the
+LSC_PAGE_SIZE addresses of one page. Every page starts as lsc_code_none, every entry LSC_OP_DECODE and nothing compiled,
+which is shared by every VM and never written. The first time anything is decoded or compiled on a page, lsc_code_page
+gives the VM one of its own from its arena (page_code says which pages it has decoded since the last lsc_decode_reset).
+A VM only has the tables for the pages its program runs from, not 576 KB of them.
+
+What an entry of lsc_code_none says holds for the entry of a page of its own that has not been decoded since, so
+nothing that reads them needs to know which one it has. Its base is LSC_OP_DECODE as well, so nothing takes it for a
+superinstruction to undo either.
+*/
+typedef struct {
+    LSC_DECODED decoded[LSC_PAGE_SIZE];
+    uint8_t jit_code_map[LSC_PAGE_SIZE]; // How many compiled JIT blocks cover each address
+} LSC_CODE_PAGE;
+
+extern const LSC_CODE_PAGE lsc_code_none;
+
+// Private state of the JIT engine, see lsc_jit.c
+typedef struct LSC_JIT LSC_JIT;
+
+// A frozen copy of a machine, see lsc_snapshot.h
+typedef struct LSC_SNAPSHOT LSC_SNAPSHOT;
+
+// Execution counts, see lsc_profile.h
+typedef struct LSC_PROFILE LSC_PROFILE;
+
+// A recorded or replayed run, see lsc_trace.h
+typedef struct LSC_TRACE LSC_TRACE;
+
+// A terminal for the VM, see lsc_console.h
+typedef struct LSC_CONSOLE LSC_CONSOLE;
+
+// A disk for the VM, see lsc_block.h
+typedef struct LSC_BLOCK LSC_BLOCK;
+
+// One thread's live counters, see lsc_metrics.h
+typedef struct LSC_METRICS_COUNTERS LSC_METRICS_COUNTERS;
+
+typedef struct LSC_VM LSC_VM;
+
+/*
+A memory mapped device.
+
+Each page of memory has an entry in LSC_VM.page_attr: LSC_PAGE_DEVICE is 0 for plain memory, otherwise which of
+LSC_VM.devices handles loads and stores anywhere in that page. Plain pages cost one table lookup per access, and devices
+never slow down anything outside their own pages.
+
+- read: the value a load from address sees
+- write: handle a store to address. Returns 0 if address is ordinary memory after all (the store then just happens).
+- context: passed back to both, for the device's own state
+*/
+typedef struct {
+    uint16_t (*read)(LSC_VM *vm, void *context, uint16_t address);
+    int (*write)(LSC_VM *vm, void *context, uint16_t address, uint16_t value);
+    void *context;
+} LSC_DEVICE;
+
+enum {
+    LSC_DEVICE_MAX = 8, // Devices per VM, including the console's registers
+};
+
+_Static_assert(LSC_DEVICE_MAX <= LSC_PAGE_DEVICE + 1, "device ids must fit in LSC_PAGE_DEVICE");
+
+/*
+Keyboard input for a VM without a console.
+
+A host that embeds VMs feeds keys in with lsc_vm_input. When a program asks for a key (GETC, IN) and there is none yet,
+lsc_vm_run returns LSC_VM_WAITING_FOR_INPUT, and the trap runs again on the next lsc_vm_run. Once lsc_vm_input_end has
+been called, running out of keys means end of input instead, and GETC gives 0xFFFF.
+*/
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+    size_t pos; // Next key to read, data[pos] to data[len - 1] are still to come
+    int ended; // No more keys are coming
+    uint8_t last; // The key read most recently, which KBDR keeps returning until the next one
+} LSC_INPUT;
+
+/*
+Console output.
+
+Output traps append to a buffer in the VM rather than writing to stdout themselves. Whoever runs the VM decides where it
+goes: the command line attaches a console that writes it out a line at a time, the batch runner copies each job's out
+after it has run.
+*/
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} LSC_OUTPUT;
+
+/*
+Memory
+
+memory[page] points at the LSC_PAGE_SIZE words of that page, so a VM only owns the pages it has stored to. Every other
+page is shared, and marked LSC_PAGE_SHARED:
+- a page nothing has stored to is lsc_page_zero, one page of zeros for the whole process
+- after a snapshot is taken or restored, every page is the snapshot's own copy, shared by every VM using that snapshot
+  (see lsc_snapshot.h). Ten thousand VMs restored from one snapshot hold one copy of the program between them.
+The first store to a shared page copies it into a page of the VM's own, from the thread's slab (see lsc_page.h).
+
+A load is one more lookup than a flat array, in a 2 KB table that stays in cache. A store tests page_attr, which it did
+for devices anyway, so page_attr is the only thing the fast path looks at. Code that copies words in or out in bulk goes
+a page at a time (lsc_mem_words, lsc_mem_page).
+
+If there is no memory left for a page, a store to it is dropped, like output.
+*/
+
+/*
+One LC-3 machine.
+
+Everything a running VM touches lives in here, so a program can host as many VMs as it likes and run each one on its own
+thread. Nothing in the VM is shared between contexts, except pages no one can write (see Memory above).
+
+Why is memory first?
+- It is the most used field, and starting at offset 0 keeps looking up a page a single load
+*/
+struct LSC_VM {
+    uint16_t *memory[LSC_PAGE_COUNT];
+    LSC_REGISTER reg;
+    LSC_CODE_PAGE *code[LSC_PAGE_COUNT]; // Decoded entries and where JIT blocks are, see Code pages above
+    LSC_DECODED spare; // Where an entry is decoded when there is no memory for its page, for running it just once
+
+    LSC_JIT *jit; // NULL until the JIT engine first runs, then in arena
+    void *jit_code; // The JIT's executable memory. Mapped the first time it compiles, and kept until lsc_vm_destroy.
+
+    // The snapshot memory was last restored from or taken into, NULL if there is none. Only pages with page_dirty set
+    // have been written since.
+    LSC_SNAPSHOT *snapshot;
+    uint8_t page_dirty[LSC_PAGE_COUNT];
+
+    // Pages anything has been decoded (or JIT compiled) from since the last lsc_decode_reset. A store to any other page
+    // has nothing to invalidate, so it skips straight past that. See lsc_analyze.h for filling it in up front. Every
+    // one of them has a code page of its own.
+    uint8_t page_code[LSC_PAGE_COUNT];
+
+    // LSC_PAGE_DEVICE and LSC_PAGE_SHARED for each page. devices[0] is never used.
+    uint8_t page_attr[LSC_PAGE_COUNT];
+    int private_pages; // Pages of memory the VM owns, the rest are shared
+    LSC_DEVICE devices[LSC_DEVICE_MAX];
+    int device_count;
+
+    int engine; // LSC_DISPATCH_* used by lsc_vm_run
+    int fuse; // Form superinstructions while predecoding (on by default)
+    LSC_PROFILE *profile; // When set, lsc_vm_run profiles instead of using engine. In arena, see lsc_profile_create.
+    LSC_TRACE *trace; // When set, lsc_vm_run records or replays instead of using engine. Closed by whoever attached it.
+    int halted; // Set by TRAP HALT
+    int faulted; // Set by an instruction this machine cannot run (RTI, the reserved opcode). PC is left on it.
+    int waiting; // Stopped in GETC or IN for a key that has not arrived, PC is left on the TRAP
+    int at_breakpoint; // Stopped on a breakpoint, PC is left on it
+    uint8_t *breakpoints; // NULL until the first lsc_vm_breakpoint, then a flag per address in arena. Read by lsc_decode.
+    uint64_t cycles; // Instructions retired since the last reset
+    uint64_t fused[LSC_FUSED_COUNT]; // Times each superinstruction ran since the last reset
+
+    LSC_INPUT input;
+    LSC_OUTPUT output;
+    LSC_CONSOLE *console; // NULL unless attached, then output is written out as it goes. Owned by whoever attached it.
+    LSC_BLOCK *block; // NULL unless attached, for BLKIN and BLKOUT. Owned by whoever attached it.
+    LSC_METRICS_COUNTERS *metrics; // NULL unless attached, counted into as the VM runs. Owned by whoever attached it.
+
+    // Where everything above that grows while the VM runs comes from (input, output, breakpoints, the JIT's state, a
+    // profile or trace). lsc_vm_clear resets it, see lsc_arena.h.
+    LSC_ARENA arena;
+};
+
+/*
+Library API
+
+    LSC_VM *vm = lsc_vm_create();
+    lsc_vm_load(vm, "image.obj");
+    for (;;) {
+        int status = lsc_vm_run_until(vm, 1000000, lsc_vm_clock() + 1000000); // At most 1M instructions or 1 ms
+        if (status == LSC_VM_WAITING_FOR_INPUT) {
+            // lsc_vm_input once there is some
+        } else if (status != LSC_VM_BUDGET_EXHAUSTED) {
+            break;
+        }
+        // do something else, like run the next VM
+    }
+    lsc_vm_destroy(vm);
+
+A VM only runs inside lsc_vm_run, so one thread can take turns running any number of them.
+*/
+enum {
+    LSC_VM_HALTED = 0, // TRAP HALT ran
+    LSC_VM_BUDGET_EXHAUSTED, // Ran max_cycles instructions (or reached the deadline) without stopping
+    LSC_VM_WAITING_FOR_INPUT, // GETC or IN needs a key, see LSC_INPUT
+    LSC_VM_FAULT, // Ran into RTI or the reserved opcode, see faulted
+    LSC_VM_BREAKPOINT, // Ran into a breakpoint, see lsc_vm_breakpoint
+    LSC_VM_STATUS_COUNT
+};
+
+enum {
+    LSC_VM_SLICE = 1 << 16, // Instructions between looking at the clock in lsc_vm_run_until, well under 1 ms
+};
+
+// lsc_vm_run_until without a deadline
+#define LSC_VM_NO_DEADLINE UINT64_MAX
+
+// Returns NULL when out of memory
+LSC_VM *lsc_vm_create(void);
+void lsc_vm_destroy(LSC_VM *vm);
+
+/*
+Load an image on top of whatever is in memory already. Returns 1 on success and 0 if the file could not be read (or
+there was no memory for the pages it is loaded into).
+*/
+int lsc_vm_load(LSC_VM *vm, const char *image_path);
+
+// Same as lsc_vm_load, for an image that is already in host memory (size in bytes). Returns 0 if it is too short too.
+int lsc_vm_load_image(LSC_VM *vm, const void *image, size_t size);
+
+// Execute at most max_cycles instructions, returns one of LSC_VM_HALTED, LSC_VM_BUDGET_EXHAUSTED and so on
+int lsc_vm_run(LSC_VM *vm, uint64_t max_cycles);
+
+// Same, but also return LSC_VM_BUDGET_EXHAUSTED once lsc_vm_clock() reaches deadline (checked every LSC_VM_SLICE instructions)
+int lsc_vm_run_until(LSC_VM *vm, uint64_t max_cycles, uint64_t deadline);
+
+// Monotonic time in nanoseconds, for deadlines
+uint64_t lsc_vm_clock(void);
+
+// "halted", "budget exhausted" and so on
+const char *lsc_vm_status_name(int status);
+
+/*
+Map device over page_count pages starting at page (an address >> LSC_PAGE_SHIFT). A NULL device turns them back into
+plain memory. Returns 0 if the VM already has LSC_DEVICE_MAX devices.
+*/
+int lsc_vm_map_device(LSC_VM *vm, uint16_t page, uint16_t page_count, const LSC_DEVICE *device);
+
+/*
+Set (or clear) a breakpoint at address. The entry there is decoded again as LSC_OP_BREAK, and lsc_vm_run stops with
+LSC_VM_BREAKPOINT when it gets to it, before running the instruction. Running it means clearing the breakpoint for one
+instruction (see lsc_gdb.c). Returns 0 when out of memory.
+
+Nothing is slower without breakpoints, or away from them: the loops run LSC_OP_BREAK like any other opcode.
+*/
+int lsc_vm_breakpoint(LSC_VM *vm, uint16_t address, int set);
+
+// Queue keys for GETC, IN and KBDR (only used when there is no console). Returns 0 when out of memory.
+int lsc_vm_input(LSC_VM *vm, const void *keys, size_t count);
+
+// No more keys are coming, so a program waiting for one reads end of input instead
+void lsc_vm_input_end(LSC_VM *vm);
+
+// Put the registers back into their power-on state. Memory is left alone.
+void lsc_vm_reset(LSC_VM *vm);
+
+/*
+Put the whole machine back into its just-created state, so it can be reused for another program. Everything in the arena
+goes in one go, so a profile or trace must have been closed first.
+*/
+void lsc_vm_clear(LSC_VM *vm);
+
+// Append to the VM's output buffer
+void lsc_output_putc(LSC_VM *vm, char c);
+
+// Room for count more bytes at the end of the output buffer (the caller then adds to output.len). NULL when out of memory.
+char *lsc_output_reserve(LSC_VM *vm, size_t count);
+
+// The PUTS and PUTSP traps for the string at address, see lsc_text.c
+void lsc_output_puts(LSC_VM *vm, uint16_t address);
+void lsc_output_putsp(LSC_VM *vm, uint16_t address);
+
+/*
+Run the trap routine for vector (everything except HALT, which the dispatch loop handles itself).
+
+Returns 0, or 1 if it has to wait for a key (see LSC_INPUT). Nothing has been changed in that case, the dispatch loop
+stops with PC still on the TRAP.
+*/
+int lsc_trap(LSC_VM *vm, uint8_t vector);
+
+// Whether the instruction at address is decoded as LSC_OP_CHECK. Superinstructions never cover one.
+static inline int lsc_is_checkpoint(uint16_t address) {
+    return (address & (LSC_PAGE_SIZE - 1)) == LSC_PAGE_SIZE - 1;
+}
+
+uint16_t lsc_sign_extend(uint16_t x, int bit_count);
+void lsc_update_flags(uint16_t r, LSC_REGISTER *reg);
+
+// Mark every entry as not yet decoded. Only the code pages the VM has of its own are touched.
+void lsc_decode_reset(LSC_VM *vm);
+
+/*
+Decode the word at address into its entry, forming a superinstruction from there if vm->fuse says so. Returns the entry,
+which is vm->spare when there is no memory for the page: that runs once, and the word is decoded again next time.
+*/
+LSC_DECODED *lsc_decode(LSC_VM *vm, uint16_t address);
+LSC_DECODED lsc_decode_word(uint16_t instr); // instr decoded on its own, with no budget checkpoint or breakpoint
+LSC_DECODED *lsc_decode_single(LSC_VM *vm, uint16_t address); // Same as lsc_decode, without forming superinstructions
+
+// The decoded entry for address. Only ever written through once its page is the VM's own, see lsc_code_page.
+static inline LSC_DECODED *lsc_decoded(const LSC_VM *vm, uint16_t address) {
+    return &vm->code[address >> LSC_PAGE_SHIFT]->decoded[address & (LSC_PAGE_SIZE - 1)];
+}
+
+/*
+The entry for pc, when d is the entry of the address straight before it: the next one along in the same code page,
+unless pc starts a page (or d is vm->spare, which has nothing after it). Saves the loops looking up the page again.
+*/
+static inline LSC_DECODED *lsc_decoded_next(const LSC_VM *vm, LSC_DECODED *d, uint16_t pc) {
+    return (pc & (LSC_PAGE_SIZE - 1)) && d != &vm->spare ? d + 1 : lsc_decoded(vm, pc);
+}
+
+// How many compiled JIT blocks cover address, in the same page as its entry
+static inline uint8_t *lsc_code_map(const LSC_VM *vm, uint16_t address) {
+    return &vm->code[address >> LSC_PAGE_SHIFT]->jit_code_map[address & (LSC_PAGE_SIZE - 1)];
+}
+
+// The code page of page, for writing. The shared one is copied into one of the VM's own first. NULL when out of memory.
+LSC_CODE_PAGE *lsc_code_page(LSC_VM *vm, uint32_t page);
+
+/*
+Entries decoded by an earlier run or another program (an extended image, the code cache), put in without decoding.
+
+lsc_decode_put checks entry first, as far as that is cheap: one the engines cannot run (an unknown opcode, a register out
+of range, no LSC_OP_CHECK where there has to be one) is left undecoded, and so is LSC_OP_DECODE. Returns 1 if entry was
+put in, and 0 for those or when there is no memory for its page. A superinstruction's later parts use their own entries, so once everything is in, lsc_decode_trim_fused turns
+any in count addresses from address that reach past the last one, or over a word with no entry, back into their first
+instruction.
+*/
+int lsc_decode_put(LSC_VM *vm, uint16_t address, LSC_DECODED entry);
+void lsc_decode_trim_fused(LSC_VM *vm, uint16_t address, uint32_t count);
+
+uint16_t lsc_mem_read(LSC_VM *vm, uint16_t address);
+void lsc_mem_write(LSC_VM *vm, uint16_t address, uint16_t value);
+
+// The word stored at address. No device is asked, see lsc_mem_read for what a load sees.
+static inline uint16_t lsc_mem_peek(const LSC_VM *vm, uint16_t address) {
+    return vm->memory[address >> LSC_PAGE_SHIFT][address & (LSC_PAGE_SIZE - 1)];
+}
+
+// The words stored from address to the end of its page, for reading
+static inline const uint16_t *lsc_mem_words(const LSC_VM *vm, uint16_t address) {
+    return vm->memory[address >> LSC_PAGE_SHIFT] + (address & (LSC_PAGE_SIZE - 1));
+}
+
+// The words of page, for writing. A shared page is copied into one of the VM's own first. NULL when out of memory.
+uint16_t *lsc_mem_page(LSC_VM *vm, uint32_t page);
+
+/*
+Point page at words the VM does not own, dropping the page it had. NULL means the zero page. words must stay as they
+are for as long as the VM uses them, see lsc_snapshot.c.
+*/
+void lsc_mem_share(LSC_VM *vm, uint32_t page, const uint16_t *words);
+
+/*
+Store value at address without asking a device or forgetting anything decoded from it, for copying memory in. Whoever
+does that calls lsc_mem_invalidate once it is done. Returns 0 when out of memory.
+*/
+static inline int lsc_mem_poke(LSC_VM *vm, uint16_t address, uint16_t value) {
+    uint32_t page = address >> LSC_PAGE_SHIFT;
+    uint16_t *words = (vm->page_attr[page] & LSC_PAGE_SHARED) ? lsc_mem_page(vm, page) : vm->memory[page];
+    if (!words) {
+        return 0;
+    }
+    words[address & (LSC_PAGE_SIZE - 1)] = value;
+    return 1;
+}
+
+// Copy count big-endian words from src into memory at address, like lsc_mem_poke. Returns how many were copied.
+size_t lsc_mem_load(LSC_VM *vm, uint16_t address, const void *src, size_t count);
+
+// Copy count words of memory from address onwards to dst, big-endian
+void lsc_mem_save(const LSC_VM *vm, void *dst, uint16_t address, size_t count);
+
+// Forget anything derived from count words of memory starting at address, after they were changed in bulk
+void lsc_mem_invalidate(LSC_VM *vm, uint16_t address, uint32_t count);
+
+// Copy count big-endian words from src to dst, swapping them into host order
+void lsc_swap_copy(uint16_t *dst, const void *src, size_t count);
+
+// Number of words before the first zero in src, or max if there is none
+size_t lsc_word_len(const uint16_t *src, size_t max);
+
+// Copy the low byte of each of count words from src to dst
+void lsc_narrow_copy(char *dst, const uint16_t *src, size_t count);
+
+#endif
@@ -10,190 +10,234 @@ From: https://www.jmeiners.com/lc3-vm/
 #include "stdio.h"
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <signal.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "lsc_analyze.h"
+#include "lsc_aot.h"
+#include "lsc_asm.h"
+#include "lsc_batch.h"
+#include "lsc_block.h"
+#include "lsc_cache.h"
+#include "lsc_console.h"
+#include "lsc_diff.h"
+#include "lsc_dispatch.h"
+#include "lsc_fuse.h"
+#include "lsc_gdb.h"
+#include "lsc_metrics.h"
+#include "lsc_perf.h"
+#include "lsc_profile.h"
+#include "lsc_trace.h"
+#include "lsc_vm.h"
+
+static void lsc_usage(void) {
+    printf("lsc_vm [--dispatch=switch|threaded|jit] [--cycles=N] [--bench=N [--csv]] [--no-fuse] [--stats] [--perf-counters] [--profile=out.folded] [--trace=out.trace | --replay=in.trace] [--cache=dir] [--disk=file] [--gdb=port] [--metrics=path] [image-file1] ...\n");
+    printf("lsc_vm --aot=out.c [image-file1] ...\n");
+    printf("lsc_vm --asm=out.obj|out.lsx source.asm\n");
+    printf("lsc_vm [--dispatch=switch|threaded|jit] [--cycles=N] [--metrics=path] --batch jobs.txt [--lanes] [-j N]\n");
+    printf("lsc_vm --diff-engines[=jobs.txt] [--programs=N] [--seed=N] [--check=N] [--cycles=N] [-j N]\n");
+    exit(2);
+}
 
 /*
-The LC-3 has 65,536 memory locations, which can be stored in a 16 bit unsigned integer
-Each memory location stores a 16 bit value
-
-This means the total N bits is (65,536*16)*(1/(8*1024)) KB
+The console takes the terminal out of line mode while the program reads the keyboard. Ctrl-C must not leave it that way.
 */
-#define LSC_MEMORY_MAX (1 << 16)
-uint16_t lsc_memory[LSC_MEMORY_MAX];
-
-/*
-The LC-3 has 10 total registers. Each of which stores 1 value.
+static LSC_CONSOLE *lsc_main_console;
 
-Why use an enum here?
-- Enum values cannot be modified. These can act as constants :)
+static void lsc_handle_interrupt(int signal) {
+    lsc_console_restore(lsc_main_console);
+    _exit(128 + signal);
+}
 
-Why use an anonymous enum?
-- This will not use memory to store the enum
-*/
-enum {
-    LSC_R_R0 = 0, // General purpose start
-    LSC_R_R1,
-    LSC_R_R2,
-    LSC_R_R3,
-    LSC_R_R4,
-    LSC_R_R5,
-    LSC_R_R6,
-    LSC_R_R7, // General purpose end
-    LSC_R_PC, // Program counter (next instruction in memory to compute)
-    LSC_R_COND, // Information about previous calculation
-    LSC_R_COUNT, // N registers
-};
-
-typedef uint16_t LSC_REGISTER[LSC_R_COUNT];
-
-LSC_REGISTER lsc_reg;
+// Assemble path, or print why it did not. Returns NULL then.
+static LSC_ASM *lsc_assemble(const char *path) {
+    LSC_ASM *assembly = lsc_asm_file(path);
+    if (!assembly) {
+        printf("failed to read source: %s\n", path);
+        return NULL;
+    }
+    if (assembly->error[0]) {
+        printf("%s: %s\n", path, assembly->error);
+        lsc_asm_free(assembly);
+        return NULL;
+    }
+    return assembly;
+}
 
-/*
-This is the instruction set.
+// Counters for workers threads, served at path for as long as the run goes on. Exits if they cannot be.
+static LSC_METRICS *lsc_main_metrics(const char *path, int workers) {
+    LSC_METRICS *metrics = lsc_metrics_create(workers);
+    if (!metrics) {
+        printf("out of memory\n");
+        exit(1);
+    }
+    if (!lsc_metrics_serve(metrics, path)) {
+        printf("failed to serve metrics: %s\n", path);
+        exit(1);
+    }
+    return metrics;
+}
 
-Each instruction has an opcode which indicates the type of task to perform and the set of parameters to provide inputs.
+static int lsc_ends_with(const char *s, const char *suffix) {
+    size_t n = strlen(s);
+    size_t m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
 
-LC-3 has 16 opcodes. Each opcode is 16 bits long. Left 4 store opcode. Rest store parameters
-*/
-enum {
-    LSC_OP_BR = 0, // Branch
-    LSC_OP_ADD, // Add
-    LSC_OP_LD, // Load
-    LSC_OP_ST, // Store
-    LSC_OP_JSR, // Jump register
-    LSC_OP_AND, // Bitwise and
-    LSC_OP_LDR, // Load register
-    LSC_OP_STR, // Store register
-    LSC_OP_RTI, // Unused
-    LSC_OP_NOT, // Bitwise not
-    LSC_OP_LDI, // Load indirect
-    LSC_OP_STI, // Store indirect
-    LSC_OP_JMP, // Jump
-    LSC_OP_RES, // Reserved/unused
-    LSC_OP_LEA, // Load effective address
-    LSC_OP_TRAP // Execute trap
-};
+static double lsc_now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
 
 /*
-These are the condition flags, stored by R_COND, which provide information about the most recently executed calculation.
-This allows for logical condition checking.
-
-Why use enum over #define here?
-- Enums are "type-safe" so the compiler validates whether the types are correct
+Decode the code the analysis finds before the first instruction runs. The analysis is for --stats. With a cache (it may
+be NULL), both come from its entry when there is one, and otherwise are noted for writing one when the run is over.
 */
-enum {
-    LSC_FL_POS = 1 << 0, // Positive sign (P)
-    LSC_FL_ZRO = 1 << 1, // Zero, so no sign (Z)
-    LSC_FL_NEG = 1 << 2, // Negative sign (N)
-};
+static LSC_ANALYSIS *lsc_predecode(LSC_VM *vm, LSC_CACHE *cache) {
+    LSC_ANALYSIS *analysis = cache ? lsc_cache_load(cache, vm) : NULL;
+    if (analysis) {
+        return analysis;
+    }
+    analysis = lsc_analyze(vm);
+    if (!analysis) {
+        printf("out of memory\n");
+        exit(1);
+    }
+    lsc_analyze_predecode(vm, analysis);
+    if (cache && !lsc_cache_keep(cache, vm, analysis)) {
+        printf("out of memory\n");
+        exit(1);
+    }
+    return analysis;
+}
 
-/*
-Let's look at an example LC-3 assembly program.
-
-HELLO WORLD PROGRAM:
-.ORIG x3000 ; This is where the program will originate from in memory
-loaded
-LEA R0, HELLO_STR ; Load the effective address of HELLO_STR into the general purpose register, R0
-PUTs ; Output the string pointed to by R0 into the console
-HALT ; Halt the program
-HELLO_STR .STRINGZ "Hello World!" ; Store this string here in the program
-.END ; EOF
-
-This is not directly compatible with the VM as it is in an assembly forl. AN assembler will transform this into the appropriate binary format.
-
-LOOP PROGRAM:
-AND R0, R0, 0 ; Clear R0
-LOOP ; This is a label
-ADD R0, R0, 1 ; Add 1 to R0 and store in R0
-ADD R1, R0, -10 ; Subtract 10 from R0 and store in R1
-BRn LOOP ; Go back to LOOP if result is negative
-BRn 
-*/
+// The --perf-counters columns of a --bench line: every counter per LC-3 instruction, then the IPC. Empty (or -) when not available.
+static void lsc_bench_counters(const LSC_PERF *perf, uint64_t executed, int csv) {
+    for (int i = 0; i < LSC_PERF_COUNT; ++i) {
+        if (perf->fd[i] < 0) {
+            printf(csv ? "," : " %10s", "-");
+        } else {
+            printf(csv ? ",%.3f" : " %10.3f", executed ? (double)perf->value[i] / executed : 0.0);
+        }
+    }
+    if (perf->fd[LSC_PERF_CYCLES] < 0 || perf->fd[LSC_PERF_INSTRUCTIONS] < 0 || !perf->value[LSC_PERF_CYCLES]) {
+        printf(csv ? "," : " %6s", "-");
+    } else {
+        printf(csv ? ",%.2f" : " %6.2f", (double)perf->value[LSC_PERF_INSTRUCTIONS] / perf->value[LSC_PERF_CYCLES]);
+    }
+}
 
 /*
-Two's complement:
-- Representation of a negative number
-- Think of a car meter
-    - Drive for a mile and you could end up with 00001 on the meter. This can be interpreted as +1.
-    - Say we could turn this meter back one mile to 99999. This can be intepreted as -1.
-- Lets look at an example
-    - 0001, this would be represented as +1
-    - 1111, This would be represented as -1. The left most bit shows that the value is negative.
-        - Think of this like so:
-            - MSB represents -8. The rest of the values are positive, adding to it. So -8 + 4 + 2
-
-Sign bit:
-- The leftmost bit also called the most significant bit
-- When this bit is 1 the number is negative and when 0 the number is positive
-
-Computing the Two's complement:
-1. Start with the binary representation of the number. With the leading bit being a sign bit.
-2. Invert ALL bits
-3. Add 1 to entire number, ignoring overflow
-
-Example:
-1. 0111 = +7
-2. Flip the bits: 1000 -> Negative number.
-3. Add 1 to the flipped number: 1001.
-    - Lets check this is correct: -8 + 1 = -7. So this does work :D
+Benchmark mode
+
+Runs the loaded images for the same number of instructions under every dispatch engine (or just the one --dispatch
+names) and prints how long each took. Every engine gets its own fresh VM with a copy of the loaded memory, so they all
+see exactly the same program.
+
+With --csv there is one line per engine instead of a table, for scripts (see make bench):
+    image,engine,instructions,seconds,ns_per_instruction,mips,peak_rss_kb
+Peak RSS is the process's, so it only belongs to one engine when the engine has a process to itself.
 */
+static void lsc_bench(LSC_VM *image, uint64_t instructions, int only_engine, const char *name, int csv, int perf_counters) {
+    double seconds[LSC_DISPATCH_COUNT] = {0};
 
-uint16_t lsc_sign_extend(uint16_t x, int bit_count) {
-    /*
-    Lets break this down:
-    - Lets assume x = (-7) and the bit_count = 4.
-    - bit_count - 1
-        - Now we are working with 3 bits.
-    - x >> 3
-        - The >> operator shifts all bits right. Here that is done 3 times. Let's see that happening:
-            - Original number = 0000 0000 0000 1001 (you can see here that -7 has been improperly extended to form 9 rather than -7)
-            - Bitshifted number = 0000 0000 0000 0001
-    - 0000 0000 0000 0001 & 0000 0000 0000 0001
-        - This is the bitwise and operator
-            - This compares 0000 0000 0000 0001 with the binary representation of 1 which is 0000 0000 0000 0001
-    
-    What is the purpose of this?
-    - This simply just checks whether the most significant bit is 1. If it is then the number should be negative.
-    */
-    if ((x >> (bit_count - 1)) & 1) {
-        /*
-        Lets continue to break this down:
-        - 0xFFFF << 4 (bit_count)
-            - 0xFFFF is a hexadecimal number
-                - Hexadecimal works on powers of 16. 0xF(1)F(16)F(256)F(4096)
-                - Multiply by powers of 16:
-                    - F is 15
-                    - 15*1 + 15*16 + 15*256 + 15*4096 = 65535
-                        - Interesting. Where have we seen that number before? That is the maximum number a 16 bit number can store. Would logically be represented like such in binary: 1111 1111 1111 1111
-                            - This would represent -1 in binary since we are using the Two's complement
-            - The << operator shifts all bits left. This is one 4 times here. Let's see this happening:
-                - Original number: 1111 1111 1111 1111
-                - Bitshifted number: 1111 1111 1111 0000
-                    - We can see the rightmost 4 bits are where our number will be stored
-        - x |= 1111 1111 1111 0000
-            - |= is the bitwise or operator. 1 will be returned if at least 1 bit is 1. Else 0.
-            - x = 0000 0000 0000 1001 
-            - 0000 0000 0000 1001 | 1111 1111 1111 0000:
-                - 1111 1111 1111 1001
-                    - Here we get -7 properly represented in 16 bit :D.
-        */
-        x |= (0xFFFF << bit_count);
+    if (!csv) {
+        printf("%-10s %14s %10s %10s %10s", "engine", "instructions", "seconds", "ns/instr", "MIPS");
+        if (perf_counters) {
+            printf(" %10s %10s %10s %10s %6s", "cycles/i", "instr/i", "brmiss/i", "icmiss/i", "IPC");
+        }
+        printf("\n");
     }
+    for (int engine = 0; engine < LSC_DISPATCH_COUNT; ++engine) {
+        if (only_engine >= 0 && engine != only_engine) {
+            continue;
+        }
+        LSC_VM *vm = lsc_vm_create();
+        if (!vm) {
+            printf("out of memory\n");
+            exit(1);
+        }
+        // Only the pages the images were loaded into, everything else is zero in both
+        for (uint32_t page = 0; page < LSC_PAGE_COUNT; ++page) {
+            if (image->page_attr[page] & LSC_PAGE_SHARED) {
+                continue;
+            }
+            uint16_t *words = lsc_mem_page(vm, page);
+            if (!words) {
+                printf("out of memory\n");
+                exit(1);
+            }
+            memcpy(words, image->memory[page], LSC_PAGE_SIZE * sizeof(uint16_t));
+        }
+        vm->engine = engine;
+        vm->fuse = image->fuse;
+        lsc_vm_input_end(vm);
+        lsc_analyze_free(lsc_predecode(vm, NULL));
+
+        LSC_PERF perf;
+        if (perf_counters) {
+            lsc_perf_open(&perf);
+            lsc_perf_start(&perf);
+        }
 
-    // If not negative, then the compiler can easily extend the value
-    return x;
-}
+        // Output is dropped a slice at a time, so a kernel that prints all the time measures the VM and not a buffer
+        // growing without end
+        double start = lsc_now_seconds();
+        for (uint64_t left = instructions; left;) {
+            uint64_t before = vm->cycles;
+            int status = lsc_vm_run(vm, left < LSC_VM_SLICE ? left : LSC_VM_SLICE);
+            left -= vm->cycles - before;
+            vm->output.len = 0;
+            if (status != LSC_VM_BUDGET_EXHAUSTED) {
+                break;
+            }
+        }
+        seconds[engine] = lsc_now_seconds() - start;
+        uint64_t executed = vm->cycles;
+        if (perf_counters) {
+            lsc_perf_stop(&perf);
+        }
 
-void lsc_update_flags(uint16_t r, LSC_REGISTER *reg) {
-    if (reg[r] == 0) {
-        *reg[LSC_R_COND] = LSC_FL_ZRO;
+        if (csv) {
+            struct rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            printf("%s,%s,%llu,%.6f,%.3f,%.2f,%ld",
+                name,
+                lsc_dispatch_name(engine),
+                (unsigned long long)executed,
+                seconds[engine],
+                seconds[engine] * 1e9 / executed,
+                executed / seconds[engine] / 1e6,
+                usage.ru_maxrss);
+        } else {
+            printf("%-10s %14llu %10.4f %10.3f %10.2f",
+                lsc_dispatch_name(engine),
+                (unsigned long long)executed,
+                seconds[engine],
+                seconds[engine] * 1e9 / executed,
+                executed / seconds[engine] / 1e6);
+        }
+        if (perf_counters) {
+            lsc_bench_counters(&perf, executed, csv);
+            lsc_perf_close(&perf);
+        }
+        printf("\n");
+
+        lsc_vm_destroy(vm);
     }
-    // A 1 in the left most bit indicates negative
-    else if (*reg[r] >> 15) {
-        *reg[LSC_R_COND] = LSC_FL_NEG;
+
+    if (csv || only_engine >= 0) {
+        return;
     }
-    else {
-        *reg[LSC_R_COND] = LSC_FL_NEG;
+    if (!LSC_HAVE_COMPUTED_GOTO) {
+        printf("note: built without computed goto, threaded is the switch engine\n");
     }
+    printf("threaded speedup over switch: %.2fx\n", seconds[LSC_DISPATCH_SWITCH] / seconds[LSC_DISPATCH_THREADED]);
 }
 
 int main(int argc, char **argv) {
@@ -205,6 +249,8 @@ int main(int argc, char **argv) {
     3. Look at opcode to determine the appropriate instruction to perform
     4. Perform instruction
     5. Repeat
+
+    The loop itself lives in lsc_dispatch.c, and the instructions in lsc_ops.h.
     */
 
     /*
@@ -212,153 +258,356 @@ int main(int argc, char **argv) {
 
     argc: ARGument Count
     argv: ARGument Variables
-    */
-    if (argc < 2) {
-        printf("lsc_vm [image-file1] ...\n");
-        exit(2);
-    }
 
-    for (int j = 1; j < argc; ++j) {
-        // STUB
+    Anything starting with -- is an option, everything else is an image.
+    */
+    LSC_VM *vm = lsc_vm_create();
+    if (!vm) {
+        printf("out of memory\n");
+        exit(1);
     }
 
-    // Exactly one condition flag must be set at any time.
-    lsc_reg[LSC_R_COND] = LSC_FL_ZRO;
+    uint64_t bench_instructions = 0;
+    uint64_t max_cycles = UINT64_MAX;
+    const char *batch_path = NULL;
+    int lanes = 0; // --lanes: run batch jobs in lockstep groups
+    int diff = 0;
+    const char *diff_path = NULL; // Jobs for --diff-engines, random programs without
+    uint64_t diff_programs = 10000;
+    uint64_t diff_seed = 1;
+    uint64_t diff_check = LSC_DIFF_CHECK;
+    int stats = 0;
+    int perf_counters = 0;
+    const char *profile_path = NULL;
+    const char *trace_path = NULL;
+    const char *aot_path = NULL;
+    const char *asm_path = NULL;
+    const char *cache_dir = NULL;
+    const char *metrics_path = NULL;
+    long gdb_port = 0;
+    LSC_ASM *assembly = NULL; // The last image given as source
+    int replay = 0;
+    int bench_engine = -1; // --dispatch given, so --bench runs only that engine
+    int csv = 0;
+    const char *last_image = NULL;
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    int images = 0;
 
-    /*
-    Set the PC to the starting position at 0x3000
-
-    An enum is used as a constant here
-    */
-    enum { PC_START = 0x3000 };
-    lsc_reg[LSC_R_PC] = PC_START;
-
-    int running = 1;
-    while (running) {
-        // Fetch instr / STUB
-        uint16_t instr = 0;
-        uint16_t op = instr >> 12;
-
-        switch (op) {
-            case LSC_OP_ADD: {
-                /*
-                ADD has two encodings:
-                - Register mode: 0001 (15-12) DR (11-9) SR1 (8-6) 0 (5) 00 (4-3 unused) SR2 (2-0)
-                - Immediate mode: 0001 (15-12) DR (11-9) SR1 (8-6) 1 (5) imm5 (4-0)
-                */
-
-                // Get the destination register stored at (11-9)
-                uint16_t dr = (instr >> 9) & 0x7;
-
-                // Get the source register stored at (8-6)
-                uint16_t sr = (instr >> 6) & 0x7;
-
-                // Check whether in immediate or register mode
-                uint16_t mode = (instr >> 5) & 0x1;
-
-                uint16_t n2;
-
-                if (mode == 1) {
-                    // Get the immediate value and extend to 16 bit preserving sign (this value is 5 bits wide inclusive of 0)
-                    n2 = lsc_sign_extend(instr & 0x1F, 5);
-                    
-                } else {
-                    // Get the source register 2 value stored at (2-0)
-                    uint16_t sr2 = instr & 0x7;
-                    n2 = lsc_reg[sr2];
-                }
-
-                // Add the immediate to the value in n2 then store in dr
-                lsc_reg[dr] = lsc_reg[sr] + n2;
-
-                // Update flags so the next cycle has sign information
-                lsc_update_flags(dr, &lsc_reg);
-                break;
+    for (int j = 1; j < argc; ++j) {
+        if (strncmp(argv[j], "--dispatch=", 11) == 0) {
+            vm->engine = lsc_dispatch_from_name(argv[j] + 11);
+            if (vm->engine < 0) {
+                printf("unknown dispatch engine: %s\n", argv[j] + 11);
+                lsc_usage();
+            }
+            bench_engine = vm->engine;
+        } else if (strncmp(argv[j], "--bench=", 8) == 0) {
+            bench_instructions = strtoull(argv[j] + 8, NULL, 10);
+            if (bench_instructions == 0) {
+                lsc_usage();
+            }
+        } else if (strncmp(argv[j], "--cycles=", 9) == 0) {
+            max_cycles = strtoull(argv[j] + 9, NULL, 10);
+            if (max_cycles == 0) {
+                lsc_usage();
             }
-            case LSC_OP_AND: {
-                /*
-                AND has two encodings:
-                - Register mode: 0101 (15-12), DR (11-9), SR1 (8-6), 0 (5), 00 (4-3 unused), SR2 (2-0)
-                - Immediate mode: 0101 (15-12), DR (11-9), SR1 (8-6), 1 (5), imm5 (4-0)
+        } else if (strcmp(argv[j], "--no-fuse") == 0) {
+            vm->fuse = 0;
+        } else if (strcmp(argv[j], "--csv") == 0) {
+            csv = 1;
+        } else if (strcmp(argv[j], "--stats") == 0) {
+            stats = 1;
+        } else if (strcmp(argv[j], "--perf-counters") == 0) {
+            perf_counters = 1;
+        } else if (strncmp(argv[j], "--profile=", 10) == 0) {
+            profile_path = argv[j] + 10;
+            if (!profile_path[0]) {
+                lsc_usage();
+            }
+        } else if (strncmp(argv[j], "--trace=", 8) == 0 || strncmp(argv[j], "--replay=", 9) == 0) {
+            replay = argv[j][2] == 'r';
+            trace_path = strchr(argv[j], '=') + 1;
+            if (!trace_path[0]) {
+                lsc_usage();
+            }
+        } else if (strncmp(argv[j], "--aot=", 6) == 0) {
+            aot_path = argv[j] + 6;
+            if (!aot_path[0]) {
+                lsc_usage();
+            }
+        } else if (strncmp(argv[j], "--asm=", 6) == 0) {
+            asm_path = argv[j] + 6;
+            if (!asm_path[0]) {
+                lsc_usage();
+            }
+        } else if (strncmp(argv[j], "--cache=", 8) == 0) {
+            cache_dir = argv[j] + 8;
+            if (!cache_dir[0]) {
+                lsc_usage();
+            }
+        } else if (strncmp(argv[j], "--metrics=", 10) == 0) {
+            metrics_path = argv[j] + 10;
+            if (!metrics_path[0]) {
+                lsc_usage();
+            }
+        } else if (strncmp(argv[j], "--gdb=", 6) == 0) {
+            gdb_port = strtol(argv[j] + 6, NULL, 10);
+            if (gdb_port < 1 || gdb_port > 65535) {
+                lsc_usage();
+            }
+        } else if (strncmp(argv[j], "--disk=", 7) == 0) {
+            lsc_block_close(vm->block);
+            vm->block = lsc_block_open(argv[j] + 7);
+            if (!vm->block) {
+                printf("failed to open disk: %s\n", argv[j] + 7);
+                exit(1);
+            }
+        } else if (strcmp(argv[j], "--batch") == 0) {
+            if (++j == argc) {
+                lsc_usage();
+            }
+            batch_path = argv[j];
+        } else if (strcmp(argv[j], "--lanes") == 0) {
+            lanes = 1;
+        } else if (strcmp(argv[j], "--diff-engines") == 0 || strncmp(argv[j], "--diff-engines=", 15) == 0) {
+            diff = 1;
+            diff_path = argv[j][14] ? argv[j] + 15 : NULL;
+            if (diff_path && !diff_path[0]) {
+                lsc_usage();
+            }
+        } else if (strncmp(argv[j], "--programs=", 11) == 0) {
+            diff_programs = strtoull(argv[j] + 11, NULL, 10);
+            if (diff_programs == 0) {
+                lsc_usage();
+            }
+        } else if (strncmp(argv[j], "--seed=", 7) == 0) {
+            diff_seed = strtoull(argv[j] + 7, NULL, 10);
+        } else if (strncmp(argv[j], "--check=", 8) == 0) {
+            diff_check = strtoull(argv[j] + 8, NULL, 10);
+            if (diff_check == 0) {
+                lsc_usage();
+            }
+        } else if (strncmp(argv[j], "-j", 2) == 0) {
+            // Both -j N and -jN
+            const char *n = argv[j][2] ? argv[j] + 2 : (++j < argc ? argv[j] : "");
+            workers = strtol(n, NULL, 10);
+            if (workers < 1) {
+                lsc_usage();
+            }
+        } else if (strncmp(argv[j], "-", 1) == 0) {
+            lsc_usage();
+        } else if (lsc_ends_with(argv[j], ".asm")) {
+            lsc_asm_free(assembly);
+            assembly = lsc_assemble(argv[j]);
+            if (!assembly) {
+                exit(1);
+            }
+            if (!lsc_asm_load(vm, assembly)) {
+                printf("out of memory\n");
+                exit(1);
+            }
+            ++images;
+            last_image = argv[j];
+        } else {
+            if (!lsc_vm_load(vm, argv[j])) {
+                printf("failed to load image: %s\n", argv[j]);
+                exit(1);
+            }
+            ++images;
+            last_image = argv[j];
+        }
+    }
 
-                SR1 and SR2/imm5 are ANDed. Result stored in DR. COND set based on sign.
-                */
+    if (diff) {
+        // Every engine runs, on programs of its own making or from the jobs file, with nothing attached
+        if (images || batch_path || lanes || vm->block || gdb_port || cache_dir || metrics_path || bench_instructions ||
+            trace_path || profile_path || aot_path || asm_path) {
+            lsc_usage();
+        }
+        lsc_vm_destroy(vm);
+        return lsc_diff_main(diff_path, diff_programs, diff_seed, diff_check,
+            max_cycles == UINT64_MAX ? LSC_DIFF_CYCLES : max_cycles, (int)workers);
+    }
 
-                // Get the destination register located at (11-9)
-                uint16_t dr = (instr >> 9) & 0x7;
+    if (batch_path) {
+        // Jobs bring their own images, and share no disk or cache. Nothing looks at one job on its own: no benchmark,
+        // profile, trace or stats, and nothing to translate or assemble.
+        if (images || vm->block || gdb_port || cache_dir || bench_instructions || profile_path || trace_path || stats ||
+            perf_counters || aot_path || asm_path) {
+            lsc_usage();
+        }
+        int engine = vm->engine;
+        lsc_vm_destroy(vm);
+        LSC_METRICS *metrics = metrics_path ? lsc_main_metrics(metrics_path, (int)workers) : NULL;
+        int exit_code = lsc_batch_main(batch_path, (int)workers, engine, max_cycles, lanes, metrics);
+        lsc_metrics_free(metrics);
+        return exit_code;
+    }
 
-                // Get the source register located at (8-6)
-                uint16_t sr1 = (instr >> 6) & 0x7;
+    // Benchmarks measure the engines, a trace would only measure the tracer. A debugger would get in the way of both. A
+    // cache would only measure the cache, and there is nothing for it (or metrics) to keep when nothing runs. Lanes need
+    // a batch to make groups of.
+    if (images == 0 || lanes || (trace_path && bench_instructions) || (gdb_port && (trace_path || bench_instructions)) ||
+        ((cache_dir || metrics_path) && (bench_instructions || asm_path || aot_path))) {
+        lsc_usage();
+    }
 
-                // Check whether in register or immediate mode located at (5)
-                uint16_t mode = (instr >> 5) & 0x1;
+    // Assembling writes the one source out and stops there
+    if (asm_path) {
+        if (images != 1 || !assembly || aot_path || bench_instructions || trace_path || profile_path || gdb_port) {
+            lsc_usage();
+        }
+        int obj = lsc_ends_with(asm_path, ".obj");
+        if (obj && assembly->section_count != 1) {
+            printf("a .obj image holds exactly one .ORIG section, %s has %zu\n", last_image, assembly->section_count);
+            exit(1);
+        }
+        if (!(obj ? lsc_asm_write_obj(assembly, asm_path) : lsc_asm_write_image(assembly, asm_path))) {
+            printf("failed to write image: %s\n", asm_path);
+            exit(1);
+        }
+        lsc_asm_free(assembly);
+        lsc_block_close(vm->block);
+        lsc_vm_destroy(vm);
+        return 0;
+    }
+    lsc_asm_free(assembly);
 
-                uint16_t n2;
+    // Translation only needs the loaded images, nothing runs
+    if (aot_path) {
+        if (bench_instructions || trace_path || profile_path || gdb_port) {
+            lsc_usage();
+        }
+        if (!lsc_aot_write(vm, aot_path)) {
+            printf("failed to write C: %s\n", aot_path);
+            exit(1);
+        }
+        lsc_block_close(vm->block);
+        lsc_vm_destroy(vm);
+        return 0;
+    }
 
-                if (mode == 1) {
-                    // Get imm5 located at (4-0)
-                    n2 = instr & 0x1F;
+    if (profile_path) {
+        vm->profile = lsc_profile_create(vm);
+        if (!vm->profile) {
+            printf("out of memory\n");
+            exit(1);
+        }
+    }
 
+    // Images are loaded by now, which is where a trace starts
+    if (trace_path) {
+        vm->trace = replay ? lsc_trace_replay(vm, trace_path) : lsc_trace_record(vm, trace_path);
+        if (!vm->trace) {
+            printf("failed to open trace: %s\n", trace_path);
+            exit(1);
+        }
+    }
 
-                } else {
-                    // Get the value located at SR2 stored at (2-0)
-                    uint16_t sr2 = instr & 0x7;
-                    n2 = lsc_reg[sr2];
-                }
+    // Keyed on memory as loaded, before predecoding or the first instruction changes anything
+    LSC_CACHE *cache = NULL;
+    if (cache_dir) {
+        cache = lsc_cache_open(vm, cache_dir);
+        if (!cache) {
+            printf("out of memory\n");
+            exit(1);
+        }
+    }
 
-                // Bitwise AND n2 and SR1 and store in dr
-                lsc_reg[dr] = lsc_reg[sr1] & n2;
+    // Counted from here on, so looking in the cache is too
+    LSC_METRICS *metrics = NULL;
+    if (metrics_path) {
+        metrics = lsc_main_metrics(metrics_path, 1);
+        vm->metrics = lsc_metrics_worker(metrics, 0);
+    }
 
-                // Set COND flag
-                lsc_update_flags(dr, &lsc_reg);
-                break;
+    int exit_code = 0;
+    int status = -1; // How the run stopped, once there has been one
+    LSC_ANALYSIS *analysis = NULL;
+    if (bench_instructions) {
+        lsc_bench(vm, bench_instructions, bench_engine, last_image, csv, perf_counters);
+    } else if (replay) {
+        // Keys come from the trace, and the output was seen the first time
+        analysis = lsc_predecode(vm, cache);
+        status = lsc_vm_run(vm, max_cycles);
+    } else {
+        analysis = lsc_predecode(vm, cache);
+
+        LSC_GDB *gdb = NULL;
+        if (gdb_port) {
+            gdb = lsc_gdb_listen((uint16_t)gdb_port);
+            if (!gdb) {
+                printf("failed to listen for a debugger on port %ld\n", gdb_port);
+                exit(1);
             }
-            case LSC_OP_NOT: break;
-            case LSC_OP_BR: break;
-            case LSC_OP_JMP: break;
-            case LSC_OP_JSR: break;
-            case LSC_OP_LD: break;
-            case LSC_OP_LDI: {
-                /*
-                LoaD Indirect has one encoding:
-                - 1010 (15-12), DR (11-9), PCoffset9 (8-0)
-
-                This function loads a value from a location in memory into a register.
-
-                PCoffset9 is an immediate value.
-
-                The adress referred to by PCoffset9 is computed by sign-extending bits (8-0) to 16 bits then adding this to the PC. 
-                What is stored at this address is the address of the data to be loaded into DR.
-
-                LDI is particularly useful for loading values that are far away from current PC as there are only 9 bits to store the address.
-                */
-
-                // Retrieve PCoffset9 stored at (8-0)
-                uint16_t pcoffset9 = lsc_sign_extend(instr & 0x9, 9);
-
-                // Retrieve DR
-                uint16_t dr = (instr >> 9) & 0x3;
+        }
 
-                // Get PC address
-                uint16_t pc_address = lsc_reg[LSC_R_PC] + pcoffset9;
+        // Output goes to the terminal as the program runs, keys come from stdin
+        vm->console = lsc_console_create(STDIN_FILENO, STDOUT_FILENO);
+        if (!vm->console) {
+            printf("out of memory\n");
+            exit(1);
+        }
+        lsc_main_console = vm->console;
+        signal(SIGINT, lsc_handle_interrupt);
+
+        // Counted around the run alone, so loading and predecoding are not in it
+        LSC_PERF perf;
+        if (perf_counters) {
+            lsc_perf_open(&perf);
+            lsc_perf_start(&perf);
+        }
+        status = gdb ? lsc_gdb_run(gdb, vm, max_cycles) : lsc_vm_run(vm, max_cycles);
+        if (perf_counters) {
+            lsc_perf_stop(&perf);
+        }
+        lsc_gdb_close(gdb);
 
-                // Get what is stored at PC and add to DR / STUB
+        lsc_main_console = NULL;
+        lsc_console_destroy(vm->console);
+        vm->console = NULL;
+        if (status == LSC_VM_FAULT) {
+            printf("illegal instruction x%04X at x%04X\n", lsc_mem_peek(vm, vm->reg[LSC_R_PC]), vm->reg[LSC_R_PC]);
+        }
+        if (stats) {
+            lsc_fuse_print_stats(vm);
+            lsc_analyze_print(analysis);
+            printf("memory: %d of %d pages owned, the rest shared\n", vm->private_pages, LSC_PAGE_COUNT);
+        }
+        if (perf_counters) {
+            lsc_perf_print(&perf, vm->cycles);
+            lsc_perf_close(&perf);
+        }
+    }
+    if (vm->metrics && status >= 0) {
+        lsc_metrics_add(&vm->metrics->jobs[status], 1);
+    }
+    if (cache && !lsc_cache_write(cache, vm)) {
+        printf("failed to write cache: %s\n", lsc_cache_path(cache));
+    }
+    lsc_cache_free(cache);
+    lsc_analyze_free(analysis);
 
-                // Update flags
-                lsc_update_flags(dr, &lsc_reg);
+    if (vm->profile) {
+        lsc_profile_print(vm->profile);
+        if (!lsc_profile_write(vm->profile, profile_path)) {
+            printf("failed to write profile: %s\n", profile_path);
+        }
+    }
 
-                break;
+    if (vm->trace) {
+        lsc_trace_print(vm->trace);
+        if (!lsc_trace_close(vm->trace)) {
+            if (!replay) {
+                printf("failed to write trace: %s\n", trace_path);
             }
-            case LSC_OP_LDR: break;
-            case LSC_OP_LEA: break;
-            case LSC_OP_ST: break;
-            case LSC_OP_STR: break;
-            case LSC_OP_TRAP: break;
-            case LSC_OP_RES:
-            case LSC_OP_RTI:
-            default: break;
+            exit_code = 1;
         }
     }
 
-    return 0;
-}
\ No newline at end of file
+    vm->metrics = NULL;
+    lsc_metrics_free(metrics);
+    lsc_block_close(vm->block);
+    lsc_vm_destroy(vm);
+    return exit_code;
+}
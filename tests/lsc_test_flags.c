@@ -0,0 +1,358 @@
+/*
+Condition code checks
+
+make test
+
+The engines keep the last flag-setting result instead of COND (see lsc_cond_flags in lsc_vm.h), and only turn it into
+flags where something outside the loop could look: a trap, or the end of a run. This runs a small program for every
+instruction that sets the flags, with a negative, a zero and a positive result, under every engine with and without
+superinstructions. Each program does its instruction and then every BR there is (n, z, p, nz, np, zp, nzp), writing
+down which ones were taken. Then a GETC with no key waits, so the run stops on the TRAP and COND is what the trap
+sees. After it every BR runs again, so the flags must have come back from COND unchanged. The program loops often
+enough for its blocks to get hot, so the JIT runs them as native code as well.
+
+Exits with 1 if any check failed.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "lsc_dispatch.h"
+#include "lsc_vm.h"
+
+enum {
+    LSC_TEST_WORDS = 128, // Room for any one program, code and data
+    LSC_TEST_LABELS = 40,
+    LSC_TEST_ITERATIONS = 200, // Several times LSC_JIT_HOT
+    LSC_TEST_BUDGET = 100000, // Far more than one iteration takes
+};
+
+// The labels of a program, including one per BR for the taken and joined paths
+enum {
+    LSC_TEST_ONE,
+    LSC_TEST_COUNT,
+    LSC_TEST_A,
+    LSC_TEST_B,
+    LSC_TEST_OPPOSITE,
+    LSC_TEST_POINTER,
+    LSC_TEST_SLOTS, // 14 words: whether each BR was taken, before the trap then after it
+    LSC_TEST_LOOP,
+    LSC_TEST_BRANCHES, // Two labels per BR from here
+};
+
+_Static_assert(LSC_TEST_BRANCHES + 2 * 14 <= LSC_TEST_LABELS, "every BR has two labels");
+
+// Instructions that set the flags
+enum {
+    LSC_TEST_ADD,
+    LSC_TEST_ADDI,
+    LSC_TEST_AND,
+    LSC_TEST_ANDI,
+    LSC_TEST_NOT,
+    LSC_TEST_LD,
+    LSC_TEST_LDR,
+    LSC_TEST_LDI,
+    LSC_TEST_LEA,
+    LSC_TEST_OP_COUNT,
+};
+
+static const char *const lsc_test_op_names[LSC_TEST_OP_COUNT] = {
+    "ADD", "ADD imm", "AND", "AND imm", "NOT", "LD", "LDR", "LDI", "LEA",
+};
+
+typedef struct {
+    uint16_t origin;
+    uint16_t words[LSC_TEST_WORDS];
+    int count;
+
+    int label[LSC_TEST_LABELS]; // Word index of each label, -1 until it is placed
+    struct {
+        int at; // The instruction with a PCoffset9 to fill in
+        int label;
+        int plus; // Words past the label
+    } fixups[LSC_TEST_WORDS];
+    int fixup_count;
+} LSC_TEST_PROGRAM;
+
+static int lsc_test_checks;
+static int lsc_test_failures;
+
+static void lsc_test_check(int ok, const char *what, const char *engine, int fuse, int op, uint16_t value) {
+    ++lsc_test_checks;
+    if (!ok) {
+        ++lsc_test_failures;
+        printf("FAIL %s: %s, fuse %d, %s giving x%04X\n", what, engine, fuse, lsc_test_op_names[op], value);
+    }
+}
+
+static void lsc_test_emit(LSC_TEST_PROGRAM *p, uint16_t word) {
+    p->words[p->count++] = word;
+}
+
+// An instruction whose low 9 bits are the offset to plus words past label
+static void lsc_test_emit_at(LSC_TEST_PROGRAM *p, uint16_t instr, int label, int plus) {
+    p->fixups[p->fixup_count].at = p->count;
+    p->fixups[p->fixup_count].label = label;
+    p->fixups[p->fixup_count].plus = plus;
+    ++p->fixup_count;
+    lsc_test_emit(p, instr);
+}
+
+static void lsc_test_emit_to(LSC_TEST_PROGRAM *p, uint16_t instr, int label) {
+    lsc_test_emit_at(p, instr, label, 0);
+}
+
+static void lsc_test_place(LSC_TEST_PROGRAM *p, int label) {
+    p->label[label] = p->count;
+}
+
+// Fill in every offset, once every label is placed
+static void lsc_test_resolve(LSC_TEST_PROGRAM *p) {
+    for (int i = 0; i < p->fixup_count; ++i) {
+        int at = p->fixups[i].at;
+        int offset = p->label[p->fixups[i].label] + p->fixups[i].plus - (at + 1);
+        p->words[at] |= (uint16_t)offset & 0x1FF;
+    }
+}
+
+static uint16_t lsc_test_address(const LSC_TEST_PROGRAM *p, int label) {
+    return (uint16_t)(p->origin + p->label[label]);
+}
+
+/*
+Every BR there is, each writing 1 (R5) to its slot when taken and 0 (R6) when not. ST leaves the flags alone, so every
+BR sees the same ones.
+*/
+static void lsc_test_emit_branches(LSC_TEST_PROGRAM *p, int first_slot, int first_label) {
+    for (int nzp = 1; nzp <= 7; ++nzp) {
+        int taken = first_label + 2 * (nzp - 1);
+        int joined = taken + 1;
+        int slot = first_slot + nzp - 1;
+        lsc_test_emit_to(p, (uint16_t)(nzp << 9), taken);
+        lsc_test_emit_at(p, 0x3000 | (LSC_R_R6 << 9), LSC_TEST_SLOTS, slot);
+        lsc_test_emit_to(p, 0x0E00, joined);
+        lsc_test_place(p, taken);
+        lsc_test_emit_at(p, 0x3000 | (LSC_R_R5 << 9), LSC_TEST_SLOTS, slot);
+        lsc_test_place(p, joined);
+    }
+}
+
+/*
+Set R0 to value with op, the last instruction before the branches. Its operands come from data, and just before it R7 is
+loaded with a word of the other sign, so an op that left the flags alone would be caught.
+*/
+static void lsc_test_emit_op(LSC_TEST_PROGRAM *p, int op, uint16_t value) {
+    switch (op) {
+        case LSC_TEST_ADD:
+        case LSC_TEST_AND:
+            lsc_test_emit_to(p, 0x2000 | (LSC_R_R1 << 9), LSC_TEST_A);
+            lsc_test_emit_to(p, 0x2000 | (LSC_R_R2 << 9), LSC_TEST_B);
+            break;
+        case LSC_TEST_ADDI:
+        case LSC_TEST_ANDI:
+        case LSC_TEST_NOT:
+            lsc_test_emit_to(p, 0x2000 | (LSC_R_R1 << 9), LSC_TEST_A);
+            break;
+        case LSC_TEST_LDR:
+            lsc_test_emit_to(p, 0xE000 | (LSC_R_R1 << 9), LSC_TEST_A);
+            break;
+    }
+    lsc_test_emit_to(p, 0x2000 | (LSC_R_R7 << 9), LSC_TEST_OPPOSITE);
+
+    switch (op) {
+        case LSC_TEST_ADD:
+            lsc_test_emit(p, 0x1000 | (LSC_R_R0 << 9) | (LSC_R_R1 << 6) | LSC_R_R2);
+            break;
+        case LSC_TEST_ADDI:
+            lsc_test_emit(p, 0x1000 | (LSC_R_R0 << 9) | (LSC_R_R1 << 6) | 0x20 | 3);
+            break;
+        case LSC_TEST_AND:
+            lsc_test_emit(p, 0x5000 | (LSC_R_R0 << 9) | (LSC_R_R1 << 6) | LSC_R_R2);
+            break;
+        case LSC_TEST_ANDI:
+            lsc_test_emit(p, 0x5000 | (LSC_R_R0 << 9) | (LSC_R_R1 << 6) | 0x20 | 0x1F);
+            break;
+        case LSC_TEST_NOT:
+            lsc_test_emit(p, 0x903F | (LSC_R_R0 << 9) | (LSC_R_R1 << 6));
+            break;
+        case LSC_TEST_LD:
+            lsc_test_emit_to(p, 0x2000 | (LSC_R_R0 << 9), LSC_TEST_A);
+            break;
+        case LSC_TEST_LDR:
+            lsc_test_emit(p, 0x6000 | (LSC_R_R0 << 9) | (LSC_R_R1 << 6));
+            break;
+        case LSC_TEST_LDI:
+            lsc_test_emit_to(p, 0xA000 | (LSC_R_R0 << 9), LSC_TEST_POINTER);
+            break;
+        case LSC_TEST_LEA:
+            // The result is an address, so where the program is decides its sign (see lsc_test_build)
+            lsc_test_emit(p, 0xE000 | (LSC_R_R0 << 9) | ((uint16_t)(value - (p->origin + p->count + 1)) & 0x1FF));
+            break;
+    }
+}
+
+// The program for op giving value
+static void lsc_test_build(LSC_TEST_PROGRAM *p, int op, uint16_t value) {
+    memset(p, 0, sizeof(*p));
+    for (int i = 0; i < LSC_TEST_LABELS; ++i) {
+        p->label[i] = -1;
+    }
+    p->origin = 0x3000;
+    uint16_t a = value;
+    uint16_t b = 0;
+    switch (op) {
+        case LSC_TEST_ADD:
+            b = 0x1234;
+            a = value - b;
+            break;
+        case LSC_TEST_ADDI:
+            a = value - 3;
+            break;
+        case LSC_TEST_AND:
+            b = 0xFFFF;
+            break;
+        case LSC_TEST_NOT:
+            a = ~value;
+            break;
+        case LSC_TEST_LEA:
+            // Close enough below value for a PCoffset9 to reach it, clear of the device page and the end of memory
+            p->origin = value < 0x100 ? 0x0010 : (uint16_t)(value - 0xFF);
+            break;
+    }
+
+    lsc_test_emit_to(p, 0x2000 | (LSC_R_R5 << 9), LSC_TEST_ONE);
+    lsc_test_emit(p, 0x5000 | (LSC_R_R6 << 9) | (LSC_R_R6 << 6) | 0x20);
+    lsc_test_emit_to(p, 0x2000 | (LSC_R_R4 << 9), LSC_TEST_COUNT);
+    lsc_test_place(p, LSC_TEST_LOOP);
+    lsc_test_emit_op(p, op, value);
+    lsc_test_emit_branches(p, 0, LSC_TEST_BRANCHES);
+    lsc_test_emit(p, 0xF000 | LSC_TRAP_GETC);
+    lsc_test_emit_branches(p, 7, LSC_TEST_BRANCHES + 14);
+    lsc_test_emit(p, 0x1000 | (LSC_R_R4 << 9) | (LSC_R_R4 << 6) | 0x20 | 0x1F);
+    lsc_test_emit_to(p, 0x0200, LSC_TEST_LOOP);
+    lsc_test_emit(p, 0xF000 | LSC_TRAP_HALT);
+
+    lsc_test_place(p, LSC_TEST_ONE);
+    lsc_test_emit(p, 1);
+    lsc_test_place(p, LSC_TEST_COUNT);
+    lsc_test_emit(p, LSC_TEST_ITERATIONS);
+    lsc_test_place(p, LSC_TEST_A);
+    lsc_test_emit(p, a);
+    lsc_test_place(p, LSC_TEST_B);
+    lsc_test_emit(p, b);
+    lsc_test_place(p, LSC_TEST_OPPOSITE);
+    lsc_test_emit(p, value == 0 || (value & 0x8000) ? 1 : 0x8000);
+    lsc_test_place(p, LSC_TEST_POINTER);
+    lsc_test_emit(p, lsc_test_address(p, LSC_TEST_A));
+    lsc_test_place(p, LSC_TEST_SLOTS);
+    for (int i = 0; i < 14; ++i) {
+        lsc_test_emit(p, 0x7777);
+    }
+
+    lsc_test_resolve(p);
+}
+
+// Whether the seven slots from first say each BR went the way flags take it
+static int lsc_test_slots_ok(LSC_VM *vm, const LSC_TEST_PROGRAM *p, int first, uint16_t flags) {
+    for (int nzp = 1; nzp <= 7; ++nzp) {
+        uint16_t seen = lsc_mem_peek(vm, lsc_test_address(p, LSC_TEST_SLOTS) + first + nzp - 1);
+        if (seen != ((nzp & flags) != 0)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void lsc_test_run(int engine, int fuse, int op, uint16_t value) {
+    const char *name = lsc_dispatch_name(engine);
+    LSC_TEST_PROGRAM p;
+    lsc_test_build(&p, op, value);
+
+    LSC_VM *vm = lsc_vm_create();
+    if (!vm) {
+        printf("out of memory\n");
+        return;
+    }
+    vm->engine = engine;
+    vm->fuse = fuse;
+    for (int i = 0; i < p.count; ++i) {
+        if (!lsc_mem_poke(vm, (uint16_t)(p.origin + i), p.words[i])) {
+            printf("out of memory\n");
+            lsc_vm_destroy(vm);
+            return;
+        }
+    }
+    lsc_mem_invalidate(vm, p.origin, (uint32_t)p.count);
+    vm->reg[LSC_R_PC] = p.origin;
+
+    // The flag bits of LSC_FL_POS, LSC_FL_ZRO and LSC_FL_NEG line up with BR's p, z and n
+    uint16_t flags = lsc_cond_flags(value);
+    uint16_t trap = lsc_test_address(&p, LSC_TEST_BRANCHES + 13);
+    int iterations = 0;
+    for (;;) {
+        int status = lsc_vm_run(vm, LSC_TEST_BUDGET);
+        if (status == LSC_VM_WAITING_FOR_INPUT) {
+            lsc_test_check(vm->reg[LSC_R_PC] == trap && vm->reg[LSC_R_R0] == value, "stopped on GETC", name, fuse, op,
+                value);
+            lsc_test_check(vm->reg[LSC_R_COND] == flags, "COND seen by the trap", name, fuse, op, value);
+            lsc_test_check(lsc_test_slots_ok(vm, &p, 0, flags), "BR before the trap", name, fuse, op, value);
+            if (iterations > 0) {
+                lsc_test_check(lsc_test_slots_ok(vm, &p, 7, flags), "BR after the trap", name, fuse, op, value);
+            }
+            ++iterations;
+            if (iterations > LSC_TEST_ITERATIONS || !lsc_vm_input(vm, "k", 1)) {
+                break;
+            }
+            continue;
+        }
+        lsc_test_check(status == LSC_VM_HALTED && iterations == LSC_TEST_ITERATIONS, "ran every iteration", name,
+            fuse, op, value);
+        if (status == LSC_VM_HALTED) {
+            lsc_test_check(lsc_test_slots_ok(vm, &p, 7, flags), "BR after the trap", name, fuse, op, value);
+        }
+        break;
+    }
+    lsc_vm_destroy(vm);
+}
+
+// lsc_cond_flags and lsc_cond_value on their own, for every value there is
+static void lsc_test_cond(void) {
+    for (uint32_t v = 0; v < LSC_MEMORY_MAX; ++v) {
+        uint16_t value = (uint16_t)v;
+        uint16_t expected = value == 0 ? LSC_FL_ZRO : (value & 0x8000) ? LSC_FL_NEG : LSC_FL_POS;
+        uint16_t flags = lsc_cond_flags(value);
+        ++lsc_test_checks;
+        if (flags != expected || lsc_cond_flags(lsc_cond_value(flags)) != flags) {
+            ++lsc_test_failures;
+            printf("FAIL lsc_cond_flags: x%04X gives %X, back through lsc_cond_value %X\n", value, flags,
+                lsc_cond_flags(lsc_cond_value(flags)));
+        }
+
+        LSC_REGISTER reg = {0};
+        reg[LSC_R_R3] = value;
+        lsc_update_flags(LSC_R_R3, &reg);
+        ++lsc_test_checks;
+        if (reg[LSC_R_COND] != expected) {
+            ++lsc_test_failures;
+            printf("FAIL lsc_update_flags: x%04X gives %X\n", value, reg[LSC_R_COND]);
+        }
+    }
+}
+
+int main(void) {
+    // Both ends and the middle of negative and positive, and zero
+    static const uint16_t values[] = {0x8000, 0xFFFF, 0x0000, 0x0001, 0x7FFF};
+
+    lsc_test_cond();
+    for (int engine = 0; engine < LSC_DISPATCH_COUNT; ++engine) {
+        for (int fuse = 0; fuse <= 1; ++fuse) {
+            for (int op = 0; op < LSC_TEST_OP_COUNT; ++op) {
+                for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+                    lsc_test_run(engine, fuse, op, values[i]);
+                }
+            }
+        }
+    }
+
+    printf("flags: %d checks, %d failures\n", lsc_test_checks, lsc_test_failures);
+    return lsc_test_failures != 0;
+}
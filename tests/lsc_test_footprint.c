@@ -0,0 +1,113 @@
+/*
+Footprint checks
+
+make test
+
+A VM should only cost what its program uses (see Memory and Code pages in lsc_vm.h). This creates LSC_TEST_VMS VMs
+under each interpreter, loads a small program into every one and runs it to the end, then checks every VM owns one page
+of memory and one code page, and that together they grew the process by less than LSC_TEST_VM_BYTES each. The JIT
+engine is left out: once it runs, a VM has the JIT's own tables and executable memory as well (see lsc_jit.h).
+
+Exits with 1 if any check failed.
+*/
+#include <stdio.h>
+#include <sys/resource.h>
+
+#include "lsc_dispatch.h"
+#include "lsc_vm.h"
+
+enum {
+    LSC_TEST_VMS = 2000,
+    LSC_TEST_VM_BYTES = 32 << 10, // Most a created, loaded and finished VM may cost, struct, pages and arena included
+    LSC_TEST_DATA = 0x3006, // Where the program leaves its last count
+};
+
+static int lsc_test_checks;
+static int lsc_test_failures;
+
+static void lsc_test_check(int ok, const char *what, const char *engine) {
+    ++lsc_test_checks;
+    if (!ok) {
+        ++lsc_test_failures;
+        printf("FAIL %s: %s\n", engine, what);
+    }
+}
+
+// Peak resident set in bytes, which only grows while the VMs are being made
+static long lsc_test_rss(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss * 1024L;
+}
+
+// Every engine's VMs are kept until the end, so none of them reuses memory another one gave back
+static LSC_VM *lsc_test_vms[LSC_DISPATCH_COUNT][LSC_TEST_VMS];
+
+static void lsc_test_engine(int engine, const char *name) {
+    // Counts down from 10, storing each count, then halts: code and data on one page
+    static const uint8_t image[] = {
+        0x30, 0x00, // .ORIG x3000
+        0x50, 0x20, // AND R0, R0, #0
+        0x10, 0x2A, // ADD R0, R0, #10
+        0x30, 0x03, // LOOP ST R0, DATA
+        0x10, 0x3F, // ADD R0, R0, #-1
+        0x03, 0xFD, // BRp LOOP
+        0xF0, 0x25, // HALT
+        0x00, 0x00, // DATA .FILL 0
+    };
+    LSC_VM **vms = lsc_test_vms[engine];
+
+    long before = lsc_test_rss();
+    int created = 0;
+    for (; created < LSC_TEST_VMS; ++created) {
+        LSC_VM *vm = lsc_vm_create();
+        if (!vm) {
+            break;
+        }
+        vms[created] = vm;
+        vm->engine = engine;
+        if (!lsc_vm_load_image(vm, image, sizeof(image))) {
+            ++created;
+            break;
+        }
+        lsc_vm_input_end(vm);
+        lsc_vm_run(vm, 1000);
+    }
+    long grown = lsc_test_rss() - before;
+    lsc_test_check(created == LSC_TEST_VMS, "created every VM", name);
+
+    int ran = 1;
+    int pages = 1;
+    for (int i = 0; i < created; ++i) {
+        LSC_VM *vm = vms[i];
+        ran &= vm->halted && lsc_mem_peek(vm, LSC_TEST_DATA) == 1;
+        int code_pages = 0;
+        for (uint32_t page = 0; page < LSC_PAGE_COUNT; ++page) {
+            code_pages += vm->code[page] != &lsc_code_none;
+        }
+        pages &= vm->private_pages == 1 && code_pages == 1;
+    }
+    lsc_test_check(ran, "every program ran to the end", name);
+    lsc_test_check(pages, "one page of memory and one code page each", name);
+
+    long per_vm = grown / (created ? created : 1);
+    lsc_test_check(per_vm < LSC_TEST_VM_BYTES, "small enough", name);
+    printf("%s: %ld bytes per VM, sizeof(LSC_VM) %zu\n", name, per_vm, sizeof(LSC_VM));
+}
+
+int main(void) {
+    lsc_test_check(sizeof(LSC_VM) < LSC_TEST_VM_BYTES / 2, "LSC_VM has no table per address", "struct");
+    lsc_test_engine(LSC_DISPATCH_SWITCH, "switch");
+#if LSC_HAVE_COMPUTED_GOTO
+    lsc_test_engine(LSC_DISPATCH_THREADED, "threaded");
+#endif
+
+    for (int engine = 0; engine < LSC_DISPATCH_COUNT; ++engine) {
+        for (int i = 0; i < LSC_TEST_VMS; ++i) {
+            lsc_vm_destroy(lsc_test_vms[engine][i]);
+        }
+    }
+
+    printf("footprint: %d checks, %d failures\n", lsc_test_checks, lsc_test_failures);
+    return lsc_test_failures != 0;
+}